@@ -525,6 +525,11 @@ int AdvancedDialog::GetBinning(void)
     return m_pCameraCtrlSet ? m_pCameraCtrlSet->GetBinning() : 1;
 }
 
+int AdvancedDialog::GetSoftwareBinning(void)
+{
+    return m_pCameraCtrlSet ? m_pCameraCtrlSet->GetSoftwareBinning() : 1;
+}
+
 void AdvancedDialog::SetBinning(int binning)
 {
     if (m_pCameraCtrlSet)
@@ -100,6 +100,7 @@ public:
     double GetPixelSize(void);
     void SetPixelSize(double val);
     int GetBinning(void);
+    int GetSoftwareBinning(void);
     void SetBinning(int binning);
     void ResetGuidingParams();
 
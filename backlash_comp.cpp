@@ -491,7 +491,7 @@ void BacklashTool::DecMeasurementStep(const PHD_Point& currentCamLoc)
                     }
                     else
                     {
-                        if (!OutOfRoom(pCamera->FullSize, currentCamLoc.X, currentCamLoc.Y, pFrame->pGuider->GetMaxMovePixels()))
+                        if (!OutOfRoom(pCamera->ImageSize(), currentCamLoc.X, currentCamLoc.Y, pFrame->pGuider->GetMaxMovePixels()))
                         {
                             pFrame->ScheduleCalibrationMove(m_scope, NORTH, m_pulseWidth);
                             m_stepCount++;
@@ -510,7 +510,7 @@ void BacklashTool::DecMeasurementStep(const PHD_Point& currentCamLoc)
                     throw ERROR_INFO("BLT: Could not clear N backlash");
                 }
             }
-            if (m_acceptedMoves >= BACKLASH_MIN_COUNT || m_backlashExemption || OutOfRoom(pCamera->FullSize, currentCamLoc.X, currentCamLoc.Y, pFrame->pGuider->GetMaxMovePixels()))    // Ok to go ahead with actual backlash measurement
+            if (m_acceptedMoves >= BACKLASH_MIN_COUNT || m_backlashExemption || OutOfRoom(pCamera->ImageSize(), currentCamLoc.X, currentCamLoc.Y, pFrame->pGuider->GetMaxMovePixels()))    // Ok to go ahead with actual backlash measurement
             {
                 m_markerPoint = currMountLocation;            // Marker point at start of big Dec move North
                 m_bltState = BLT_STATE_STEP_NORTH;
@@ -530,7 +530,7 @@ void BacklashTool::DecMeasurementStep(const PHD_Point& currentCamLoc)
             }
 
         case BLT_STATE_STEP_NORTH:
-            if (m_stepCount < m_northPulseCount && !OutOfRoom(pCamera->FullSize, currentCamLoc.X, currentCamLoc.Y, pFrame->pGuider->GetMaxMovePixels()))
+            if (m_stepCount < m_northPulseCount && !OutOfRoom(pCamera->ImageSize(), currentCamLoc.X, currentCamLoc.Y, pFrame->pGuider->GetMaxMovePixels()))
             {
                 m_lastStatus = wxString::Format(_("Moving North for %d ms, step %d / %d"), m_pulseWidth, m_stepCount + 1, m_northPulseCount);
                 Debug.Write(wxString::Format("BLT: %s, DecLoc = %0.2f\n", m_lastStatus, currMountLocation.Y));
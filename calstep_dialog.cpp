@@ -57,7 +57,7 @@ static wxSpinCtrlDouble *NewSpinner(wxWindow *parent, int width, double val, dou
     return pNewCtrl;
 }
 
-CalstepDialog::CalstepDialog(wxWindow *parent, int focalLength, double pixelSize, int binning) :
+CalstepDialog::CalstepDialog(wxWindow *parent, int focalLength, double pixelSize, int binning, int softwareBinning) :
     wxDialog(parent, wxID_ANY, _("Calibration Step Calculator"), wxDefaultPosition, wxSize(400, 500), wxCAPTION | wxCLOSE_BOX)
 {
     double dGuideRateDec = 0.0; // initialize to suppress compiler warning
@@ -72,6 +72,7 @@ CalstepDialog::CalstepDialog(wxWindow *parent, int focalLength, double pixelSize
     m_iFocalLength = focalLength;
     m_fPixelSize = pixelSize;
     m_binning = binning;
+    m_softwareBinning = softwareBinning;
     m_fGuideSpeed = (float) pConfig->Profile.GetDouble ("/CalStepCalc/GuideSpeed", DEFAULT_GUIDESPEED);
 
     // Now improve on Dec and guide speed if mount/pointing info is available
@@ -191,7 +192,7 @@ void CalstepDialog::AddTableEntry (wxFlexGridSizer *pTable, const wxString& labe
 //
 //  FocalLength = focal length in millimeters
 //  PixelSize = pixel size in microns (un-binned)
-//  Binning = hardware pixel binning factor
+//  Binning = pixel binning factor of the guide frames, hardware times software
 //  GuideSpeed = guide rate as fraction of sidereal rate
 //  DesiredSteps = desired number of calibration steps
 //  Declination = declination in degrees
@@ -252,7 +253,7 @@ void CalstepDialog::DoRecalc(void)
             m_status->SetLabel(wxEmptyString);
 
             // Spin controls enforce numeric ranges
-            GetCalibrationStepSize(m_iFocalLength, m_fPixelSize, m_binning, m_fGuideSpeed, m_iNumSteps,
+            GetCalibrationStepSize(m_iFocalLength, m_fPixelSize, m_binning * m_softwareBinning, m_fGuideSpeed, m_iNumSteps,
                 m_dDeclination, &m_fImageScale, &m_iStepSize);
 
             m_bValidResult = true;
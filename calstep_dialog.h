@@ -63,6 +63,7 @@ private:
     double m_fGuideSpeed;
     int m_iNumSteps;
     int m_binning;
+    int m_softwareBinning;      // further binning of the frames in software, not a choice here
     double m_fImageScale;
     int m_iStepSize;
     bool m_bValidResult;
@@ -73,7 +74,7 @@ public:
     enum { DEFAULT_STEPS = 12 };
     static const double DEFAULT_GUIDESPEED;
 
-    CalstepDialog(wxWindow *parent, int focalLength, double pixelSize, int binning);
+    CalstepDialog(wxWindow *parent, int focalLength, double pixelSize, int binning, int softwareBinning = 1);
     ~CalstepDialog(void);
     bool GetResults(int *focalLength, double *pixelSize, int *binning, int *stepSize);
 
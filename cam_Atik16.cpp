@@ -239,17 +239,14 @@ static bool StopCapture(ArtemisHandle h)
 
 bool Camera_Atik16Class::Capture(int duration, usImage& img, int options, const wxRect& subframe)
 {
-    if (img.Init(FullSize))
-    {
-        DisconnectWithAlert(CAPT_FAIL_MEMORY);
-        return true;
-    }
-
     bool useSubframe = UseSubframes;
 
     if (subframe.width <= 0 || subframe.height <= 0)
         useSubframe = false;
 
+    if (InitCaptureImage(img, useSubframe, subframe))
+        return true;
+
     if (HasShutter)
         ArtemisSetDarkMode(Cam_Handle, ShutterClosed);
 
@@ -320,14 +317,13 @@ bool Camera_Atik16Class::Capture(int duration, usImage& img, int options, const
 
     if (useSubframe)
     {
-        img.Subframe = subframe;
-        img.Clear();
+        // only the subframe is stored
         const unsigned short *buf = (unsigned short *) ArtemisImageBuffer(Cam_Handle);
 
         for (int y = 0; y < subframe.height; y++)
         {
             const unsigned short *src = buf + (y + subframePos.y) * frame.width + subframePos.x;
-            unsigned short *dst = img.ImageData + (y + subframe.y) * FullSize.GetWidth() + subframe.x;
+            unsigned short *dst = &img.Pixel(subframe.x, subframe.y + y);
             memcpy(dst, src, subframe.width * sizeof(unsigned short));
         }
     }
@@ -342,7 +338,7 @@ bool Camera_Atik16Class::Capture(int duration, usImage& img, int options, const
     if (options & CAPTURE_SUBTRACT_DARK)
         SubtractDark(img);
     if (Color && Binning == 1 && (options & CAPTURE_RECON))
-        QuickLRecon(img);
+        Debayer(img);
 
     return false;
 }
@@ -47,6 +47,7 @@ public:
 
     bool    EnumCameras(wxArrayString& names, wxArrayString& ids);
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer() { return Color; }
     bool    HasNonGuiCapture(void);
     bool    Connect(const wxString& camId);
     bool    Disconnect();
@@ -460,27 +460,23 @@ bool Camera_INDIClass::ReadFITS(usImage& img, bool takeSubframe, const wxRect& s
         return true;
     }
     if (takeSubframe) {
-        if (img.Init(FullSize)) {
+        // the blob holds just the subframe; store only that
+        if (xsize != subframe.width || ysize != subframe.height) {
+            Debug.Write(wxString::Format("INDI subframe size mismatch: got %dx%d expected %dx%d\n", xsize, ysize, subframe.width, subframe.height));
+            pFrame->Alert(_("Unsupported type or read error loading FITS file"));
+            PHD_fits_close_file(fptr);
+            return true;
+        }
+        if (img.InitSubframe(FullSize, subframe)) {
             pFrame->Alert(_("Memory allocation error"));
             PHD_fits_close_file(fptr);
             return true;
         }
-        img.Clear();
-        img.Subframe = subframe;
-        unsigned short *rawdata = new unsigned short[xsize*ysize];
-        if (fits_read_pix(fptr, TUSHORT, fpixel, xsize*ysize, NULL, rawdata, NULL, &status) ) {
+        if (fits_read_pix(fptr, TUSHORT, fpixel, xsize*ysize, NULL, img.ImageData, NULL, &status) ) {
             pFrame->Alert(_("Error reading data"));
             PHD_fits_close_file(fptr);
             return true;
         }
-        int i = 0;
-        for (int y = 0; y < subframe.height; y++)
-        {
-            unsigned short *dataptr = img.ImageData + (y + subframe.y) * img.Size.GetWidth() + subframe.x;
-            memcpy(dataptr, &rawdata[i], subframe.width * sizeof(unsigned short));
-            i += subframe.width;
-        }
-        delete[] rawdata;
     }
     else {
         if (img.Init(xsize,ysize)) {
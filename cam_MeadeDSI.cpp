@@ -217,7 +217,7 @@ bool Camera_DSIClass::Capture(int duration, usImage& img, int options, const wxR
     if (options & CAPTURE_RECON)
     {
         if (MeadeCam->IsColor)
-            QuickLRecon(img);
+            Debayer(img);
         if (MeadeCam->IsDsiII)
             SquarePixels(img, 8.6, 8.3);
         else if (!MeadeCam->IsDsiIII)           // Original DSI
@@ -232,4 +232,9 @@ bool Camera_DSIClass::HasNonGuiCapture(void)
     return true;
 }
 
+bool Camera_DSIClass::IsBayer(void)
+{
+    return MeadeCam && MeadeCam->IsColor;
+}
+
 #endif // MEADE_DSI
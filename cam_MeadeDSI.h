@@ -50,6 +50,7 @@ public:
 
     bool    EnumCameras(wxArrayString& names, wxArrayString& ids);
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer();
     bool    HasNonGuiCapture();
     wxByte  BitsPerPixel();
     bool    Connect(const wxString& camId);
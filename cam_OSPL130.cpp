@@ -104,7 +104,7 @@ bool Camera_OpticstarPL130Class::Capture(int duration, usImage& img, int options
 
     if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
     if (Color && (options & CAPTURE_RECON))
-        QuickLRecon(img);
+        Debayer(img);
 
     return false;
 }
@@ -42,6 +42,7 @@ public:
     Camera_OpticstarPL130Class();
 
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer() { return Color; }
     bool    Connect(const wxString& camId);
     bool    Disconnect();
     wxByte  BitsPerPixel();
@@ -276,7 +276,7 @@ bool Camera_QHY5IIBase::Capture(int duration, usImage& img, int options, const w
     }
 
     if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
-    if (Color && (options & CAPTURE_RECON)) QuickLRecon(img);
+    if (Color && (options & CAPTURE_RECON)) Debayer(img);
 
     return false;
 }
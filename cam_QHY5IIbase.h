@@ -48,6 +48,7 @@ protected:
 
 public:
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer() { return Color; }
     bool    Connect(const wxString& camId);
     bool    Disconnect();
     void    InitCapture();
@@ -156,7 +156,7 @@ bool Camera_SAC42Class::Capture(int duration, usImage& img, int options, const w
     }
     // Do quick L recon to remove bayer array
     if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
-    if (ColorArray && (options & CAPTURE_RECON)) QuickLRecon(img);
+    if (ColorArray && (options & CAPTURE_RECON)) Debayer(img);
 
     delete[] buffer;
 #endif
@@ -48,6 +48,7 @@ protected:
 public:
     Camera_SAC42Class();
     bool   Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool   IsBayer() { return ColorArray; }
     bool   Connect(const wxString& camId);
     bool   Disconnect();
     void   InitCapture();
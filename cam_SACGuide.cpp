@@ -225,7 +225,7 @@ bool Camera_SACGuiderClass::GenericCapture(int duration, usImage& img, int xsize
 
     if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
     // Do quick L recon to remove bayer array
-    if (options & CAPTURE_RECON) QuickLRecon(img);
+    if (options & CAPTURE_RECON) Debayer(img);
 
     delete[] buffer;
 
@@ -57,6 +57,7 @@ public:
     Camera_SACGuiderClass();
 
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer() { return true; }
     bool    Connect(const wxString& camId);
     bool    Disconnect();
     void    InitCapture();
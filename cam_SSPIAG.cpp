@@ -383,7 +383,7 @@ bool Camera_SSPIAGClass::Capture(int duration, usImage& img, int options, const
     if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
 
     // Do quick L recon to remove bayer array
-    if (options & CAPTURE_RECON) QuickLRecon(img);
+    if (options & CAPTURE_RECON) Debayer(img);
 
     return false;
 }
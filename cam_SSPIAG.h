@@ -43,6 +43,7 @@ class Camera_SSPIAGClass : public GuideCamera
 
 public:
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer() { return true; }
     bool    Connect(const wxString& camId);
     bool    Disconnect();
     void    InitCapture();
@@ -732,7 +732,19 @@ bool Camera_SXVClass::Capture(int duration, usImage& img, int options, const wxR
 
     unsigned int nPixelsToRead = (xsize / xbin) * (ysize / ybin);
 
-    if (nPixelsToRead > RawDataSize)
+    // progressive frames are read straight into the image when the readout
+    // matches the image layout; the other modes are reassembled from RawData
+    bool const progressive = !Interlaced || (Binning > 1 && !SquarePixels);
+    bool readDirect = false;
+
+    if (progressive && !IsCMOSGuider(CameraModel))
+    {
+        if (InitCaptureImage(img, takeSubframe, wxRect(xofs / xbin, yofs / ybin, xsize / xbin, ysize / ybin)))
+            return true;
+        readDirect = img.NPixels == (int) nPixelsToRead;
+    }
+
+    if (!readDirect && nPixelsToRead > RawDataSize)
     {
         delete[] RawData;
         RawData = new unsigned short[nPixelsToRead];
@@ -772,7 +784,7 @@ bool Camera_SXVClass::Capture(int duration, usImage& img, int options, const wxR
     // if (WorkerThread::InterruptRequested())
     //    return true;
 
-    if (!ReadPixels(hCam, RawData, nPixelsToRead))  // stop exposure and read but only the one frame
+    if (!ReadPixels(hCam, readDirect ? img.ImageData : RawData, nPixelsToRead))  // stop exposure and read but only the one frame
     {
         DisconnectWithAlert(_("Lost connection to camera"), RECONNECT);
         return true;
@@ -786,13 +798,13 @@ bool Camera_SXVClass::Capture(int duration, usImage& img, int options, const wxR
 
     // Re-assemble image
 
-    if (!Interlaced || (Binning > 1 && !SquarePixels))
+    if (progressive)
     {
-        bool error;
+        bool error = false;
 
         if (IsCMOSGuider(CameraModel))
             error = InitImgCMOSGuider(img, FullSize, RawData);
-        else
+        else if (!readDirect)
             error = InitImgProgressive(img, xofs / xbin, yofs / ybin, xsize / xbin, ysize / ybin, takeSubframe, FullSize, RawData);
 
         if (error)
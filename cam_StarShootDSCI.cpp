@@ -185,7 +185,7 @@ bool Camera_StarShootDSCIClass::Capture(int duration, usImage& img, int options,
     memcpy(img.ImageData, rawptr, img.NPixels * sizeof(unsigned short));
 
     SubtractDark(img);
-    QuickLRecon(img);
+    Debayer(img);
     SquarePixels(img,XPixelSize,YPixelSize);
     return false;
 }
@@ -56,6 +56,7 @@ class Camera_StarShootDSCIClass : public GuideCamera
 public:
     Camera_StarShootDSCIClass();
     bool   Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool   IsBayer() { return true; }
     bool   Connect(const wxString& camId);
     bool   Disconnect();
     bool HasNonGuiCapture() { return true; }
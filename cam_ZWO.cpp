@@ -410,7 +410,7 @@ inline static int round_up(int v, int m)
     return round_down(v + m - 1, m);
 }
 
-static void flush_buffered_image(int cameraId, usImage& img)
+static void flush_buffered_image(int cameraId, unsigned char *buf, long bufSize)
 {
     enum { NUM_IMAGE_BUFFERS = 2 }; // camera has 2 internal frame buffers
 
@@ -418,7 +418,7 @@ static void flush_buffered_image(int cameraId, usImage& img)
 
     for (unsigned int num_cleared = 0; num_cleared < NUM_IMAGE_BUFFERS; num_cleared++)
     {
-        ASI_ERROR_CODE status = ASIGetVideoData(cameraId, (unsigned char *) img.ImageData, img.NPixels * sizeof(unsigned short), 0);
+        ASI_ERROR_CODE status = ASIGetVideoData(cameraId, buf, bufSize, 0);
         if (status != ASI_SUCCESS)
             break; // no more buffered frames
 
@@ -437,12 +437,6 @@ bool Camera_ZWO::Capture(int duration, usImage& img, int options, const wxRect&
         binning_change = true;
     }
 
-    if (img.Init(FullSize))
-    {
-        DisconnectWithAlert(CAPT_FAIL_MEMORY);
-        return true;
-    }
-
     wxRect frame;
     wxPoint subframePos; // position of subframe within frame
 
@@ -468,6 +462,12 @@ bool Camera_ZWO::Capture(int duration, usImage& img, int options, const wxRect&
         frame = wxRect(FullSize);
     }
 
+    // the camera is read out in RAW8, keep the pixels 8-bit if allowed
+    bool const native8 = (options & CAPTURE_NATIVE_8BIT) != 0;
+
+    if (InitCaptureImage(img, useSubframe, subframe, native8))
+        return true;
+
     long exposureUS = duration * 1000;
     ASI_BOOL tmp;
     long cur_exp;
@@ -516,7 +516,7 @@ bool Camera_ZWO::Capture(int duration, usImage& img, int options, const wxRect&
     // which could be quite stale. read out all buffered frames so the frame we
     // get is current
 
-    flush_buffered_image(m_cameraId, img);
+    flush_buffered_image(m_cameraId, m_buffer, m_maxSize.GetWidth() * m_maxSize.GetHeight());
 
     if (!m_capturing)
     {
@@ -527,13 +527,16 @@ bool Camera_ZWO::Capture(int duration, usImage& img, int options, const wxRect&
 
     int frameSize = frame.GetWidth() * frame.GetHeight();
 
+    // an 8-bit full frame is read straight into the image
+    unsigned char *dest = native8 && !useSubframe ? img.ImageData8 : m_buffer;
+
     int poll = wxMin(duration, 100);
 
     CameraWatchdog watchdog(duration, duration + GetTimeoutMs() + 10000); // total timeout is 2 * duration + 15s (typically)
 
     while (true)
     {
-        ASI_ERROR_CODE status = ASIGetVideoData(m_cameraId, m_buffer, frameSize, poll);
+        ASI_ERROR_CODE status = ASIGetVideoData(m_cameraId, dest, frameSize, poll);
         if (status == ASI_SUCCESS)
             break;
         if (WorkerThread::InterruptRequested())
@@ -552,20 +555,21 @@ bool Camera_ZWO::Capture(int duration, usImage& img, int options, const wxRect&
 
     if (useSubframe)
     {
-        img.Subframe = subframe;
-
-        // Clear out the image
-        img.Clear();
-
+        // only the subframe is stored
         for (int y = 0; y < subframe.height; y++)
         {
             const unsigned char *src = m_buffer + (y + subframePos.y) * frame.width + subframePos.x;
-            unsigned short *dst = img.ImageData + (y + subframe.y) * FullSize.GetWidth() + subframe.x;
-            for (int x = 0; x < subframe.width; x++)
-                *dst++ = *src++;
+            if (native8)
+                memcpy(&img.Pixel8(subframe.x, subframe.y + y), src, subframe.width);
+            else
+            {
+                unsigned short *dst = &img.Pixel(subframe.x, subframe.y + y);
+                for (int x = 0; x < subframe.width; x++)
+                    *dst++ = *src++;
+            }
         }
     }
-    else
+    else if (!native8)
     {
         for (int i = 0; i < img.NPixels; i++)
             img.ImageData[i] = m_buffer[i];
@@ -574,7 +578,7 @@ bool Camera_ZWO::Capture(int duration, usImage& img, int options, const wxRect&
     if (options & CAPTURE_SUBTRACT_DARK)
         SubtractDark(img);
     if (m_isColor && Binning == 1 && (options & CAPTURE_RECON))
-        QuickLRecon(img);
+        Debayer(img);
 
     return false;
 }
@@ -55,6 +55,7 @@ public:
 
     bool EnumCameras(wxArrayString& names, wxArrayString& ids);
     bool Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool IsBayer() { return m_isColor; }
     bool Connect(const wxString& camId);
     bool Disconnect();
 
@@ -968,7 +968,7 @@ bool Camera_ASCOMLateClass::Capture(int duration, usImage& img, int options, con
     if (options & CAPTURE_SUBTRACT_DARK)
         SubtractDark(img);
     if (Color && Binning == 1 && (options & CAPTURE_RECON))
-        QuickLRecon(img);
+        Debayer(img);
 
     return false;
 }
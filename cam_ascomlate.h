@@ -69,6 +69,7 @@ public:
     ~Camera_ASCOMLateClass();
 
     bool    Capture(int duration, usImage& img, int options, const wxRect& subframe);
+    bool    IsBayer() { return Color; }
     bool    HasNonGuiCapture(void);
     bool    Connect(const wxString& camId);
     bool    Disconnect(void);
@@ -601,13 +601,6 @@ bool SimCamState::ReadNextImage(usImage& img, const wxRect& subframe)
     int xsize = (int) fits_size[0];
     int ysize = (int) fits_size[1];
 
-    if (img.Init(xsize, ysize)) {
-        pFrame->Alert(_("Memory allocation error"));
-        PHD_fits_close_file(fptr);
-        return true;
-    }
-
-    unsigned short *buf = new unsigned short[img.NPixels];
     bool useSubframe = !subframe.IsEmpty();
     wxRect frame;
     if (useSubframe)
@@ -615,39 +608,23 @@ bool SimCamState::ReadNextImage(usImage& img, const wxRect& subframe)
     else
         frame = wxRect(0, 0, xsize, ysize);
 
+    // with a subframe only the subframe pixels are allocated and read
+    if (useSubframe ? img.InitSubframe(wxSize(xsize, ysize), subframe) : img.Init(xsize, ysize)) {
+        pFrame->Alert(_("Memory allocation error"));
+        PHD_fits_close_file(fptr);
+        return true;
+    }
+
     long inc[] = { 1, 1 };
     long fpixel[] = { frame.GetLeft() + 1, frame.GetTop() + 1 };
     long lpixel[] = { frame.GetRight() + 1, frame.GetBottom() + 1 };
-    if (fits_read_subset(fptr, TUSHORT, fpixel, lpixel, inc, NULL, buf, NULL, &status))
+    if (fits_read_subset(fptr, TUSHORT, fpixel, lpixel, inc, NULL, img.ImageData, NULL, &status))
     {
         pFrame->Alert(_("Error reading data"));
         PHD_fits_close_file(fptr);
         return true;
     }
 
-    if (useSubframe)
-    {
-        img.Subframe = subframe;
-
-        // Clear out the image
-        img.Clear();
-
-        int i = 0;
-        for (int y = 0; y < subframe.height; y++)
-        {
-            unsigned short *dst = img.ImageData + (y + subframe.y) * xsize + subframe.x;
-            for (int x = 0; x < subframe.width; x++, i++)
-                *dst++ = (unsigned short) buf[i];
-        }
-    }
-    else
-    {
-        for (int i = 0; i < img.NPixels; i++)
-            img.ImageData[i] = (unsigned short) buf[i];
-    }
-
-    delete[] buf;
-
     PHD_fits_close_file(fptr);
 
     return false;
@@ -667,9 +644,7 @@ static void rand_normal(double r[2])
 
 inline static unsigned short *pixel_addr(usImage& img, int x, int y)
 {
-    if (x < 0 || x >= img.Size.x)
-        return 0;
-    if (y < 0 || y >= img.Size.y)
+    if (!img.DataRect().Contains(x, y))
         return 0;
     return &img.Pixel(x, y);
 }
@@ -801,7 +776,7 @@ static void render_star(usImage& img, int binning, const wxRect& subframe, const
 static void render_clouds(usImage& img, const wxRect& subframe, int exptime, int gain, int offset)
 {
     unsigned short *p0 = &img.Pixel(subframe.GetLeft(), subframe.GetTop());
-    for (int r = 0; r < subframe.GetHeight(); r++, p0 += img.Size.GetWidth())
+    for (int r = 0; r < subframe.GetHeight(); r++, p0 += img.Stride)
     {
         unsigned short *const end = p0 + subframe.GetWidth();
         for (unsigned short *p = p0; p < end; p++)
@@ -1170,7 +1145,7 @@ bool Camera_SimClass::Capture(int duration, usImage& img, int options, const wxR
 static void fill_noise(usImage& img, const wxRect& subframe, int exptime, int gain, int offset)
 {
     unsigned short *p0 = &img.Pixel(subframe.GetLeft(), subframe.GetTop());
-    for (int r = 0; r < subframe.GetHeight(); r++, p0 += img.Size.GetWidth())
+    for (int r = 0; r < subframe.GetHeight(); r++, p0 += img.Stride)
     {
         unsigned short *const end = p0 + subframe.GetWidth();
         for (unsigned short *p = p0; p < end; p++)
@@ -1210,22 +1185,17 @@ bool Camera_SimClass::Capture(int duration, usImage& img, int options, const wxR
     int const gain = 30;
     int const offset = 100;
 
-    if (img.Init(FullSize))
+    // with a subframe only the subframe pixels are allocated and rendered
+    if (usingSubframe ? img.InitSubframe(FullSize, subframe) : img.Init(FullSize))
     {
         pFrame->Alert(_("Memory allocation error"));
         return true;
     }
 
-    if (usingSubframe)
-        img.Clear();
-
     fill_noise(img, subframe, exptime, gain, offset);
 
     sim->FillImage(img, subframe, exptime, gain, offset);
 
-    if (usingSubframe)
-        img.Subframe = subframe;
-
     if (options & CAPTURE_SUBTRACT_DARK) SubtractDark(img);
 
 #endif // SIMMODE == 1
@@ -206,6 +206,9 @@ GuideCamera::GuideCamera(void)
     m_pixelSize = GetProfilePixelSize();
     MaxBinning = 1;
     Binning = pConfig->Profile.GetInt("/camera/binning", 1);
+    SoftwareBinning = wxMax(1, wxMin(MAX_SOFTWARE_BINNING, pConfig->Profile.GetInt("/camera/softwareBinning", 1)));
+    SoftwareBinSum = pConfig->Profile.GetBoolean("/camera/softwareBinSum", false);
+    BayerRecon = (BayerReconMode) wxMax(BAYER_RECON_2X2, wxMin(BAYER_RECON_SUPERPIXEL, pConfig->Profile.GetInt("/camera/bayerRecon", BAYER_RECON_2X2)));
     CurrentDarkFrame = NULL;
     CurrentDefectMap = NULL;
 }
@@ -663,6 +666,55 @@ bool GuideCamera::SetBinning(int binning)
     return false;
 }
 
+bool GuideCamera::SetSoftwareBinning(int binning, bool sum)
+{
+    if (binning < 1)
+        binning = 1;
+    if (binning > MAX_SOFTWARE_BINNING)
+        binning = MAX_SOFTWARE_BINNING;
+
+    Debug.Write(wxString::Format("camera: set software binning = %d %s\n", binning, sum ? "sum" : "mean"));
+
+    SoftwareBinning = binning;
+    SoftwareBinSum = sum;
+    pConfig->Profile.SetInt("/camera/softwareBinning", binning);
+    pConfig->Profile.SetBoolean("/camera/softwareBinSum", sum);
+
+    return false;
+}
+
+bool GuideCamera::SetBayerRecon(int mode)
+{
+    if (mode < BAYER_RECON_2X2 || mode > BAYER_RECON_SUPERPIXEL)
+        mode = BAYER_RECON_2X2;
+
+    Debug.Write(wxString::Format("camera: set bayer recon = %d\n", mode));
+
+    BayerRecon = (BayerReconMode) mode;
+    pConfig->Profile.SetInt("/camera/bayerRecon", mode);
+
+    return false;
+}
+
+int GuideCamera::SoftwareBinFactor(int softwareBinning, BayerReconMode recon)
+{
+    if (FullSize == UNDEFINED_FRAME_SIZE || DarkFrameSize() != FullSize)
+        return 1;
+    return softwareBinning * (recon == BAYER_RECON_SUPERPIXEL && IsRawBayer() ? 2 : 1);
+}
+
+wxSize GuideCamera::ImageSize()
+{
+    int const bin = SoftwareBinFactor();
+    return wxSize(FullSize.GetWidth() / bin, FullSize.GetHeight() / bin);
+}
+
+wxSize GuideCamera::DarkLibraryFrameSize()
+{
+    // darks are captured through Capture(), so they are binned like the lights
+    return SoftwareBinFactor() > 1 ? ImageSize() : DarkFrameSize();
+}
+
 void GuideCamera::SetTimeoutMs(int ms)
 {
     static const int MIN_TIMEOUT_MS = 5000;
@@ -773,6 +825,8 @@ void CameraConfigDialogPane::LayoutControls(GuideCamera *pCamera, BrainCtrlIdMap
         if (pCamera->HasPortNum)     ++numItems;
         if (pCamera->MaxBinning > 1) ++numItems;
         if (pCamera->HasCooler)      ++numItems;
+        if (pCamera->IsBayer())      ++numItems;
+        ++numItems;                  // software binning
         wxFlexGridSizer *pDetailsSizer = new wxFlexGridSizer((numItems + 1) / 2, 3, 15, 15);
 
         wxSizerFlags spec_flags = wxSizerFlags(0).Border(wxALL, 10).Expand();
@@ -786,6 +840,9 @@ void CameraConfigDialogPane::LayoutControls(GuideCamera *pCamera, BrainCtrlIdMap
             pDetailsSizer->Add(GetSizerCtrl(CtrlMap, AD_szPort));
         if (pCamera->MaxBinning > 1)
             pDetailsSizer->Add(GetSizerCtrl(CtrlMap, AD_binning));
+        pDetailsSizer->Add(GetSizerCtrl(CtrlMap, AD_softwareBinning));
+        if (pCamera->IsBayer())
+            pDetailsSizer->Add(GetSizerCtrl(CtrlMap, AD_bayerRecon));
         if (pCamera->HasSubframes)
             pDetailsSizer->Add(GetSingleCtrl(CtrlMap, AD_cbUseSubFrames));
         if (pCamera->HasCooler)
@@ -850,6 +907,44 @@ CameraConfigDialogCtrlSet::CameraConfigDialogCtrlSet(wxWindow *pParent, GuideCam
         AddLabeledCtrl(CtrlMap, AD_binning, _("Binning"), m_binning, _("Camera pixel binning"));
     }
 
+    // Software binning
+    {
+        wxArrayString opts;
+        opts.Add(_("None"));
+        for (int i = 2; i <= MAX_SOFTWARE_BINNING; i++)
+            opts.Add(wxString::Format("%dx%d", i, i));
+        int width = StringArrayWidth(opts);
+        wxSizer *sz = new wxBoxSizer(wxHORIZONTAL);
+        m_softwareBinning = new wxChoice(GetParentWindow(AD_softwareBinning), wxID_ANY, wxDefaultPosition,
+            wxSize(width + 35, -1), opts);
+        wxSizer *szc = MakeLabeledControl(AD_softwareBinning, _("Software binning"), m_softwareBinning,
+            _("Bin the camera frames in software before they are processed. Useful for high-resolution cameras "
+            "without hardware binning. Dark library and bad-pixel map must be rebuilt after a change."));
+        sz->Add(szc, wxSizerFlags().Align(wxALIGN_CENTER_VERTICAL).Border(wxRIGHT));
+        m_softwareBinSum = new wxCheckBox(GetParentWindow(AD_softwareBinning), wxID_ANY, _("Sum"));
+        m_softwareBinSum->SetToolTip(_("Check to sum the binned pixels instead of averaging them"));
+        sz->Add(m_softwareBinSum, wxSizerFlags().Align(wxALIGN_CENTER_VERTICAL));
+        AddGroup(CtrlMap, AD_softwareBinning, sz);
+    }
+
+    // Luminance reconstruction of color cameras
+    m_bayerRecon = NULL;
+    if (m_pCamera->IsBayer())
+    {
+        wxArrayString opts;
+        opts.Add(_("2x2 (fast)"));
+        opts.Add(_("3x3 (smooth)"));
+        opts.Add(_("Super-pixel (half size)"));
+        int width = StringArrayWidth(opts);
+        m_bayerRecon = new wxChoice(GetParentWindow(AD_bayerRecon), wxID_ANY, wxDefaultPosition,
+            wxSize(width + 35, -1), opts);
+        AddLabeledCtrl(CtrlMap, AD_bayerRecon, _("Color debayer"), m_bayerRecon,
+            _("How the luminance of one-shot-color camera frames is computed. 2x2 averages a sliding 2x2 window. "
+            "3x3 weights red, green and blue 1:2:1 around every pixel. Super-pixel makes one pixel of each "
+            "2x2 color cell, halving the image size, which makes all further processing faster. "
+            "Dark library and bad-pixel map must be rebuilt after changing to or from super-pixel."));
+    }
+
     // Delay parameter
     if (m_pCamera->HasDelayParam)
     {
@@ -915,6 +1010,19 @@ void CameraConfigDialogCtrlSet::LoadValues()
         m_binning->Enable(!pFrame->pGuider || !pFrame->pGuider->IsCalibratingOrGuiding());
     }
 
+    m_softwareBinning->Select(m_pCamera->SoftwareBinning - 1);
+    m_softwareBinSum->SetValue(m_pCamera->SoftwareBinSum);
+    {
+        bool enable = !pFrame->pGuider || !pFrame->pGuider->IsCalibratingOrGuiding();
+        m_softwareBinning->Enable(enable);
+        m_softwareBinSum->Enable(enable);
+        if (m_bayerRecon)
+        {
+            m_bayerRecon->Select(m_pCamera->BayerRecon);
+            m_bayerRecon->Enable(enable);
+        }
+    }
+
     m_timeoutVal->SetValue(m_pCamera->GetTimeoutMs() / 1000);
 
     if (m_pCamera->HasDelayParam)
@@ -1049,6 +1157,10 @@ void CameraConfigDialogCtrlSet::UnloadValues()
         m_pCamera->SetBinning(idx + 1);
     }
 
+    m_pCamera->SetSoftwareBinning(m_softwareBinning->GetSelection() + 1, m_softwareBinSum->GetValue());
+    if (m_bayerRecon)
+        m_pCamera->SetBayerRecon(m_bayerRecon->GetSelection());
+
     m_pCamera->SetTimeoutMs(m_timeoutVal->GetValue() * 1000);
 
     if (m_pCamera->HasDelayParam)
@@ -1114,6 +1226,13 @@ int CameraConfigDialogCtrlSet::GetBinning()
     return m_binning ? m_binning->GetSelection() + 1 : 1;
 }
 
+// the software binning factor the selected settings would give
+int CameraConfigDialogCtrlSet::GetSoftwareBinning()
+{
+    BayerReconMode recon = m_bayerRecon ? (BayerReconMode) m_bayerRecon->GetSelection() : m_pCamera->BayerRecon;
+    return m_pCamera->SoftwareBinFactor(m_softwareBinning->GetSelection() + 1, recon);
+}
+
 void CameraConfigDialogCtrlSet::SetBinning(int binning)
 {
     if (m_binning)
@@ -1142,11 +1261,16 @@ wxString GuideCamera::GetSettingsSummary()
     else
         pixelSizeStr = wxString::Format(_("%0.1f um"), m_pixelSize);
 
-    return wxString::Format("Camera = %s, gain = %d%s%s, full size = %d x %d, %s, %s, pixel size = %s\n",
+    int const softBin = SoftwareBinFactor() > 1 ? SoftwareBinning : 1;
+    static const char *const reconNames[] = { "2x2", "3x3", "super-pixel" };
+
+    return wxString::Format("Camera = %s, gain = %d%s%s, full size = %d x %d%s%s, %s, %s, pixel size = %s\n",
                             Name, GuideCameraGain,
                             HasDelayParam ? wxString::Format(", delay = %d", ReadDelay) : "",
                             HasPortNum ? wxString::Format(", port = 0x%hx", Port) : "",
                             FullSize.GetWidth(), FullSize.GetHeight(),
+                            softBin > 1 ? wxString::Format(", software binning = %dx%d %s", softBin, softBin, SoftwareBinSum ? "sum" : "mean") : "",
+                            IsBayer() && BayerRecon != BAYER_RECON_2X2 ? wxString::Format(", debayer = %s", reconNames[BayerRecon]) : "",
                             darkDur ? wxString::Format("have dark, dark dur = %d", darkDur) : "no dark",
                             (CurrentDefectMap) ? "defect map in use" : "no defect map",
                             pixelSizeStr);
@@ -1247,6 +1371,8 @@ void GuideCamera::ClearDarks()
 
 void GuideCamera::SubtractDark(usImage& img)
 {
+    TraceSpan span("GuideCamera::SubtractDark");
+
     // dark subtraction is done in the camera worker thread, so we need to acquire the
     // DarkFrameLock to protect against the dark frame disappearing when the main
     // thread does "Load Darks" or "Clear Darks"
@@ -1321,11 +1447,79 @@ void GuideCamera::InitCapture()
 
 bool GuideCamera::Capture(GuideCamera *camera, int duration, usImage& img, int captureOptions, const wxRect& subframe)
 {
+    TraceSpan span("GuideCamera::Capture");
+
     img.InitImgStartTime();
     img.BitsPerPixel = camera->BitsPerPixel();
     img.ImgExpDur = duration;
-    bool err = camera->Capture(duration, img, captureOptions, subframe);
-    return err;
+
+    int const bin = camera->SoftwareBinFactor();
+    if (bin == 1)
+        return camera->Capture(duration, img, captureOptions, subframe);
+
+    // With software binning the driver reads out the sensor area of the
+    // subframe and the frame is binned here, before dark subtraction, so the
+    // dark is subtracted at the binned size. The dark library is captured
+    // through here too, so it is binned the same way. The driver does not
+    // debayer: binning by an even factor sums whole Bayer quads, which is
+    // luminance already, and a reconstruction ahead of the binning would
+    // smooth the defects the dark and bad-pixel map are meant to remove. For
+    // super-pixel debayering each Bayer quad is averaged into one pixel here,
+    // before any further binning.
+    bool const superPixel = camera->BayerRecon == BAYER_RECON_SUPERPIXEL && camera->IsRawBayer();
+
+    wxRect sensorSubframe(0, 0, 0, 0);
+    if (subframe.width > 0 && subframe.height > 0)
+    {
+        sensorSubframe = wxRect(subframe.x * bin, subframe.y * bin, subframe.width * bin, subframe.height * bin);
+        sensorSubframe.Intersect(wxRect(camera->FullSize));
+    }
+
+    if (camera->Capture(duration, img, captureOptions & ~(CAPTURE_SUBTRACT_DARK | CAPTURE_RECON), sensorSubframe))
+        return true;
+
+    if ((superPixel && SoftwareBin(img, 2, false)) ||
+        SoftwareBin(img, camera->SoftwareBinning, camera->SoftwareBinSum))
+    {
+        camera->DisconnectWithAlert(CAPT_FAIL_MEMORY);
+        return true;
+    }
+
+    if (captureOptions & CAPTURE_SUBTRACT_DARK)
+        camera->SubtractDark(img);
+
+    // binning by an odd factor leaves part of the color pattern, so those
+    // frames are reconstructed once the dark is off
+    if ((captureOptions & CAPTURE_RECON) && camera->IsRawBayer() && !superPixel && camera->SoftwareBinning % 2 != 0)
+    {
+        if (camera->Debayer(img))
+        {
+            camera->DisconnectWithAlert(CAPT_FAIL_MEMORY);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool GuideCamera::InitCaptureImage(usImage& img, bool takeSubframe, const wxRect& subframe, bool eightBit)
+{
+    if (takeSubframe ? img.InitSubframe(FullSize, subframe, eightBit) : img.Init(FullSize, eightBit))
+    {
+        DisconnectWithAlert(CAPT_FAIL_MEMORY);
+        return true;
+    }
+    return false;
+}
+
+bool GuideCamera::Debayer(usImage& img)
+{
+    // super-pixel frames are binned by the static Capture(), which does not
+    // ask the driver to debayer them; when super-pixel is not possible this
+    // falls back to 2x2
+    if (BayerRecon == BAYER_RECON_3X3)
+        return BayerLuminance(img);
+    return QuickLRecon(img);
 }
 
 bool GuideCamera::ST4HasGuideOutput(void)
@@ -71,6 +71,9 @@ class CameraConfigDialogCtrlSet : public ConfigDialogCtrlSet
     wxSpinCtrl *m_pDelay;
     wxSpinCtrlDouble *m_pPixelSize;
     wxChoice *m_binning;
+    wxChoice *m_softwareBinning;
+    wxCheckBox *m_softwareBinSum;
+    wxChoice *m_bayerRecon;
     wxCheckBox *m_coolerOn;
     wxSpinCtrl *m_coolerSetpt;
 
@@ -84,16 +87,31 @@ public:
     void SetPixelSize(double val);
     int GetBinning(void);
     void SetBinning(int val);
+    int GetSoftwareBinning(void);
 };
 
 enum CaptureOptionBits
 {
     CAPTURE_SUBTRACT_DARK = 1 << 0,
     CAPTURE_RECON         = 1 << 1,    // debayer and/or deinterlace as required
+    CAPTURE_NATIVE_8BIT   = 1 << 2,    // 8-bit cameras may return 8-bit pixels instead of widening them
 
-    CAPTURE_LIGHT = CAPTURE_SUBTRACT_DARK | CAPTURE_RECON,
-    CAPTURE_DARK = 0,
-    CAPTURE_BPM_REVIEW = CAPTURE_SUBTRACT_DARK,
+    CAPTURE_LIGHT = CAPTURE_SUBTRACT_DARK | CAPTURE_RECON | CAPTURE_NATIVE_8BIT,
+    CAPTURE_DARK = 0,   // darks are always 16-bit, they go into the dark library
+    CAPTURE_BPM_REVIEW = CAPTURE_SUBTRACT_DARK | CAPTURE_NATIVE_8BIT,
+};
+
+enum
+{
+    MAX_SOFTWARE_BINNING = 4,
+};
+
+// how the luminance of a one-shot-color (Bayer) frame is reconstructed
+enum BayerReconMode
+{
+    BAYER_RECON_2X2,            // sliding 2x2 window, full resolution
+    BAYER_RECON_3X3,            // 3x3 binomial (R + 2G + B) / 4, full resolution
+    BAYER_RECON_SUPERPIXEL,     // one pixel per Bayer quad, half resolution
 };
 
 class GuideCamera :  public wxMessageBoxProxy, public OnboardST4
@@ -120,6 +138,9 @@ public:
     bool            HasSubframes;
     wxByte          MaxBinning;
     wxByte          Binning;
+    wxByte          SoftwareBinning;    // further binning of the captured frames in software, 1 = none
+    bool            SoftwareBinSum;     // software bins hold the sum of the pixels instead of the mean
+    BayerReconMode  BayerRecon;
     short           Port;
     int             ReadDelay;
     bool            ShutterClosed;  // false=light, true=dark
@@ -185,11 +206,41 @@ public:
 
     virtual const wxSize& DarkFrameSize() { return FullSize; }
 
+    // true for a one-shot-color camera, whose driver calls Debayer()
+    virtual bool    IsBayer() { return false; }
+    // the frames are an undebayered mosaic: a color camera without hardware binning
+    bool            IsRawBayer() { return IsBayer() && Binning == 1; }
+
+    // Software binning is applied by the static Capture() to the frames the
+    // driver delivers, so the guider sees images of ImageSize() with a pixel
+    // scale given by ImageBinning(). It is not done for cameras whose darks
+    // are raw frames of a different size than the guide frames. Super-pixel
+    // debayering of a raw Bayer mosaic is done the same way, as a 2x2 mean,
+    // and counts towards the factor.
+    int             SoftwareBinFactor() { return SoftwareBinFactor(SoftwareBinning, BayerRecon); }
+    int             SoftwareBinFactor(int softwareBinning, BayerReconMode recon);
+    unsigned short  ImageBinning() { return Binning * SoftwareBinFactor(); }
+    wxSize          ImageSize();
+    wxSize          DarkLibraryFrameSize();
+    bool            SetSoftwareBinning(int binning, bool sum);
+    bool            SetBayerRecon(int mode);
+
     static double GetProfilePixelSize(void);
 
 protected:
 
     virtual bool Capture(int duration, usImage& img, int captureOptions, const wxRect& subframe) = 0;
+    // Sizes img for the frame about to be read out: the full frame, or only the
+    // subframe when takeSubframe is set. The buffer is recycled from the image
+    // buffer pool, so a driver whose SDK takes a destination pointer can read
+    // straight into img.ImageData (img.Stride pixels per row) with no copy.
+    // With eightBit set the image holds 8-bit pixels in img.ImageData8; only
+    // pass it when the capture options include CAPTURE_NATIVE_8BIT.
+    // Returns true on error, after disconnecting with an alert.
+    bool InitCaptureImage(usImage& img, bool takeSubframe, const wxRect& subframe, bool eightBit = false);
+    // Luminance reconstruction of a color frame, for drivers to call when the
+    // capture options include CAPTURE_RECON. Returns true on error.
+    bool Debayer(usImage& img);
     int GetCameraGain(void);
     bool SetCameraGain(int cameraGain);
     bool SetBinning(int binning);
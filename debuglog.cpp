@@ -35,21 +35,168 @@
 
 #include "phd.h"
 
+#include <atomic>
+
 #define ALWAYS_FLUSH_DEBUGLOG
 const int RetentionPeriod = 30;
 
+// Each thread that logs gets its own single-producer/single-consumer ring of
+// raw entries (timestamp, thread id, UTF-8 payload). The drain thread merges
+// the rings in sequence order, does the timestamp formatting and writes the
+// file, so a Write() on the guiding path is little more than a memcpy.
+//
+// Rings are never freed while the log is active (there is no portable way
+// to find out when a thread exits), so only the first MAX_RINGS threads get a
+// private ring; the rest share one ring guarded by a critical section. Lines
+// too long for a ring go to the drain thread through a locked queue, so the
+// drain thread is the only consumer of the rings.
+
+enum
+{
+    MAX_RINGS = 32,
+    DRAIN_INTERVAL_MS = 20
+};
+
+struct DebugLogEntryHdr
+{
+    wxLongLong_t time;          // UTC milliseconds
+    unsigned long threadId;
+    unsigned int seq;
+    unsigned int len;           // payload bytes following the header
+};
+
+struct DebugLogRing
+{
+    enum { RING_BYTES = 32 * 1024, RING_MASK = RING_BYTES - 1 };
+
+    std::atomic<size_t> head;   // advanced by the producer
+    std::atomic<size_t> tail;   // advanced by the drain thread
+    std::atomic<unsigned int> dropped;
+    bool shared;
+    DebugLogRing *next;
+    char buf[RING_BYTES];
+
+    DebugLogRing(bool isShared) : head(0), tail(0), dropped(0), shared(isShared), next(0) { }
+
+    void Put(size_t pos, const void *src, size_t n)
+    {
+        const char *p = static_cast<const char *>(src);
+        for (size_t i = 0; i < n; i++)
+            buf[(pos + i) & RING_MASK] = p[i];
+    }
+
+    void Get(size_t pos, void *dst, size_t n) const
+    {
+        char *p = static_cast<char *>(dst);
+        for (size_t i = 0; i < n; i++)
+            p[i] = buf[(pos + i) & RING_MASK];
+    }
+};
+
+static std::atomic<unsigned int> s_seq(0);
+static wxTLS_TYPE(DebugLogRing *) s_threadRing;
+
+class DebugLogDrainThread : public wxThread
+{
+    DebugLog *m_log;
+    volatile bool m_stop;
+
+public:
+    DebugLogDrainThread(DebugLog *log) : wxThread(wxTHREAD_JOINABLE), m_log(log), m_stop(false) { }
+    void Stop() { m_stop = true; m_log->m_wakeDrain.Post(); Wait(); }
+    ExitCode Entry();
+};
+
+wxThread::ExitCode DebugLogDrainThread::Entry()
+{
+    while (!m_stop)
+    {
+        m_log->m_wakeDrain.WaitTimeout(DRAIN_INTERVAL_MS);
+
+        bool flush = m_log->m_flushRequested.exchange(false);
+
+        m_log->Drain();
+
+        if (flush)
+            m_log->m_flushDone.Post();
+    }
+
+    m_log->Drain();
+
+    return 0;
+}
+
+static size_t Utf8Len(const wxString& str)
+{
+    size_t n = 0;
+    for (wxString::const_iterator it = str.begin(); it != str.end(); ++it)
+    {
+        wxUint32 c = (*it).GetValue();
+        n += c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+    }
+    return n;
+}
+
+static size_t PutUtf8(DebugLogRing *ring, size_t pos, const wxString& str)
+{
+    for (wxString::const_iterator it = str.begin(); it != str.end(); ++it)
+    {
+        wxUint32 c = (*it).GetValue();
+        if (c < 0x80)
+            ring->buf[pos++ & DebugLogRing::RING_MASK] = (char) c;
+        else
+        {
+            char b[4];
+            size_t n;
+            if (c < 0x800)
+            {
+                b[0] = (char)(0xC0 | (c >> 6));
+                b[1] = (char)(0x80 | (c & 0x3F));
+                n = 2;
+            }
+            else if (c < 0x10000)
+            {
+                b[0] = (char)(0xE0 | (c >> 12));
+                b[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+                b[2] = (char)(0x80 | (c & 0x3F));
+                n = 3;
+            }
+            else
+            {
+                b[0] = (char)(0xF0 | (c >> 18));
+                b[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+                b[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+                b[3] = (char)(0x80 | (c & 0x3F));
+                n = 4;
+            }
+            ring->Put(pos, b, n);
+            pos += n;
+        }
+    }
+    return pos;
+}
+
 void DebugLog::InitVars(void)
 {
     m_bEnabled = false;
+    m_bVerbose = true;
     m_lastWriteTime = wxDateTime::UNow();
+    m_pDrainThread = 0;
+    m_pRings = 0;
+    m_ringCount = 0;
+    m_pSharedRing = 0;
+    m_flushRequested = false;
+    m_lastDrainTime = m_lastWriteTime.GetValue().GetValue();
 }
 
 DebugLog::DebugLog(void)
+    : m_wakeDrain(0, 1)
 {
     InitVars();
 }
 
 DebugLog::DebugLog(const wxString& name, bool bEnabled = true)
+    : m_wakeDrain(0, 1)
 {
     InitVars();
     Init(name, bEnabled);
@@ -59,6 +206,14 @@ DebugLog::~DebugLog(void)
 {
     wxFFile::Flush();
     wxFFile::Close();
+
+    // the drain thread was stopped in Shutdown()
+    while (m_pRings)
+    {
+        DebugLogRing *next = m_pRings->next;
+        delete m_pRings;
+        m_pRings = next;
+    }
 }
 
 bool DebugLog::Enable(bool bEnabled)
@@ -70,8 +225,17 @@ bool DebugLog::Enable(bool bEnabled)
     return prevState;
 }
 
+void DebugLog::SetVerbose(bool verbose)
+{
+    m_bVerbose = verbose;
+}
+
 bool DebugLog::Init(const wxString& name, bool bEnable, bool bForceOpen)
 {
+    // write out the lines queued for the old file
+    if (m_pDrainThread)
+        Flush();
+
     wxCriticalSectionLocker lock(m_criticalSection);
 
     if (m_bEnabled)
@@ -96,9 +260,29 @@ bool DebugLog::Init(const wxString& name, bool bEnable, bool bForceOpen)
 
     m_bEnabled = bEnable;
 
+    if (m_bEnabled && !m_pDrainThread)
+    {
+        DebugLogDrainThread *thread = new DebugLogDrainThread(this);
+        if (thread->Create() == wxTHREAD_NO_ERROR && thread->Run() == wxTHREAD_NO_ERROR)
+            m_pDrainThread = thread;
+        else
+            delete thread;  // keep writing synchronously
+    }
+
     return m_bEnabled;
 }
 
+void DebugLog::Shutdown(void)
+{
+    if (!m_pDrainThread)
+        return;
+
+    DebugLogDrainThread *thread = m_pDrainThread;
+    thread->Stop();
+    m_pDrainThread = 0;
+    delete thread;
+}
+
 bool DebugLog::ChangeDirLog(const wxString& newdir)
 {
     bool bEnabled = IsEnabled();
@@ -143,6 +327,17 @@ bool DebugLog::Flush(void)
 
     if (m_bEnabled)
     {
+        if (m_pDrainThread && wxThread::GetCurrentId() != m_pDrainThread->GetId())
+        {
+            // have the drain thread write out everything queued so far; first
+            // consume a completion left over from a flush that timed out
+            while (m_flushDone.TryWait() == wxSEMA_NO_ERROR)
+                ;
+            m_flushRequested = true;
+            m_wakeDrain.Post();
+            m_flushDone.WaitTimeout(1000);
+        }
+
         wxCriticalSectionLocker lock(m_criticalSection);
 
         bReturn = wxFFile::Flush();
@@ -151,52 +346,276 @@ bool DebugLog::Flush(void)
     return bReturn;
 }
 
-wxString DebugLog::Write(const wxString& str)
+DebugLogRing *DebugLog::ThreadRing(void)
 {
-    if (m_bEnabled)
+    DebugLogRing *ring = wxTLS_VALUE(s_threadRing);
+
+    if (!ring)
     {
-        wxCriticalSectionLocker lock(m_criticalSection);
+        wxCriticalSectionLocker lock(m_ringsLock);
 
-        wxDateTime now = wxDateTime::UNow();
-        wxTimeSpan deltaTime = now - m_lastWriteTime;
-        m_lastWriteTime = now;
-        wxString outputLine = wxString::Format("%s %s %lu %s", now.Format("%H:%M:%S.%l"),
-                                                              deltaTime.Format("%S.%l"),
-                                                              (unsigned long) wxThread::GetCurrentId(),
-                                                              str);
+        if (m_ringCount < MAX_RINGS)
+        {
+            ring = new DebugLogRing(false);
+            ring->next = m_pRings;
+            m_pRings = ring;
+            ++m_ringCount;
+        }
+        else
+        {
+            if (!m_pSharedRing)
+            {
+                m_pSharedRing = new DebugLogRing(true);
+                m_pSharedRing->next = m_pRings;
+                m_pRings = m_pSharedRing;
+            }
+            ring = m_pSharedRing;
+        }
 
-        wxFFile::Write(outputLine);
-#if defined(ALWAYS_FLUSH_DEBUGLOG)
-        wxFFile::Flush();
-#endif
-#if defined(__WINDOWS__) && defined(_DEBUG)
-        OutputDebugString(outputLine.c_str());
-#endif
+        wxTLS_VALUE(s_threadRing) = ring;
     }
 
-    return str;
+    return ring;
+}
+
+// queue a line for the drain thread
+void DebugLog::Enqueue(const wxString& str)
+{
+    DebugLogEntryHdr hdr;
+    hdr.time = wxDateTime::UNow().GetValue().GetValue();
+    hdr.threadId = (unsigned long) wxThread::GetCurrentId();
+    hdr.len = Utf8Len(str);
+
+    size_t need = sizeof(hdr) + hdr.len;
+    if (need > DebugLogRing::RING_BYTES / 2)
+    {
+        // rare, so an allocation and a lock are fine here
+        wxScopedCharBuffer utf8 = str.utf8_str();
+        hdr.len = utf8.length();
+        std::string entry(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        entry.append(utf8.data(), utf8.length());
+        {
+            wxCriticalSectionLocker lock(m_longLinesLock);
+            hdr.seq = s_seq++;
+            memcpy(&entry[0], &hdr, sizeof(hdr));
+            m_longLines.push_back(entry);
+        }
+        m_wakeDrain.Post();
+        return;
+    }
+
+    DebugLogRing *ring = ThreadRing();
+
+    if (ring->shared)
+        m_sharedRingLock.Enter();
+
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    size_t tail = ring->tail.load(std::memory_order_acquire);
+
+    if (DebugLogRing::RING_BYTES - (head - tail) < need)
+    {
+        // ring is full; never stall the calling thread, which may be guiding
+        // or capturing. The drain thread reports the count.
+        ring->dropped++;
+        if (ring->shared)
+            m_sharedRingLock.Leave();
+        m_wakeDrain.Post();
+        return;
+    }
+
+    hdr.seq = s_seq++;
+
+    ring->Put(head, &hdr, sizeof(hdr));
+    PutUtf8(ring, head + sizeof(hdr), str);
+    ring->head.store(head + need, std::memory_order_release);
+
+    if (ring->shared)
+        m_sharedRingLock.Leave();
+
+    if (head + need - tail > DebugLogRing::RING_BYTES / 2)
+        m_wakeDrain.Post();
 }
 
-DebugLog& operator<< (DebugLog& out, const wxString &str)
+// Called from the fatal exception handler: write out whatever is still
+// queued in the rings on the crashing thread, since the last lines before a
+// crash are the ones that matter. This is best effort; if the drain thread
+// is draining, or another thread holds one of the log locks, the queued
+// lines are left alone rather than risking a deadlock.
+void DebugLog::EmergencyFlush(void)
 {
-    out.Write(str);
-    return out;
+    if (!m_bEnabled || !m_pDrainThread || wxThread::GetCurrentId() == m_pDrainThread->GetId())
+        return;
+
+    if (!m_criticalSection.TryEnter())
+        return;
+
+    DrainLocked(true);
+    wxFFile::Flush();
+
+    m_criticalSection.Leave();
 }
 
-DebugLog& operator<< (DebugLog& out, const char *str)
+void DebugLog::WriteLine(const wxString& outputLine)
 {
-    out.Write(str);
-    return out;
+    wxFFile::Write(outputLine);
+#if defined(ALWAYS_FLUSH_DEBUGLOG)
+    wxFFile::Flush();
+#endif
+#if defined(__WINDOWS__) && defined(_DEBUG)
+    OutputDebugString(outputLine.c_str());
+#endif
 }
 
-DebugLog& operator<< (DebugLog& out, const int i)
+// called on the drain thread: merge the queued entries of all rings in
+// sequence order, format them and write them to the file
+void DebugLog::Drain(void)
 {
-    out.Write(wxString::Format(_T("%d"), i));
-    return out;
+    wxCriticalSectionLocker lock(m_criticalSection);
+    DrainLocked(false);
 }
 
-DebugLog& operator<< (DebugLog& out, const double d)
+// Drain() with m_criticalSection held, which keeps the ring tails to one
+// consumer at a time. In an emergency the other locks are only tried.
+void DebugLog::DrainLocked(bool emergency)
 {
-    out.Write(wxString::Format(_T("%f"), d));
-    return out;
+    DebugLogRing *rings[MAX_RINGS + 1];
+    size_t heads[MAX_RINGS + 1];
+    unsigned int nrings = 0;
+
+    if (emergency)
+    {
+        if (!m_ringsLock.TryEnter())
+            return;
+    }
+    else
+        m_ringsLock.Enter();
+    for (DebugLogRing *r = m_pRings; r && nrings < WXSIZEOF(rings); r = r->next)
+        rings[nrings++] = r;
+    m_ringsLock.Leave();
+
+    for (unsigned int i = 0; i < nrings; i++)
+        heads[i] = rings[i]->head.load(std::memory_order_acquire);
+
+    std::deque<std::string> longLines;
+    if (!emergency)
+        m_longLinesLock.Enter();
+    if (!emergency || m_longLinesLock.TryEnter())
+    {
+        longLines.swap(m_longLines);
+        m_longLinesLock.Leave();
+    }
+
+    m_drainBuf.clear();
+
+    for (unsigned int i = 0; i < nrings; i++)
+    {
+        unsigned int dropped = rings[i]->dropped.exchange(0);
+        if (dropped)
+            m_drainBuf += wxString::Format("DebugLog: %u lines were dropped, the log could not be written fast enough\n", dropped).ToStdString();
+    }
+
+    while (true)
+    {
+        // pick the oldest entry across all rings and the long lines
+        int best = -1;
+        DebugLogEntryHdr bestHdr;
+
+        for (unsigned int i = 0; i < nrings; i++)
+        {
+            size_t tail = rings[i]->tail.load(std::memory_order_relaxed);
+            if ((ptrdiff_t)(heads[i] - tail) <= 0)
+                continue;
+
+            DebugLogEntryHdr hdr;
+            rings[i]->Get(tail, &hdr, sizeof(hdr));
+            if (best < 0 || (int)(hdr.seq - bestHdr.seq) < 0)
+            {
+                best = i;
+                bestHdr = hdr;
+            }
+        }
+
+        bool longLine = false;
+        if (!longLines.empty())
+        {
+            DebugLogEntryHdr hdr;
+            memcpy(&hdr, longLines.front().data(), sizeof(hdr));
+            if (best < 0 || (int)(hdr.seq - bestHdr.seq) < 0)
+            {
+                longLine = true;
+                bestHdr = hdr;
+            }
+        }
+
+        if (best < 0 && !longLine)
+            break;
+
+        wxLongLong_t delta = bestHdr.time - m_lastDrainTime;
+        if (delta < 0)
+            delta = 0;
+        m_lastDrainTime = bestHdr.time;
+
+        wxString prefix = wxString::Format("%s %02ld.%03d %lu ",
+            wxDateTime(wxLongLong(bestHdr.time)).Format("%H:%M:%S.%l"),
+            (long)(delta / 1000), (int)(delta % 1000), bestHdr.threadId);
+
+        m_drainBuf += prefix.ToStdString();
+
+        if (longLine)
+        {
+            m_drainBuf.append(longLines.front(), sizeof(bestHdr), std::string::npos);
+            longLines.pop_front();
+            continue;
+        }
+
+        DebugLogRing *ring = rings[best];
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+
+        size_t pos = m_drainBuf.size();
+        m_drainBuf.resize(pos + bestHdr.len);
+        ring->Get(tail + sizeof(bestHdr), &m_drainBuf[pos], bestHdr.len);
+
+        ring->tail.store(tail + sizeof(bestHdr) + bestHdr.len, std::memory_order_release);
+    }
+
+    if (!m_drainBuf.empty() && m_bEnabled)
+    {
+        wxFFile::Write(m_drainBuf.data(), m_drainBuf.size());
+#if defined(ALWAYS_FLUSH_DEBUGLOG)
+        wxFFile::Flush();
+#endif
+#if defined(__WINDOWS__) && defined(_DEBUG)
+        OutputDebugStringA(m_drainBuf.c_str());
+#endif
+    }
+
+    m_lastWriteTime = wxDateTime(wxLongLong(m_lastDrainTime));
+}
+
+wxString DebugLog::Write(const wxString& str)
+{
+    if (m_bEnabled)
+    {
+        if (m_pDrainThread)
+        {
+            Enqueue(str);
+            return str;
+        }
+
+        // no drain thread (startup, shutdown): write it directly
+        wxCriticalSectionLocker lock(m_criticalSection);
+
+        wxDateTime now = wxDateTime::UNow();
+        wxTimeSpan deltaTime = now - m_lastWriteTime;
+        m_lastWriteTime = now;
+        m_lastDrainTime = now.GetValue().GetValue();
+        wxString outputLine = wxString::Format("%s %s %lu %s", now.Format("%H:%M:%S.%l"),
+                                                              deltaTime.Format("%S.%l"),
+                                                              (unsigned long) wxThread::GetCurrentId(),
+                                                              str);
+
+        WriteLine(outputLine);
+    }
+
+    return str;
 }
@@ -38,15 +38,44 @@
 
 #include "logger.h"
 
+#include <atomic>
+#include <deque>
+
+struct DebugLogRing;
+class DebugLogDrainThread;
+
 class DebugLog : public wxFFile, public Logger
 {
 private:
     bool m_bEnabled;
+    bool m_bVerbose;
     wxCriticalSection m_criticalSection;
     wxDateTime m_lastWriteTime;
     wxString m_pPathName;
 
+    // lines are queued in per-thread rings and written out by the drain thread
+    DebugLogDrainThread *m_pDrainThread;
+    wxCriticalSection m_ringsLock;
+    DebugLogRing *m_pRings;
+    unsigned int m_ringCount;
+    DebugLogRing *m_pSharedRing;
+    wxCriticalSection m_sharedRingLock;
+    wxSemaphore m_wakeDrain;
+    wxSemaphore m_flushDone;
+    std::atomic<bool> m_flushRequested;
+    wxLongLong_t m_lastDrainTime;
+    std::string m_drainBuf;
+    wxCriticalSection m_longLinesLock;
+    std::deque<std::string> m_longLines;    // lines too long for a ring, header and payload
+
+    friend class DebugLogDrainThread;
+
     void InitVars(void);
+    DebugLogRing *ThreadRing(void);
+    void Enqueue(const wxString& str);
+    void Drain(void);
+    void DrainLocked(bool emergency);
+    void WriteLine(const wxString& outputLine);
 
 public:
     DebugLog(void);
@@ -60,6 +89,11 @@ public:
     wxString AddBytes(const wxString& str, const unsigned char *pBytes, unsigned count);
     wxString Write(const wxString& str);
     bool Flush(void);
+    void EmergencyFlush(void);
+    void Shutdown(void);
+
+    bool IsVerbose(void) const;
+    void SetVerbose(bool verbose);
 
     bool ChangeDirLog(const wxString& newdir);
     void RemoveOldFiles();
@@ -75,6 +109,20 @@ inline bool DebugLog::IsEnabled(void)
     return m_bEnabled;
 }
 
+inline bool DebugLog::IsVerbose(void) const
+{
+    return m_bEnabled && m_bVerbose;
+}
+
 extern DebugLog Debug;
 
+// High-volume diagnostic lines go through DEBUG_VERBOSE so the message is
+// not even formatted unless verbose debug logging is on. Defining
+// PHD_NO_VERBOSE_DEBUGLOG compiles them out entirely.
+#if defined(PHD_NO_VERBOSE_DEBUGLOG)
+# define DEBUG_VERBOSE(s) do { } while (0)
+#else
+# define DEBUG_VERBOSE(s) do { if (Debug.IsVerbose()) Debug.Write(s); } while (0)
+#endif
+
 #endif
@@ -82,7 +82,7 @@ void MyFrame::OnEEGG(wxCommandEvent& evt)
             cal.pierSide = pPointingSource->SideOfPier();
             cal.raGuideParity = cal.decGuideParity = GUIDE_PARITY_UNCHANGED;
             cal.rotatorAngle = Rotator::RotatorPosition();
-            cal.binning = pCamera->Binning;
+            cal.binning = pCamera->ImageBinning();
             cal.isValid = true;
 
             if (!pMount->IsCalibrated())
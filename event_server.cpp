@@ -36,13 +36,22 @@
 
 #include <wx/sstream.h>
 #include <wx/sckstrm.h>
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <deque>
 #include <sstream>
+#include <vector>
+
+#ifndef __WINDOWS__
+# include <sys/select.h>
+#endif
 
 EventServer EvtServer;
 
 BEGIN_EVENT_TABLE(EventServer, wxEvtHandler)
-    EVT_SOCKET(EVENT_SERVER_ID, EventServer::OnEventServerEvent)
-    EVT_SOCKET(EVENT_SERVER_CLIENT_ID, EventServer::OnEventServerClientEvent)
+    EVT_THREAD(EVENT_SERVER_ID, EventServer::OnEventServerEvent)
+    EVT_THREAD(EVENT_SERVER_CLIENT_ID, EventServer::OnEventServerRequest)
 END_EVENT_TABLE()
 
 enum
@@ -177,6 +186,7 @@ struct NV
     NV(const wxString& n_, JAry& ary) : n(n_), v(ary.str()) { }
     NV(const wxString& n_, JObj& obj) : n(n_), v(obj.str()) { }
     NV(const wxString& n_, const json_value *v_) : n(n_), v(json_format(v_)) { }
+    NV(const wxString& n_, const JsonWriter& w) : n(n_), v(wxString::FromUTF8(w.Data(), w.Size())) { }
     NV(const wxString& n_, const PHD_Point& p) : n(n_) { JAry ary; ary << p.X << p.Y; v = ary.str(); }
     NV(const wxString& n_, const wxPoint& p) : n(n_) { JAry ary; ary << p.x << p.y; v = ary.str(); }
     NV(const wxString& n_, const NULL_TYPE& nul) : n(n_), v(literal_null) { }
@@ -223,12 +233,67 @@ static JAry& operator<<(JAry& a, JObj& j)
     return a << j.str();
 }
 
+enum EventType
+{
+    EV_VERSION,
+    EV_LOCK_POSITION_SET,
+    EV_CALIBRATION_COMPLETE,
+    EV_STAR_SELECTED,
+    EV_START_GUIDING,
+    EV_PAUSED,
+    EV_START_CALIBRATION,
+    EV_APP_STATE,
+    EV_CALIBRATION_FAILED,
+    EV_CALIBRATION_DATA_FLIPPED,
+    EV_LOOPING_EXPOSURES,
+    EV_LOOPING_EXPOSURES_STOPPED,
+    EV_STAR_LOST,
+    EV_GUIDING_STOPPED,
+    EV_RESUMED,
+    EV_GUIDE_STEP,
+    EV_GUIDING_DITHERED,
+    EV_LOCK_POSITION_LOST,
+    EV_SETTLING,
+    EV_SETTLE_DONE,
+    EV_ALERT,
+    EV_GUIDE_PARAM_CHANGE,
+    NUM_EVENT_TYPES
+};
+
+static const char *const s_eventNames[NUM_EVENT_TYPES] =
+{
+    "Version",
+    "LockPositionSet",
+    "CalibrationComplete",
+    "StarSelected",
+    "StartGuiding",
+    "Paused",
+    "StartCalibration",
+    "AppState",
+    "CalibrationFailed",
+    "CalibrationDataFlipped",
+    "LoopingExposures",
+    "LoopingExposuresStopped",
+    "StarLost",
+    "GuidingStopped",
+    "Resumed",
+    "GuideStep",
+    "GuidingDithered",
+    "LockPositionLost",
+    "Settling",
+    "SettleDone",
+    "Alert",
+    "GuideParamChange"
+};
+
 struct Ev : public JObj
 {
-    Ev(const wxString& event)
+    EventType type;
+
+    Ev(EventType type_) : type(type_)
     {
         double const now = ::wxGetUTCTimeMillis().ToDouble() / 1000.0;
-        *this << NV("Event", event)
+        *this << NV("Event", s_eventNames[type])
             << NV("Timestamp", now, 3)
             << NV("Host", wxGetHostName())
             << NV("Inst", pFrame->GetInstanceNumber());
@@ -237,7 +302,7 @@ struct Ev : public JObj
 
 static Ev ev_message_version()
 {
-    Ev ev("Version");
+    Ev ev(EV_VERSION);
     ev << NV("PHDVersion", PHDVERSION)
         << NV("PHDSubver", PHDSUBVER)
         << NV("MsgVersion", MSG_PROTOCOL_VERSION);
@@ -246,14 +311,14 @@ static Ev ev_message_version()
 
 static Ev ev_set_lock_position(const PHD_Point& xy)
 {
-    Ev ev("LockPositionSet");
+    Ev ev(EV_LOCK_POSITION_SET);
     ev << xy;
     return ev;
 }
 
 static Ev ev_calibration_complete(Mount *mount)
 {
-    Ev ev("CalibrationComplete");
+    Ev ev(EV_CALIBRATION_COMPLETE);
     ev << NVMount(mount);
 
     if (mount->IsStepGuider())
@@ -266,50 +331,38 @@ static Ev ev_calibration_complete(Mount *mount)
 
 static Ev ev_star_selected(const PHD_Point& pos)
 {
-    Ev ev("StarSelected");
+    Ev ev(EV_STAR_SELECTED);
     ev << pos;
     return ev;
 }
 
 static Ev ev_start_guiding()
 {
-    return Ev("StartGuiding");
+    return Ev(EV_START_GUIDING);
 }
 
 static Ev ev_paused()
 {
-    return Ev("Paused");
+    return Ev(EV_PAUSED);
 }
 
 static Ev ev_start_calibration(Mount *mount)
 {
-    Ev ev("StartCalibration");
+    Ev ev(EV_START_CALIBRATION);
     ev << NVMount(mount);
     return ev;
 }
 
 static Ev ev_app_state(EXPOSED_STATE st = Guider::GetExposedState())
 {
-    Ev ev("AppState");
+    Ev ev(EV_APP_STATE);
     ev << NV("State", state_name(st));
     return ev;
 }
 
-static Ev ev_settling(double distance, double time, double settleTime, bool starLocked)
-{
-    Ev ev("Settling");
-
-    ev << NV("Distance", distance, 2)
-       << NV("Time", time, 1)
-       << NV("SettleTime", settleTime, 1)
-       << NV("StarLocked", starLocked);
-
-    return ev;
-}
-
 static Ev ev_settle_done(const wxString& errorMsg, int settleFrames, int droppedFrames)
 {
-    Ev ev("SettleDone");
+    Ev ev(EV_SETTLE_DONE);
 
     int status = errorMsg.IsEmpty() ? 0 : 1;
 
@@ -326,97 +379,431 @@ static Ev ev_settle_done(const wxString& errorMsg, int settleFrames, int dropped
     return ev;
 }
 
+// Client input is framed into lines incrementally. Each read appends to the
+// buffer and only the newly received bytes are scanned for a line terminator,
+// so a large batch request arriving in many small reads is never rescanned.
+// The buffer grows as needed; a line still incomplete after MAX_LINE bytes is
+// rejected and discarded through its terminator.
+
 struct ClientReadBuf
 {
-    enum { SIZE = 1024 };
-    char buf[SIZE];
-    char *dest;
+    enum { READ_SIZE = 1024, MAX_LINE = 1024 * 1024 };
+    std::vector<char> buf;
+    size_t len;         // bytes received
+    size_t start;       // start of the current line
+    size_t scanned;     // bytes already checked for a line terminator
+    bool discarding;    // skipping the rest of an oversized line
+
+    ClientReadBuf() : buf(READ_SIZE), len(0), start(0), scanned(0), discarding(false) { }
+
+    char *dest() { return &buf[len]; }
+    size_t avail() const { return buf.size() - len; }
+
+    // make room for at least one more read
+    void reserve()
+    {
+        if (start > 0)
+        {
+            memmove(&buf[0], &buf[start], len - start);
+            len -= start;
+            scanned -= start;
+            start = 0;
+        }
+        if (avail() < READ_SIZE)
+            buf.resize(std::max(buf.size() * 2, len + READ_SIZE));
+    }
+
+    // returns the next complete line, nul-terminated, or NULL if there is none yet
+    char *next_line()
+    {
+        for (; scanned < len; scanned++)
+        {
+            char& c = buf[scanned];
+            if (c == '\r' || c == '\n')
+            {
+                c = 0;
+                char *line = &buf[start];
+                start = ++scanned;
+                return line;
+            }
+        }
+        return 0;
+    }
+
+    void reset() { len = start = scanned = 0; }
+};
+
+// Outbound messages are queued per client and written to the sockets by the
+// event server I/O thread, so a client that does not read its socket cannot
+// stall the main thread. When a client's queue grows past its high-water
+// mark the client's backpressure policy decides what to give up.
+
+enum OutboundKind
+{
+    OUT_RESPONSE,       // never discarded
+    OUT_EVENT,
+    OUT_GUIDESTEP
+};
+
+enum EventQueuePolicy
+{
+    EVQ_COALESCE,       // keep only the latest queued GuideStep event
+    EVQ_DROP_OLDEST,    // discard the oldest queued events
+    EVQ_DISCONNECT      // disconnect the client
+};
+
+enum
+{
+    DEFAULT_HIGH_WATER_KB = 256,
+    COALESCE_HARD_LIMIT = 4,    // coalescing client is disconnected at this many times its high-water mark
+    IO_POLL_MS = 250,           // longest the I/O thread waits if it cannot be woken
+    MAX_EVENT_INTERVAL_MS = 24 * 3600 * 1000    // longest max_rate interval, so it fits the rate check
+};
+
+// what an EVENT_SERVER_ID thread event tells the main thread
+enum
+{
+    SERVER_CLIENT_CONNECT,      // payload: the accepted socket
+    SERVER_CLIENT_LOST          // payload: the ClientData
+};
+
+static const char *const s_policyNames[] = { "coalesce", "drop_oldest", "disconnect" };
+
+struct OutboundMsg
+{
+    std::string data;
+    size_t sent;
+    OutboundKind kind;
+};
+
+// Events a client has subscribed to, with optional rate limits. Only
+// touched on the main thread.
+struct EventFilter
+{
+    std::bitset<NUM_EVENT_TYPES> subscribed;
+    unsigned int minIntervalMs[NUM_EVENT_TYPES];    // 0 = not rate limited
+    wxLongLong lastSent[NUM_EVENT_TYPES];
+
+    EventFilter() { Reset(); }
+
+    void Reset()
+    {
+        subscribed.set();
+        for (int i = 0; i < NUM_EVENT_TYPES; i++)
+        {
+            minIntervalMs[i] = 0;
+            lastSent[i] = wxLongLong();
+        }
+    }
 
-    ClientReadBuf() { reset(); }
-    size_t avail() const { return &buf[SIZE] - dest; }
-    void reset() { dest = &buf[0]; }
+    bool Wants(EventType type, const wxLongLong& now) const
+    {
+        return subscribed[type] && (minIntervalMs[type] == 0 || now - lastSent[type] >= (long) minIntervalMs[type]);
+    }
 };
 
 struct ClientData
 {
-    wxSocketClient *cli;
+    wxSOCKET_T fd;                  // only touched by the I/O thread
     int refcnt;
-    ClientReadBuf rdbuf;
-    wxMutex wrlock;
-
-    ClientData(wxSocketClient *cli_) : cli(cli_), refcnt(1) { }
+    ClientReadBuf rdbuf;            // owned by the I/O thread
+    bool eof;                       // I/O thread saw the connection close or fail
+    wxMutex inlock;                 // guards mainq and mainPending
+    std::deque<std::string> mainq;  // requests waiting for the main thread
+    unsigned int mainPending;       // requests passed to the main thread and not yet answered
+    bool mainBusy;                  // main thread is handling this client's requests
+    wxMutex wrlock;                 // guards the outbound queue and byte counters
+    std::deque<OutboundMsg> outq;
+    size_t queued;                  // bytes in outq not yet written
+    EventQueuePolicy policy;
+    size_t highWater;
+    bool dropping;                  // client is being disconnected
+    unsigned long long bytesQueued;
+    unsigned long long bytesSent;
+    unsigned long long bytesDropped;
+    EventFilter filter;
+
+    ClientData(wxSOCKET_T fd_)
+        : fd(fd_),
+        refcnt(1),
+        eof(false),
+        mainPending(0),
+        mainBusy(false),
+        queued(0),
+        dropping(false),
+        bytesQueued(0),
+        bytesSent(0),
+        bytesDropped(0)
+    {
+        int p = pConfig->Global.GetInt("/Server/EventQueuePolicy", EVQ_COALESCE);
+        policy = p >= EVQ_COALESCE && p <= EVQ_DISCONNECT ? (EventQueuePolicy) p : EVQ_COALESCE;
+        highWater = pConfig->Global.GetInt("/Server/EventQueueHighWaterKB", DEFAULT_HIGH_WATER_KB) * 1024;
+    }
     void AddRef() { ++refcnt; }
     void RemoveRef()
     {
         if (--refcnt == 0)
-        {
-            cli->Destroy();
-            delete this;
-        }
+            delete this;    // the I/O thread closes the socket
     }
 };
 
 struct ClientDataGuard
 {
     ClientData *cd;
-    ClientDataGuard(wxSocketClient *cli) : cd((ClientData *) cli->GetClientData()) { cd->AddRef(); }
+    ClientDataGuard(ClientData *cd_) : cd(cd_) { cd->AddRef(); }
     ~ClientDataGuard() { cd->RemoveRef(); }
     ClientData *operator->() const { return cd; }
 };
 
-inline static wxMutex *client_wrlock(wxSocketClient *cli)
+// The client sockets are owned by an I/O thread that waits on all of them at
+// once. It accepts connections, reads requests and writes the outbound
+// queues, and is the only thread that touches the sockets, so a socket is
+// never closed while it is in use. Requests that can run off the main thread
+// are answered right there; the rest, and new and lost connections, are
+// passed to the main thread with wxThreadEvents.
+
+class EventServerIO : public wxThread
+{
+    wxMutex m_lock;                     // guards m_clients and m_closing, held while servicing clients
+    std::set<ClientData *> m_clients;
+    std::vector<wxSOCKET_T> m_closing;  // sockets of removed clients, closed by this thread
+    wxSOCKET_T m_listener;
+    IoWaker m_waker;
+    JsonParser m_parser;
+    volatile bool m_stop;
+
+    void Accept();
+    void Read(ClientData *cd);
+    bool Write(ClientData *cd);
+    void Lost(ClientData *cd);
+    void Dispatch(ClientData *cd, char *line);
+
+public:
+    EventServerIO(wxSOCKET_T listener) : wxThread(wxTHREAD_JOINABLE), m_listener(listener), m_stop(false) { }
+    ~EventServerIO();
+
+    void AddClient(ClientData *cd);
+    void RemoveClient(ClientData *cd);
+    void Wake() { m_waker.Wake(); }
+    void Stop();
+
+protected:
+    ExitCode Entry();
+};
+
+static EventServerIO *s_io;
+
+// discard queued messages of the given kind that have not been started,
+// oldest first, until at most maxQueued bytes remain; returns bytes discarded
+static size_t discard_queued(ClientData *cd, OutboundKind kind, size_t maxQueued)
+{
+    size_t dropped = 0;
+
+    std::deque<OutboundMsg>::iterator it = cd->outq.begin();
+    while (it != cd->outq.end() && cd->queued > maxQueued)
+    {
+        if (it->sent == 0 && (it->kind == kind || (kind == OUT_EVENT && it->kind == OUT_GUIDESTEP)))
+        {
+            size_t len = it->data.size();
+            cd->queued -= len;
+            dropped += len;
+            it = cd->outq.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    cd->bytesDropped += dropped;
+
+    return dropped;
+}
+
+static void post_client_lost(ClientData *cd)
 {
-    return &((ClientData *) cli->GetClientData())->wrlock;
+    wxThreadEvent *evt = new wxThreadEvent(wxEVT_THREAD, EVENT_SERVER_ID);
+    evt->SetInt(SERVER_CLIENT_LOST);
+    evt->SetPayload(cd);
+    wxQueueEvent(&EvtServer, evt);
 }
 
-static void send_buf(wxSocketClient *client, const wxCharBuffer& buf)
+static void drop_client(ClientData *cd)
 {
-    wxMutexLocker lock(*client_wrlock(client));
-    client->Write(buf.data(), buf.length());
-    if (client->LastWriteCount() != buf.length())
+    // disconnect via the normal connection lost path once the main thread is back in the event loop
+    post_client_lost(cd);
+}
+
+static void send_buf(ClientData *cd, const char *data, size_t len, OutboundKind kind)
+{
+    size_t dropped = 0;
+    bool disconnect = false;
+
     {
-        Debug.Write(wxString::Format("evsrv: cli %p short write %u/%u\n",
-            client, client->LastWriteCount(), (unsigned int) buf.length()));
+        wxMutexLocker lock(cd->wrlock);
+
+        if (cd->dropping)
+            return;
+
+        if (kind != OUT_RESPONSE && cd->queued + len > cd->highWater)
+        {
+            switch (cd->policy)
+            {
+            case EVQ_COALESCE:
+                // older guide steps are superseded by this one; other events are kept up to a hard limit
+                dropped = discard_queued(cd, OUT_GUIDESTEP, 0);
+                if (cd->queued + len > cd->highWater * COALESCE_HARD_LIMIT)
+                    disconnect = true;
+                break;
+
+            case EVQ_DROP_OLDEST:
+                dropped = discard_queued(cd, OUT_EVENT, cd->highWater > len ? cd->highWater - len : 0);
+                if (cd->queued + len > cd->highWater)
+                {
+                    // still no room, drop this one too
+                    cd->bytesDropped += len;
+                    dropped += len;
+                    len = 0;
+                }
+                break;
+
+            case EVQ_DISCONNECT:
+                disconnect = true;
+                break;
+            }
+        }
+
+        if (disconnect)
+        {
+            cd->dropping = true;
+            cd->bytesDropped += cd->queued + len;
+            cd->queued = 0;
+            cd->outq.clear();
+        }
+        else if (len > 0)
+        {
+            cd->outq.push_back(OutboundMsg());
+            OutboundMsg& msg = cd->outq.back();
+            msg.data.assign(data, len);
+            msg.sent = 0;
+            msg.kind = kind;
+            cd->queued += len;
+            cd->bytesQueued += len;
+        }
+    }
+
+    if (disconnect)
+    {
+        Debug.Write(wxString::Format("evsrv: cli %p outbound queue over high-water mark (%u bytes), disconnecting\n",
+            cd, (unsigned int) cd->highWater));
+        drop_client(cd);
+        return;
     }
+
+    if (dropped)
+        Debug.Write(wxString::Format("evsrv: cli %p outbound queue full, dropped %u bytes\n", cd, (unsigned int) dropped));
+
+    if (s_io)
+        s_io->Wake();
+}
+
+static void do_notify1(ClientData *cd, const JAry& ary)
+{
+    wxCharBuffer buf = (JAry(ary).str() + "\r\n").ToUTF8();
+    send_buf(cd, buf.data(), buf.length(), OUT_RESPONSE);
 }
 
-static void do_notify1(wxSocketClient *client, const JAry& ary)
+static void do_notify1(ClientData *cd, const JObj& j)
 {
-    send_buf(client, (JAry(ary).str() + "\r\n").ToUTF8());
+    wxCharBuffer buf = (JObj(j).str() + "\r\n").ToUTF8();
+    send_buf(cd, buf.data(), buf.length(), OUT_RESPONSE);
 }
 
-static void do_notify1(wxSocketClient *client, const JObj& j)
+// check the client filters so that events nobody wants are never built
+static bool any_client_wants(const EventServer::CliSockSet& cli, EventType type)
 {
-    send_buf(client, (JObj(j).str() + "\r\n").ToUTF8());
+    if (cli.empty())
+        return false;
+
+    wxLongLong now = ::wxGetLocalTimeMillis();
+
+    for (EventServer::CliSockSet::const_iterator it = cli.begin();
+        it != cli.end(); ++it)
+    {
+        if ((*it)->filter.Wants(type, now))
+            return true;
+    }
+
+    return false;
 }
 
-static void do_notify(const EventServer::CliSockSet& cli, const JObj& jj)
+static void send_event(const EventServer::CliSockSet& cli, EventType type, const char *data, size_t len, OutboundKind kind)
 {
-    wxCharBuffer buf = (JObj(jj).str() + "\r\n").ToUTF8();
+    wxLongLong now = ::wxGetLocalTimeMillis();
 
     for (EventServer::CliSockSet::const_iterator it = cli.begin();
         it != cli.end(); ++it)
     {
-        send_buf(*it, buf);
+        EventFilter& filter = (*it)->filter;
+        if (filter.Wants(type, now))
+        {
+            filter.lastSent[type] = now;
+            send_buf(*it, data, len, kind);
+        }
     }
 }
 
-inline static void simple_notify(const EventServer::CliSockSet& cli, const wxString& ev)
+static void do_notify(const EventServer::CliSockSet& cli, const Ev& ev, OutboundKind kind = OUT_EVENT)
+{
+    wxCharBuffer buf = (Ev(ev).str() + "\r\n").ToUTF8();
+    send_event(cli, ev.type, buf.data(), buf.length(), kind);
+}
+
+// Events sent every frame are serialized with a JsonWriter straight into a
+// UTF-8 buffer that is reused from one event to the next, skipping the
+// wxString temporaries of JObj and the UTF-8 conversion. Like the rest of
+// the event server this runs on the main thread only.
+
+static JsonWriter s_evWriter;
+static EventType s_evType;
+
+static JsonWriter& begin_event(EventType type)
+{
+    static std::string s_host;
+    if (s_host.empty())
+        s_host = wxGetHostName().utf8_str();
+
+    double const now = ::wxGetUTCTimeMillis().ToDouble() / 1000.0;
+
+    s_evType = type;
+    s_evWriter.Reset();
+    s_evWriter.BeginObject()
+        .Key("Event").String(s_eventNames[type])
+        .Key("Timestamp").Double(now, 3)
+        .Key("Host").String(s_host.data(), s_host.size())
+        .Key("Inst").Int(pFrame->GetInstanceNumber());
+
+    return s_evWriter;
+}
+
+static void notify_event(const EventServer::CliSockSet& cli, JsonWriter& w, OutboundKind kind = OUT_EVENT)
 {
-    if (!cli.empty())
-        do_notify(cli, Ev(ev));
+    w.EndObject().EndLine();
+    send_event(cli, s_evType, w.Data(), w.Size(), kind);
 }
 
-inline static void simple_notify_ev(const EventServer::CliSockSet& cli, const Ev& ev)
+inline static void simple_notify(const EventServer::CliSockSet& cli, EventType type)
 {
-    if (!cli.empty())
-        do_notify(cli, ev);
+    if (any_client_wants(cli, type))
+        do_notify(cli, Ev(type));
 }
 
-#define SIMPLE_NOTIFY(s) simple_notify(m_eventServerClients, s)
-#define SIMPLE_NOTIFY_EV(ev) simple_notify_ev(m_eventServerClients, ev)
+#define SIMPLE_NOTIFY(type) simple_notify(m_eventServerClients, type)
+// ev is only evaluated if some client wants the event
+#define SIMPLE_NOTIFY_EV(type, ev) do { \
+    if (any_client_wants(m_eventServerClients, type)) \
+        do_notify(m_eventServerClients, ev); \
+} while (0)
 
-static void send_catchup_events(wxSocketClient *cli)
+static void send_catchup_events(ClientData *cli)
 {
     EXPOSED_STATE st = Guider::GetExposedState();
 
@@ -455,34 +842,27 @@ static void send_catchup_events(wxSocketClient *cli)
     do_notify1(cli, ev_app_state());
 }
 
-static void destroy_client(wxSocketClient *cli)
-{
-    ClientData *buf = (ClientData *) cli->GetClientData();
-    buf->RemoveRef();
-}
+// traffic of clients that have already disconnected, for GetTrafficStats
+static unsigned long long s_closedBytesQueued;
+static unsigned long long s_closedBytesSent;
+static unsigned long long s_closedBytesDropped;
 
-static void drain_input(wxSocketInputStream& sis)
+static void destroy_client(ClientData *cd)
 {
-    while (sis.CanRead())
-    {
-        char buf[1024];
-        if (sis.Read(buf, sizeof(buf)).LastRead() == 0)
-            break;
-    }
-}
+    Debug.Write(wxString::Format("evsrv: cli %p bytes queued %llu sent %llu dropped %llu\n",
+        cd, cd->bytesQueued, cd->bytesSent, cd->bytesDropped));
 
-static bool find_eol(char *p, size_t len)
-{
-    const char *end = p + len;
-    for (; p < end; p++)
     {
-        if (*p == '\r' || *p == '\n')
-        {
-            *p = 0;
-            return true;
-        }
+        wxMutexLocker lck(cd->wrlock);
+        s_closedBytesQueued += cd->bytesQueued;
+        s_closedBytesSent += cd->bytesSent;
+        s_closedBytesDropped += cd->bytesDropped;
     }
-    return false;
+
+    if (s_io)
+        s_io->RemoveClient(cd);
+
+    cd->RemoveRef();
 }
 
 enum {
@@ -572,6 +952,65 @@ static const json_value *at(const json_value *ary, unsigned int idx)
     } \
 } while (0)
 
+// The METHOD_ANY_THREAD handlers run on the I/O thread and must not touch
+// the guider, which the main thread can change, or replace, at any moment.
+// The main thread publishes what they report in a snapshot instead: when a
+// client connects, after it answers requests, and whenever its event loop
+// goes idle.
+
+struct GuiderSnapshot
+{
+    bool haveGuider;
+    EXPOSED_STATE appState;
+    bool paused;
+    PHD_Point lockPos;
+    int searchRegion;
+    LockPosShiftParams lockShift;
+
+    GuiderSnapshot() : haveGuider(false), appState(EXPOSED_STATE_NONE), paused(false), searchRegion(0)
+    {
+        lockShift.shiftEnabled = false;
+        lockShift.shiftUnits = UNIT_PIXELS;
+        lockShift.shiftIsMountCoords = false;
+    }
+};
+
+static wxMutex s_snapshotLock;
+static GuiderSnapshot s_snapshot;
+
+static void publish_snapshot()
+{
+    GuiderSnapshot snap;
+    Guider *guider = pFrame ? pFrame->pGuider : 0;
+
+    if (guider)
+    {
+        snap.haveGuider = true;
+        snap.appState = Guider::GetExposedState();
+        snap.paused = guider->IsPaused();
+        snap.lockPos = guider->LockPosition();
+        snap.searchRegion = guider->GetSearchRegion();
+        snap.lockShift = guider->GetLockPosShiftParams();
+    }
+
+    wxMutexLocker lck(s_snapshotLock);
+    s_snapshot = snap;
+}
+
+static GuiderSnapshot guider_snapshot()
+{
+    wxMutexLocker lck(s_snapshotLock);
+    return s_snapshot;
+}
+
+#define VERIFY_SNAPSHOT(snap, response) do { \
+    if (!(snap).haveGuider) \
+    { \
+        response << jrpc_error(1, "internal error"); \
+        return; \
+    } \
+} while (0)
+
 static void deselect_star(JObj& response, const json_value *params)
 {
     VERIFY_GUIDER(response);
@@ -834,8 +1273,9 @@ static bool bool_param(const json_value *jv, bool *val)
 
 static void get_paused(JObj& response, const json_value *params)
 {
-    VERIFY_GUIDER(response);
-    response << jrpc_result(pFrame->pGuider->IsPaused());
+    GuiderSnapshot snap = guider_snapshot();
+    VERIFY_SNAPSHOT(snap, response);
+    response << jrpc_result(snap.paused);
 }
 
 static void set_paused(JObj& response, const json_value *params)
@@ -923,17 +1363,16 @@ static void get_pixel_scale(JObj& response, const json_value *params)
 
 static void get_app_state(JObj& response, const json_value *params)
 {
-    EXPOSED_STATE st = Guider::GetExposedState();
-    response << jrpc_result(state_name(st));
+    response << jrpc_result(state_name(guider_snapshot().appState));
 }
 
 static void get_lock_position(JObj& response, const json_value *params)
 {
-    VERIFY_GUIDER(response);
+    GuiderSnapshot snap = guider_snapshot();
+    VERIFY_SNAPSHOT(snap, response);
 
-    const PHD_Point& lockPos = pFrame->pGuider->LockPosition();
-    if (lockPos.IsValid())
-        response << jrpc_result(lockPos);
+    if (snap.lockPos.IsValid())
+        response << jrpc_result(snap.lockPos);
     else
         response << jrpc_result(NULL_VALUE);
 }
@@ -1044,9 +1483,9 @@ static void flip_calibration(JObj& response, const json_value *params)
 
 static void get_lock_shift_enabled(JObj& response, const json_value *params)
 {
-    VERIFY_GUIDER(response);
-    bool enabled = pFrame->pGuider->GetLockPosShiftParams().shiftEnabled;
-    response << jrpc_result(enabled);
+    GuiderSnapshot snap = guider_snapshot();
+    VERIFY_SNAPSHOT(snap, response);
+    response << jrpc_result(snap.lockShift.shiftEnabled);
 }
 
 static void set_lock_shift_enabled(JObj& response, const json_value *params)
@@ -1069,8 +1508,9 @@ static void set_lock_shift_enabled(JObj& response, const json_value *params)
 
 static void get_lock_shift_params(JObj& response, const json_value *params)
 {
-    VERIFY_GUIDER(response);
-    const LockPosShiftParams& lockShift = pFrame->pGuider->GetLockPosShiftParams();
+    GuiderSnapshot snap = guider_snapshot();
+    VERIFY_SNAPSHOT(snap, response);
+    const LockPosShiftParams& lockShift = snap.lockShift;
     JObj rslt;
     rslt << NV("enabled", lockShift.shiftEnabled);
     if (lockShift.shiftRate.IsValid())
@@ -1196,7 +1636,7 @@ static void save_image(JObj& response, const json_value *params)
 {
     VERIFY_GUIDER(response);
 
-    if (!pFrame->pGuider->CurrentImage()->ImageData)
+    if (!pFrame->pGuider->CurrentImage()->HasPixels())
     {
         response << jrpc_error(2, "no image available");
         return;
@@ -1216,6 +1656,41 @@ static void save_image(JObj& response, const json_value *params)
     response << jrpc_result(rslt);
 }
 
+static void get_tracing(JObj& response, const json_value *params)
+{
+    response << jrpc_result(Tracer.Enabled());
+}
+
+static void set_tracing(JObj& response, const json_value *params)
+{
+    Params p("enabled", params);
+    const json_value *val = p.param("enabled");
+    bool enable;
+    if (!val || !bool_param(val, &enable))
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected enabled boolean param");
+        return;
+    }
+
+    bool wasEnabled = Tracer.Enabled();
+    wxString traceFile;
+
+    if (pFrame->EnablePipelineTracing(enable, &traceFile))
+    {
+        response << jrpc_error(1, "could not write trace file");
+        return;
+    }
+
+    if (!enable && wasEnabled)
+    {
+        JObj rslt;
+        rslt << NV("filename", traceFile);
+        response << jrpc_result(rslt);
+    }
+    else
+        response << jrpc_result(0);
+}
+
 static void get_use_subframes(JObj& response, const json_value *params)
 {
     response << jrpc_result(pCamera && pCamera->UseSubframes);
@@ -1223,8 +1698,9 @@ static void get_use_subframes(JObj& response, const json_value *params)
 
 static void get_search_region(JObj& response, const json_value *params)
 {
-    VERIFY_GUIDER(response);
-    response << jrpc_result(pFrame->pGuider->GetSearchRegion());
+    GuiderSnapshot snap = guider_snapshot();
+    VERIFY_SNAPSHOT(snap, response);
+    response << jrpc_result(snap.searchRegion);
 }
 
 struct B64Encode
@@ -1299,7 +1775,7 @@ static void get_star_image(JObj& response, const json_value *params)
     const usImage *img = guider->CurrentImage();
     const PHD_Point& star = guider->CurrentPosition();
 
-    if (guider->GetState() < GUIDER_STATE::STATE_SELECTED || !img->ImageData || !star.IsValid())
+    if (guider->GetState() < GUIDER_STATE::STATE_SELECTED || !img->HasPixels() || !star.IsValid())
     {
         response << jrpc_error(2, "no star selected");
         return;
@@ -1321,8 +1797,19 @@ static void get_star_image(JObj& response, const json_value *params)
     B64Encode enc;
     for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
     {
-        const unsigned short *p = img->ImageData + y * img->Size.GetWidth() + rect.GetLeft();
-        enc.append(p, rect.GetWidth() * sizeof(unsigned short));
+        if (img->Is8Bit())
+        {
+            // the star image is always sent as 16-bit pixels
+            unsigned short row[64];     // width is at most 63
+            const unsigned char *p = &img->Pixel8(rect.GetLeft(), y);
+            std::copy(p, p + width, row);
+            enc.append(row, width * sizeof(unsigned short));
+        }
+        else
+        {
+            const unsigned short *p = &img->Pixel(rect.GetLeft(), y);
+            enc.append(p, rect.GetWidth() * sizeof(unsigned short));
+        }
     }
 
     PHD_Point pos(star);
@@ -1339,6 +1826,108 @@ static void get_star_image(JObj& response, const json_value *params)
     response << jrpc_result(rslt);
 }
 
+static const char *const s_fieldTypeNames[] = { "int32", "float32", "float64" };
+
+// the binary columns are little-endian whatever the host byte order
+static void column_to_little_endian(std::vector<unsigned char>& col, size_t size)
+{
+#if wxBYTE_ORDER == wxBIG_ENDIAN
+    for (size_t i = 0; i + size <= col.size(); i += size)
+        std::reverse(col.begin() + i, col.begin() + i + size);
+#else
+    POSSIBLY_UNUSED(col);
+    POSSIBLY_UNUSED(size);
+#endif
+}
+
+// get_guide_history: since_frame = only the steps after this frame (default all steps of the
+// current guiding session), fields = [names] (default all), binary = true to return each field as
+// base64-encoded packed little-endian values of the field's type instead of an array of numbers
+static void get_guide_history(JObj& response, const json_value *params)
+{
+    Params p("since_frame", "fields", "binary", params);
+
+    int sinceFrame = -1;
+    const json_value *jv = p.param("since_frame");
+    if (jv)
+        sinceFrame = jv->int_value;
+
+    std::vector<GuideStepHistory::Field> fields;
+    jv = p.param("fields");
+    if (jv)
+    {
+        json_for_each (f, jv)
+        {
+            GuideStepHistory::Field field;
+            if (f->type != JSON_STRING || !GuideStepHistory::FieldByName(f->string_value, &field))
+            {
+                response << jrpc_error(JSONRPC_INVALID_PARAMS, "unknown field name in fields param");
+                return;
+            }
+            fields.push_back(field);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < GuideStepHistory::NUM_FIELDS; i++)
+            fields.push_back((GuideStepHistory::Field) i);
+    }
+
+    jv = p.param("binary");
+    bool binary = jv && bool_value(jv);
+
+    std::vector<std::vector<unsigned char> > columns;
+    unsigned int count = GuideHistory.Query(sinceFrame, fields, &columns);
+
+    JsonWriter w;
+    w.BeginObject()
+        .Key("count").Int(count)
+        .Key("fields").BeginObject();
+
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+        const GuideStepHistory::FieldInfo& info = GuideStepHistory::Info(fields[i]);
+        const unsigned char *col = columns[i].empty() ? 0 : &columns[i][0];
+
+        w.Key(info.name);
+
+        if (binary)
+        {
+            column_to_little_endian(columns[i], GuideStepHistory::FieldSize(fields[i]));
+            B64Encode enc;
+            enc.append(col, columns[i].size());
+            std::string data(enc.finish());
+            w.BeginObject()
+                .Key("type").String(s_fieldTypeNames[info.type])
+                .Key("data").String(data.c_str())
+                .EndObject();
+            continue;
+        }
+
+        w.BeginArray();
+        for (unsigned int j = 0; j < count; j++)
+        {
+            switch (info.type)
+            {
+            case GuideStepHistory::FT_INT32:
+                w.Int(((const int *) col)[j]);
+                break;
+            case GuideStepHistory::FT_FLOAT32:
+                w.Double(((const float *) col)[j], info.precision);
+                break;
+            case GuideStepHistory::FT_FLOAT64:
+                w.Double(((const double *) col)[j], info.precision);
+                break;
+            }
+        }
+        w.EndArray();
+    }
+
+    w.EndObject().EndObject();
+
+    response << jrpc_result(w);
+}
+
 static bool parse_settle(SettleParams *settle, const json_value *j, wxString *error)
 {
     bool found_pixels = false, found_time = false, found_timeout = false;
@@ -1518,7 +2107,7 @@ static void get_camera_binning(JObj& response, const json_value *params)
 {
     if (pCamera && pCamera->Connected)
     {
-        int binning = pCamera->Binning;
+        int binning = pCamera->ImageBinning();
         response << jrpc_result(binning);
     }
     else
@@ -1664,97 +2253,360 @@ static void set_algo_param(JObj& response, const json_value *params)
         response << jrpc_error(1, "could not set param");
 }
 
-static void dump_request(const wxSocketClient *cli, const json_value *req)
-{
-    Debug.Write(wxString::Format("evsrv: cli %p request: %s\n", cli, json_format(req)));
-}
-
-static void dump_response(const wxSocketClient *cli, const JRpcResponse& resp)
+static void set_event_queue_policy(ClientData *cd, JObj& response, const json_value *params)
 {
-    Debug.Write(wxString::Format("evsrv: cli %p response: %s\n", cli, const_cast<JRpcResponse&>(resp).str()));
-}
+    Params p("policy", "high_water", params);
+    const json_value *jp = p.param("policy");
+    const json_value *jh = p.param("high_water");
 
-static bool handle_request(const wxSocketClient *cli, JObj& response, const json_value *req)
-{
-    const json_value *method;
-    const json_value *params;
-    const json_value *id;
+    int policy = -1;
+    if (jp && jp->type == JSON_STRING)
+    {
+        for (unsigned int i = 0; i < WXSIZEOF(s_policyNames); i++)
+            if (strcmp(jp->string_value, s_policyNames[i]) == 0)
+                policy = i;
+    }
+    if (jp && policy < 0)
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected policy param: coalesce, drop_oldest or disconnect");
+        return;
+    }
+    if (jh && (jh->type != JSON_INT || jh->int_value < 1024))
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected high_water param of at least 1024 bytes");
+        return;
+    }
 
-    dump_request(cli, req);
+    wxMutexLocker lck(cd->wrlock);
 
-    parse_request(req, &method, &params, &id);
+    if (policy >= 0)
+        cd->policy = (EventQueuePolicy) policy;
+    if (jh)
+        cd->highWater = jh->int_value;
 
-    if (!method)
+    response << jrpc_result(0);
+}
+
+static bool event_type(const char *name, EventType *type)
+{
+    for (int i = 0; i < NUM_EVENT_TYPES; i++)
     {
-        response << jrpc_error(JSONRPC_INVALID_REQUEST, "invalid request") << jrpc_id(0);
-        return true;
+        if (strcmp(name, s_eventNames[i]) == 0)
+        {
+            *type = (EventType) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// set_event_filter: events = [names] subscribes to only those events (omit for all events),
+// max_rate = { name: Hz, ... } limits how often an event is sent (0 = no limit)
+static void set_event_filter(ClientData *cd, JObj& response, const json_value *params)
+{
+    Params p("events", "max_rate", params);
+    const json_value *events = p.param("events");
+    const json_value *rates = p.param("max_rate");
+
+    EventFilter filter;
+
+    if (events)
+    {
+        if (events->type != JSON_ARRAY)
+        {
+            response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected events array param");
+            return;
+        }
+
+        filter.subscribed.reset();
+
+        json_for_each (ev, events)
+        {
+            EventType type;
+            if (ev->type != JSON_STRING || !event_type(ev->string_value, &type))
+            {
+                response << jrpc_error(JSONRPC_INVALID_PARAMS, wxString::Format("unknown event %s", json_format(ev)));
+                return;
+            }
+            filter.subscribed.set(type);
+        }
     }
 
-    static struct {
-        const char *name;
-        void (*fn)(JObj& response, const json_value *params);
-    } methods[] = {
-        { "clear_calibration", &clear_calibration, },
-        { "deselect_star", &deselect_star, },
-        { "get_exposure", &get_exposure, },
-        { "set_exposure", &set_exposure, },
-        { "get_exposure_durations", &get_exposure_durations, },
-        { "get_profiles", &get_profiles, },
-        { "get_profile", &get_profile, },
-        { "set_profile", &set_profile, },
-        { "get_connected", &get_connected, },
-        { "set_connected", &set_connected, },
-        { "get_calibrated", &get_calibrated, },
-        { "get_paused", &get_paused, },
-        { "set_paused", &set_paused, },
-        { "get_lock_position", &get_lock_position, },
-        { "set_lock_position", &set_lock_position, },
-        { "loop", &loop, },
-        { "stop_capture", &stop_capture, },
-        { "guide", &guide, },
-        { "dither", &dither, },
-        { "find_star", &find_star, },
-        { "get_pixel_scale", &get_pixel_scale, },
-        { "get_app_state", &get_app_state, },
-        { "flip_calibration", &flip_calibration, },
-        { "get_lock_shift_enabled", &get_lock_shift_enabled, },
-        { "set_lock_shift_enabled", &set_lock_shift_enabled, },
-        { "get_lock_shift_params", &get_lock_shift_params, },
-        { "set_lock_shift_params", &set_lock_shift_params, },
-        { "save_image", &save_image, },
-        { "get_star_image", &get_star_image, },
-        { "get_use_subframes", &get_use_subframes, },
-        { "get_search_region", &get_search_region, },
-        { "shutdown", &shutdown, },
-        { "get_camera_binning", &get_camera_binning, },
-        { "get_current_equipment", &get_current_equipment, },
-        { "get_guide_output_enabled", &get_guide_output_enabled, },
-        { "set_guide_output_enabled", &set_guide_output_enabled, },
-        { "get_algo_param_names", &get_algo_param_names, },
-        { "get_algo_param", &get_algo_param, },
-        { "set_algo_param", &set_algo_param, },
-    };
-
-    for (unsigned int i = 0; i < WXSIZEOF(methods); i++)
-    {
-        if (strcmp(method->string_value, methods[i].name) == 0)
+    if (rates)
+    {
+        if (rates->type != JSON_OBJECT)
+        {
+            response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected max_rate object param");
+            return;
+        }
+
+        json_for_each (r, rates)
         {
-            (*methods[i].fn)(response, params);
-            if (id)
+            EventType type;
+            if (!event_type(r->name, &type))
             {
-                response << jrpc_id(id);
-                return true;
+                response << jrpc_error(JSONRPC_INVALID_PARAMS, wxString::Format("unknown event %s", r->name));
+                return;
             }
-            else
+            double hz;
+            if (!float_param(r, &hz) || !std::isfinite(hz) || hz < 0.0)
             {
-                return false;
+                response << jrpc_error(JSONRPC_INVALID_PARAMS, wxString::Format("invalid max_rate for %s", r->name));
+                return;
             }
+            // a tiny rate gives an interval too large to convert, clamp it first
+            double intervalMs = hz > 0.0 ? 1000.0 / hz : 0.0;
+            filter.minIntervalMs[type] = intervalMs < MAX_EVENT_INTERVAL_MS ? (unsigned int) intervalMs : MAX_EVENT_INTERVAL_MS;
+        }
+    }
+
+    cd->filter = filter;
+
+    response << jrpc_result(0);
+}
+
+static void get_event_queue_stats(ClientData *cd, JObj& response, const json_value *params)
+{
+    wxMutexLocker lck(cd->wrlock);
+
+    // byte counters are reported as doubles, which are exact well past any realistic session
+    JObj t;
+    t << NV("policy", s_policyNames[cd->policy])
+      << NV("high_water", (int) cd->highWater)
+      << NV("queued", (int) cd->queued)
+      << NV("bytes_queued", (double) cd->bytesQueued, 0)
+      << NV("bytes_sent", (double) cd->bytesSent, 0)
+      << NV("bytes_dropped", (double) cd->bytesDropped, 0);
+
+    response << jrpc_result(t);
+}
+
+static void dump_request(const ClientData *cli, const json_value *req)
+{
+    Debug.Write(wxString::Format("evsrv: cli %p request: %s\n", cli, json_format(req)));
+}
+
+static void dump_response(const ClientData *cli, const JRpcResponse& resp)
+{
+    Debug.Write(wxString::Format("evsrv: cli %p response: %s\n", cli, const_cast<JRpcResponse&>(resp).str()));
+}
+
+// Methods are looked up by binary search in s_methods, which must be kept
+// sorted by name.
+//
+// A method's parameter schema lists its parameters in positional order as
+// "name:type", separated by commas, with a trailing '?' on optional ones.
+// Types are int, number, bool, string, object, array and any. Parameters can
+// be passed by position or by name. Requests with a missing or mistyped
+// parameter are rejected before the handler runs; range checks and the like
+// are left to the handler.
+//
+// Methods flagged METHOD_ANY_THREAD only read state that is safe to read
+// while the main thread runs (the guider snapshot, the guide history, and
+// the like), and are answered directly on the socket I/O thread. All others
+// are passed to the main thread.
+
+enum MethodFlags
+{
+    METHOD_MAIN_THREAD = 0,
+    METHOD_ANY_THREAD = 1
+};
+
+struct JRpcMethod
+{
+    const char *name;
+    const char *params;
+    unsigned int flags;
+    void (*fn)(JObj& response, const json_value *params);
+    void (*clifn)(ClientData *cli, JObj& response, const json_value *params);     // methods that act on the calling client
+};
+
+static const JRpcMethod s_methods[] = {
+    { "clear_calibration", "", METHOD_MAIN_THREAD, &clear_calibration, },     // takes any number of "mount", "ao" or "both"
+    { "deselect_star", "", METHOD_MAIN_THREAD, &deselect_star, },
+    { "dither", "amount:number,raOnly:bool?,settle:object", METHOD_MAIN_THREAD, &dither, },
+    { "find_star", "", METHOD_MAIN_THREAD, &find_star, },
+    { "flip_calibration", "", METHOD_MAIN_THREAD, &flip_calibration, },
+    { "get_algo_param", "axis:string,name:string", METHOD_MAIN_THREAD, &get_algo_param, },
+    { "get_algo_param_names", "axis:string", METHOD_MAIN_THREAD, &get_algo_param_names, },
+    { "get_app_state", "", METHOD_ANY_THREAD, &get_app_state, },
+    { "get_calibrated", "", METHOD_MAIN_THREAD, &get_calibrated, },
+    { "get_camera_binning", "", METHOD_MAIN_THREAD, &get_camera_binning, },
+    { "get_connected", "", METHOD_MAIN_THREAD, &get_connected, },
+    { "get_current_equipment", "", METHOD_MAIN_THREAD, &get_current_equipment, },
+    { "get_event_queue_stats", "", METHOD_ANY_THREAD, 0, &get_event_queue_stats, },
+    { "get_exposure", "", METHOD_MAIN_THREAD, &get_exposure, },
+    { "get_exposure_durations", "", METHOD_ANY_THREAD, &get_exposure_durations, },
+    { "get_guide_history", "since_frame:int?,fields:array?,binary:bool?", METHOD_ANY_THREAD, &get_guide_history, },
+    { "get_guide_output_enabled", "", METHOD_MAIN_THREAD, &get_guide_output_enabled, },
+    { "get_lock_position", "", METHOD_ANY_THREAD, &get_lock_position, },
+    { "get_lock_shift_enabled", "", METHOD_ANY_THREAD, &get_lock_shift_enabled, },
+    { "get_lock_shift_params", "", METHOD_ANY_THREAD, &get_lock_shift_params, },
+    { "get_paused", "", METHOD_ANY_THREAD, &get_paused, },
+    { "get_pixel_scale", "", METHOD_MAIN_THREAD, &get_pixel_scale, },
+    { "get_profile", "", METHOD_MAIN_THREAD, &get_profile, },
+    { "get_profiles", "", METHOD_MAIN_THREAD, &get_profiles, },
+    { "get_search_region", "", METHOD_ANY_THREAD, &get_search_region, },
+    { "get_star_image", "size:int?", METHOD_MAIN_THREAD, &get_star_image, },
+    { "get_tracing", "", METHOD_ANY_THREAD, &get_tracing, },
+    { "get_use_subframes", "", METHOD_MAIN_THREAD, &get_use_subframes, },
+    { "guide", "settle:object,recalibrate:bool?", METHOD_MAIN_THREAD, &guide, },
+    { "loop", "", METHOD_MAIN_THREAD, &loop, },
+    { "save_image", "", METHOD_MAIN_THREAD, &save_image, },
+    { "set_algo_param", "axis:string,name:string,value:number", METHOD_MAIN_THREAD, &set_algo_param, },
+    { "set_connected", "connected:bool", METHOD_MAIN_THREAD, &set_connected, },
+    { "set_event_filter", "events:array?,max_rate:object?", METHOD_MAIN_THREAD, 0, &set_event_filter, },
+    { "set_event_queue_policy", "policy:string?,high_water:int?", METHOD_MAIN_THREAD, 0, &set_event_queue_policy, },
+    { "set_exposure", "exposure:int", METHOD_MAIN_THREAD, &set_exposure, },
+    { "set_guide_output_enabled", "enabled:bool", METHOD_MAIN_THREAD, &set_guide_output_enabled, },
+    { "set_lock_position", "x:number,y:number,exact:bool?", METHOD_MAIN_THREAD, &set_lock_position, },
+    { "set_lock_shift_enabled", "enabled:bool", METHOD_MAIN_THREAD, &set_lock_shift_enabled, },
+    { "set_lock_shift_params", "", METHOD_MAIN_THREAD, &set_lock_shift_params, },     // params may be wrapped in an array, checked by the handler
+    { "set_paused", "paused:bool,type:string?", METHOD_MAIN_THREAD, &set_paused, },
+    { "set_profile", "id:int", METHOD_MAIN_THREAD, &set_profile, },
+    { "set_tracing", "enabled:bool", METHOD_MAIN_THREAD, &set_tracing, },
+    { "shutdown", "", METHOD_MAIN_THREAD, &shutdown, },
+    { "stop_capture", "", METHOD_MAIN_THREAD, &stop_capture, },
+};
+
+static const JRpcMethod *find_method(const char *name)
+{
+    unsigned int lo = 0, hi = WXSIZEOF(s_methods);
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi) / 2;
+        int cmp = strcmp(name, s_methods[mid].name);
+        if (cmp == 0)
+            return &s_methods[mid];
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return 0;
+}
+
+static bool methods_sorted()
+{
+    for (unsigned int i = 1; i < WXSIZEOF(s_methods); i++)
+        if (strcmp(s_methods[i - 1].name, s_methods[i].name) >= 0)
+            return false;
+    return true;
+}
+
+static bool type_is(const char *type, size_t len, const char *name)
+{
+    return strncmp(type, name, len) == 0 && name[len] == 0;
+}
+
+static bool param_type_ok(const char *type, size_t len, const json_value *jv)
+{
+    if (type_is(type, len, "int"))
+        return jv->type == JSON_INT;
+    if (type_is(type, len, "number"))
+        return jv->type == JSON_INT || jv->type == JSON_FLOAT;
+    if (type_is(type, len, "bool"))
+        return jv->type == JSON_BOOL || jv->type == JSON_INT;     // same as bool_param
+    if (type_is(type, len, "string"))
+        return jv->type == JSON_STRING;
+    if (type_is(type, len, "object"))
+        return jv->type == JSON_OBJECT;
+    if (type_is(type, len, "array"))
+        return jv->type == JSON_ARRAY;
+    return true;
+}
+
+static const json_value *named_param(const json_value *params, const char *name, size_t len)
+{
+    json_for_each (jv, params)
+    {
+        if (jv->name && strncmp(jv->name, name, len) == 0 && jv->name[len] == 0)
+            return jv;
+    }
+    return 0;
+}
+
+static bool check_params(const char *schema, const json_value *params, wxString *error)
+{
+    const char *p = schema;
+    for (unsigned int idx = 0; *p; idx++)
+    {
+        const char *end = strchr(p, ',');
+        if (!end)
+            end = p + strlen(p);
+
+        const char *name = p;
+        const char *type = strchr(p, ':') + 1;
+        size_t namelen = type - 1 - name;
+        size_t typelen = end - type;
+        bool optional = end[-1] == '?';
+        if (optional)
+            --typelen;
+
+        p = *end ? end + 1 : end;
+
+        const json_value *jv = 0;
+        if (params && params->type == JSON_ARRAY)
+            jv = at(params, idx);
+        else if (params && params->type == JSON_OBJECT)
+            jv = named_param(params, name, namelen);
+
+        if (!jv)
+        {
+            if (optional)
+                continue;
+            *error = wxString::Format("expected %.*s param", (int) namelen, name);
+            return false;
+        }
+
+        if (!param_type_ok(type, typelen, jv))
+        {
+            *error = wxString::Format("expected %.*s param of type %.*s", (int) namelen, name, (int) typelen, type);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool handle_request(ClientData *cli, JObj& response, const json_value *req)
+{
+    const json_value *method;
+    const json_value *params;
+    const json_value *id;
+
+    dump_request(cli, req);
+
+    parse_request(req, &method, &params, &id);
+
+    if (!method)
+    {
+        response << jrpc_error(JSONRPC_INVALID_REQUEST, "invalid request") << jrpc_id(0);
+        return true;
+    }
+
+    const JRpcMethod *m = find_method(method->string_value);
+
+    if (!m)
+    {
+        if (id)
+        {
+            response << jrpc_error(JSONRPC_METHOD_NOT_FOUND, "method not found") << jrpc_id(id);
+            return true;
         }
+        return false;
     }
 
+    wxString err;
+    if (!check_params(m->params, params, &err))
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, err);
+    else if (m->fn)
+        (*m->fn)(response, params);
+    else
+        (*m->clifn)(cli, response, params);
+
     if (id)
     {
-        response << jrpc_error(JSONRPC_METHOD_NOT_FOUND, "method not found") << jrpc_id(id);
+        response << jrpc_id(id);
         return true;
     }
     else
@@ -1763,19 +2615,43 @@ static bool handle_request(const wxSocketClient *cli, JObj& response, const json
     }
 }
 
-static void handle_cli_input_complete(wxSocketClient *cli, char *input, JsonParser& parser)
+// true if the request can be answered on the socket I/O thread
+static bool any_thread_request(const json_value *req)
 {
-    if (!parser.Parse(input))
+    const json_value *method;
+    const json_value *params;
+    const json_value *id;
+
+    parse_request(req, &method, &params, &id);
+
+    // invalid requests and unknown methods only produce an error response
+    const JRpcMethod *m = method ? find_method(method->string_value) : 0;
+    return !m || (m->flags & METHOD_ANY_THREAD) != 0;
+}
+
+static bool any_thread_input(const json_value *root)
+{
+    if (root->type != JSON_ARRAY)
+        return any_thread_request(root);
+
+    json_for_each (req, root)
     {
-        JRpcResponse response;
-        response << jrpc_error(JSONRPC_PARSE_ERROR, parser_error(parser)) << jrpc_id(0);
-        dump_response(cli, response);
-        do_notify1(cli, response);
-        return;
+        if (!any_thread_request(req))
+            return false;
     }
+    return true;
+}
 
-    const json_value *root = parser.Root();
+static void handle_parse_error(ClientData *cli, const JsonParser& parser)
+{
+    JRpcResponse response;
+    response << jrpc_error(JSONRPC_PARSE_ERROR, parser_error(parser)) << jrpc_id(0);
+    dump_response(cli, response);
+    do_notify1(cli, response);
+}
 
+static void handle_json_input(ClientData *cli, const json_value *root)
+{
     if (root->type == JSON_ARRAY)
     {
         // a batch request
@@ -1811,49 +2687,272 @@ static void handle_cli_input_complete(wxSocketClient *cli, char *input, JsonPars
     }
 }
 
-static void handle_cli_input(wxSocketClient *cli, JsonParser& parser)
+static void handle_cli_input_complete(ClientData *cli, char *input, JsonParser& parser)
 {
-    // Bump refcnt to protect against reentrancy.
-    //
-    // Some functions like set_connected can cause the event loop to run reentrantly. If the
-    // client disconnects before the response is sent and a socket disconnect event is
-    // dispatched the client data could be destroyed before we respond.
+    if (!parser.Parse(input))
+    {
+        handle_parse_error(cli, parser);
+        return;
+    }
 
-    ClientDataGuard clidata(cli);
+    handle_json_input(cli, parser.Root());
+}
 
-    ClientReadBuf *rdbuf = &clidata->rdbuf;
+EventServerIO::~EventServerIO()
+{
+    for (size_t i = 0; i < m_closing.size(); i++)
+        IoSocket::Close(m_closing[i]);
+    IoSocket::Close(m_listener);
+}
 
-    wxSocketInputStream sis(*cli);
-    size_t avail = rdbuf->avail();
+void EventServerIO::AddClient(ClientData *cd)
+{
+    {
+        wxMutexLocker lck(m_lock);
+        m_clients.insert(cd);
+    }
+    Wake();
+}
 
-    while (sis.CanRead())
+// once this returns the I/O thread no longer touches the client; it closes
+// the socket the next time round its loop
+void EventServerIO::RemoveClient(ClientData *cd)
+{
     {
-        if (avail == 0)
-        {
-            drain_input(sis);
+        wxMutexLocker lck(m_lock);
+        if (m_clients.erase(cd))
+            m_closing.push_back(cd->fd);
+    }
+    Wake();
+}
+
+void EventServerIO::Stop()
+{
+    m_stop = true;
+    Wake();
+    Wait();
+}
+
+// accepted connections are handed to the main thread, which sends the
+// catchup events and then gives the client back to us with AddClient
+void EventServerIO::Accept()
+{
+    wxSOCKET_T fd;
+    while ((fd = IoSocket::Accept(m_listener)) != INVALID_IO_SOCKET)
+    {
+        wxThreadEvent *evt = new wxThreadEvent(wxEVT_THREAD, EVENT_SERVER_ID);
+        evt->SetInt(SERVER_CLIENT_CONNECT);
+        evt->SetPayload(fd);
+        wxQueueEvent(&EvtServer, evt);
+    }
+}
+
+// the main thread removes the client when it gets the event
+void EventServerIO::Lost(ClientData *cd)
+{
+    cd->eof = true;
+    post_client_lost(cd);
+}
+
+// hand a request to the main thread; requests are answered in the order received
+static void queue_for_main_thread(ClientData *cd, const char *line)
+{
+    {
+        wxMutexLocker lck(cd->inlock);
+        cd->mainq.push_back(line);
+        ++cd->mainPending;
+    }
+
+    wxThreadEvent *evt = new wxThreadEvent(wxEVT_THREAD, EVENT_SERVER_CLIENT_ID);
+    evt->SetPayload(cd);
+    wxQueueEvent(&EvtServer, evt);
+}
+
+void EventServerIO::Dispatch(ClientData *cd, char *line)
+{
+    bool pending;
+    {
+        wxMutexLocker lck(cd->inlock);
+        pending = cd->mainPending > 0;
+    }
+
+    // only this thread adds to mainPending, so once it is zero it stays zero
+    // until we queue something
+
+    if (pending)
+    {
+        queue_for_main_thread(cd, line);
+        return;
+    }
+
+    std::string req(line);  // the parser modifies its input
+
+    if (!m_parser.Parse(line))
+    {
+        handle_parse_error(cd, m_parser);
+        return;
+    }
+
+    if (any_thread_input(m_parser.Root()))
+        handle_json_input(cd, m_parser.Root());
+    else
+        queue_for_main_thread(cd, req.c_str());
+}
 
+void EventServerIO::Read(ClientData *cd)
+{
+    ClientReadBuf *rdbuf = &cd->rdbuf;
+
+    rdbuf->reserve();
+
+    int n = IoSocket::Read(cd->fd, rdbuf->dest(), rdbuf->avail());
+    if (n <= 0)
+    {
+        if (n < 0)
+            Lost(cd);
+        return;
+    }
+    rdbuf->len += n;
+
+    char *line;
+    while ((line = rdbuf->next_line()) != 0)
+    {
+        if (rdbuf->discarding)
+            rdbuf->discarding = false;
+        else if (*line)
+            Dispatch(cd, line);
+    }
+
+    if (rdbuf->start == rdbuf->len)
+        rdbuf->reset();
+    else if (rdbuf->len - rdbuf->start > ClientReadBuf::MAX_LINE)
+    {
+        if (!rdbuf->discarding)
+        {
             JRpcResponse response;
             response << jrpc_error(JSONRPC_INTERNAL_ERROR, "too big") << jrpc_id(0);
-            do_notify1(cli, response);
+            do_notify1(cd, response);
+            rdbuf->discarding = true;
+        }
+        rdbuf->reset();
+    }
+}
 
-            rdbuf->reset();
-            break;
+// write as much of the client's queue as the socket will take without
+// blocking; returns true if data remains queued
+bool EventServerIO::Write(ClientData *cd)
+{
+    bool failed = false;
+    bool pending;
+
+    {
+        wxMutexLocker lck(cd->wrlock);
+
+        while (!cd->outq.empty())
+        {
+            OutboundMsg& msg = cd->outq.front();
+
+            int n = IoSocket::Write(cd->fd, msg.data.data() + msg.sent, msg.data.size() - msg.sent);
+            if (n < 0)
+            {
+                Debug.Write(wxString::Format("evsrv: cli %p write error %d, discarding %u bytes\n",
+                    cd, IoSocket::LastError(), (unsigned int) cd->queued));
+                cd->bytesDropped += cd->queued;
+                cd->queued = 0;
+                cd->outq.clear();
+                failed = true;
+                break;
+            }
+
+            msg.sent += n;
+            cd->queued -= n;
+            cd->bytesSent += n;
+
+            if (msg.sent < msg.data.size())
+                break;
+
+            cd->outq.pop_front();
         }
-        size_t n = sis.Read(rdbuf->dest, avail).LastRead();
-        if (n == 0)
-            break;
 
-        if (find_eol(rdbuf->dest, n))
+        pending = !cd->outq.empty();
+    }
+
+    if (failed)
+        Lost(cd);
+
+    return pending;
+}
+
+wxThread::ExitCode EventServerIO::Entry()
+{
+    while (!m_stop)
+    {
+        fd_set rfds;
+        fd_set wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+
+        FD_SET(m_listener, &rfds);
+        wxSOCKET_T maxfd = m_listener;
+
+        if (m_waker.Ok())
         {
-            drain_input(sis);
-            handle_cli_input_complete(cli, &rdbuf->buf[0], parser);
-            rdbuf->reset();
-            break;
+            FD_SET(m_waker.Fd(), &rfds);
+            maxfd = std::max(maxfd, m_waker.Fd());
         }
 
-        rdbuf->dest += n;
-        avail -= n;
+        {
+            wxMutexLocker lck(m_lock);
+
+            // sockets are only closed here, never while select() may be waiting on them
+            for (size_t i = 0; i < m_closing.size(); i++)
+                IoSocket::Close(m_closing[i]);
+            m_closing.clear();
+
+            for (std::set<ClientData *>::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+            {
+                ClientData *cd = *it;
+                if (cd->eof)
+                    continue;
+                // send what we can now and wait for room for the rest
+                if (Write(cd))
+                    FD_SET(cd->fd, &wfds);
+                if (cd->eof)
+                    continue;
+                FD_SET(cd->fd, &rfds);
+                maxfd = std::max(maxfd, cd->fd);
+            }
+        }
+
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = IO_POLL_MS * 1000;
+
+        int ret = select((int) maxfd + 1, &rfds, &wfds, 0, &tv);
+        if (ret < 0)
+        {
+            Debug.Write(wxString::Format("evsrv: select failed, error %d\n", IoSocket::LastError()));
+            wxMilliSleep(IO_POLL_MS);
+            continue;
+        }
+        if (ret == 0)
+            continue;
+
+        if (m_waker.Ok() && FD_ISSET(m_waker.Fd(), &rfds))
+            m_waker.Drain();
+
+        if (FD_ISSET(m_listener, &rfds))
+            Accept();
+
+        wxMutexLocker lck(m_lock);
+        for (std::set<ClientData *>::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+        {
+            if (!(*it)->eof && FD_ISSET((*it)->fd, &rfds))
+                Read(*it);
+        }
     }
+
+    return 0;
 }
 
 EventServer::EventServer()
@@ -1866,28 +2965,34 @@ EventServer::~EventServer()
 
 bool EventServer::EventServerStart(unsigned int instanceId)
 {
-    if (m_serverSocket)
+    if (s_io)
     {
         Debug.AddLine("attempt to start event server when it is already started?");
         return false;
     }
 
     unsigned int port = 4400 + instanceId - 1;
-    wxIPV4address eventServerAddr;
-    eventServerAddr.Service(port);
-    m_serverSocket = new wxSocketServer(eventServerAddr);
+    wxSOCKET_T listener = IoSocket::Listen(port);
 
-    if (!m_serverSocket->Ok())
+    if (listener == INVALID_IO_SOCKET)
     {
         Debug.Write(wxString::Format("Event server failed to start - Could not listen at port %u\n", port));
-        delete m_serverSocket;
-        m_serverSocket = NULL;
         return true;
     }
 
-    m_serverSocket->SetEventHandler(*this, EVENT_SERVER_ID);
-    m_serverSocket->SetNotify(wxSOCKET_CONNECTION_FLAG);
-    m_serverSocket->Notify(true);
+    if (!methods_sorted())
+        Debug.AddLine("evsrv: method table is not sorted, some methods will not be found");
+
+    s_io = new EventServerIO(listener);     // closes the listener when deleted
+    if (s_io->Create() != wxTHREAD_NO_ERROR || s_io->Run() != wxTHREAD_NO_ERROR)
+    {
+        Debug.AddLine("Event server failed to start - could not start I/O thread");
+        delete s_io;
+        s_io = NULL;
+        return true;
+    }
+
+    wxTheApp->Bind(wxEVT_IDLE, &EventServer::OnIdle, this);
 
     Debug.Write(wxString::Format("event server started, listening on port %u\n", port));
 
@@ -1896,9 +3001,11 @@ bool EventServer::EventServerStart(unsigned int instanceId)
 
 void EventServer::EventServerStop()
 {
-    if (!m_serverSocket)
+    if (!s_io)
         return;
 
+    wxTheApp->Unbind(wxEVT_IDLE, &EventServer::OnIdle, this);
+
     for (CliSockSet::const_iterator it = m_eventServerClients.begin();
          it != m_eventServerClients.end(); ++it)
     {
@@ -1906,72 +3013,139 @@ void EventServer::EventServerStop()
     }
     m_eventServerClients.clear();
 
-    delete m_serverSocket;
-    m_serverSocket = NULL;
+    s_io->Stop();
+    delete s_io;
+    s_io = NULL;
 
     Debug.AddLine("event server stopped");
 }
 
-void EventServer::OnEventServerEvent(wxSocketEvent& event)
+void EventServer::GetTrafficStats(unsigned int *clients, unsigned long long *queued, unsigned long long *sent,
+    unsigned long long *dropped)
 {
-    wxSocketServer *server = static_cast<wxSocketServer *>(event.GetSocket());
+    *clients = m_eventServerClients.size();
+    *queued = s_closedBytesQueued;
+    *sent = s_closedBytesSent;
+    *dropped = s_closedBytesDropped;
 
-    if (event.GetSocketEvent() != wxSOCKET_CONNECTION)
-        return;
+    for (CliSockSet::const_iterator it = m_eventServerClients.begin();
+         it != m_eventServerClients.end(); ++it)
+    {
+        ClientData *cd = *it;
+        wxMutexLocker lck(cd->wrlock);
+        *queued += cd->bytesQueued;
+        *sent += cd->bytesSent;
+        *dropped += cd->bytesDropped;
+    }
+}
 
-    wxSocketClient *client = static_cast<wxSocketClient *>(server->Accept(false));
+void EventServer::OnEventServerEvent(wxThreadEvent& event)
+{
+    if (event.GetInt() == SERVER_CLIENT_CONNECT)
+    {
+        wxSOCKET_T fd = event.GetPayload<wxSOCKET_T>();
 
-    if (!client)
-        return;
+        if (!s_io)
+        {
+            // the server was stopped before we got here
+            IoSocket::Close(fd);
+            return;
+        }
+
+        ClientData *cd = new ClientData(fd);
 
-    Debug.Write(wxString::Format("evsrv: cli %p connect\n", client));
+        Debug.Write(wxString::Format("evsrv: cli %p connect\n", cd));
 
-    client->SetEventHandler(*this, EVENT_SERVER_CLIENT_ID);
-    client->SetNotify(wxSOCKET_LOST_FLAG | wxSOCKET_INPUT_FLAG);
-    client->SetFlags(wxSOCKET_NOWAIT);
-    client->Notify(true);
-    client->SetClientData(new ClientData(client));
+        // queued before the I/O thread reads anything from the client
+        send_catchup_events(cd);
+        publish_snapshot();
 
-    send_catchup_events(client);
+        m_eventServerClients.insert(cd);
+        s_io->AddClient(cd);
+    }
+    else
+    {
+        ClientData *cd = event.GetPayload<ClientData *>();
 
-    m_eventServerClients.insert(client);
+        if (m_eventServerClients.find(cd) == m_eventServerClients.end())
+        {
+            // a client we already disconnected
+            Debug.Write(wxString::Format("evsrv: ignoring connection lost for cli %p not in client set\n", cd));
+            return;
+        }
+
+        Debug.Write(wxString::Format("evsrv: cli %p disconnect\n", cd));
+
+        m_eventServerClients.erase(cd);
+
+        destroy_client(cd);
+    }
 }
 
-void EventServer::OnEventServerClientEvent(wxSocketEvent& event)
+// requests the I/O thread could not answer itself
+void EventServer::OnEventServerRequest(wxThreadEvent& event)
 {
-    wxSocketClient *cli = static_cast<wxSocketClient *>(event.GetSocket());
+    ClientData *cli = event.GetPayload<ClientData *>();
 
-    if (event.GetSocketEvent() == wxSOCKET_LOST)
-    {
-        Debug.Write(wxString::Format("evsrv: cli %p disconnect\n", cli));
+    if (m_eventServerClients.find(cli) == m_eventServerClients.end())
+        return; // client disconnected
+
+    // Bump refcnt to protect against reentrancy.
+    //
+    // Some functions like set_connected can cause the event loop to run reentrantly. If the
+    // client disconnects before the response is sent and a connection lost event is
+    // dispatched the client data could be destroyed before we respond.
 
-        unsigned int const n = m_eventServerClients.erase(cli);
-        if (n != 1)
-            Debug.AddLine("client disconnected but not present in client set!");
+    ClientDataGuard clidata(cli);
 
-        destroy_client(cli);
-    }
-    else if (event.GetSocketEvent() == wxSOCKET_INPUT)
-    {
-        handle_cli_input(cli, m_parser);
-    }
-    else
+    // a reentrant call leaves the client's requests to the outer call so
+    // they are answered in order
+    if (clidata->mainBusy)
+        return;
+    clidata->mainBusy = true;
+
+    while (true)
     {
-        Debug.Write(wxString::Format("unexpected client socket event %d\n", event.GetSocketEvent()));
+        std::string req;
+        {
+            wxMutexLocker lck(clidata->inlock);
+            if (clidata->mainq.empty())
+                break;
+            req.swap(clidata->mainq.front());
+            clidata->mainq.pop_front();
+        }
+
+        handle_cli_input_complete(cli, &req[0], m_parser);
+
+        wxMutexLocker lck(clidata->inlock);
+        --clidata->mainPending;
     }
+
+    clidata->mainBusy = false;
+
+    // the requests may have changed what the I/O thread reports
+    publish_snapshot();
+}
+
+void EventServer::OnIdle(wxIdleEvent& event)
+{
+    event.Skip();
+
+    if (!m_eventServerClients.empty())
+        publish_snapshot();
 }
 
 void EventServer::NotifyStartCalibration(Mount *mount)
 {
-    SIMPLE_NOTIFY_EV(ev_start_calibration(mount));
+    SIMPLE_NOTIFY_EV(EV_START_CALIBRATION, ev_start_calibration(mount));
 }
 
 void EventServer::NotifyCalibrationFailed(Mount *mount, const wxString& msg)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_CALIBRATION_FAILED))
         return;
 
-    Ev ev("CalibrationFailed");
+    Ev ev(EV_CALIBRATION_FAILED);
     ev << NVMount(mount) << NV("Reason", msg);
 
     do_notify(m_eventServerClients, ev);
@@ -1979,7 +3153,7 @@ void EventServer::NotifyCalibrationFailed(Mount *mount, const wxString& msg)
 
 void EventServer::NotifyCalibrationComplete(Mount *mount)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_CALIBRATION_COMPLETE))
         return;
 
     do_notify(m_eventServerClients, ev_calibration_complete(mount));
@@ -1987,10 +3161,10 @@ void EventServer::NotifyCalibrationComplete(Mount *mount)
 
 void EventServer::NotifyCalibrationDataFlipped(Mount *mount)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_CALIBRATION_DATA_FLIPPED))
         return;
 
-    Ev ev("CalibrationDataFlipped");
+    Ev ev(EV_CALIBRATION_DATA_FLIPPED);
     ev << NVMount(mount);
 
     do_notify(m_eventServerClients, ev);
@@ -1998,123 +3172,129 @@ void EventServer::NotifyCalibrationDataFlipped(Mount *mount)
 
 void EventServer::NotifyLooping(unsigned int exposure)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_LOOPING_EXPOSURES))
         return;
 
-    Ev ev("LoopingExposures");
-    ev << NV("Frame", (int) exposure);
+    JsonWriter& ev = begin_event(EV_LOOPING_EXPOSURES);
+    ev.Key("Frame").Int((int) exposure);
 
-    do_notify(m_eventServerClients, ev);
+    notify_event(m_eventServerClients, ev);
 }
 
 void EventServer::NotifyLoopingStopped()
 {
-    SIMPLE_NOTIFY("LoopingExposuresStopped");
+    SIMPLE_NOTIFY(EV_LOOPING_EXPOSURES_STOPPED);
 }
 
 void EventServer::NotifyStarSelected(const PHD_Point& pt)
 {
-    SIMPLE_NOTIFY_EV(ev_star_selected(pt));
+    SIMPLE_NOTIFY_EV(EV_STAR_SELECTED, ev_star_selected(pt));
 }
 
 void EventServer::NotifyStarLost(const FrameDroppedInfo& info)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_STAR_LOST))
         return;
 
-    Ev ev("StarLost");
+    JsonWriter& ev = begin_event(EV_STAR_LOST);
 
-    ev << NV("Frame", info.frameNumber)
-       << NV("Time", info.time, 3)
-       << NV("StarMass", info.starMass, 0)
-       << NV("SNR", info.starSNR, 2)
-       << NV("AvgDist", info.avgDist, 2);
+    ev.Key("Frame").Int(info.frameNumber)
+      .Key("Time").Double(info.time, 3)
+      .Key("StarMass").Double(info.starMass, 0)
+      .Key("SNR").Double(info.starSNR, 2)
+      .Key("AvgDist").Double(info.avgDist, 2);
 
     if (info.starError)
-        ev << NV("ErrorCode", info.starError);
+        ev.Key("ErrorCode").Int(info.starError);
 
     if (!info.status.IsEmpty())
-        ev << NV("Status", info.status);
+        ev.Key("Status").String(info.status.wc_str());
 
-    do_notify(m_eventServerClients, ev);
+    notify_event(m_eventServerClients, ev);
 }
 
 void EventServer::NotifyStartGuiding()
 {
-    SIMPLE_NOTIFY_EV(ev_start_guiding());
+    SIMPLE_NOTIFY_EV(EV_START_GUIDING, ev_start_guiding());
 }
 
 void EventServer::NotifyGuidingStopped()
 {
-    SIMPLE_NOTIFY("GuidingStopped");
+    SIMPLE_NOTIFY(EV_GUIDING_STOPPED);
 }
 
 void EventServer::NotifyPaused()
 {
-    SIMPLE_NOTIFY_EV(ev_paused());
+    SIMPLE_NOTIFY_EV(EV_PAUSED, ev_paused());
 }
 
 void EventServer::NotifyResumed()
 {
-    SIMPLE_NOTIFY("Resumed");
+    SIMPLE_NOTIFY(EV_RESUMED);
 }
 
 void EventServer::NotifyGuideStep(const GuideStepInfo& step)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_GUIDE_STEP))
         return;
 
-    Ev ev("GuideStep");
+    JsonWriter& ev = begin_event(EV_GUIDE_STEP);
 
-    ev << NV("Frame", step.frameNumber)
-       << NV("Time", step.time, 3)
-       << NVMount(step.mount)
-       << NV("dx", step.cameraOffset.X, 3)
-       << NV("dy", step.cameraOffset.Y, 3)
-       << NV("RADistanceRaw", step.mountOffset.X, 3)
-       << NV("DECDistanceRaw", step.mountOffset.Y, 3)
-       << NV("RADistanceGuide", step.guideDistanceRA, 3)
-       << NV("DECDistanceGuide", step.guideDistanceDec, 3);
+    ev.Key("Frame").Int(step.frameNumber)
+      .Key("Time").Double(step.time, 3)
+      .Key("Mount").String(step.mount->Name().wc_str())
+      .Key("dx").Double(step.cameraOffset.X, 3)
+      .Key("dy").Double(step.cameraOffset.Y, 3)
+      .Key("RADistanceRaw").Double(step.mountOffset.X, 3)
+      .Key("DECDistanceRaw").Double(step.mountOffset.Y, 3)
+      .Key("RADistanceGuide").Double(step.guideDistanceRA, 3)
+      .Key("DECDistanceGuide").Double(step.guideDistanceDec, 3);
 
     if (step.durationRA > 0)
     {
-       ev << NV("RADuration", step.durationRA)
-          << NV("RADirection", step.mount->DirectionStr((GUIDE_DIRECTION)step.directionRA));
+        ev.Key("RADuration").Int(step.durationRA)
+          .Key("RADirection").String(step.mount->DirectionStr((GUIDE_DIRECTION)step.directionRA));
     }
 
     if (step.durationDec > 0)
     {
-        ev << NV("DECDuration", step.durationDec)
-           << NV("DECDirection", step.mount->DirectionStr((GUIDE_DIRECTION)step.directionDec));
+        ev.Key("DECDuration").Int(step.durationDec)
+          .Key("DECDirection").String(step.mount->DirectionStr((GUIDE_DIRECTION)step.directionDec));
     }
 
     if (step.mount->IsStepGuider())
     {
-        ev << NV("Pos", step.aoPos);
+        ev.Key("Pos").BeginArray().Int(step.aoPos.x).Int(step.aoPos.y).EndArray();
     }
 
-    ev << NV("StarMass", step.starMass, 0)
-       << NV("SNR", step.starSNR, 2)
-       << NV("AvgDist", step.avgDist, 2);
+    ev.Key("StarMass").Double(step.starMass, 0)
+      .Key("SNR").Double(step.starSNR, 2)
+      .Key("AvgDist").Double(step.avgDist, 2);
+
+    if (step.starFWHM > 0.0)
+    {
+        ev.Key("FWHM").Double(step.starFWHM, 2)
+          .Key("Ellipticity").Double(step.starEllipticity, 3);
+    }
 
     if (step.starError)
-       ev << NV("ErrorCode", step.starError);
+        ev.Key("ErrorCode").Int(step.starError);
 
     if (step.raLimited)
-        ev << NV("RALimited", true);
+        ev.Key("RALimited").Bool(true);
 
     if (step.decLimited)
-        ev << NV("DecLimited", true);
+        ev.Key("DecLimited").Bool(true);
 
-    do_notify(m_eventServerClients, ev);
+    notify_event(m_eventServerClients, ev, OUT_GUIDESTEP);
 }
 
 void EventServer::NotifyGuidingDithered(double dx, double dy)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_GUIDING_DITHERED))
         return;
 
-    Ev ev("GuidingDithered");
+    Ev ev(EV_GUIDING_DITHERED);
     ev << NV("dx", dx, 3) << NV("dy", dy, 3);
 
     do_notify(m_eventServerClients, ev);
@@ -2122,7 +3302,7 @@ void EventServer::NotifyGuidingDithered(double dx, double dy)
 
 void EventServer::NotifySetLockPosition(const PHD_Point& xy)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_LOCK_POSITION_SET))
         return;
 
     do_notify(m_eventServerClients, ev_set_lock_position(xy));
@@ -2130,12 +3310,12 @@ void EventServer::NotifySetLockPosition(const PHD_Point& xy)
 
 void EventServer::NotifyLockPositionLost()
 {
-    SIMPLE_NOTIFY("LockPositionLost");
+    SIMPLE_NOTIFY(EV_LOCK_POSITION_LOST);
 }
 
 void EventServer::NotifyAppState()
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_APP_STATE))
         return;
 
     do_notify(m_eventServerClients, ev_app_state());
@@ -2143,19 +3323,25 @@ void EventServer::NotifyAppState()
 
 void EventServer::NotifySettling(double distance, double time, double settleTime, bool starLocked)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_SETTLING))
         return;
 
-    Ev ev(ev_settling(distance, time, settleTime, starLocked));
+    JsonWriter& ev = begin_event(EV_SETTLING);
 
-    Debug.Write(wxString::Format("evsrv: %s\n", ev.str()));
+    ev.Key("Distance").Double(distance, 2)
+      .Key("Time").Double(time, 1)
+      .Key("SettleTime").Double(settleTime, 1)
+      .Key("StarLocked").Bool(starLocked);
 
-    do_notify(m_eventServerClients, ev);
+    notify_event(m_eventServerClients, ev);
+
+    // the event ends with CRLF
+    Debug.Write(wxString::Format("evsrv: %.*s\n", (int) ev.Size() - 2, ev.Data()));
 }
 
 void EventServer::NotifySettleDone(const wxString& errorMsg, int settleFrames, int droppedFrames)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_SETTLE_DONE))
         return;
 
     Ev ev(ev_settle_done(errorMsg, settleFrames, droppedFrames));
@@ -2167,10 +3353,10 @@ void EventServer::NotifySettleDone(const wxString& errorMsg, int settleFrames, i
 
 void EventServer::NotifyAlert(const wxString& msg, int type)
 {
-    if (m_eventServerClients.empty())
+    if (!any_client_wants(m_eventServerClients, EV_ALERT))
         return;
 
-    Ev ev("Alert");
+    Ev ev(EV_ALERT);
     ev << NV("Msg", msg);
 
     wxString s;
@@ -2199,10 +3385,10 @@ void EventServer::NotifyAlert(const wxString& msg, int type)
 template<typename T>
 static void NotifyGuidingParam(const EventServer::CliSockSet& clients, const wxString& name, T val)
 {
-    if (clients.empty())
+    if (!any_client_wants(clients, EV_GUIDE_PARAM_CHANGE))
         return;
 
-    Ev ev("GuideParamChange");
+    Ev ev(EV_GUIDE_PARAM_CHANGE);
     ev << NV("Name", name);
     ev << NV("Value", val);
 
@@ -38,14 +38,15 @@
 #include <set>
 #include "json_parser.h"
 
+struct ClientData;
+
 class EventServer : public wxEvtHandler
 {
 public:
-    typedef std::set<wxSocketClient *> CliSockSet;
+    typedef std::set<ClientData *> CliSockSet;
 
 private:
     JsonParser m_parser;
-    wxSocketServer *m_serverSocket;
     CliSockSet m_eventServerClients;
 
 public:
@@ -80,9 +81,14 @@ public:
     void NotifyGuidingParam(const wxString& name, bool val);
     void NotifyGuidingParam(const wxString& name, const wxString& val);
 
+    // connected client count and cumulative byte counters across all clients
+    void GetTrafficStats(unsigned int *clients, unsigned long long *queued, unsigned long long *sent,
+        unsigned long long *dropped);
+
 private:
-    void OnEventServerEvent(wxSocketEvent& evt);
-    void OnEventServerClientEvent(wxSocketEvent& evt);
+    void OnEventServerEvent(wxThreadEvent& evt);
+    void OnEventServerRequest(wxThreadEvent& evt);
+    void OnIdle(wxIdleEvent& evt);
 
     wxDECLARE_EVENT_TABLE();
 };
@@ -0,0 +1,625 @@
+/*
+*  frame_stream.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+#include <algorithm>
+
+#ifndef __WINDOWS__
+# include <sys/select.h>
+#endif
+
+FrameStreamServer FrameStream;
+
+enum
+{
+    FRAME_MAGIC = 0x46444850,       // "PHDF"
+    HEADER_SIZE = 56,
+    STREAM_VERSION = 1,
+    MAX_DECIMATE = 16,
+    MAX_BUFFERS = 8,
+    IO_POLL_MS = 250,           // longest the I/O thread waits if it cannot be woken
+    INPUT_MAX = 256
+};
+
+// a staged frame, header followed by pixels, shared by the clients sending it
+struct FrameBuf
+{
+    std::vector<unsigned char> data;
+    int refs;                       // clients sending this buffer, plus one while staging
+    unsigned int decimate;
+    bool subframe;
+
+    FrameBuf() : refs(0), decimate(1), subframe(false) { }
+};
+
+struct FrameStreamClient
+{
+    wxSOCKET_T fd;
+
+    // guarded by the I/O thread lock
+    unsigned int minIntervalMs;
+    unsigned int decimate;
+    bool subframe;
+    wxLongLong lastSent;
+    FrameBuf *frame;                // frame being written, NULL when idle
+    size_t sent;
+    unsigned int framesSent;
+    unsigned int framesSkipped;
+
+    // I/O thread only
+    char rdbuf[INPUT_MAX];
+    size_t rdlen;
+    bool lost;                      // connection closed or failed
+
+    FrameStreamClient(wxSOCKET_T fd_)
+        : fd(fd_),
+        minIntervalMs(1000),
+        decimate(1),
+        subframe(false),
+        frame(0),
+        sent(0),
+        framesSent(0),
+        framesSkipped(0),
+        rdlen(0),
+        lost(false)
+    {
+    }
+};
+
+// The listening socket and the client sockets are owned by an I/O thread,
+// which accepts connections, reads the clients' option lines and writes the
+// staged frames. The main thread only stages frames and hands them over
+// under the lock.
+class FrameStreamIO : public wxThread
+{
+    wxSOCKET_T m_listener;
+    IoWaker m_waker;
+    volatile bool m_stop;
+
+    void Accept();
+    void Read(FrameStreamClient *fsc);
+    bool Write(FrameStreamClient *fsc);
+    void RemoveLost();
+    void DestroyClient(FrameStreamClient *fsc);
+
+public:
+    wxMutex m_lock;                 // guards m_clients, m_pool and the shared state of clients and buffers
+    std::vector<FrameStreamClient *> m_clients;
+    std::vector<FrameBuf *> m_pool;
+
+    FrameStreamIO(wxSOCKET_T listener) : wxThread(wxTHREAD_JOINABLE), m_listener(listener), m_stop(false) { }
+    ~FrameStreamIO();
+
+    FrameBuf *AcquireBuffer();
+    void Wake() { m_waker.Wake(); }
+    void Stop();
+
+protected:
+    ExitCode Entry();
+};
+
+FrameStreamIO::~FrameStreamIO()
+{
+    for (size_t i = 0; i < m_clients.size(); i++)
+        DestroyClient(m_clients[i]);
+    for (size_t i = 0; i < m_pool.size(); i++)
+        delete m_pool[i];
+    IoSocket::Close(m_listener);
+}
+
+// find an idle buffer, reserving it for staging; call with m_lock held
+FrameBuf *FrameStreamIO::AcquireBuffer()
+{
+    for (size_t i = 0; i < m_pool.size(); i++)
+    {
+        if (m_pool[i]->refs == 0)
+        {
+            m_pool[i]->refs = 1;
+            return m_pool[i];
+        }
+    }
+
+    if (m_pool.size() >= MAX_BUFFERS)
+        return 0;
+
+    FrameBuf *buf = new FrameBuf();
+    buf->refs = 1;
+    m_pool.push_back(buf);
+    return buf;
+}
+
+void FrameStreamIO::Stop()
+{
+    m_stop = true;
+    m_waker.Wake();
+    Wait();
+}
+
+void FrameStreamIO::DestroyClient(FrameStreamClient *fsc)
+{
+    if (fsc->frame)
+        --fsc->frame->refs;
+
+    Debug.Write(wxString::Format("FrameStream: cli %p frames sent %u skipped %u\n", fsc, fsc->framesSent, fsc->framesSkipped));
+
+    IoSocket::Close(fsc->fd);
+    delete fsc;
+}
+
+// drop the clients whose connection closed; call with m_lock held
+void FrameStreamIO::RemoveLost()
+{
+    for (size_t i = 0; i < m_clients.size(); )
+    {
+        FrameStreamClient *fsc = m_clients[i];
+        if (fsc->lost)
+        {
+            Debug.Write(wxString::Format("FrameStream: cli %p disconnect\n", fsc));
+            m_clients.erase(m_clients.begin() + i);
+            DestroyClient(fsc);
+        }
+        else
+            ++i;
+    }
+}
+
+void FrameStreamIO::Accept()
+{
+    wxSOCKET_T fd;
+    while ((fd = IoSocket::Accept(m_listener)) != INVALID_IO_SOCKET)
+    {
+        FrameStreamClient *fsc = new FrameStreamClient(fd);
+
+        Debug.Write(wxString::Format("FrameStream: cli %p connect\n", fsc));
+
+        wxMutexLocker lck(m_lock);
+        m_clients.push_back(fsc);
+    }
+}
+
+// write as much of the client's frame as the socket takes without blocking;
+// returns true if the frame is not finished. Called with m_lock held.
+bool FrameStreamIO::Write(FrameStreamClient *fsc)
+{
+    FrameBuf *buf = fsc->frame;
+    if (!buf)
+        return false;
+
+    const std::vector<unsigned char>& data = buf->data;
+
+    int n = IoSocket::Write(fsc->fd, &data[fsc->sent], data.size() - fsc->sent);
+    if (n >= 0)
+    {
+        fsc->sent += n;
+        if (fsc->sent < data.size())
+            return true;
+    }
+    else
+    {
+        Debug.Write(wxString::Format("FrameStream: cli %p write error %d\n", fsc, IoSocket::LastError()));
+        fsc->lost = true;
+    }
+
+    --buf->refs;
+    fsc->frame = 0;
+
+    return false;
+}
+
+static void put16(unsigned char *p, unsigned int val)
+{
+    unsigned short v = (unsigned short) val;
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put32(unsigned char *p, unsigned int val)
+{
+    memcpy(p, &val, sizeof(val));
+}
+
+static void put64(unsigned char *p, unsigned long long val)
+{
+    memcpy(p, &val, sizeof(val));
+}
+
+static unsigned int clamp16(int val)
+{
+    return val < 0 ? 0 : val > 65535 ? 65535 : val;
+}
+
+// copy the dw x dh view of r decimated by dec into dst as 16-bit pixels
+template<typename T>
+static void stage_pixels(unsigned short *dst, const usImage& img, const wxRect& r, unsigned int dec,
+                         unsigned int dw, unsigned int dh)
+{
+    if (dec == 1)
+    {
+        for (unsigned int y = 0; y < dh; y++)
+        {
+            const T *src = PixelPtr<T>(img, r.GetLeft(), r.GetTop() + y);
+            if (sizeof(T) == sizeof(unsigned short))
+                memcpy(dst + y * dw, src, dw * sizeof(unsigned short));
+            else
+                std::copy(src, src + dw, dst + y * dw);
+        }
+        return;
+    }
+
+    // box average
+    unsigned int n = dec * dec;
+    for (unsigned int y = 0; y < dh; y++)
+    {
+        for (unsigned int x = 0; x < dw; x++)
+        {
+            unsigned int sum = 0;
+            for (unsigned int j = 0; j < dec; j++)
+            {
+                const T *src = PixelPtr<T>(img, r.GetLeft() + x * dec, r.GetTop() + y * dec + j);
+                for (unsigned int i = 0; i < dec; i++)
+                    sum += src[i];
+            }
+            *dst++ = (unsigned short) (sum / n);
+        }
+    }
+}
+
+// copy the requested view of the frame into buf; like the rest of PHD2 this
+// assumes a little-endian host
+static void stage_frame(FrameBuf *buf, const usImage& img, unsigned int frameNumber, const wxLongLong& now)
+{
+    wxRect r(0, 0, img.Size.GetWidth(), img.Size.GetHeight());
+    if (buf->subframe && img.Subframe.GetWidth() > 0 && img.Subframe.GetHeight() > 0)
+        r = img.Subframe;
+    else if (img.IsRoiOnly())
+        r = img.DataRect();     // nothing outside the subframe is stored
+
+    unsigned int dec = wxMin(buf->decimate, (unsigned int) wxMin(r.GetWidth(), r.GetHeight()));
+    if (dec < 1)
+        dec = 1;
+    unsigned int dw = r.GetWidth() / dec;
+    unsigned int dh = r.GetHeight() / dec;
+    size_t payload = (size_t) dw * dh * sizeof(unsigned short);
+
+    buf->data.resize(HEADER_SIZE + payload);
+    unsigned char *h = &buf->data[0];
+
+    put32(h + 0, FRAME_MAGIC);
+    put16(h + 4, HEADER_SIZE);
+    put16(h + 6, STREAM_VERSION);
+    put32(h + 8, frameNumber);
+    put32(h + 12, img.ImgExpDur);
+    put64(h + 16, (unsigned long long) img.ImgStartTime);
+    put64(h + 24, (unsigned long long) now.GetValue());
+    put16(h + 32, img.Size.GetWidth());
+    put16(h + 34, img.Size.GetHeight());
+    put16(h + 36, r.GetLeft());
+    put16(h + 38, r.GetTop());
+    put16(h + 40, r.GetWidth());
+    put16(h + 42, r.GetHeight());
+    put16(h + 44, dec);
+    put16(h + 46, img.BitsPerPixel ? img.BitsPerPixel : 16);
+    put16(h + 48, clamp16(img.FiltMin));
+    put16(h + 50, clamp16(img.FiltMax));
+    put32(h + 52, (unsigned int) payload);
+
+    if (payload == 0)
+        return;
+
+    unsigned short *dst = reinterpret_cast<unsigned short *>(h + HEADER_SIZE);
+
+    if (img.Is8Bit())
+        stage_pixels<unsigned char>(dst, img, r, dec, dw, dh);
+    else
+        stage_pixels<unsigned short>(dst, img, r, dec, dw, dh);
+}
+
+// apply a {"fps": f, "decimate": n, "region": "full"|"subframe"} option
+// line; call with the I/O thread lock held
+static void apply_options(FrameStreamClient *fsc, char *line)
+{
+    JsonParser parser;
+    if (!parser.Parse(line))
+    {
+        Debug.Write(wxString::Format("FrameStream: cli %p invalid options: %s\n", fsc, parser.ErrorDesc()));
+        return;
+    }
+
+    json_for_each (j, parser.Root())
+    {
+        if (!j->name)
+            continue;
+
+        if (strcmp(j->name, "fps") == 0 && (j->type == JSON_INT || j->type == JSON_FLOAT))
+        {
+            double fps = j->type == JSON_INT ? j->int_value : j->float_value;
+            fsc->minIntervalMs = fps > 0.0 ? (unsigned int) (1000.0 / fps) : 1000;
+        }
+        else if (strcmp(j->name, "decimate") == 0 && j->type == JSON_INT)
+        {
+            fsc->decimate = wxMax(1, wxMin((int) MAX_DECIMATE, j->int_value));
+        }
+        else if (strcmp(j->name, "region") == 0 && j->type == JSON_STRING)
+        {
+            fsc->subframe = strcmp(j->string_value, "subframe") == 0;
+        }
+    }
+
+    Debug.Write(wxString::Format("FrameStream: cli %p interval %u ms decimate %u %s\n", fsc,
+        fsc->minIntervalMs, fsc->decimate, fsc->subframe ? "subframe" : "full"));
+}
+
+// read whatever the client has sent; called with m_lock held
+void FrameStreamIO::Read(FrameStreamClient *fsc)
+{
+    while (true)
+    {
+        if (fsc->rdlen == INPUT_MAX)
+            fsc->rdlen = 0; // overlong line, discard it
+
+        int n = IoSocket::Read(fsc->fd, fsc->rdbuf + fsc->rdlen, INPUT_MAX - fsc->rdlen);
+        if (n <= 0)
+        {
+            if (n < 0)
+                fsc->lost = true;
+            break;
+        }
+
+        size_t start = 0;
+        for (size_t i = fsc->rdlen; i < fsc->rdlen + n; i++)
+        {
+            if (fsc->rdbuf[i] == '\n' || fsc->rdbuf[i] == '\r')
+            {
+                fsc->rdbuf[i] = 0;
+                if (i > start)
+                    apply_options(fsc, fsc->rdbuf + start);
+                start = i + 1;
+            }
+        }
+
+        fsc->rdlen += n;
+        memmove(fsc->rdbuf, fsc->rdbuf + start, fsc->rdlen - start);
+        fsc->rdlen -= start;
+    }
+}
+
+wxThread::ExitCode FrameStreamIO::Entry()
+{
+    while (!m_stop)
+    {
+        fd_set rfds;
+        fd_set wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+
+        FD_SET(m_listener, &rfds);
+        wxSOCKET_T maxfd = m_listener;
+
+        if (m_waker.Ok())
+        {
+            FD_SET(m_waker.Fd(), &rfds);
+            maxfd = std::max(maxfd, m_waker.Fd());
+        }
+
+        {
+            wxMutexLocker lck(m_lock);
+
+            for (size_t i = 0; i < m_clients.size(); i++)
+            {
+                FrameStreamClient *fsc = m_clients[i];
+                // send what we can now and wait for room for the rest
+                bool pending = Write(fsc);
+                // a lost client's socket is closed below, keep it out of the sets
+                if (fsc->lost)
+                    continue;
+                if (pending)
+                    FD_SET(fsc->fd, &wfds);
+                FD_SET(fsc->fd, &rfds);
+                maxfd = std::max(maxfd, fsc->fd);
+            }
+
+            RemoveLost();
+        }
+
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = IO_POLL_MS * 1000;
+
+        int ret = select((int) maxfd + 1, &rfds, &wfds, 0, &tv);
+        if (ret < 0)
+        {
+            Debug.Write(wxString::Format("FrameStream: select failed, error %d\n", IoSocket::LastError()));
+            wxMilliSleep(IO_POLL_MS);
+            continue;
+        }
+        if (ret == 0)
+            continue;
+
+        if (m_waker.Ok() && FD_ISSET(m_waker.Fd(), &rfds))
+            m_waker.Drain();
+
+        if (FD_ISSET(m_listener, &rfds))
+            Accept();
+
+        wxMutexLocker lck(m_lock);
+
+        for (size_t i = 0; i < m_clients.size(); i++)
+        {
+            if (FD_ISSET(m_clients[i]->fd, &rfds))
+                Read(m_clients[i]);
+        }
+
+        RemoveLost();
+    }
+
+    return 0;
+}
+
+FrameStreamServer::FrameStreamServer()
+    : m_io(0)
+{
+}
+
+FrameStreamServer::~FrameStreamServer()
+{
+}
+
+bool FrameStreamServer::Start(unsigned int instanceId)
+{
+    if (m_io)
+        return false;
+
+    unsigned int port = 4500 + instanceId - 1;
+    wxSOCKET_T listener = IoSocket::Listen(port);
+
+    if (listener == INVALID_IO_SOCKET)
+    {
+        Debug.Write(wxString::Format("Frame stream server failed to start - Could not listen at port %u\n", port));
+        return true;
+    }
+
+    m_io = new FrameStreamIO(listener);     // closes the listener when deleted
+    if (m_io->Create() != wxTHREAD_NO_ERROR || m_io->Run() != wxTHREAD_NO_ERROR)
+    {
+        Debug.AddLine("Frame stream server failed to start - could not start I/O thread");
+        delete m_io;
+        m_io = 0;
+        return true;
+    }
+
+    Debug.Write(wxString::Format("frame stream server started, listening on port %u\n", port));
+
+    return false;
+}
+
+void FrameStreamServer::Stop()
+{
+    if (!m_io)
+        return;
+
+    m_io->Stop();
+    delete m_io;
+    m_io = 0;
+
+    Debug.AddLine("frame stream server stopped");
+}
+
+// true if the client is ready for a new frame; call with the I/O thread lock held
+static bool frame_due(const FrameStreamClient *fsc, const wxLongLong& now)
+{
+    return !fsc->frame && now - fsc->lastSent >= (long) fsc->minIntervalMs;
+}
+
+void FrameStreamServer::PushFrame(const usImage& img, unsigned int frameNumber)
+{
+    if (!m_io || !img.HasPixels())
+        return;
+
+    wxLongLong now = ::wxGetUTCTimeMillis();
+    std::vector<FrameBuf *> staged;
+
+    // reserve a buffer for each distinct view the due clients want
+    {
+        wxMutexLocker lck(m_io->m_lock);
+
+        for (size_t i = 0; i < m_io->m_clients.size(); i++)
+        {
+            FrameStreamClient *fsc = m_io->m_clients[i];
+
+            if (now - fsc->lastSent < (long) fsc->minIntervalMs)
+                continue;
+
+            if (fsc->frame)
+            {
+                // still sending the last frame
+                ++fsc->framesSkipped;
+                continue;
+            }
+
+            size_t j;
+            for (j = 0; j < staged.size(); j++)
+                if (staged[j]->decimate == fsc->decimate && staged[j]->subframe == fsc->subframe)
+                    break;
+            if (j < staged.size())
+                continue;
+
+            FrameBuf *buf = m_io->AcquireBuffer();
+            if (!buf)
+            {
+                Debug.AddLine("FrameStream: no free frame buffer, frame skipped");
+                continue;
+            }
+            buf->decimate = fsc->decimate;
+            buf->subframe = fsc->subframe;
+            staged.push_back(buf);
+        }
+    }
+
+    if (staged.empty())
+        return;
+
+    // the buffers are reserved for us, fill them without the lock
+    for (size_t j = 0; j < staged.size(); j++)
+        stage_frame(staged[j], img, frameNumber, now);
+
+    // clients may have come, gone or changed their options meanwhile
+    wxMutexLocker lck(m_io->m_lock);
+
+    for (size_t i = 0; i < m_io->m_clients.size(); i++)
+    {
+        FrameStreamClient *fsc = m_io->m_clients[i];
+
+        if (!frame_due(fsc, now))
+            continue;
+
+        for (size_t j = 0; j < staged.size(); j++)
+        {
+            FrameBuf *buf = staged[j];
+            if (buf->decimate == fsc->decimate && buf->subframe == fsc->subframe)
+            {
+                fsc->frame = buf;
+                fsc->sent = 0;
+                fsc->lastSent = now;
+                ++fsc->framesSent;
+                ++buf->refs;
+                break;
+            }
+        }
+    }
+
+    for (size_t j = 0; j < staged.size(); j++)
+        --staged[j]->refs;
+
+    m_io->Wake();
+}
@@ -0,0 +1,84 @@
+/*
+*  frame_stream.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef FRAME_STREAM_INCLUDED
+#define FRAME_STREAM_INCLUDED
+
+class FrameStreamIO;
+
+// Opt-in binary stream of camera frames for remote clients, listening on
+// port 4500 + instance - 1 when /Server/FrameStream is enabled.
+//
+// A client may send one line of JSON at any time to choose what it receives:
+//
+//   {"fps": 2, "decimate": 2, "region": "subframe"}
+//
+// fps is the maximum frame rate (default 1), decimate the box-averaging
+// factor (1-16, default 1) and region "full" (default) or "subframe" for
+// just the subframe when the camera is using subframes.
+//
+// Each frame is sent as a 56-byte little-endian header followed by the
+// pixels as 16-bit little-endian values, row by row:
+//
+//   u32 magic "PHDF"      u16 header size     u16 version (1)
+//   u32 frame number      u32 exposure (ms)
+//   u64 exposure start (Unix time, s)         u64 time sent (Unix time, ms)
+//   u16 image width       u16 image height
+//   u16 x, y, width, height of the region sent (image pixels, before decimation)
+//   u16 decimation        u16 bits per pixel
+//   u16 black level       u16 white level     (display stretch hints)
+//   u32 payload bytes
+//
+// Frames are staged once in pooled buffers shared by all clients that want
+// the same view and written by an I/O thread that owns the sockets. A client
+// that has not finished reading the previous frame skips frames until it
+// catches up.
+class FrameStreamServer
+{
+    FrameStreamIO *m_io;
+
+public:
+    FrameStreamServer();
+    ~FrameStreamServer();
+
+    bool Start(unsigned int instanceId);
+    void Stop();
+
+    // called on the main thread for each new frame
+    void PushFrame(const usImage& img, unsigned int frameNumber);
+};
+
+extern FrameStreamServer FrameStream;
+
+#endif
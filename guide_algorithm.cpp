@@ -68,7 +68,7 @@ double GuideAlgorithm::SmartDefaultMinMove()
         double focalLength = pFrame->GetFocalLength();
         if (focalLength != 0)
         {
-            double imageScale = MyFrame::GetPixelScale(pCamera->GetCameraPixelSize(), focalLength, pCamera->Binning);
+            double imageScale = MyFrame::GetPixelScale(pCamera->GetCameraPixelSize(), focalLength, pCamera->ImageBinning());
             // Following based on empirical data using a range of image scales - same as profile wizard
             return wxMax(0.1515 + 0.1548 / imageScale, 0.15);
         }
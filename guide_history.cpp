@@ -0,0 +1,190 @@
+/*
+*  guide_history.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+GuideStepHistory GuideHistory;
+
+static const GuideStepHistory::FieldInfo s_fields[GuideStepHistory::NUM_FIELDS] =
+{
+    { "Frame", GuideStepHistory::FT_INT32, 0 },
+    { "Time", GuideStepHistory::FT_FLOAT64, 3 },
+    { "dx", GuideStepHistory::FT_FLOAT32, 3 },
+    { "dy", GuideStepHistory::FT_FLOAT32, 3 },
+    { "RADistanceRaw", GuideStepHistory::FT_FLOAT32, 3 },
+    { "DECDistanceRaw", GuideStepHistory::FT_FLOAT32, 3 },
+    { "RADistanceGuide", GuideStepHistory::FT_FLOAT32, 3 },
+    { "DECDistanceGuide", GuideStepHistory::FT_FLOAT32, 3 },
+    { "RADuration", GuideStepHistory::FT_INT32, 0 },
+    { "DECDuration", GuideStepHistory::FT_INT32, 0 },
+    { "StarMass", GuideStepHistory::FT_FLOAT32, 0 },
+    { "SNR", GuideStepHistory::FT_FLOAT32, 2 },
+    { "AvgDist", GuideStepHistory::FT_FLOAT32, 2 },
+    { "ErrorCode", GuideStepHistory::FT_INT32, 0 },
+    { "RALimited", GuideStepHistory::FT_INT32, 0 },
+    { "DecLimited", GuideStepHistory::FT_INT32, 0 },
+    { "AO", GuideStepHistory::FT_INT32, 0 },
+};
+
+const GuideStepHistory::FieldInfo& GuideStepHistory::Info(Field field)
+{
+    return s_fields[field];
+}
+
+bool GuideStepHistory::FieldByName(const char *name, Field *field)
+{
+    for (int i = 0; i < NUM_FIELDS; i++)
+    {
+        if (strcmp(name, s_fields[i].name) == 0)
+        {
+            *field = (Field) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t GuideStepHistory::FieldSize(Field field)
+{
+    // int32 and float32 columns both take 4 bytes
+    return s_fields[field].type == FT_FLOAT64 ? sizeof(double) : sizeof(float);
+}
+
+GuideStepHistory::GuideStepHistory()
+    : m_head(0),
+    m_count(0)
+{
+    for (int i = 0; i < NUM_FIELDS; i++)
+        m_columns[i] = new unsigned char[CAPACITY * FieldSize((Field) i)];
+}
+
+GuideStepHistory::~GuideStepHistory()
+{
+    for (int i = 0; i < NUM_FIELDS; i++)
+        delete[] m_columns[i];
+}
+
+void GuideStepHistory::Clear()
+{
+    wxCriticalSectionLocker lck(m_lock);
+    m_head = 0;
+    m_count = 0;
+}
+
+template<typename T>
+inline static void put(unsigned char *column, unsigned int slot, T val)
+{
+    ((T *) column)[slot] = val;
+}
+
+inline static int signed_duration(int duration, int direction, GUIDE_DIRECTION negative)
+{
+    return direction == negative ? -duration : duration;
+}
+
+void GuideStepHistory::Add(const GuideStepInfo& step)
+{
+    wxCriticalSectionLocker lck(m_lock);
+
+    unsigned int slot = m_head;
+
+    put<int>(m_columns[GH_FRAME], slot, step.frameNumber);
+    put<double>(m_columns[GH_TIME], slot, step.time);
+    put<float>(m_columns[GH_DX], slot, (float) step.cameraOffset.X);
+    put<float>(m_columns[GH_DY], slot, (float) step.cameraOffset.Y);
+    put<float>(m_columns[GH_RA_RAW], slot, (float) step.mountOffset.X);
+    put<float>(m_columns[GH_DEC_RAW], slot, (float) step.mountOffset.Y);
+    put<float>(m_columns[GH_RA_GUIDE], slot, (float) step.guideDistanceRA);
+    put<float>(m_columns[GH_DEC_GUIDE], slot, (float) step.guideDistanceDec);
+    put<int>(m_columns[GH_RA_DURATION], slot, signed_duration(step.durationRA, step.directionRA, WEST));
+    put<int>(m_columns[GH_DEC_DURATION], slot, signed_duration(step.durationDec, step.directionDec, SOUTH));
+    put<float>(m_columns[GH_STAR_MASS], slot, (float) step.starMass);
+    put<float>(m_columns[GH_SNR], slot, (float) step.starSNR);
+    put<float>(m_columns[GH_AVG_DIST], slot, (float) step.avgDist);
+    put<int>(m_columns[GH_ERROR_CODE], slot, step.starError);
+    put<int>(m_columns[GH_RA_LIMITED], slot, step.raLimited ? 1 : 0);
+    put<int>(m_columns[GH_DEC_LIMITED], slot, step.decLimited ? 1 : 0);
+    put<int>(m_columns[GH_AO], slot, step.mount && step.mount->IsStepGuider() ? 1 : 0);
+
+    m_head = (m_head + 1) % CAPACITY;
+    if (m_count < CAPACITY)
+        ++m_count;
+}
+
+// frame number of the i'th oldest step
+int GuideStepHistory::FrameAt(unsigned int i) const
+{
+    unsigned int slot = (m_head + CAPACITY - m_count + i) % CAPACITY;
+    return ((const int *) m_columns[GH_FRAME])[slot];
+}
+
+unsigned int GuideStepHistory::Query(int sinceFrame, const std::vector<Field>& fields,
+                                     std::vector<std::vector<unsigned char> > *columns) const
+{
+    wxCriticalSectionLocker lck(m_lock);
+
+    // frame numbers never decrease within a guiding session, find the first
+    // step after sinceFrame
+    unsigned int lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi) / 2;
+        if (FrameAt(mid) <= sinceFrame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    unsigned int count = m_count - lo;
+    unsigned int first = (m_head + CAPACITY - count) % CAPACITY;
+
+    // the steps are in at most two runs, before and after the end of the ring
+    unsigned int run1 = std::min(count, (unsigned int) CAPACITY - first);
+    unsigned int run2 = count - run1;
+
+    columns->resize(fields.size());
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+        size_t sz = FieldSize(fields[i]);
+        const unsigned char *src = m_columns[fields[i]];
+        std::vector<unsigned char>& dst = (*columns)[i];
+        dst.resize(count * sz);
+        if (run1)
+            memcpy(&dst[0], src + first * sz, run1 * sz);
+        if (run2)
+            memcpy(&dst[run1 * sz], src, run2 * sz);
+    }
+
+    return count;
+}
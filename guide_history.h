@@ -0,0 +1,116 @@
+/*
+*  guide_history.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef GUIDE_HISTORY_INCLUDED
+#define GUIDE_HISTORY_INCLUDED
+
+#include <vector>
+
+// Fixed-capacity ring of the guide steps of the current guiding session,
+// stored as one array per field so that a query for a few fields over many
+// steps reads contiguous memory. Steps are added on the main thread; queries
+// may come from any thread.
+class GuideStepHistory
+{
+public:
+    enum { CAPACITY = 8192 };
+
+    // field names are the same as in the GuideStep event, but as in the
+    // guide log the durations are signed instead of having a direction:
+    // negative for West (AO left) and South (AO down) pulses
+    enum Field
+    {
+        GH_FRAME,
+        GH_TIME,
+        GH_DX,
+        GH_DY,
+        GH_RA_RAW,
+        GH_DEC_RAW,
+        GH_RA_GUIDE,
+        GH_DEC_GUIDE,
+        GH_RA_DURATION,
+        GH_DEC_DURATION,
+        GH_STAR_MASS,
+        GH_SNR,
+        GH_AVG_DIST,
+        GH_ERROR_CODE,
+        GH_RA_LIMITED,
+        GH_DEC_LIMITED,
+        GH_AO,
+        NUM_FIELDS
+    };
+
+    enum FieldType
+    {
+        FT_INT32,
+        FT_FLOAT32,
+        FT_FLOAT64
+    };
+
+    struct FieldInfo
+    {
+        const char *name;
+        FieldType type;
+        int precision;      // decimal places when written as JSON text
+    };
+
+    static const FieldInfo& Info(Field field);
+    static bool FieldByName(const char *name, Field *field);
+    static size_t FieldSize(Field field);
+
+private:
+    mutable wxCriticalSection m_lock;
+    unsigned int m_head;        // slot for the next step
+    unsigned int m_count;
+    unsigned char *m_columns[NUM_FIELDS];
+
+    int FrameAt(unsigned int i) const;
+
+public:
+    GuideStepHistory();
+    ~GuideStepHistory();
+
+    void Clear();
+    void Add(const GuideStepInfo& step);
+
+    // Copy the given fields of the steps after frame sinceFrame, oldest
+    // first, as packed native-endian arrays, one per field. Returns the
+    // number of steps copied.
+    unsigned int Query(int sinceFrame, const std::vector<Field>& fields,
+                       std::vector<std::vector<unsigned char> > *columns) const;
+};
+
+extern GuideStepHistory GuideHistory;
+
+#endif
@@ -350,6 +350,8 @@ void Guider::OnClose(wxCloseEvent& evt)
 
 bool Guider::PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC)
 {
+    TraceSpan span("Guider::PaintHelper");
+
     bool bError = false;
 
     try
@@ -357,7 +359,7 @@ bool Guider::PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC)
         GUIDER_STATE state = GetState();
         GetSize(&XWinSize, &YWinSize);
 
-        if (m_pCurrentImage->ImageData)
+        if (m_pCurrentImage->HasPixels())
         {
             int blevel = m_pCurrentImage->FiltMin;
             int wlevel = m_pCurrentImage->FiltMax;
@@ -662,6 +664,12 @@ bool Guider::SaveCurrentImage(const wxString& fileName)
     return m_pCurrentImage->Save(fileName);
 }
 
+// called after each mount move with the displacement the move should have
+// produced on the camera
+void Guider::NotifyCommandedMotion(const PHD_Point& starMotion)
+{
+}
+
 void Guider::InvalidateLockPosition(void)
 {
     m_lockPosition.Invalidate();
@@ -1124,6 +1132,7 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
                 case STATE_GUIDING:
                 {
                     GuideLog.FrameDropped(info);
+                    PipelineMetrics::Inc(Metrics.framesDropped);
                     EvtServer.NotifyStarLost(info);
                     GuidingAssistant::NotifyFrameDropped(info);
                     pFrame->pGraphLog->AppendData(info);
@@ -1257,6 +1266,7 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
                 pFrame->StatusMsg(_("Guiding"));
                 pFrame->m_guidingStarted = wxDateTime::UNow();
                 pFrame->m_frameCounter = 0;
+                GuideHistory.Clear();
                 GuideLog.StartGuiding();
                 EvtServer.NotifyStartGuiding();
                 break;
@@ -1558,7 +1568,15 @@ EXPOSED_STATE Guider::GetExposedState(void)
                     rval = EXPOSED_STATE_GUIDING_LOST;
         }
 
-        Debug.Write(wxString::Format("case statement mapped state %d to %d\n", guider->GetState(), rval));
+        // the event server polls this, only log changes
+        static int s_lastState = -1;
+        static EXPOSED_STATE s_lastMapped = EXPOSED_STATE_NONE;
+        if (guider->GetState() != s_lastState || rval != s_lastMapped)
+        {
+            Debug.Write(wxString::Format("case statement mapped state %d to %d\n", guider->GetState(), rval));
+            s_lastState = guider->GetState();
+            s_lastMapped = rval;
+        }
     }
 
     return rval;
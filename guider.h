@@ -266,6 +266,7 @@ private:
     virtual void InvalidateLockPosition(void);
 public:
     virtual void LoadProfileSettings(void);
+    virtual void NotifyCommandedMotion(const PHD_Point& starMotion);
 
     // pure virtual functions -- these MUST be overridden by a subclass
 public:
@@ -288,6 +289,8 @@ public:
     virtual unsigned int StarPeakADU(void) = 0;
     virtual double SNR(void) = 0;
     virtual double HFD(void) = 0;
+    virtual double FWHM(void) = 0;
+    virtual double Ellipticity(void) = 0;
     virtual int StarError(void) = 0;
 
     usImage *CurrentImage(void);
@@ -39,6 +39,7 @@
 #include "phd.h"
 #include <wx/dir.h>
 #include <algorithm>
+#include <float.h>
 
 #if ((wxMAJOR_VERSION < 3) && (wxMINOR_VERSION < 9))
 #define wxPENSTYLE_DOT wxDOT
@@ -147,6 +148,27 @@ enum {
     MAX_SEARCH_REGION = 50,
 };
 
+enum {
+    MIN_MAX_STARS = 2,
+    DEFAULT_MAX_STARS = 9,
+    MAX_MAX_STARS = 20,
+    SECONDARY_MAX_MISSED = 10,  // drop a secondary star after this many frames without it
+    OFFSET_AVG_FRAMES = 30,     // frames to average a secondary star's offset over
+};
+
+static const double SecondaryClipSigma = 2.5;
+static const double SecondaryClipMinPx = 0.25;  // never reject an estimate closer than this
+
+enum {
+    REACQUIRE_MAX_SCALE_LOG2 = 3,   // the reacquisition search box grows to 8 search regions
+    REACQUIRE_MAX_FRAMES = 10,      // fall back to full frames after this many attempts
+    REACQUIRE_MAX_CANDIDATES = 16,  // brightest peaks in the box checked against the lost star
+};
+
+// how different a candidate may be from the lost star and still match it
+static const double ReacquireMassRatio = 3.0;
+static const double ReacquireHFDTolerance = 0.5;
+
 BEGIN_EVENT_TABLE(GuiderOneStar, Guider)
     EVT_PAINT(GuiderOneStar::OnPaint)
     EVT_LEFT_DOWN(GuiderOneStar::OnLClick)
@@ -155,7 +177,13 @@ END_EVENT_TABLE()
 // Define a constructor for the guide canvas
 GuiderOneStar::GuiderOneStar(wxWindow *parent)
     : Guider(parent, XWinSize, YWinSize),
-      m_massChecker(new MassChecker())
+      m_massChecker(new MassChecker()),
+      m_lostFrames(0),
+      m_commandedMotion(0., 0.),
+      m_multiStarEnabled(false),
+      m_maxStars(DEFAULT_MAX_STARS),
+      m_fastReacquireEnabled(true),
+      m_psfFitEnabled(false)
 {
     SetState(STATE_UNINITIALIZED);
 }
@@ -178,6 +206,18 @@ void GuiderOneStar::LoadProfileSettings(void)
 
     int searchRegion = pConfig->Profile.GetInt("/guider/onestar/SearchRegion", DEFAULT_SEARCH_REGION);
     SetSearchRegion(searchRegion);
+
+    bool multiStar = pConfig->Profile.GetBoolean("/guider/onestar/MultiStar", false);
+    SetMultiStarEnabled(multiStar);
+
+    int maxStars = pConfig->Profile.GetInt("/guider/onestar/MaxStars", DEFAULT_MAX_STARS);
+    SetMaxStars(maxStars);
+
+    bool fastReacquire = pConfig->Profile.GetBoolean("/guider/onestar/FastReacquire", true);
+    SetFastReacquireEnabled(fastReacquire);
+
+    bool psfFit = pConfig->Profile.GetBoolean("/guider/onestar/PSFFit", false);
+    SetPSFFitEnabled(psfFit);
 }
 
 bool GuiderOneStar::GetMassChangeThresholdEnabled(void)
@@ -251,6 +291,84 @@ bool GuiderOneStar::SetSearchRegion(int searchRegion)
     return bError;
 }
 
+bool GuiderOneStar::GetMultiStarEnabled(void)
+{
+    return m_multiStarEnabled;
+}
+
+void GuiderOneStar::SetMultiStarEnabled(bool enable)
+{
+    m_multiStarEnabled = enable;
+    if (!enable)
+        m_secondaries.clear();
+    pConfig->Profile.SetBoolean("/guider/onestar/MultiStar", enable);
+}
+
+int GuiderOneStar::GetMaxStars(void)
+{
+    return m_maxStars;
+}
+
+bool GuiderOneStar::SetMaxStars(int maxStars)
+{
+    bool bError = false;
+
+    try
+    {
+        if (maxStars < MIN_MAX_STARS)
+        {
+            m_maxStars = MIN_MAX_STARS;
+            throw ERROR_INFO("maxStars < MIN_MAX_STARS");
+        }
+        else if (maxStars > MAX_MAX_STARS)
+        {
+            m_maxStars = MAX_MAX_STARS;
+            throw ERROR_INFO("maxStars > MAX_MAX_STARS");
+        }
+        m_maxStars = maxStars;
+    }
+    catch (const wxString& Msg)
+    {
+        POSSIBLY_UNUSED(Msg);
+        bError = true;
+    }
+
+    pConfig->Profile.SetInt("/guider/onestar/MaxStars", m_maxStars);
+
+    return bError;
+}
+
+bool GuiderOneStar::GetFastReacquireEnabled(void)
+{
+    return m_fastReacquireEnabled;
+}
+
+void GuiderOneStar::SetFastReacquireEnabled(bool enable)
+{
+    m_fastReacquireEnabled = enable;
+    pConfig->Profile.SetBoolean("/guider/onestar/FastReacquire", enable);
+}
+
+bool GuiderOneStar::GetPSFFitEnabled(void)
+{
+    return m_psfFitEnabled;
+}
+
+void GuiderOneStar::SetPSFFitEnabled(bool enable)
+{
+    m_psfFitEnabled = enable;
+    pConfig->Profile.SetBoolean("/guider/onestar/PSFFit", enable);
+}
+
+// the find mode for the guide star and secondary star searches
+Star::FindMode GuiderOneStar::StarFindMode(void)
+{
+    Star::FindMode mode = pFrame->GetStarFindMode();
+    if (mode == Star::FIND_CENTROID && m_psfFitEnabled)
+        mode = Star::FIND_PSF_FIT;
+    return mode;
+}
+
 bool GuiderOneStar::SetCurrentPosition(usImage *pImage, const PHD_Point& position)
 {
     bool bError = true;
@@ -278,7 +396,10 @@ bool GuiderOneStar::SetCurrentPosition(usImage *pImage, const PHD_Point& positio
         }
 
         m_massChecker->Reset();
-        bError = !m_star.Find(pImage, m_searchRegion, x, y, pFrame->GetStarFindMode());
+        m_secondaries.clear();
+        m_lostFrames = 0;
+        m_commandedMotion.SetXY(0., 0.);
+        bError = !m_star.Find(pImage, m_searchRegion, x, y, StarFindMode());
     }
     catch (const wxString& Msg)
     {
@@ -382,7 +503,7 @@ bool GuiderOneStar::AutoSelect(void)
 
     try
     {
-        if (!pImage || !pImage->ImageData)
+        if (!pImage || !pImage->HasPixels())
         {
             throw ERROR_INFO("No Current Image");
         }
@@ -397,13 +518,15 @@ bool GuiderOneStar::AutoSelect(void)
         if (pSecondaryMount && pSecondaryMount->IsConnected() && !pSecondaryMount->IsCalibrated())
             edgeAllowance = wxMax(edgeAllowance, pSecondaryMount->CalibrationTotDistance());
 
-        Star newStar;
-        if (!newStar.AutoFind(*pImage, edgeAllowance, m_searchRegion))
+        std::vector<Star> candidates;
+        if (!Star::AutoFindStars(*pImage, edgeAllowance, m_searchRegion, m_multiStarEnabled ? m_maxStars : 1, &candidates))
         {
             throw ERROR_INFO("Unable to AutoFind");
         }
+        const Star& newStar = candidates[0];
 
         m_massChecker->Reset();
+        m_secondaries.clear();
 
         if (!m_star.Find(pImage, m_searchRegion, newStar.X, newStar.Y, Star::FIND_CENTROID))
         {
@@ -415,6 +538,8 @@ bool GuiderOneStar::AutoSelect(void)
             throw ERROR_INFO("Unable to set Lock Position");
         }
 
+        SelectSecondaryStars(pImage, candidates);
+
         if (GetState() == STATE_SELECTING)
         {
             // immediately advance the state machine now, rather than waiting for
@@ -432,7 +557,7 @@ bool GuiderOneStar::AutoSelect(void)
     }
     catch (const wxString& Msg)
     {
-        if (pImage && pImage->ImageData)
+        if (pImage && pImage->HasPixels())
         {
             SaveAutoSelectFailedImg(pImage);
         }
@@ -444,6 +569,127 @@ bool GuiderOneStar::AutoSelect(void)
     return bError;
 }
 
+void GuiderOneStar::SelectSecondaryStars(const usImage *pImage, const std::vector<Star>& candidates)
+{
+    m_secondaries.clear();
+
+    for (size_t i = 1; i < candidates.size(); i++)
+    {
+        SecondaryStar sec;
+        if (!sec.star.Find(pImage, m_searchRegion, candidates[i].X, candidates[i].Y, Star::FIND_CENTROID))
+            continue;
+        sec.offset = sec.star - m_star;
+        sec.frames = 1;
+        sec.missed = 0;
+        m_secondaries.push_back(sec);
+    }
+
+    Debug.Write(wxString::Format("GuiderOneStar: tracking %u secondary stars\n", (unsigned int) m_secondaries.size()));
+}
+
+// Estimate the guide star position from the guide star and each secondary
+// star found this frame. The estimates are averaged with inverse-variance
+// weights (centroid error scales as 1/SNR). Each pass rejects the estimate
+// that deviates most from the mean of the others, if it is more than
+// SecondaryClipSigma times their scatter away; leaving it out of its own
+// mean and scale is what lets a single outlier show up among a few stars.
+PHD_Point GuiderOneStar::CombinedPosition(const Star& guideStar, unsigned int *starsUsed)
+{
+    struct Estimate
+    {
+        double x;
+        double y;
+        double snr;
+        bool used;
+    };
+
+    std::vector<Estimate> est;
+    est.reserve(1 + m_secondaries.size());
+
+    Estimate e0 = { guideStar.X, guideStar.Y, guideStar.SNR, true };
+    est.push_back(e0);
+
+    for (size_t i = 0; i < m_secondaries.size(); i++)
+    {
+        const SecondaryStar& sec = m_secondaries[i];
+        if (sec.missed)
+            continue;
+        Estimate e = { sec.star.X - sec.offset.X, sec.star.Y - sec.offset.Y, sec.star.SNR, true };
+        est.push_back(e);
+    }
+
+    double mx = guideStar.X, my = guideStar.Y;
+    unsigned int nused = est.size();
+
+    enum { MAX_CLIP_PASSES = 3 };
+    for (int pass = 0; ; pass++)
+    {
+        double sw = 0.0, sx = 0.0, sy = 0.0;
+        for (size_t i = 0; i < est.size(); i++)
+        {
+            if (!est[i].used)
+                continue;
+            double w = est[i].snr * est[i].snr;
+            sw += w;
+            sx += w * est[i].x;
+            sy += w * est[i].y;
+        }
+        if (sw <= 0.0)
+            break;
+        mx = sx / sw;
+        my = sy / sw;
+
+        if (pass == MAX_CLIP_PASSES || nused < 3)
+            break;
+
+        int worst = -1;
+        double worstRatio = SecondaryClipSigma;
+        for (size_t i = 0; i < est.size(); i++)
+        {
+            if (!est[i].used)
+                continue;
+
+            double wi = est[i].snr * est[i].snr;
+            double wo = sw - wi;
+            if (wi <= 0.0 || wo <= 0.0)
+                continue;
+            double ox = (sx - wi * est[i].x) / wo;
+            double oy = (sy - wi * est[i].y) / wo;
+
+            // scatter of the other estimates about their mean, normalized
+            // by each one's expected error
+            double sr2 = 0.0;
+            for (size_t j = 0; j < est.size(); j++)
+            {
+                if (j != i && est[j].used)
+                    sr2 += ((est[j].x - ox) * (est[j].x - ox) + (est[j].y - oy) * (est[j].y - oy)) * est[j].snr * est[j].snr;
+            }
+            double scale = sqrt(sr2 / (nused - 2));
+
+            double d = hypot(est[i].x - ox, est[i].y - oy);
+            if (d < SecondaryClipMinPx)
+                continue;
+
+            // the residual's expected error includes that of the others' mean
+            double z = d / sqrt(1.0 / wi + 1.0 / wo);
+            double ratio = scale > 0.0 ? z / scale : DBL_MAX;
+            if (ratio > worstRatio)
+            {
+                worst = i;
+                worstRatio = ratio;
+            }
+        }
+        if (worst < 0)
+            break;
+
+        est[worst].used = false;
+        --nused;
+    }
+
+    *starsUsed = nused;
+    return PHD_Point(mx, my);
+}
+
 bool GuiderOneStar::IsLocked(void)
 {
     return m_star.WasFound();
@@ -493,6 +739,19 @@ wxRect GuiderOneStar::GetBoundingBox(void)
         subframe = false;
     }
 
+    int halfwidth = m_searchRegion + SUBFRAME_BOUNDARY_PX;
+    bool reacquiring = false;
+
+    if (!subframe && m_lostFrames > 0 && m_lostFrames < REACQUIRE_MAX_FRAMES && IsCalibratingOrGuiding())
+    {
+        // the star was lost: read a growing box around where it should be
+        // instead of the full frame
+        subframe = true;
+        reacquiring = true;
+        pos = m_star + m_commandedMotion;
+        halfwidth = ReacquireRadius();
+    }
+
     if (m_forceFullFrame)
     {
         subframe = false;
@@ -500,8 +759,15 @@ wxRect GuiderOneStar::GetBoundingBox(void)
 
     if (subframe)
     {
-        wxRect box(SubframeRect(pos, m_searchRegion + SUBFRAME_BOUNDARY_PX));
-        box.Intersect(wxRect(0, 0, pCamera->FullSize.x, pCamera->FullSize.y));
+        wxRect box(SubframeRect(pos, halfwidth));
+        // cameras take a single subframe, so read the box enclosing all the
+        // secondary star search regions
+        if (!reacquiring)
+        {
+            for (size_t i = 0; i < m_secondaries.size(); i++)
+                box.Union(SubframeRect(pos + m_secondaries[i].offset, halfwidth));
+        }
+        box.Intersect(wxRect(pCamera->ImageSize()));
         return box;
     }
     else
@@ -535,6 +801,16 @@ double GuiderOneStar::HFD(void)
     return m_star.HFD;
 }
 
+double GuiderOneStar::FWHM(void)
+{
+    return m_star.FWHM;
+}
+
+double GuiderOneStar::Ellipticity(void)
+{
+    return m_star.Ellipticity;
+}
+
 int GuiderOneStar::StarError(void)
 {
     return m_star.GetError();
@@ -543,6 +819,9 @@ int GuiderOneStar::StarError(void)
 void GuiderOneStar::InvalidateCurrentPosition(bool fullReset)
 {
     m_star.Invalidate();
+    m_secondaries.clear();
+    m_lostFrames = 0;
+    m_commandedMotion.SetXY(0., 0.);
 
     if (fullReset)
     {
@@ -550,6 +829,147 @@ void GuiderOneStar::InvalidateCurrentPosition(bool fullReset)
     }
 }
 
+struct StarSearch
+{
+    const usImage *image;
+    int searchRegion;
+    Star::FindMode mode;
+    Star *stars;
+};
+
+static void FindStarWork(void *ctx, unsigned int item)
+{
+    StarSearch *search = static_cast<StarSearch *>(ctx);
+    search->stars[item].Find(search->image, search->searchRegion, search->mode);
+}
+
+// take this frame's secondary star search results, dropping stars that
+// have not been found for a while
+void GuiderOneStar::UpdateSecondaryStars(void)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < m_secondaries.size(); i++)
+    {
+        SecondaryStar sec = m_secondaries[i];
+        Star& found = m_findStars[i + 1];
+
+        if (found.WasFound())
+        {
+            sec.star = found;
+            sec.missed = 0;
+        }
+        else if (++sec.missed > SECONDARY_MAX_MISSED)
+        {
+            Debug.Write(wxString::Format("GuiderOneStar: dropping secondary star at offset (%.1f, %.1f)\n", sec.offset.X, sec.offset.Y));
+            continue;
+        }
+
+        m_secondaries[n++] = sec;
+    }
+    m_secondaries.resize(n);
+}
+
+// Average each secondary star's offset from the guide star over recent
+// frames, so the offsets are not stuck with the noise of the frame the stars
+// were selected on and can follow slow differential motion like field rotation.
+void GuiderOneStar::RefineSecondaryOffsets(const PHD_Point& guidePos)
+{
+    for (size_t i = 0; i < m_secondaries.size(); i++)
+    {
+        SecondaryStar& sec = m_secondaries[i];
+        if (sec.missed)
+            continue;
+        if (sec.frames < OFFSET_AVG_FRAMES)
+            ++sec.frames;
+        double k = 1.0 / sec.frames;
+        sec.offset.SetXY(sec.offset.X + (sec.star.X - guidePos.X - sec.offset.X) * k,
+                         sec.offset.Y + (sec.star.Y - guidePos.Y - sec.offset.Y) * k);
+    }
+}
+
+void GuiderOneStar::NotifyCommandedMotion(const PHD_Point& starMotion)
+{
+    m_commandedMotion += starMotion;
+}
+
+// half-width of the box searched for a lost star, doubling with each failed
+// attempt up to a limit
+int GuiderOneStar::ReacquireRadius(void) const
+{
+    unsigned int scale = wxMin(m_lostFrames + 1, (unsigned int) REACQUIRE_MAX_SCALE_LOG2);
+    return m_searchRegion << scale;
+}
+
+// Look for the lost guide star in a box around its predicted position, the
+// last place it was seen plus the motion of any moves made since then. The
+// candidate that best matches the lost star's mass and HFD is taken, so the
+// star can be picked up again as soon as it reappears without going back to
+// full frames.
+bool GuiderOneStar::ReacquireLostStar(const usImage *pImage, Star *newStar)
+{
+    if (!m_fastReacquireEnabled || !IsCalibratingOrGuiding() || m_lostFrames >= REACQUIRE_MAX_FRAMES)
+        return false;
+
+    PHD_Point predicted(m_star + m_commandedMotion);
+    int radius = ReacquireRadius();
+
+    wxRect box(SubframeRect(predicted, radius));
+    box.Intersect(pImage->Subframe.IsEmpty() ? wxRect(pImage->Size) : pImage->Subframe);
+
+    // pick out likely stars on a binned copy of the box, then run the star
+    // searches on those at full resolution
+    std::vector<PHD_Point> peaks;
+    Star::FindCandidates(*pImage, box, REACQUIRE_MAX_CANDIDATES, &peaks);
+
+    std::vector<Star> candidates(peaks.size());
+    for (size_t i = 0; i < peaks.size(); i++)
+        candidates[i].SetXY(peaks[i].X, peaks[i].Y);
+
+    if (!candidates.empty())
+    {
+        StarSearch search = { pImage, m_searchRegion, pFrame->GetStarFindMode(), &candidates[0] };
+        WorkPool::Run(&FindStarWork, &search, candidates.size());
+    }
+
+    Star *best = 0;
+    double bestScore = 0.0;
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        Star& s = candidates[i];
+        if (!s.WasFound() || s.Mass <= 0.0)
+            continue;
+
+        double massDiff = m_star.Mass > 0.0 ? fabs(log(s.Mass / m_star.Mass)) / log(ReacquireMassRatio) : 0.0;
+        double hfdDiff = m_star.HFD > 0.0 ? fabs(s.HFD - m_star.HFD) / m_star.HFD / ReacquireHFDTolerance : 0.0;
+        if (massDiff > 1.0 || hfdDiff > 1.0)
+            continue;
+
+        double score = massDiff + hfdDiff + s.Distance(predicted) / radius;
+        if (!best || score < bestScore)
+        {
+            best = &s;
+            bestScore = score;
+        }
+    }
+
+    if (!best)
+    {
+        ++m_lostFrames;
+        Debug.Write(wxString::Format("GuiderOneStar: lost star not found within %d px of (%.1f, %.1f), attempt %u\n",
+            radius, predicted.X, predicted.Y, m_lostFrames));
+        return false;
+    }
+
+    Debug.Write(wxString::Format("GuiderOneStar: reacquired star at (%.2f, %.2f) predicted (%.2f, %.2f) mass %.0f vs %.0f HFD %.2f vs %.2f\n",
+        best->X, best->Y, predicted.X, predicted.Y, best->Mass, m_star.Mass, best->HFD, m_star.HFD));
+
+    *newStar = *best;
+    m_lostFrames = 0;
+    // the recent masses are from before the star was lost
+    m_massChecker->Reset();
+    return true;
+}
+
 bool GuiderOneStar::UpdateCurrentPosition(usImage *pImage, FrameDroppedInfo *errorInfo)
 {
     if (!m_star.IsValid() && m_star.X == 0.0 && m_star.Y == 0.0)
@@ -568,7 +988,37 @@ bool GuiderOneStar::UpdateCurrentPosition(usImage *pImage, FrameDroppedInfo *err
     {
         Star newStar(m_star);
 
-        if (!newStar.Find(pImage, m_searchRegion, pFrame->GetStarFindMode()))
+        if (m_secondaries.empty())
+        {
+            newStar.Find(pImage, m_searchRegion, StarFindMode());
+        }
+        else
+        {
+            // search for the guide star and the secondary stars in parallel; the
+            // secondary searches are centered where they should be relative to
+            // the guide star's last position
+            m_findStars.resize(1 + m_secondaries.size());
+            m_findStars[0] = m_star;
+            for (size_t i = 0; i < m_secondaries.size(); i++)
+            {
+                m_findStars[i + 1] = m_secondaries[i].star;
+                m_findStars[i + 1].SetXY(m_star.X + m_secondaries[i].offset.X, m_star.Y + m_secondaries[i].offset.Y);
+            }
+
+            StarSearch search = { pImage, m_searchRegion, StarFindMode(), &m_findStars[0] };
+            WorkPool::Run(&FindStarWork, &search, m_findStars.size());
+
+            newStar = m_findStars[0];
+        }
+
+        if (!newStar.WasFound() && ReacquireLostStar(pImage, &newStar))
+        {
+            // the secondary star searches were centered on the old position
+            for (size_t i = 1; i < m_findStars.size(); i++)
+                m_findStars[i].Invalidate();
+        }
+
+        if (!newStar.WasFound())
         {
             errorInfo->starError = newStar.GetError();
             errorInfo->starMass = 0.0;
@@ -597,8 +1047,21 @@ bool GuiderOneStar::UpdateCurrentPosition(usImage *pImage, FrameDroppedInfo *err
             throw THROW_INFO("massChangeThreshold error");
         }
 
+        unsigned int starsUsed = 1;
+        if (!m_secondaries.empty())
+        {
+            UpdateSecondaryStars();
+            PHD_Point pos = CombinedPosition(newStar, &starsUsed);
+            Debug.Write(wxString::Format("GuiderOneStar: guide star (%.2f, %.2f) combined (%.2f, %.2f) from %u stars\n",
+                newStar.X, newStar.Y, pos.X, pos.Y, starsUsed));
+            newStar.SetXY(pos.X, pos.Y);
+            RefineSecondaryOffsets(newStar);
+        }
+
         // update the star position, mass, etc.
         m_star = newStar;
+        m_lostFrames = 0;
+        m_commandedMotion.SetXY(0., 0.);
         m_massChecker->AppendData(newStar.Mass);
 
         const PHD_Point& lockPos = LockPosition();
@@ -613,6 +1076,8 @@ bool GuiderOneStar::UpdateCurrentPosition(usImage *pImage, FrameDroppedInfo *err
         pFrame->AdjustAutoExposure(m_star.SNR);
         pFrame->UpdateStarInfo(m_star.SNR, m_star.GetError() == Star::STAR_SATURATED);
         errorInfo->status = StarStatus(m_star);
+        if (!m_secondaries.empty())
+            errorInfo->status += _T(" ") + wxString::Format(_("Stars=%u"), starsUsed);
     }
     catch (const wxString& Msg)
     {
@@ -776,15 +1241,31 @@ void GuiderOneStar::OnPaint(wxPaintEvent& event)
             DrawBox(dc, m_star, m_searchRegion, m_scaleFactor);
         }
 
+        // secondary stars get a smaller box
+        if (state >= STATE_SELECTED && !m_secondaries.empty())
+        {
+            for (size_t i = 0; i < m_secondaries.size(); i++)
+            {
+                const SecondaryStar& sec = m_secondaries[i];
+                if (sec.missed)
+                    dc.SetPen(wxPen(wxColour(230,130,30), 1, wxDOT));
+                else
+                    dc.SetPen(wxPen(wxColour(0,190,190), 1, wxSOLID));
+                DrawBox(dc, sec.star, m_searchRegion / 2, m_scaleFactor);
+            }
+        }
+
         // Image logging
         if (state >= STATE_SELECTED && pFrame->IsImageLoggingEnabled() && pFrame->m_frameCounter != pFrame->m_loggedImageFrame)
         {
             // only log each image frame once
             pFrame->m_loggedImageFrame = pFrame->m_frameCounter;
 
-            if (pFrame->GetLoggedImageFormat() == LIF_RAW_FITS) // Save star image as a FITS
+            LOGGED_IMAGE_FORMAT format = pFrame->GetLoggedImageFormat();
+
+            if (format == LIF_RAW_FITS || format == LIF_COMPRESSED_FITS) // Save star image as a FITS
             {
-                SaveStarFITS();
+                SaveStarFITS(format == LIF_COMPRESSED_FITS);
             }
             else  // Save star image as a JPEG
             {
@@ -803,17 +1284,14 @@ void GuiderOneStar::OnPaint(wxPaintEvent& event)
                 tmpMdc.Blit(0,0,60,60,&memDC,ROUND(m_star.X * m_scaleFactor) - 30,ROUND(m_star.Y * m_scaleFactor) - 30,wxCOPY,false);
     #endif
                 //          tmpMdc.Blit(0,0,200,200,&Cdc,0,0,wxCOPY);
+                tmpMdc.SelectObject(wxNullBitmap);
 
                 wxString fname = Debug.GetLogDir() + PATHSEPSTR + "PHD_GuideStar" + wxDateTime::Now().Format(_T("_%j_%H%M%S")) + ".jpg";
                 wxImage subImg = SubBmp.ConvertToImage();
                 // subImg.Rescale(120, 120);  zoom up (not now)
-                if (pFrame->GetLoggedImageFormat() == LIF_HI_Q_JPEG)
-                {
-                    // set high(ish) JPEG quality
-                    subImg.SetOption(wxIMAGE_OPTION_QUALITY, 100);
-                }
-                subImg.SaveFile(fname, wxBITMAP_TYPE_JPEG);
-                tmpMdc.SelectObject(wxNullBitmap);
+
+                // set high(ish) JPEG quality for LIF_HI_Q_JPEG; the file is written by the image logger thread
+                ImageLog.QueueJPEG(subImg, fname, format == LIF_HI_Q_JPEG ? 100 : 0);
             }
         }
     }
@@ -823,84 +1301,29 @@ void GuiderOneStar::OnPaint(wxPaintEvent& event)
     }
 }
 
-void GuiderOneStar::SaveStarFITS()
+void GuiderOneStar::SaveStarFITS(bool compress)
 {
     double StarX = m_star.X;
     double StarY = m_star.Y;
     usImage *pImage = CurrentImage();
-    usImage tmpimg;
 
-    tmpimg.Init(60,60);
     int start_x = ROUND(StarX)-30;
     int start_y = ROUND(StarY)-30;
     if ((start_x + 60) > pImage->Size.GetWidth())
         start_x = pImage->Size.GetWidth() - 60;
     if ((start_y + 60) > pImage->Size.GetHeight())
         start_y = pImage->Size.GetHeight() - 60;
-    int x,y, width;
-    width = pImage->Size.GetWidth();
-    unsigned short *usptr = tmpimg.ImageData;
-    for (y=0; y<60; y++)
-        for (x=0; x<60; x++, usptr++)
-            *usptr = *(pImage->ImageData + (y+start_y)*width + (x+start_x));
-
-    wxString fname = Debug.GetLogDir() + PATHSEPSTR + "PHD_GuideStar" + wxDateTime::Now().Format(_T("_%j_%H%M%S")) + ".fit";
-
-    fitsfile *fptr;  // FITS file pointer
-    int status = 0;  // CFITSIO status value MUST be initialized to zero!
-    long fpixel[3] = {1,1,1};
-    long fsize[3];
-    char keyname[9]; // was 9
-    char keycomment[100];
-    char keystring[100];
-    int output_format=USHORT_IMG;
-
-    fsize[0] = 60;
-    fsize[1] = 60;
-    fsize[2] = 0;
-    PHD_fits_create_file(&fptr, fname, false, &status);
-    if (!status)
-    {
-        fits_create_img(fptr,output_format, 2, fsize, &status);
-
-        time_t now = wxDateTime::GetTimeNow();
-        struct tm *timestruct = gmtime(&now);
-        sprintf(keyname,"DATE");
-        sprintf(keycomment,"UTC date that FITS file was created");
-        sprintf(keystring,"%.4d-%.2d-%.2d %.2d:%.2d:%.2d",timestruct->tm_year+1900,timestruct->tm_mon+1,timestruct->tm_mday,timestruct->tm_hour,timestruct->tm_min,timestruct->tm_sec);
-        if (!status) fits_write_key(fptr, TSTRING, keyname, keystring, keycomment, &status);
-
-        sprintf(keyname,"DATE-OBS");
-        sprintf(keycomment,"YYYY-MM-DDThh:mm:ss observation start, UT");
-        sprintf(keystring,"%s", (const char *) pImage->GetImgStartTime().c_str());
-        if (!status) fits_write_key(fptr, TSTRING, keyname, keystring, keycomment, &status);
-
-        sprintf(keyname,"EXPOSURE");
-        sprintf(keycomment,"Exposure time [s]");
-        float dur = (float) pImage->ImgExpDur / 1000.0;
-        if (!status) fits_write_key(fptr, TFLOAT, keyname, &dur, keycomment, &status);
-
-        unsigned int tmp = 1;
-        sprintf(keyname,"XBINNING");
-        sprintf(keycomment,"Camera binning mode");
-        fits_write_key(fptr, TUINT, keyname, &tmp, keycomment, &status);
-        sprintf(keyname,"YBINNING");
-        sprintf(keycomment,"Camera binning mode");
-        fits_write_key(fptr, TUINT, keyname, &tmp, keycomment, &status);
-
-        sprintf(keyname,"XORGSUB");
-        sprintf(keycomment,"Subframe x position in binned pixels");
-        tmp = start_x;
-        fits_write_key(fptr, TINT, keyname, &tmp, keycomment, &status);
-        sprintf(keyname,"YORGSUB");
-        sprintf(keycomment,"Subframe y position in binned pixels");
-        tmp = start_y;
-        fits_write_key(fptr, TINT, keyname, &tmp, keycomment, &status);
-
-        if (!status) fits_write_pix(fptr,TUSHORT,fpixel,tmpimg.NPixels,tmpimg.ImageData,&status);
-
-    }
-    PHD_fits_close_file(fptr);
+    if (start_x < 0)
+        start_x = 0;
+    if (start_y < 0)
+        start_y = 0;
+
+    wxRect crop(start_x, start_y, wxMin(60, pImage->Size.GetWidth()), wxMin(60, pImage->Size.GetHeight()));
+
+    wxString fname = Debug.GetLogDir() + PATHSEPSTR + "PHD_GuideStar" + wxDateTime::Now().Format(_T("_%j_%H%M%S")) + (compress ? ".fit.fz" : ".fit");
+
+    // the crop is copied here and written to disk by the image logger thread
+    ImageLog.QueueFITS(*pImage, crop, fname, compress);
 }
 
 wxString GuiderOneStar::GetSettingsSummary()
@@ -913,6 +1336,12 @@ wxString GuiderOneStar::GetSettingsSummary()
     else
         s += _T("disabled\n");
 
+    if (GetMultiStarEnabled())
+        s += wxString::Format(_T("Multi-star mode, max stars = %d, secondary stars = %u\n"), GetMaxStars(), (unsigned int) m_secondaries.size());
+
+    s += wxString::Format(_T("Fast star reacquisition = %s, PSF fit centroid = %s\n"),
+        GetFastReacquireEnabled() ? _T("enabled") : _T("disabled"), GetPSFFitEnabled() ? _T("enabled") : _T("disabled"));
+
     return s;
 }
 
@@ -969,9 +1398,35 @@ GuiderOneStarConfigDialogCtrlSet::GuiderOneStarConfigDialogCtrlSet(wxWindow *pPa
     pStarMass->Add(m_pEnableStarMassChangeThresh, wxSizerFlags(0).Border(wxTOP, 3));
     pStarMass->Add(pTolerance, wxSizerFlags(0).Border(wxLEFT, 40));
 
-    wxFlexGridSizer *pTrackingParams = new wxFlexGridSizer(1, 2, 5, 15);
+    wxStaticBoxSizer *pMultiStar = new wxStaticBoxSizer(wxHORIZONTAL, GetParentWindow(AD_szStarTracking), _("Multiple Stars"));
+    m_pEnableMultiStar = new wxCheckBox(GetParentWindow(AD_szStarTracking), MULTI_STAR_ENABLE, _("Use multiple stars"));
+    m_pEnableMultiStar->SetToolTip(_("Check to have Auto-select Star also pick additional stars. Their motion is averaged "
+        "with the guide star's to reduce the effect of seeing on the guide star position."));
+
+    GetParentWindow(AD_szStarTracking)->Bind(wxEVT_COMMAND_CHECKBOX_CLICKED, &GuiderOneStarConfigDialogCtrlSet::OnMultiStarEnableChecked, this, MULTI_STAR_ENABLE);
+
+    width = StringWidth(_T("000"));
+    m_pMaxStars = pFrame->MakeSpinCtrl(GetParentWindow(AD_szStarTracking), wxID_ANY, _T(" "), wxDefaultPosition,
+        wxSize(width, -1), wxSP_ARROW_KEYS, MIN_MAX_STARS, MAX_MAX_STARS, DEFAULT_MAX_STARS, _T("MaxStars"));
+    wxSizer *pMaxStars = MakeLabeledControl(AD_szStarTracking, _("Max stars"), m_pMaxStars,
+        _("Maximum number of stars to use, including the guide star. Default = 9"));
+    pMultiStar->Add(m_pEnableMultiStar, wxSizerFlags(0).Border(wxTOP, 3));
+    pMultiStar->Add(pMaxStars, wxSizerFlags(0).Border(wxLEFT, 40));
+
+    m_pFastReacquire = new wxCheckBox(GetParentWindow(AD_szStarTracking), wxID_ANY, _("Fast star reacquisition"));
+    m_pFastReacquire->SetToolTip(_("Check to have PHD look for a lost guide star in a growing area around where it "
+        "should be, and resume guiding on it as soon as it reappears, without downloading full frames."));
+
+    m_pPSFFit = new wxCheckBox(GetParentWindow(AD_szStarTracking), wxID_ANY, _("Fit star PSF"));
+    m_pPSFFit->SetToolTip(_("Check to measure the guide star position by fitting a Gaussian to the star image instead of "
+        "taking its center of mass. More accurate for undersampled or saturated stars, and reports the star FWHM and ellipticity."));
+
+    wxFlexGridSizer *pTrackingParams = new wxFlexGridSizer(3, 2, 5, 15);
     pTrackingParams->Add(pSearchRegion, wxSizerFlags(0).Border(wxTOP, 10));
     pTrackingParams->Add(pStarMass,wxSizerFlags(0).Border(wxLEFT, 75));
+    pTrackingParams->Add(m_pFastReacquire, wxSizerFlags(0).Border(wxTOP, 10));
+    pTrackingParams->Add(pMultiStar, wxSizerFlags(0).Border(wxLEFT, 75));
+    pTrackingParams->Add(m_pPSFFit, wxSizerFlags(0).Border(wxTOP, 3));
 
     AddGroup(CtrlMap, AD_szStarTracking, pTrackingParams);
 
@@ -989,6 +1444,12 @@ void GuiderOneStarConfigDialogCtrlSet::LoadValues()
     m_pMassChangeThreshold->Enable(starMassEnabled);
     m_pMassChangeThreshold->SetValue(100.0 * m_pGuiderOneStar->GetMassChangeThreshold());
     m_pSearchRegion->SetValue(m_pGuiderOneStar->GetSearchRegion());
+    bool multiStar = m_pGuiderOneStar->GetMultiStarEnabled();
+    m_pEnableMultiStar->SetValue(multiStar);
+    m_pMaxStars->Enable(multiStar);
+    m_pMaxStars->SetValue(m_pGuiderOneStar->GetMaxStars());
+    m_pFastReacquire->SetValue(m_pGuiderOneStar->GetFastReacquireEnabled());
+    m_pPSFFit->SetValue(m_pGuiderOneStar->GetPSFFitEnabled());
     GuiderConfigDialogCtrlSet::LoadValues();
 }
 
@@ -997,6 +1458,10 @@ void GuiderOneStarConfigDialogCtrlSet::UnloadValues()
     m_pGuiderOneStar->SetMassChangeThresholdEnabled(m_pEnableStarMassChangeThresh->GetValue());
     m_pGuiderOneStar->SetMassChangeThreshold(m_pMassChangeThreshold->GetValue() / 100.0);
     m_pGuiderOneStar->SetSearchRegion(m_pSearchRegion->GetValue());
+    m_pGuiderOneStar->SetMultiStarEnabled(m_pEnableMultiStar->GetValue());
+    m_pGuiderOneStar->SetMaxStars(m_pMaxStars->GetValue());
+    m_pGuiderOneStar->SetFastReacquireEnabled(m_pFastReacquire->GetValue());
+    m_pGuiderOneStar->SetPSFFitEnabled(m_pPSFFit->GetValue());
     GuiderConfigDialogCtrlSet::UnloadValues();
 }
 
@@ -1004,3 +1469,8 @@ void GuiderOneStarConfigDialogCtrlSet::OnStarMassEnableChecked(wxCommandEvent& e
 {
     m_pMassChangeThreshold->Enable(event.IsChecked());
 }
+
+void GuiderOneStarConfigDialogCtrlSet::OnMultiStarEnableChecked(wxCommandEvent& event)
+{
+    m_pMaxStars->Enable(event.IsChecked());
+}
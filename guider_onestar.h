@@ -55,21 +55,43 @@ public:
     wxSpinCtrl *m_pSearchRegion;
     wxCheckBox *m_pEnableStarMassChangeThresh;
     wxSpinCtrlDouble *m_pMassChangeThreshold;
+    wxCheckBox *m_pEnableMultiStar;
+    wxSpinCtrl *m_pMaxStars;
+    wxCheckBox *m_pFastReacquire;
+    wxCheckBox *m_pPSFFit;
 
     virtual void LoadValues(void);
     virtual void UnloadValues(void);
     void OnStarMassEnableChecked(wxCommandEvent& event);
+    void OnMultiStarEnableChecked(wxCommandEvent& event);
 };
 
 class GuiderOneStar : public Guider
 {
 private:
+    // an additional star tracked to average out centroid noise on the guide star
+    struct SecondaryStar
+    {
+        Star star;
+        PHD_Point offset;       // position relative to the guide star
+        unsigned int frames;    // frames the offset has been averaged over
+        unsigned int missed;    // consecutive frames the star was not found
+    };
+
     Star m_star;
     MassChecker *m_massChecker;
+    std::vector<SecondaryStar> m_secondaries;
+    std::vector<Star> m_findStars;          // scratch for the per-frame star search
+    unsigned int m_lostFrames;              // failed attempts to reacquire the lost guide star
+    PHD_Point m_commandedMotion;            // expected star motion from moves since the star was last found
 
     // parameters
     bool m_massChangeThresholdEnabled;
     double m_massChangeThreshold;
+    bool m_multiStarEnabled;
+    int m_maxStars;                         // including the guide star
+    bool m_fastReacquireEnabled;
+    bool m_psfFitEnabled;
 
 public:
     class GuiderOneStarConfigDialogPane : public GuiderConfigDialogPane
@@ -90,6 +112,14 @@ public:
     double GetMassChangeThreshold(void);
     bool SetMassChangeThreshold(double starMassChangeThreshold);
     bool SetSearchRegion(int searchRegion);
+    bool GetMultiStarEnabled(void);
+    void SetMultiStarEnabled(bool enable);
+    int GetMaxStars(void);
+    bool SetMaxStars(int maxStars);
+    bool GetFastReacquireEnabled(void);
+    void SetFastReacquireEnabled(bool enable);
+    bool GetPSFFitEnabled(void);
+    void SetPSFFitEnabled(bool enable);
 
     friend class GuiderOneStarConfigDialogPane;
     friend class GuiderOneStarConfigDialogCtrlSet;
@@ -109,6 +139,8 @@ public:
     unsigned int StarPeakADU(void);
     double SNR(void);
     double HFD(void);
+    double FWHM(void);
+    double Ellipticity(void);
     int StarError(void);
     wxString GetSettingsSummary();
 
@@ -116,16 +148,24 @@ public:
     GuiderConfigDialogCtrlSet *GetConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap);
 
     void LoadProfileSettings(void);
+    void NotifyCommandedMotion(const PHD_Point& starMotion);
 
 private:
     bool IsValidLockPosition(const PHD_Point& pt);
+    Star::FindMode StarFindMode(void);
     void InvalidateCurrentPosition(bool fullReset = false);
     bool UpdateCurrentPosition(usImage *pImage, FrameDroppedInfo *errorInfo);
     bool SetCurrentPosition(usImage *pImage, const PHD_Point& position);
+    void SelectSecondaryStars(const usImage *pImage, const std::vector<Star>& candidates);
+    void UpdateSecondaryStars(void);
+    PHD_Point CombinedPosition(const Star& guideStar, unsigned int *starsUsed);
+    void RefineSecondaryOffsets(const PHD_Point& guidePos);
+    int ReacquireRadius(void) const;
+    bool ReacquireLostStar(const usImage *pImage, Star *newStar);
 
     void OnLClick(wxMouseEvent& evt);
 
-    void SaveStarFITS();
+    void SaveStarFITS(bool compress);
 
     DECLARE_EVENT_TABLE()
 };
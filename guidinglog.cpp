@@ -35,19 +35,618 @@
 
 #include "phd.h"
 
+#include "guide_session.h"
+
+#include <atomic>
+#include <stddef.h>
+
+#ifdef __WINDOWS__
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
 #define GUIDELOG_VERSION _T("2.5")
 
 const int RetentionPeriod = 60;
 
+// Guide log output is formatted and written by a background thread. The
+// guiding path only fills fixed-size records in a lock-free ring: a caller
+// claims slots with a compare-and-swap and publishes them with a store, so it
+// never allocates, locks or waits. The writer thread formats the records
+// into a reusable byte buffer and writes the buffer to the file every couple
+// of seconds or when it gets large.
+//
+// When session recording is enabled the writer thread also records every
+// entry in a binary guide session file (see tools/guide_session), which
+// phd2_session2csv can turn back into this text log.
+
+struct GuideLogRecord
+{
+    enum RecordType
+    {
+        REC_TEXT,
+        REC_GUIDE_STEP,
+        REC_FRAME_DROPPED,
+        REC_CALIBRATION_STEP,
+        REC_PARAM
+    };
+
+    enum { TEXT_SIZE = 232 };
+
+    unsigned char type;
+    bool more;                  // REC_TEXT: the line continues in the next record
+    unsigned short textLen;     // bytes used in text
+    unsigned short nameLen;     // REC_PARAM: text holds the name followed by the value
+    union
+    {
+        GuideSession::Step step;
+        GuideSession::FrameDropped drop;
+        GuideSession::CalibrationStep cal;
+    };
+    char text[TEXT_SIZE];       // UTF-8: text, drop status, calibration direction or param name and value
+};
+
+struct GuideLogSlot
+{
+    std::atomic<size_t> seq;    // == position: free, == position + 1: published
+    GuideLogRecord rec;
+};
+
+class GuideLogWriter : public wxThread
+{
+    enum
+    {
+        RING_SIZE = 4096,
+        RING_MASK = RING_SIZE - 1,
+        MAX_TEXT_RECORDS = 64,              // longer text is truncated
+        DRAIN_INTERVAL_MS = 250,
+        FLUSH_INTERVAL_MS = 2000,
+        FLUSH_SIZE = 64 * 1024,
+        FLUSH_TIMEOUT_MS = 5000,
+        EMERGENCY_BUF_SIZE = 16 * 1024
+    };
+
+    wxFFile *m_file;
+    wxMutex m_fileLock;
+    GuideSession::Writer m_session;
+
+    GuideLogSlot *m_ring;
+    std::atomic<size_t> m_enqueuePos;
+    std::atomic<size_t> m_dequeuePos;       // only advanced by the consumer
+    std::atomic<unsigned int> m_lost;
+    volatile bool m_stop;
+    wxSemaphore m_wake;
+
+    // Flush() requests a generation and waits until the writer has written
+    // everything up to it; a flush that timed out leaves nothing behind
+    std::atomic<unsigned int> m_flushRequested;
+    wxMutex m_flushLock;
+    wxCondition m_flushCond;
+    unsigned int m_flushed;
+
+    // formatted output waiting to be written
+    char *m_buf;
+    volatile size_t m_len;
+    size_t m_size;
+    std::string m_line;
+    std::string m_text;         // text line being reassembled from REC_TEXT records
+
+    // held by whoever consumes the ring and m_buf: the writer thread, or the
+    // fatal exception handler when the writer is not in the middle of it
+    std::atomic<bool> m_consuming;
+    char *m_emergencyBuf;
+
+    bool Claim(unsigned int n, size_t *pos);
+    void Publish(size_t pos, unsigned int n);
+    void Reserve(size_t n);
+    void AppendBytes(const char *s, size_t len);
+    void Append(const char *fmt, ...);
+    void Format(const GuideLogRecord& rec);
+    void Drain();
+    bool WriteBuffer();
+
+public:
+    GuideLogWriter(wxFFile *file, FILE *sessionFile);
+    ~GuideLogWriter();
+
+    bool PushText(const wxString& str);
+    bool Push(GuideLogRecord& rec, const wxString& text, const wxString& value = wxEmptyString);
+    bool Flush();
+    void Stop();
+    void EmergencyFlush();
+    wxMutex& FileLock() { return m_fileLock; }
+
+protected:
+    ExitCode Entry();
+};
+
+static size_t Utf8Len(const wxString& str)
+{
+    size_t n = 0;
+    for (wxString::const_iterator it = str.begin(); it != str.end(); ++it)
+    {
+        wxUint32 c = (*it).GetValue();
+        n += c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+    }
+    return n;
+}
+
+// UTF-8 encode characters of str starting at it into dst, as many whole
+// characters as fit in size bytes; returns the number of bytes written
+static unsigned int CopyUtf8(char *dst, unsigned int size, const wxString& str, wxString::const_iterator& it)
+{
+    unsigned int n = 0;
+
+    for (; it != str.end(); ++it)
+    {
+        wxUint32 c = (*it).GetValue();
+        unsigned int len = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (n + len > size)
+            break;
+
+        switch (len)
+        {
+        case 1:
+            dst[n] = (char) c;
+            break;
+        case 2:
+            dst[n] = (char)(0xC0 | (c >> 6));
+            dst[n + 1] = (char)(0x80 | (c & 0x3F));
+            break;
+        case 3:
+            dst[n] = (char)(0xE0 | (c >> 12));
+            dst[n + 1] = (char)(0x80 | ((c >> 6) & 0x3F));
+            dst[n + 2] = (char)(0x80 | (c & 0x3F));
+            break;
+        default:
+            dst[n] = (char)(0xF0 | (c >> 18));
+            dst[n + 1] = (char)(0x80 | ((c >> 12) & 0x3F));
+            dst[n + 2] = (char)(0x80 | ((c >> 6) & 0x3F));
+            dst[n + 3] = (char)(0x80 | (c & 0x3F));
+            break;
+        }
+        n += len;
+    }
+
+    return n;
+}
+
+GuideLogWriter::GuideLogWriter(wxFFile *file, FILE *sessionFile)
+    : wxThread(wxTHREAD_JOINABLE),
+    m_file(file),
+    m_enqueuePos(0),
+    m_dequeuePos(0),
+    m_lost(0),
+    m_stop(false),
+    m_wake(0, 1),
+    m_flushRequested(0),
+    m_flushCond(m_flushLock),
+    m_flushed(0),
+    m_len(0),
+    m_size(FLUSH_SIZE + 4096),
+    m_consuming(false)
+{
+    m_ring = new GuideLogSlot[RING_SIZE];
+    for (size_t i = 0; i < RING_SIZE; i++)
+        m_ring[i].seq.store(i, std::memory_order_relaxed);
+    m_buf = new char[m_size];
+    m_emergencyBuf = new char[EMERGENCY_BUF_SIZE];
+    m_line.reserve(512);
+    m_text.reserve(512);
+
+    if (sessionFile && m_session.Begin(sessionFile))
+        Debug.AddLine("GuideLog: error writing guide session file");
+}
+
+GuideLogWriter::~GuideLogWriter()
+{
+    delete[] m_ring;
+    delete[] m_buf;
+    delete[] m_emergencyBuf;
+}
+
+// claim n consecutive slots for the caller to fill; returns false, counting
+// the loss, if the ring is full. The consumer frees slots in order, so when
+// the last of the n slots is free the ones before it are too.
+bool GuideLogWriter::Claim(unsigned int n, size_t *pos)
+{
+    size_t p = m_enqueuePos.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        size_t last = p + n - 1;
+        size_t seq = m_ring[last & RING_MASK].seq.load(std::memory_order_acquire);
+        ptrdiff_t dif = (ptrdiff_t) (seq - last);
+
+        if (dif == 0)
+        {
+            if (m_enqueuePos.compare_exchange_weak(p, p + n, std::memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+        {
+            // the writer is stalled on the disk; never block the guiding thread
+            ++m_lost;
+            return false;
+        }
+        else
+            p = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    *pos = p;
+    return true;
+}
+
+void GuideLogWriter::Publish(size_t pos, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+        m_ring[(pos + i) & RING_MASK].seq.store(pos + i + 1, std::memory_order_release);
+
+    // the writer polls; only wake it early when the ring is filling up
+    if (pos + n - m_dequeuePos.load(std::memory_order_relaxed) > RING_SIZE / 2)
+        m_wake.Post();
+}
+
+// queue a line of text, split over as many records as it needs; returns true
+// if the text was discarded
+bool GuideLogWriter::PushText(const wxString& str)
+{
+    // CopyUtf8 does not split characters, so allow for a partly used record
+    size_t len = Utf8Len(str);
+    unsigned int n = wxMin((unsigned int) ((len + GuideLogRecord::TEXT_SIZE - 4) / (GuideLogRecord::TEXT_SIZE - 3)),
+        (unsigned int) MAX_TEXT_RECORDS);
+    if (n == 0)
+        n = 1;
+
+    size_t pos;
+    if (!Claim(n, &pos))
+        return true;
+
+    wxString::const_iterator it = str.begin();
+    for (unsigned int i = 0; i < n; i++)
+    {
+        GuideLogRecord& rec = m_ring[(pos + i) & RING_MASK].rec;
+        rec.type = GuideLogRecord::REC_TEXT;
+        rec.textLen = CopyUtf8(rec.text, GuideLogRecord::TEXT_SIZE, str, it);
+        rec.more = i < n - 1;
+    }
+
+    Publish(pos, n);
+
+    return false;
+}
+
+// queue a record with its text (and param value); text that does not fit is
+// truncated. Returns true if the record was discarded.
+bool GuideLogWriter::Push(GuideLogRecord& rec, const wxString& text, const wxString& value)
+{
+    wxString::const_iterator it = text.begin();
+    rec.nameLen = CopyUtf8(rec.text, GuideLogRecord::TEXT_SIZE, text, it);
+    it = value.begin();
+    rec.textLen = rec.nameLen + CopyUtf8(rec.text + rec.nameLen, GuideLogRecord::TEXT_SIZE - rec.nameLen, value, it);
+    rec.more = false;
+
+    size_t pos;
+    if (!Claim(1, &pos))
+        return true;
+
+    GuideLogRecord& dst = m_ring[pos & RING_MASK].rec;
+    memcpy(&dst, &rec, offsetof(GuideLogRecord, text) + rec.textLen);
+
+    Publish(pos, 1);
+
+    return false;
+}
+
+// write everything queued so far to disk, waiting for completion
+bool GuideLogWriter::Flush()
+{
+    unsigned int gen = ++m_flushRequested;
+    m_wake.Post();
+
+    wxStopWatch swatch;
+    wxMutexLocker lck(m_flushLock);
+
+    while ((int) (m_flushed - gen) < 0)
+    {
+        long remaining = FLUSH_TIMEOUT_MS - swatch.Time();
+        if (remaining <= 0 || m_flushCond.WaitTimeout(remaining) == wxCOND_TIMEOUT)
+            return (int) (m_flushed - gen) < 0;
+    }
+
+    return false;
+}
+
+void GuideLogWriter::Stop()
+{
+    m_stop = true;
+    m_wake.Post();
+    Wait();
+}
+
+static void emergency_write(int fd, const char *buf, size_t len)
+{
+#ifdef __WINDOWS__
+    _write(fd, buf, (unsigned int) len);
+#else
+    ssize_t ret = write(fd, buf, len);
+    POSSIBLY_UNUSED(ret);
+#endif
+}
+
+// Called from the fatal exception handler, which on Unix is a signal
+// handler, so this only copies and write()s bytes that are already text: the
+// formatted output not yet written, then the queued text lines. Queued guide
+// steps and other records would need formatting and are left out. Nothing is
+// done if the writer thread is in the middle of consuming the ring.
+void GuideLogWriter::EmergencyFlush()
+{
+    FILE *fp = m_file->fp();
+    if (!fp)
+        return;
+
+    if (m_consuming.exchange(true, std::memory_order_acquire))
+        return;
+
+#ifdef __WINDOWS__
+    int fd = _fileno(fp);
+#else
+    int fd = fileno(fp);
+#endif
+
+    if (m_len > 0)
+        emergency_write(fd, m_buf, m_len);
+    m_len = 0;
+
+    size_t len = 0;
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        GuideLogSlot& slot = m_ring[pos & RING_MASK];
+        if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+            break;
+
+        const GuideLogRecord& rec = slot.rec;
+        if (rec.type == GuideLogRecord::REC_TEXT)
+        {
+            if (len + rec.textLen > EMERGENCY_BUF_SIZE)
+            {
+                emergency_write(fd, m_emergencyBuf, len);
+                len = 0;
+            }
+            memcpy(m_emergencyBuf + len, rec.text, rec.textLen);
+            len += rec.textLen;
+        }
+
+        slot.seq.store(pos + RING_SIZE, std::memory_order_release);
+        ++pos;
+        m_dequeuePos.store(pos, std::memory_order_relaxed);
+    }
+
+    if (len > 0)
+        emergency_write(fd, m_emergencyBuf, len);
+
+    m_consuming.store(false, std::memory_order_release);
+}
+
+void GuideLogWriter::Reserve(size_t n)
+{
+    if (m_len + n <= m_size)
+        return;
+
+    size_t newSize = wxMax(m_size * 2, m_len + n);
+    char *buf = new char[newSize];
+    memcpy(buf, m_buf, m_len);
+    delete[] m_buf;
+    m_buf = buf;
+    m_size = newSize;
+}
+
+void GuideLogWriter::AppendBytes(const char *s, size_t len)
+{
+    Reserve(len);
+    memcpy(m_buf + m_len, s, len);
+    m_len += len;
+}
+
+void GuideLogWriter::Append(const char *fmt, ...)
+{
+    va_list ap;
+
+    Reserve(512);
+
+    va_start(ap, fmt);
+    int n = vsnprintf(m_buf + m_len, m_size - m_len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return;
+
+    if ((size_t) n >= m_size - m_len)
+    {
+        Reserve(n + 1);
+        va_start(ap, fmt);
+        vsnprintf(m_buf + m_len, m_size - m_len, fmt, ap);
+        va_end(ap);
+    }
+
+    m_len += n;
+}
+
+// format a record into the output buffer and add it to the session file
+void GuideLogWriter::Format(const GuideLogRecord& rec)
+{
+    if (rec.type == GuideLogRecord::REC_TEXT)
+    {
+        AppendBytes(rec.text, rec.textLen);
+        // the session file gets one text entry per line queued
+        m_text.append(rec.text, rec.textLen);
+        if (!rec.more)
+        {
+            m_session.AddText(m_text.data(), m_text.size());
+            m_text.clear();
+        }
+        return;
+    }
+
+    m_line.clear();
+
+    // the format functions and the session writer take NUL-terminated strings
+    std::string text(rec.text, rec.type == GuideLogRecord::REC_PARAM ? rec.nameLen : rec.textLen);
+
+    switch (rec.type)
+    {
+    case GuideLogRecord::REC_GUIDE_STEP:
+        GuideSession::FormatStep(m_line, rec.step);
+        m_session.AddStep(rec.step);
+        break;
+
+    case GuideLogRecord::REC_FRAME_DROPPED:
+        GuideSession::FormatFrameDropped(m_line, rec.drop, text.c_str());
+        m_session.AddFrameDropped(rec.drop, text.c_str());
+        break;
+
+    case GuideLogRecord::REC_CALIBRATION_STEP:
+        GuideSession::FormatCalibrationStep(m_line, text.c_str(), rec.cal);
+        m_session.AddCalibrationStep(text.c_str(), rec.cal);
+        break;
+
+    case GuideLogRecord::REC_PARAM:
+    {
+        std::string value(rec.text + rec.nameLen, rec.textLen - rec.nameLen);
+        GuideSession::FormatParam(m_line, text.c_str(), value.c_str());
+        m_session.AddParam(text.c_str(), value.c_str());
+        break;
+    }
+    }
+
+    AppendBytes(m_line.data(), m_line.size());
+}
+
+// format every published record, stopping at the first one still being filled
+void GuideLogWriter::Drain()
+{
+    unsigned int lost = m_lost.exchange(0);
+    if (lost)
+        Append("INFO: %u guide log entries were lost, the log file could not be written fast enough\n", lost);
+
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        GuideLogSlot& slot = m_ring[pos & RING_MASK];
+        if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+            break;
+
+        Format(slot.rec);
+
+        slot.seq.store(pos + RING_SIZE, std::memory_order_release);
+        ++pos;
+        m_dequeuePos.store(pos, std::memory_order_relaxed);
+    }
+}
+
+bool GuideLogWriter::WriteBuffer()
+{
+    bool bError = false;
+
+    wxMutexLocker lck(m_fileLock);
+
+    if (m_len > 0 && m_file->IsOpened())
+    {
+        if (m_file->Write(m_buf, m_len) != m_len || !m_file->Flush())
+        {
+            Debug.AddLine("GuideLog: error writing guide log file");
+            bError = true;
+        }
+    }
+
+    m_len = 0;
+
+    return bError;
+}
+
+wxThread::ExitCode GuideLogWriter::Entry()
+{
+    wxStopWatch sinceWrite;
+    unsigned int flushed = 0;
+
+    while (true)
+    {
+        m_wake.WaitTimeout(DRAIN_INTERVAL_MS);
+
+        // read these before draining so the drain covers everything queued
+        // before the stop or flush request
+        bool stop = m_stop;
+        unsigned int flushRequested = m_flushRequested.load();
+
+        // the fatal exception handler has the ring; try again next time
+        if (m_consuming.exchange(true, std::memory_order_acquire))
+            continue;
+
+        Drain();
+
+        bool flush = flushRequested != flushed;
+
+        if (flush || stop || m_len >= FLUSH_SIZE || (m_len > 0 && sinceWrite.Time() >= FLUSH_INTERVAL_MS))
+        {
+            WriteBuffer();
+            m_consuming.store(false, std::memory_order_release);
+            // the session file keeps pace with the text log, so a crash
+            // loses no more of it than of the log
+            if (m_session.Flush())
+                Debug.AddLine("GuideLog: error writing guide session file");
+            sinceWrite.Start();
+        }
+        else
+            m_consuming.store(false, std::memory_order_release);
+
+        if (flush)
+        {
+            flushed = flushRequested;
+            wxMutexLocker lck(m_flushLock);
+            m_flushed = flushed;
+            m_flushCond.Broadcast();
+        }
+
+        if (stop)
+            break;
+    }
+
+    if (m_session.End())
+        Debug.AddLine("GuideLog: error writing guide session file");
+
+    return 0;
+}
+
 GuidingLog::GuidingLog(void)
     : m_enabled(false),
     m_keepFile(false),
-    m_isGuiding(false)
+    m_isGuiding(false),
+    m_writer(0),
+    m_sessionFile(0)
 {
 }
 
 GuidingLog::~GuidingLog(void)
 {
+    delete m_writer;
+}
+
+void GuidingLog::Write(const wxString& str)
+{
+    if (!m_writer)
+        return;
+
+    m_writer->PushText(str);
+}
+
+void GuidingLog::EmergencyFlush(void)
+{
+    if (m_writer)
+        m_writer->EmergencyFlush();
 }
 
 bool GuidingLog::EnableLogging(void)
@@ -65,7 +664,16 @@ bool GuidingLog::EnableLogging(void)
             m_fileName = GetLogDir() + PATHSEPSTR + "PHD2_GuideLog" + now.Format(_T("_%Y-%m-%d")) +
                 now.Format(_T("_%H%M%S")) + ".txt";
 
-            if (!m_file.Open(m_fileName, "w"))
+            bool opened;
+            if (m_writer)
+            {
+                wxMutexLocker lck(m_writer->FileLock());
+                opened = m_file.Open(m_fileName, "w");
+            }
+            else
+                opened = m_file.Open(m_fileName, "w");
+
+            if (!opened)
             {
                 throw ERROR_INFO("unable to open file");
             }
@@ -74,12 +682,39 @@ bool GuidingLog::EnableLogging(void)
 
         assert(m_file.IsOpened());
 
-        m_file.Write(_T("PHD2 version ") FULLVER _T(", Log version ") GUIDELOG_VERSION _T(". Log enabled at ") +
+        if (!m_writer)
+        {
+            // optional binary recording of the session, named to match the log file
+            if (pConfig->Global.GetBoolean("/GuideLog/SessionRecording", false))
+            {
+                wxFileName fn(m_fileName);
+                wxString name = fn.GetName();
+                name.Replace("PHD2_GuideLog", "PHD2_GuideSession");
+                fn.SetName(name);
+                fn.SetExt("phds");
+                m_sessionFileName = fn.GetFullPath();
+                m_sessionFile = wxFopen(m_sessionFileName, "wb");
+                if (!m_sessionFile)
+                    Debug.AddLine("GuideLog: unable to create session file " + m_sessionFileName);
+            }
+
+            GuideLogWriter *writer = new GuideLogWriter(&m_file, m_sessionFile);
+            if (writer->Create() != wxTHREAD_NO_ERROR || writer->Run() != wxTHREAD_NO_ERROR)
+            {
+                delete writer;
+                CloseSessionFile();
+                throw ERROR_INFO("unable to start guide log writer thread");
+            }
+            m_writer = writer;
+        }
+
+        Write(_T("PHD2 version ") FULLVER _T(", Log version ") GUIDELOG_VERSION _T(". Log enabled at ") +
             now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
-        Flush();
 
         m_enabled = true;
 
+        Flush();
+
         // persist state
         pConfig->Global.SetBoolean("/LoggingMode", m_enabled);
 
@@ -113,8 +748,8 @@ void GuidingLog::DisableLogging(void)
     assert(m_file.IsOpened());
     wxDateTime now = wxDateTime::Now();
 
-    m_file.Write("\n");
-    m_file.Write("Log disabled at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    Write("\n");
+    Write("Log disabled at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
     Flush();
     m_enabled = false;
 
@@ -147,11 +782,22 @@ bool GuidingLog::ChangeDirLog(const wxString& newdir)
 void GuidingLog::RemoveOldFiles()
 {
     Logger::RemoveMatchingFiles("PHD2_GuideLog*.txt", RetentionPeriod);
+    Logger::RemoveMatchingFiles("PHD2_GuideSession*.phds", RetentionPeriod);
+}
+
+void GuidingLog::CloseSessionFile(void)
+{
+    if (m_sessionFile)
+    {
+        if (fclose(m_sessionFile) != 0)
+            Debug.AddLine("GuideLog: error closing session file " + m_sessionFileName);
+        m_sessionFile = 0;
+    }
 }
 
 bool GuidingLog::Flush(void)
 {
-    if (!m_enabled)
+    if (!m_enabled || !m_writer)
         return false;
 
     bool bError = false;
@@ -160,7 +806,8 @@ bool GuidingLog::Flush(void)
     {
         assert(m_file.IsOpened());
 
-        if (!m_file.Flush())
+        // wait for the writer thread to get everything queued so far on disk
+        if (m_writer->Flush())
         {
             throw ERROR_INFO("unable to flush file");
         }
@@ -177,20 +824,40 @@ bool GuidingLog::Flush(void)
 void GuidingLog::Close(void)
 {
     if (!m_enabled)
+    {
+        // logging was disabled, but the writer thread is still running
+        if (m_writer)
+        {
+            m_writer->Stop();
+            delete m_writer;
+            m_writer = 0;
+            CloseSessionFile();
+        }
         return;
+    }
 
     assert(m_file.IsOpened());
     wxDateTime now = wxDateTime::Now();
 
-    m_file.Write("\n");
-    m_file.Write("Log closed at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    Write("\n");
+    Write("Log closed at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
     Flush();
+
+    m_writer->Stop();
+    delete m_writer;
+    m_writer = 0;
+
+    bool haveSession = m_sessionFile != 0;
+    CloseSessionFile();
+
     m_file.Close();
     m_enabled = false;
 
     if (!m_keepFile)            // Delete the file if nothing useful was logged
     {
         wxRemove(m_fileName);
+        if (haveSession)
+            wxRemove(m_sessionFileName);
     }
 }
 
@@ -254,36 +921,35 @@ void GuidingLog::StartCalibration(Mount *pCalibrationMount)
     assert(m_file.IsOpened());
     wxDateTime now = wxDateTime::Now();
 
-    m_file.Write("\n");
-    m_file.Write("Calibration Begins at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
-    m_file.Write("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
+    Write("\n");
+    Write("Calibration Begins at " + now.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    Write("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
 
     assert(pCalibrationMount && pCalibrationMount->IsConnected());
 
     if (pCamera)
     {
         // phdlab v0.5.3 expects camera name on a line by itself
-        m_file.Write(wxString::Format("Camera = %s\nExposure = %s\n",
+        Write(wxString::Format("Camera = %s\nExposure = %s\n",
             pCamera->Name, pFrame->ExposureDurationSummary()));
     }
-    m_file.Write(pFrame->PixelScaleSummary() + "\n");
+    Write(pFrame->PixelScaleSummary() + "\n");
 
-    m_file.Write("Mount = " + pCalibrationMount->Name());
+    Write("Mount = " + pCalibrationMount->Name());
     wxString calSettings = pCalibrationMount->CalibrationSettingsSummary();
     if (!calSettings.IsEmpty())
-        m_file.Write(", " + calSettings);
-    m_file.Write("\n");
+        Write(", " + calSettings);
+    Write("\n");
 
-    m_file.Write(wxString::Format("%s\n", PointingInfo()));
+    Write(wxString::Format("%s\n", PointingInfo()));
 
-    m_file.Write(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
+    Write(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
                 pFrame->pGuider->LockPosition().X,
                 pFrame->pGuider->LockPosition().Y,
                 pFrame->pGuider->CurrentPosition().X,
                 pFrame->pGuider->CurrentPosition().Y,
                 pFrame->pGuider->HFD()));
-    m_file.Write("Direction,Step,dx,dy,x,y,Dist\n");
-    Flush();
+    Write("Direction,Step,dx,dy,x,y,Dist\n");
 
     m_keepFile = true;
 }
@@ -296,8 +962,7 @@ void GuidingLog::CalibrationFailed(Mount *pCalibrationMount, const wxString& msg
         return;
 
     assert(m_file.IsOpened());
-    m_file.Write(msg); m_file.Write("\n");
-    Flush();
+    Write(msg + "\n");
 }
 
 void GuidingLog::CalibrationStep(Mount *pCalibrationMount, const wxString& direction,
@@ -307,14 +972,17 @@ void GuidingLog::CalibrationStep(Mount *pCalibrationMount, const wxString& direc
         return;
 
     assert(m_file.IsOpened());
-    // Direction,Step,dx,dy,x,y,Dist
-    m_file.Write(wxString::Format("%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
-        direction,
-        steps,
-        dx, dy,
-        xy.X, xy.Y,
-        dist));
-    Flush();
+
+    GuideLogRecord rec;
+    rec.type = GuideLogRecord::REC_CALIBRATION_STEP;
+    rec.cal.steps = steps;
+    rec.cal.dx = dx;
+    rec.cal.dy = dy;
+    rec.cal.x = xy.X;
+    rec.cal.y = xy.Y;
+    rec.cal.dist = dist;
+
+    m_writer->Push(rec, direction);
 }
 
 void GuidingLog::CalibrationDirectComplete(Mount *pCalibrationMount, const wxString& direction, double angle, double rate, int parity)
@@ -323,9 +991,8 @@ void GuidingLog::CalibrationDirectComplete(Mount *pCalibrationMount, const wxStr
         return;
 
     assert(m_file.IsOpened());
-    m_file.Write(wxString::Format("%s calibration complete. Angle = %.1f deg, Rate = %.3f px/sec, Parity = %s\n",
+    Write(wxString::Format("%s calibration complete. Angle = %.1f deg, Rate = %.3f px/sec, Parity = %s\n",
         direction, degrees(angle), rate * 1000.0, ParityStr(parity)));
-    Flush();
 }
 
 void GuidingLog::CalibrationComplete(Mount *pCalibrationMount)
@@ -336,8 +1003,7 @@ void GuidingLog::CalibrationComplete(Mount *pCalibrationMount)
         return;
 
     assert(m_file.IsOpened());
-    m_file.Write(wxString::Format("Calibration complete, mount = %s.\n", pCalibrationMount->Name()));
-    Flush();
+    Write(wxString::Format("Calibration complete, mount = %s.\n", pCalibrationMount->Name()));
 }
 
 void GuidingLog::StartGuiding()
@@ -349,8 +1015,8 @@ void GuidingLog::StartGuiding()
 
     assert(m_file.IsOpened());
 
-    m_file.Write("\n");
-    m_file.Write("Guiding Begins at " + pFrame->m_guidingStarted.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    Write("\n");
+    Write("Guiding Begins at " + pFrame->m_guidingStarted.Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
     m_keepFile = true;
 
     // add common guiding header
@@ -365,41 +1031,39 @@ void GuidingLog::StopGuiding(void)
         return;
 
     assert(m_file.IsOpened());
-    m_file.Write("Guiding Ends at " + wxDateTime::Now().Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
+    Write("Guiding Ends at " + wxDateTime::Now().Format(_T("%Y-%m-%d %H:%M:%S")) + "\n");
 }
 
 void GuidingLog::GuidingHeader(void)
     // output guiding header to log file
 {
-    m_file.Write(pFrame->GetSettingsSummary());
-    m_file.Write(pFrame->pGuider->GetSettingsSummary());
+    Write(pFrame->GetSettingsSummary());
+    Write(pFrame->pGuider->GetSettingsSummary());
 
-    m_file.Write("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
+    Write("Equipment Profile = " + pConfig->GetCurrentProfile() + "\n");
 
     if (pCamera)
     {
-        m_file.Write(pCamera->GetSettingsSummary());
-        m_file.Write("Exposure = " + pFrame->ExposureDurationSummary() + "\n");
+        Write(pCamera->GetSettingsSummary());
+        Write("Exposure = " + pFrame->ExposureDurationSummary() + "\n");
     }
 
     if (pMount)
-        m_file.Write(pMount->GetSettingsSummary());
+        Write(pMount->GetSettingsSummary());
 
     if (pSecondaryMount)
-        m_file.Write(pSecondaryMount->GetSettingsSummary());
+        Write(pSecondaryMount->GetSettingsSummary());
 
-    m_file.Write(wxString::Format("%s\n", PointingInfo()));
+    Write(wxString::Format("%s\n", PointingInfo()));
 
-    m_file.Write(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
+    Write(wxString::Format("Lock position = %.3f, %.3f, Star position = %.3f, %.3f, HFD = %.2f px\n",
                 pFrame->pGuider->LockPosition().X,
                 pFrame->pGuider->LockPosition().Y,
                 pFrame->pGuider->CurrentPosition().X,
                 pFrame->pGuider->CurrentPosition().Y,
                 pFrame->pGuider->HFD()));
 
-    m_file.Write("Frame,Time,mount,dx,dy,RARawDistance,DECRawDistance,RAGuideDistance,DECGuideDistance,RADuration,RADirection,DECDuration,DECDirection,XStep,YStep,StarMass,SNR,ErrorCode\n");
-
-    Flush();
+    Write("Frame,Time,mount,dx,dy,RARawDistance,DECRawDistance,RAGuideDistance,DECGuideDistance,RADuration,RADirection,DECDuration,DECDirection,XStep,YStep,StarMass,SNR,ErrorCode\n");
 }
 
 void GuidingLog::GuideStep(const GuideStepInfo& step)
@@ -409,30 +1073,38 @@ void GuidingLog::GuideStep(const GuideStepInfo& step)
 
     assert(m_file.IsOpened());
 
-    m_file.Write(wxString::Format("%d,%.3f,\"%s\",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,",
-        step.frameNumber, step.time,
-        step.mount->IsStepGuider() ? "AO" : "Mount",
-        step.cameraOffset.X, step.cameraOffset.Y,
-        step.mountOffset.X, step.mountOffset.Y,
-        step.guideDistanceRA, step.guideDistanceDec));
-
-    if (step.mount->IsStepGuider())
+    GuideLogRecord rec;
+    rec.type = GuideLogRecord::REC_GUIDE_STEP;
+    GuideSession::Step& s = rec.step;
+    s.frameNumber = step.frameNumber;
+    s.time = step.time;
+    s.isAO = step.mount->IsStepGuider();
+    s.cameraOffsetX = step.cameraOffset.X;
+    s.cameraOffsetY = step.cameraOffset.Y;
+    s.mountOffsetX = step.mountOffset.X;
+    s.mountOffsetY = step.mountOffset.Y;
+    s.guideDistanceRA = step.guideDistanceRA;
+    s.guideDistanceDec = step.guideDistanceDec;
+
+    if (s.isAO)
     {
-        int xSteps = step.directionRA == LEFT ? -step.durationRA : step.durationRA;
-        int ySteps = step.directionDec == DOWN ? -step.durationDec : step.durationDec;
-        m_file.Write(wxString::Format(",,,,%d,%d,", xSteps, ySteps));
+        s.durationRA = step.directionRA == LEFT ? -step.durationRA : step.durationRA;
+        s.durationDec = step.directionDec == DOWN ? -step.durationDec : step.durationDec;
+        s.directionRA = s.directionDec = 0;
     }
     else
     {
-        m_file.Write(wxString::Format("%d,%s,%d,%s,,,",
-            step.durationRA, step.durationRA > 0 ? step.mount->DirectionChar((GUIDE_DIRECTION)step.directionRA) : "",
-            step.durationDec, step.durationDec > 0 ? step.mount->DirectionChar((GUIDE_DIRECTION)step.directionDec): ""));
+        s.durationRA = step.durationRA;
+        s.durationDec = step.durationDec;
+        s.directionRA = step.durationRA > 0 ? step.mount->DirectionChar((GUIDE_DIRECTION)step.directionRA)[0] : 0;
+        s.directionDec = step.durationDec > 0 ? step.mount->DirectionChar((GUIDE_DIRECTION)step.directionDec)[0] : 0;
     }
 
-    m_file.Write(wxString::Format("%.f,%.2f,%d\n",
-            step.starMass, step.starSNR, step.starError));
+    s.starMass = step.starMass;
+    s.starSNR = step.starSNR;
+    s.starError = step.starError;
 
-    Flush();
+    m_writer->Push(rec, wxEmptyString);
 }
 
 void GuidingLog::FrameDropped(const FrameDroppedInfo& info)
@@ -442,10 +1114,15 @@ void GuidingLog::FrameDropped(const FrameDroppedInfo& info)
 
     assert(m_file.IsOpened());
 
-    m_file.Write(wxString::Format("%d,%.3f,\"DROP\",,,,,,,,,,,,,%.f,%.2f,%d,\"%s\"\n",
-        info.frameNumber, info.time, info.starMass, info.starSNR, info.starError, info.status));
+    GuideLogRecord rec;
+    rec.type = GuideLogRecord::REC_FRAME_DROPPED;
+    rec.drop.frameNumber = info.frameNumber;
+    rec.drop.time = info.time;
+    rec.drop.starMass = info.starMass;
+    rec.drop.starSNR = info.starSNR;
+    rec.drop.starError = info.starError;
 
-    Flush();
+    m_writer->Push(rec, info.status);
 }
 
 void GuidingLog::NotifyGuidingDithered(Guider *guider, double dx, double dy)
@@ -453,22 +1130,19 @@ void GuidingLog::NotifyGuidingDithered(Guider *guider, double dx, double dy)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: DITHER by %.3f, %.3f, new lock pos = %.3f, %.3f\n",
+    Write(wxString::Format("INFO: DITHER by %.3f, %.3f, new lock pos = %.3f, %.3f\n",
         dx, dy, guider->LockPosition().X, guider->LockPosition().Y));
-    Flush();
 }
 
 void GuidingLog::NotifySettlingStateChange(const wxString& msg)
 {
-    m_file.Write(wxString::Format("INFO: SETTLING STATE CHANGE, %s\n", msg));
-    Flush();
+    Write(wxString::Format("INFO: SETTLING STATE CHANGE, %s\n", msg));
 }
 
 void GuidingLog::NotifyGAResult(const wxString& msg)
 {
     // Client needs to handle end-of-line formatting
-    m_file.Write(wxString::Format("INFO: GA Result - %s", msg));
-    Flush();
+    Write(wxString::Format("INFO: GA Result - %s", msg));
 }
 
 void GuidingLog::NotifySetLockPosition(Guider *guider)
@@ -476,10 +1150,9 @@ void GuidingLog::NotifySetLockPosition(Guider *guider)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: SET LOCK POSITION, new lock pos = %.3f, %.3f\n",
+    Write(wxString::Format("INFO: SET LOCK POSITION, new lock pos = %.3f, %.3f\n",
         guider->LockPosition().X, guider->LockPosition().Y));
     m_keepFile = true;
-    Flush();
 }
 
 void GuidingLog::NotifyLockShiftParams(const LockPosShiftParams& shiftParams, const PHD_Point& cameraRate)
@@ -498,9 +1171,8 @@ void GuidingLog::NotifyLockShiftParams(const LockPosShiftParams& shiftParams, co
                                     cameraRate.IsValid() ? cameraRate.X * 3600.0 : 0.0,
                                     cameraRate.IsValid() ? cameraRate.Y * 3600.0 : 0.0);
     }
-    m_file.Write(wxString::Format("INFO: LOCK SHIFT, enabled = %d %s\n", shiftParams.shiftEnabled, details));
+    Write(wxString::Format("INFO: LOCK SHIFT, enabled = %d %s\n", shiftParams.shiftEnabled, details));
     m_keepFile = true;
-    Flush();
 }
 
 void GuidingLog::ServerCommand(Guider *guider, const wxString& cmd)
@@ -508,9 +1180,8 @@ void GuidingLog::ServerCommand(Guider *guider, const wxString& cmd)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: Server received %s\n", cmd));
+    Write(wxString::Format("INFO: Server received %s\n", cmd));
     m_keepFile = true;
-    Flush();
 }
 
 void GuidingLog::SetGuidingParam(const wxString& name, double val)
@@ -533,7 +1204,9 @@ void GuidingLog::SetGuidingParam(const wxString& name, const wxString& val)
     if (!m_enabled || !m_isGuiding)
         return;
 
-    m_file.Write(wxString::Format("INFO: Guiding parameter change, %s = %s\n", name, val));
+    GuideLogRecord rec;
+    rec.type = GuideLogRecord::REC_PARAM;
+    m_writer->Push(rec, name, val);
+
     m_keepFile = true;
-    Flush();
 }
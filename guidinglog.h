@@ -41,6 +41,7 @@
 class Mount;
 class Guider;
 struct LockPosShiftParams;
+class GuideLogWriter;
 
 struct GuideStepInfo
 {
@@ -63,6 +64,8 @@ struct GuideStepInfo
     wxPoint aoPos;
     double starMass;
     double starSNR;
+    double starFWHM;        // 0 unless the star position came from a PSF fit
+    double starEllipticity;
     double avgDist;
     int starError;
 };
@@ -85,9 +88,14 @@ class GuidingLog : public Logger
     wxString m_fileName;
     bool m_keepFile;
     bool m_isGuiding;
+    GuideLogWriter *m_writer;
+    wxString m_sessionFileName;
+    FILE *m_sessionFile;
 
 protected:
     void GuidingHeader(void);
+    void Write(const wxString& str);
+    void CloseSessionFile(void);
 
 public:
     GuidingLog(void);
@@ -99,6 +107,7 @@ public:
     bool IsEnabled(void) const;
     bool Flush(void);
     void Close(void);
+    void EmergencyFlush(void);
 
     void StartCalibration(Mount *pCalibrationMount);
     void CalibrationFailed(Mount *pCalibrationMount, const wxString& msg);
@@ -0,0 +1,388 @@
+/*
+*  image_logger.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+#include <algorithm>
+
+ImageLogger ImageLog;
+
+struct LoggedImage
+{
+    bool isFits;
+    wxString fileName;
+    wxString created;       // DATE keyword
+    wxString dateObs;       // DATE-OBS keyword
+
+    // FITS
+    usImage pixels;
+    wxPoint origin;
+    unsigned int binning;
+    bool compress;
+
+    // JPEG
+    wxImage jpeg;
+    int quality;
+};
+
+class ImageLogger::WriterThread : public wxThread
+{
+    ImageLogger *m_logger;
+
+public:
+    WriterThread(ImageLogger *logger) : wxThread(wxTHREAD_JOINABLE), m_logger(logger) { }
+    ExitCode Entry();
+};
+
+wxThread::ExitCode ImageLogger::WriterThread::Entry()
+{
+    while (true)
+    {
+        LoggedImage *img;
+
+        {
+            wxMutexLocker lck(m_logger->m_lock);
+
+            while (m_logger->m_queue.empty() && !m_logger->m_stop)
+                m_logger->m_cond.Wait();
+
+            if (m_logger->m_queue.empty())
+                break; // stop requested and nothing left to write
+
+            img = m_logger->m_queue.front();
+            m_logger->m_queue.pop_front();
+        }
+
+        m_logger->WriteImage(img);
+
+        {
+            wxMutexLocker lck(m_logger->m_lock);
+
+            m_logger->m_pool.push_back(img);
+
+            if (m_logger->m_throttling && m_logger->m_queue.size() <= m_logger->m_maxQueued / 2)
+                m_logger->m_throttling = false;
+        }
+    }
+
+    return 0;
+}
+
+ImageLogger::ImageLogger()
+    : m_cond(m_lock),
+    m_allocated(0),
+    m_maxQueued(8),
+    m_policy(ILO_DROP_OLDEST),
+    m_throttling(false),
+    m_stop(false),
+    m_dropped(0),
+    m_thread(0)
+{
+}
+
+ImageLogger::~ImageLogger()
+{
+    // the writer thread is stopped by Stop() before the app exits
+    for (std::deque<LoggedImage *>::iterator it = m_queue.begin(); it != m_queue.end(); ++it)
+        delete *it;
+    for (std::vector<LoggedImage *>::iterator it = m_pool.begin(); it != m_pool.end(); ++it)
+        delete *it;
+}
+
+bool ImageLogger::Start()
+{
+    if (m_thread)
+        return false;
+
+    m_policy = (IMAGE_LOG_OVERFLOW_POLICY) pConfig->Global.GetInt("/ImageLog/OverflowPolicy", ILO_DROP_OLDEST);
+    m_maxQueued = wxMax(1, pConfig->Global.GetInt("/ImageLog/QueueDepth", 8));
+    m_stop = false;
+    m_throttling = false;
+
+    WriterThread *thread = new WriterThread(this);
+
+    if (thread->Create() != wxTHREAD_NO_ERROR || thread->Run() != wxTHREAD_NO_ERROR)
+    {
+        Debug.AddLine("ImageLogger: could not start writer thread, images will be written synchronously");
+        delete thread;
+        return true;
+    }
+
+    m_thread = thread;
+
+    Debug.AddLine(wxString::Format("ImageLogger: started, queue depth %u, overflow policy %d", m_maxQueued, m_policy));
+
+    return false;
+}
+
+void ImageLogger::Stop()
+{
+    if (!m_thread)
+        return;
+
+    {
+        wxMutexLocker lck(m_lock);
+        m_stop = true;
+        m_cond.Broadcast();
+    }
+
+    // the thread drains the queue before exiting
+    m_thread->Wait();
+    delete m_thread;
+    m_thread = 0;
+
+    Debug.AddLine(wxString::Format("ImageLogger: stopped, %u buffers allocated, %u images dropped", m_allocated, DroppedCount()));
+}
+
+void ImageLogger::SetOverflowPolicy(IMAGE_LOG_OVERFLOW_POLICY policy)
+{
+    wxMutexLocker lck(m_lock);
+    m_policy = policy;
+    m_throttling = false;
+    pConfig->Global.SetInt("/ImageLog/OverflowPolicy", policy);
+}
+
+// get a buffer for a new image, or NULL if the image must be discarded
+LoggedImage *ImageLogger::GetBuffer()
+{
+    LoggedImage *img = 0;
+    bool dropped = false;
+    unsigned int droppedCount = 0;
+
+    {
+        wxMutexLocker lck(m_lock);
+
+        if (m_thread && (m_throttling || m_queue.size() >= m_maxQueued))
+        {
+            dropped = true;
+            droppedCount = ++m_dropped;
+
+            if (m_policy == ILO_THROTTLE)
+                m_throttling = true;
+            else if (!m_queue.empty())
+            {
+                // recycle the oldest queued image
+                img = m_queue.front();
+                m_queue.pop_front();
+            }
+        }
+        else if (!m_pool.empty())
+        {
+            img = m_pool.back();
+            m_pool.pop_back();
+        }
+    }
+
+    if (dropped)
+    {
+        Debug.Write(wxString::Format("ImageLogger: writer is behind, dropped %s image (%u total)\n",
+            img ? "oldest" : "new", droppedCount));
+        if (img)
+            img->jpeg.Destroy();
+        return img;
+    }
+
+    if (!img)
+    {
+        img = new LoggedImage();
+        ++m_allocated;
+    }
+
+    return img;
+}
+
+void ImageLogger::Enqueue(LoggedImage *img)
+{
+    if (!m_thread)
+    {
+        WriteImage(img);
+        img->jpeg.Destroy();
+        wxMutexLocker lck(m_lock);
+        m_pool.push_back(img);
+        return;
+    }
+
+    wxMutexLocker lck(m_lock);
+    m_queue.push_back(img);
+    m_cond.Signal();
+}
+
+static wxString FitsDateNow()
+{
+    time_t now = wxDateTime::GetTimeNow();
+    struct tm *timestruct = gmtime(&now);
+    return wxString::Format("%.4d-%.2d-%.2d %.2d:%.2d:%.2d", timestruct->tm_year + 1900, timestruct->tm_mon + 1,
+        timestruct->tm_mday, timestruct->tm_hour, timestruct->tm_min, timestruct->tm_sec);
+}
+
+bool ImageLogger::QueueFITS(const usImage& img, const wxRect& crop, const wxString& fname, bool compress)
+{
+    LoggedImage *li = GetBuffer();
+    if (!li)
+        return true;
+
+    li->isFits = true;
+    li->fileName = fname.Clone();
+    li->created = FitsDateNow();
+    li->dateObs = img.GetImgStartTime();
+    li->origin = crop.GetTopLeft();
+    li->binning = pCamera ? pCamera->ImageBinning() : 1;
+    li->compress = compress;
+
+    li->pixels.Init(crop.GetSize());
+    li->pixels.ImgExpDur = img.ImgExpDur;
+
+    // only the stored part of a subframe-only image is copied, the rest of
+    // the crop is black
+    wxRect src(crop);
+    src.Intersect(img.DataRect());
+    if (src != crop)
+        li->pixels.Clear();
+
+    for (int y = src.GetTop(); y <= src.GetBottom(); y++)
+    {
+        unsigned short *dst = li->pixels.ImageData + (y - crop.y) * crop.width + (src.x - crop.x);
+        if (img.Is8Bit())
+        {
+            const unsigned char *p = &img.Pixel8(src.x, y);
+            std::copy(p, p + src.width, dst);
+        }
+        else
+            memcpy(dst, &img.Pixel(src.x, y), src.width * sizeof(unsigned short));
+    }
+
+    Enqueue(li);
+
+    return false;
+}
+
+bool ImageLogger::QueueJPEG(wxImage& img, const wxString& fname, int quality)
+{
+    LoggedImage *li = GetBuffer();
+    if (!li)
+    {
+        img.Destroy();
+        return true;
+    }
+
+    li->isFits = false;
+    li->fileName = fname.Clone();
+    li->quality = quality;
+
+    // wxImage data is reference counted without locking, so make sure
+    // the caller's reference is gone before the writer thread sees it
+    li->jpeg = img;
+    img.Destroy();
+
+    Enqueue(li);
+
+    return false;
+}
+
+void ImageLogger::WriteImage(LoggedImage *img)
+{
+    if (!img->isFits)
+    {
+        if (img->quality > 0)
+            img->jpeg.SetOption(wxIMAGE_OPTION_QUALITY, img->quality);
+        if (!img->jpeg.SaveFile(img->fileName, wxBITMAP_TYPE_JPEG))
+            Debug.Write(wxString::Format("ImageLogger: error saving %s\n", img->fileName));
+        img->jpeg.Destroy();
+        return;
+    }
+
+    fitsfile *fptr;  // FITS file pointer
+    int status = 0;  // CFITSIO status value MUST be initialized to zero!
+    long fpixel[3] = { 1, 1, 1 };
+    long fsize[3];
+    char keyname[9];
+    char keycomment[100];
+    char keystring[100];
+
+    fsize[0] = img->pixels.Size.GetWidth();
+    fsize[1] = img->pixels.Size.GetHeight();
+    fsize[2] = 0;
+
+    PHD_fits_create_file(&fptr, img->fileName, false, &status);
+    if (status)
+    {
+        Debug.Write(wxString::Format("ImageLogger: error creating %s, status %d\n", img->fileName, status));
+        return;
+    }
+
+    // Rice tile compression, readable by any cfitsio-based tool or funpack
+    if (img->compress)
+        fits_set_compression_type(fptr, RICE_1, &status);
+
+    if (!status) fits_create_img(fptr, USHORT_IMG, 2, fsize, &status);
+
+    sprintf(keyname, "DATE");
+    sprintf(keycomment, "UTC date that FITS file was created");
+    sprintf(keystring, "%s", (const char *) img->created.c_str());
+    if (!status) fits_write_key(fptr, TSTRING, keyname, keystring, keycomment, &status);
+
+    sprintf(keyname, "DATE-OBS");
+    sprintf(keycomment, "YYYY-MM-DDThh:mm:ss observation start, UT");
+    sprintf(keystring, "%s", (const char *) img->dateObs.c_str());
+    if (!status) fits_write_key(fptr, TSTRING, keyname, keystring, keycomment, &status);
+
+    sprintf(keyname, "EXPOSURE");
+    sprintf(keycomment, "Exposure time [s]");
+    float dur = (float) img->pixels.ImgExpDur / 1000.0;
+    if (!status) fits_write_key(fptr, TFLOAT, keyname, &dur, keycomment, &status);
+
+    unsigned int tmp = img->binning;
+    sprintf(keyname, "XBINNING");
+    sprintf(keycomment, "Camera binning mode");
+    if (!status) fits_write_key(fptr, TUINT, keyname, &tmp, keycomment, &status);
+    sprintf(keyname, "YBINNING");
+    sprintf(keycomment, "Camera binning mode");
+    if (!status) fits_write_key(fptr, TUINT, keyname, &tmp, keycomment, &status);
+
+    int org = img->origin.x;
+    sprintf(keyname, "XORGSUB");
+    sprintf(keycomment, "Subframe x position in binned pixels");
+    if (!status) fits_write_key(fptr, TINT, keyname, &org, keycomment, &status);
+    org = img->origin.y;
+    sprintf(keyname, "YORGSUB");
+    sprintf(keycomment, "Subframe y position in binned pixels");
+    if (!status) fits_write_key(fptr, TINT, keyname, &org, keycomment, &status);
+
+    if (!status) fits_write_pix(fptr, TUSHORT, fpixel, img->pixels.NPixels, img->pixels.ImageData, &status);
+
+    if (status)
+        Debug.Write(wxString::Format("ImageLogger: error writing %s, status %d\n", img->fileName, status));
+
+    PHD_fits_close_file(fptr);
+}
@@ -0,0 +1,104 @@
+/*
+*  image_logger.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef IMAGE_LOGGER_INCLUDED
+#define IMAGE_LOGGER_INCLUDED
+
+#include <deque>
+#include <vector>
+
+enum IMAGE_LOG_OVERFLOW_POLICY
+{
+    ILO_DROP_OLDEST,    // discard the oldest queued image to make room for the new one
+    ILO_THROTTLE        // discard new images until the writer has caught up
+};
+
+struct LoggedImage;
+
+// Writes logged guide star images (FITS or JPEG) from a background thread so
+// that a slow disk never stalls the paint handler or the guiding loop.
+// Queued images live in a small pool of reusable buffers; when the pool is
+// exhausted the overflow policy decides which image gets discarded.
+class ImageLogger
+{
+    class WriterThread;
+    friend class WriterThread;
+
+    mutable wxMutex m_lock;
+    wxCondition m_cond;
+    std::deque<LoggedImage *> m_queue;
+    std::vector<LoggedImage *> m_pool;
+    unsigned int m_allocated;
+    unsigned int m_maxQueued;
+    IMAGE_LOG_OVERFLOW_POLICY m_policy;
+    bool m_throttling;
+    bool m_stop;
+    unsigned int m_dropped;
+    WriterThread *m_thread;
+
+    LoggedImage *GetBuffer();
+    void Enqueue(LoggedImage *img);
+    void WriteImage(LoggedImage *img);
+
+public:
+    ImageLogger();
+    ~ImageLogger();
+
+    bool Start();
+    void Stop();
+
+    IMAGE_LOG_OVERFLOW_POLICY GetOverflowPolicy() const;
+    void SetOverflowPolicy(IMAGE_LOG_OVERFLOW_POLICY policy);
+    unsigned int DroppedCount() const;
+
+    // copy the crop rectangle of img and queue it to be saved as FITS; returns true if dropped
+    bool QueueFITS(const usImage& img, const wxRect& crop, const wxString& fname, bool compress);
+    // take ownership of img and queue it to be saved as JPEG; returns true if dropped
+    bool QueueJPEG(wxImage& img, const wxString& fname, int quality);
+};
+
+extern ImageLogger ImageLog;
+
+inline IMAGE_LOG_OVERFLOW_POLICY ImageLogger::GetOverflowPolicy() const
+{
+    return m_policy;
+}
+
+inline unsigned int ImageLogger::DroppedCount() const
+{
+    wxMutexLocker lck(m_lock);
+    return m_dropped;
+}
+
+#endif
@@ -40,6 +40,7 @@
 #include <wx/tokenzr.h>
 
 #include <algorithm>
+#include <limits>
 
 int dbl_sort_func (double *first, double *second)
 {
@@ -76,96 +77,311 @@ double CalcSlope(const ArrayOfDbl& y)
     return (n * s_xy - (s_x * s_y)) / (n * s_xx - (s_x * s_x));
 }
 
-bool QuickLRecon(usImage& img)
+// the part of the image a luminance reconstruction works on, in image
+// coordinates: the subframe if there is one, else the whole frame
+static wxRect ReconRect(const usImage& img)
 {
-    // Does a simple debayer of luminance data only -- sliding 2x2 window
-    usImage tmp;
-    if (tmp.Init(img.Size))
+    if (img.IsRoiOnly() || img.Subframe.IsEmpty())
+        return img.DataRect();
+    return img.Subframe;
+}
+
+// Does a simple debayer of luminance data only -- sliding 2x2 window. Works in
+// place, row by row: output row y only needs rows y and y + 1, and row y + 1
+// is not overwritten until the next pass, so the only temporary is one row of
+// vertical sums. Pixels outside the subframe are left alone.
+template<typename T>
+static bool QuickLReconT(usImage& img)
+{
+    wxRect const r(ReconRect(img));
+    int const RW = r.GetWidth();
+    int const RH = r.GetHeight();
+    if (RW < 2 || RH < 2)
+        return true;
+
+    std::vector<unsigned int> sums(RW);
+    unsigned int *s = &sums[0];
+
+    for (int y = r.GetTop(); y < r.GetBottom(); y++)
     {
-        pFrame->Alert(_("Memory allocation error"));
+        T *d = PixelPtr<T>(img, r.GetLeft(), y);
+        const T *below = PixelPtr<T>(img, r.GetLeft(), y + 1);
+
+        for (int x = 0; x < RW; x++)
+            s[x] = (unsigned int) d[x] + below[x];
+
+        for (int x = 0; x < RW - 1; x++)
+            d[x] = (T)((s[x] + s[x + 1]) >> 2);
+
+        // last col
+        d[RW - 1] = (T)(s[RW - 1] >> 1);
+    }
+
+    // last row; the bottom-right pixel is unchanged
+
+    T *d = PixelPtr<T>(img, r.GetLeft(), r.GetBottom());
+    for (int x = 0; x < RW - 1; x++)
+        d[x] = (T)(((unsigned int) d[x] + d[x + 1]) >> 1);
+
+    return false;
+}
+
+bool QuickLRecon(usImage& img)
+{
+    TraceSpan span("QuickLRecon");
+    return img.Is8Bit() ? QuickLReconT<unsigned char>(img) : QuickLReconT<unsigned short>(img);
+}
+
+// Full resolution luminance of a Bayer mosaic: the separable 3x3 binomial
+// kernel [1 2 1] x [1 2 1] / 16 weights R, G and B 1:2:1 whatever the CFA
+// position of the center pixel, so every output is (R + 2G + B) / 4 with no
+// half-pixel shift. Works in place: a copy of the previous unfiltered row and
+// one row of vertical sums are the only temporaries. Edges are replicated.
+template<typename T>
+static bool BayerLuminanceT(usImage& img)
+{
+    wxRect const r(ReconRect(img));
+    int const RW = r.GetWidth();
+    int const RH = r.GetHeight();
+    if (RW < 2 || RH < 2)
         return true;
+
+    std::vector<T> prevRow(RW);
+    std::vector<unsigned int> sums(RW + 2);
+    T *prev = &prevRow[0];
+    unsigned int *v = &sums[1];
+
+    for (int y = r.GetTop(); y <= r.GetBottom(); y++)
+    {
+        T *d = PixelPtr<T>(img, r.GetLeft(), y);
+        const T *above = y > r.GetTop() ? prev : d;
+        const T *below = y < r.GetBottom() ? PixelPtr<T>(img, r.GetLeft(), y + 1) : d;
+
+        for (int x = 0; x < RW; x++)
+            v[x] = (unsigned int) above[x] + 2U * d[x] + below[x];
+        v[-1] = v[0];
+        v[RW] = v[RW - 1];
+
+        memcpy(prev, d, RW * sizeof(T));
+
+        for (int x = 0; x < RW; x++)
+            d[x] = (T)((v[x - 1] + 2U * v[x] + v[x + 1] + 8U) >> 4);
     }
 
-    int const W = img.Size.GetWidth();
-    int RX, RY, RW, RH;
-    if (img.Subframe.IsEmpty())
+    return false;
+}
+
+bool BayerLuminance(usImage& img)
+{
+    TraceSpan span("BayerLuminance");
+    return img.Is8Bit() ? BayerLuminanceT<unsigned char>(img) : BayerLuminanceT<unsigned short>(img);
+}
+
+template<typename T>
+static bool Median3T(usImage& img)
+{
+    bool const eightBit = img.Is8Bit();
+    usImage tmp;
+
+    bool err;
+
+    if (img.IsRoiOnly())
     {
-        RX = RY = 0;
-        RW = img.Size.GetWidth();
-        RH = img.Size.GetHeight();
+        tmp.InitSubframe(img.Size, img.Subframe, eightBit);
+        err = Median3(PixelData<T>(tmp), PixelData<T>(img), img.Subframe.GetSize(), wxRect(img.Subframe.GetSize()));
+    }
+    else if (img.Subframe.IsEmpty())
+    {
+        tmp.Init(img.Size, eightBit);
+        err = Median3(PixelData<T>(tmp), PixelData<T>(img), img.Size, wxRect(img.Size));
     }
     else
     {
-        RX = img.Subframe.GetX();
-        RY = img.Subframe.GetY();
-        RW = img.Subframe.GetWidth();
-        RH = img.Subframe.GetHeight();
+        tmp.Init(img.Size, eightBit);
         tmp.Clear();
+        err = Median3(PixelData<T>(tmp), PixelData<T>(img), img.Size, img.Subframe);
     }
 
-#define IX(x_, y_) ((RY + (y_)) * W + RX + (x_))
+    img.SwapImageData(tmp);
+    return err;
+}
 
-    unsigned short *d;
-    unsigned int t;
+bool Median3(usImage& img)
+{
+    TraceSpan span("Median3");
 
-    for (int y = 0; y <= RH - 2; y++)
-    {
-        d = &tmp.ImageData[IX(0, y)];
+    return img.Is8Bit() ? Median3T<unsigned char>(img) : Median3T<unsigned short>(img);
+}
 
-        for (int x = 0; x <= RW - 2; x++)
-        {
-            t  = img.ImageData[IX(x    , y    )];
-            t += img.ImageData[IX(x + 1, y    )];
-            t += img.ImageData[IX(x    , y + 1)];
-            t += img.ImageData[IX(x + 1, y + 1)];
-            *d++ = (unsigned short)(t >> 2);
-        }
+// Build the 2x2 and 4x4 box-binned levels of an image pyramid in a single
+// pass over the source rows. Each binned pixel is the rounded mean of the
+// source pixels. Partial bins at the right and bottom edges are dropped.
+// If maxVal is not null it receives the largest source pixel value.
+bool BinPyramid(const usImage& img, usImage *bin2, usImage *bin4, unsigned short *maxVal)
+{
+    TraceSpan span("BinPyramid");
 
-        // last col
-        t  = img.ImageData[IX(RW - 1, y    )];
-        t += img.ImageData[IX(RW - 1, y + 1)];
-        *d = (unsigned short)(t >> 1);
-    }
+    int const w = img.Size.GetWidth();
+    int const h = img.Size.GetHeight();
+    int const w2 = w / 2, h2 = h / 2;
+    int const w4 = w / 4, h4 = h / 4;
+
+    if (bin2->Init(w2, h2) || bin4->Init(w4, h4))
+        return true;
 
-    // last row
+    bin2->BitsPerPixel = bin4->BitsPerPixel = img.BitsPerPixel;
+    bin2->Pedestal = bin4->Pedestal = img.Pedestal;
 
-    d = &tmp.ImageData[IX(0, RH - 1)];
+    std::vector<unsigned int> sum4(w4 + 1);
+    unsigned short mx = 0;
 
-    for (int x = 0; x <= RW - 2; x++)
+    for (int y = 0; y < h; y++)
     {
-        t  = img.ImageData[IX(x    , RH - 1)];
-        t += img.ImageData[IX(x + 1, RH - 1)];
-        *d++ = (unsigned short)(t >> 1);
-    }
+        const unsigned short *row = img.ImageData + w * y;
+        for (int x = 0; x < w; x++)
+            mx = std::max(mx, row[x]);
 
-    // bottom-right pixel
-    *d = img.ImageData[IX(RW - 1, RH - 1)];
+        if ((y & 1) == 0 || y / 2 >= h2)
+            continue;
 
-#undef IX
+        // second row of a 2x2 bin
+        int const y2 = y / 2;
+        const unsigned short *r0 = row - w;
+        unsigned short *d2 = bin2->ImageData + w2 * y2;
+
+        if ((y2 & 1) == 0)
+            std::fill(sum4.begin(), sum4.end(), 0U);
+
+        for (int x2 = 0; x2 < w2; x2++)
+        {
+            unsigned int const s = (unsigned int) r0[2 * x2] + r0[2 * x2 + 1] + row[2 * x2] + row[2 * x2 + 1];
+            d2[x2] = (unsigned short) ((s + 2) >> 2);
+            sum4[x2 >> 1] += s;
+        }
+
+        if ((y2 & 1) != 0 && y2 / 2 < h4)
+        {
+            unsigned short *d4 = bin4->ImageData + w4 * (y2 / 2);
+            for (int x4 = 0; x4 < w4; x4++)
+                d4[x4] = (unsigned short) ((sum4[x4] + 8) >> 4);
+        }
+    }
+
+    if (maxVal)
+        *maxVal = mx;
 
-    img.SwapImageData(tmp);
     return false;
 }
 
-bool Median3(usImage& img)
+// the part of r covered by complete factor x factor bins, in binned
+// coordinates, or an empty rect if there is none
+static wxRect BinnedRect(const wxRect& r, int factor, const wxSize& binnedSize)
 {
-    usImage tmp;
-    tmp.Init(img.Size);
+    int const x0 = (r.GetLeft() + factor - 1) / factor;
+    int const y0 = (r.GetTop() + factor - 1) / factor;
+    int const x1 = wxMin((r.GetRight() + 1) / factor, binnedSize.GetWidth()) - 1;
+    int const y1 = wxMin((r.GetBottom() + 1) / factor, binnedSize.GetHeight()) - 1;
+    if (r.IsEmpty() || x1 < x0 || y1 < y0)
+        return wxRect(0, 0, 0, 0);
+    return wxRect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
 
-    bool err;
+// bin the rows of out (binned coordinates) from src into dst; the F source
+// rows are first summed column by column, which the compiler vectorizes,
+// then each group of F columns is added up
+template<typename S, typename D, int F>
+static void BinRows(const usImage& src, usImage& dst, const wxRect& out, bool sum)
+{
+    int const w = out.GetWidth();
+    int const sw = w * F;
+    unsigned int const n = F * F;
+    std::vector<unsigned int> acc(sw);
+    unsigned int *a = &acc[0];
 
-    if (img.Subframe.IsEmpty())
+    for (int y = out.GetTop(); y <= out.GetBottom(); y++)
     {
-        err = Median3(tmp.ImageData, img.ImageData, img.Size, wxRect(img.Size));
+        const S *s = PixelPtr<S>(src, out.GetLeft() * F, y * F);
+        for (int i = 0; i < sw; i++)
+            a[i] = s[i];
+        for (int j = 1; j < F; j++)
+        {
+            s = PixelPtr<S>(src, out.GetLeft() * F, y * F + j);
+            for (int i = 0; i < sw; i++)
+                a[i] += s[i];
+        }
+
+        D *d = PixelPtr<D>(dst, out.GetLeft(), y);
+        for (int x = 0; x < w; x++)
+        {
+            unsigned int v = 0;
+            for (int i = 0; i < F; i++)
+                v += a[x * F + i];
+            if (sum)
+                d[x] = (D) wxMin(v, 65535U);
+            else
+                d[x] = (D) ((v + n / 2) / n);
+        }
     }
-    else
+}
+
+template<typename S, typename D>
+static void BinRows(const usImage& src, usImage& dst, const wxRect& out, int factor, bool sum)
+{
+    switch (factor)
     {
-        tmp.Clear();
-        err = Median3(tmp.ImageData, img.ImageData, img.Size, img.Subframe);
+    case 2:
+        BinRows<S, D, 2>(src, dst, out, sum);
+        break;
+    case 3:
+        BinRows<S, D, 3>(src, dst, out, sum);
+        break;
+    default:
+        BinRows<S, D, 4>(src, dst, out, sum);
+        break;
     }
+}
+
+// Software binning of a captured frame by factor x factor, 2 to 4, in place.
+// Each bin is the sum of its pixels, clipped to 16 bits, or their rounded
+// mean; only complete bins are kept. A subframe-only image stays
+// subframe-only, with its subframe binned. Summed 8-bit frames become 16-bit,
+// averaged ones stay 8-bit. Returns true on error.
+bool SoftwareBin(usImage& img, int factor, bool sum)
+{
+    TraceSpan span("SoftwareBin");
+
+    if (factor == 1)
+        return false;
+    if (factor < 2 || factor > 4 || !img.HasPixels())
+        return true;
+
+    wxSize const size(img.Size.GetWidth() / factor, img.Size.GetHeight() / factor);
+    wxRect const out(BinnedRect(img.DataRect(), factor, size));
+    if (out.IsEmpty())
+        return true;
+
+    bool const eightBit = img.Is8Bit() && !sum;
+    usImage tmp;
+    if (img.IsRoiOnly() ? tmp.InitSubframe(size, out, eightBit) : tmp.Init(size, eightBit))
+        return true;
+    if (!img.IsRoiOnly())
+        tmp.Subframe = BinnedRect(img.Subframe, factor, size);
+
+    if (!img.Is8Bit())
+        BinRows<unsigned short, unsigned short>(img, tmp, out, factor, sum);
+    else if (eightBit)
+        BinRows<unsigned char, unsigned char>(img, tmp, out, factor, sum);
+    else
+        BinRows<unsigned char, unsigned short>(img, tmp, out, factor, sum);
 
+    img.Size = tmp.Size;
+    img.Subframe = tmp.Subframe;
     img.SwapImageData(tmp);
-    return err;
+
+    if (sum && img.BitsPerPixel)
+        img.BitsPerPixel = wxMin(16, img.BitsPerPixel + (factor == 2 ? 2 : 4));
+
+    return false;
 }
 
 inline static void swap(unsigned short& a, unsigned short& b)
@@ -316,7 +532,11 @@ inline static unsigned short median3(const unsigned short l[3])
     return l0;
 }
 
-bool Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect)
+// median filter rows [y0, y1) of rect; the rows are filtered exactly as
+// they would be by filtering the whole rect, so separate row bands can be
+// filtered in parallel
+template<typename T>
+static bool Median3RowsT(T *dst, const T *src, const wxSize& size, const wxRect& rect, int y0, int y1)
 {
     int const W = size.GetWidth();
     int const RX = rect.GetX();
@@ -325,200 +545,233 @@ bool Median3(unsigned short *dst, const unsigned short *src, const wxSize& size,
     int const RH = rect.GetHeight();
 
     unsigned short a[9];
-    unsigned short *d;
+    T *d;
 
 #define IX(x_, y_) ((RY + (y_)) * W + RX + (x_))
 
-    // top row
-    d = &dst[IX(0, 0)];
-
-    // top-left corner
-    a[0] = src[IX(0, 0)];
-    a[1] = src[IX(1, 0)];
-    a[2] = src[IX(0, 1)];
-    a[3] = src[IX(1, 1)];
-    *d++ = median4(a);
-
-    // top row middle pixels
-    for (int x = 1; x <= RW - 2; x++)
+    for (int y = y0; y < y1; y++)
     {
-        a[0] = src[IX(x - 1, 0)];
-        a[1] = src[IX(x,     0)];
-        a[2] = src[IX(x + 1, 0)];
-        a[3] = src[IX(x - 1, 1)];
-        a[4] = src[IX(x,     1)];
-        a[5] = src[IX(x + 1, 1)];
-        *d++ = median6(a);
-    }
-
-    // top-right corner
-    a[0] = src[IX(RW - 2, 0)];
-    a[1] = src[IX(RW - 1, 0)];
-    a[2] = src[IX(RW - 2, 1)];
-    a[3] = src[IX(RW - 1, 1)];
-    *d = median4(a);
+        if (y == 0)
+        {
+            // top row
+            d = &dst[IX(0, 0)];
+
+            // top-left corner
+            a[0] = src[IX(0, 0)];
+            a[1] = src[IX(1, 0)];
+            a[2] = src[IX(0, 1)];
+            a[3] = src[IX(1, 1)];
+            *d++ = (T) median4(a);
+
+            // top row middle pixels
+            for (int x = 1; x <= RW - 2; x++)
+            {
+                a[0] = src[IX(x - 1, 0)];
+                a[1] = src[IX(x,     0)];
+                a[2] = src[IX(x + 1, 0)];
+                a[3] = src[IX(x - 1, 1)];
+                a[4] = src[IX(x,     1)];
+                a[5] = src[IX(x + 1, 1)];
+                *d++ = (T) median6(a);
+            }
 
-    for (int y = 1; y <= RH - 2; y++)
-    {
-        d = &dst[IX(0, y)];
-
-        // leftmost pixel
-        a[0] = src[IX(0, y - 1)];
-        a[1] = src[IX(1, y - 1)];
-        a[2] = src[IX(0, y    )];
-        a[3] = src[IX(1, y    )];
-        a[4] = src[IX(0, y + 1)];
-        a[5] = src[IX(1, y + 1)];
-        *d++ = median6(a);
-
-        for (int x = 1; x <= RW - 2; x++)
+            // top-right corner
+            a[0] = src[IX(RW - 2, 0)];
+            a[1] = src[IX(RW - 1, 0)];
+            a[2] = src[IX(RW - 2, 1)];
+            a[3] = src[IX(RW - 1, 1)];
+            *d = (T) median4(a);
+        }
+        else if (y == RH - 1)
         {
-            a[0] = src[IX(x - 1, y - 1)];
-            a[1] = src[IX(x    , y - 1)];
-            a[2] = src[IX(x + 1, y - 1)];
-            a[3] = src[IX(x - 1, y    )];
-            a[4] = src[IX(x    , y    )];
-            a[5] = src[IX(x + 1, y    )];
-            a[6] = src[IX(x - 1, y + 1)];
-            a[7] = src[IX(x    , y + 1)];
-            a[8] = src[IX(x + 1, y + 1)];
-            *d++ = median9(a);
+            // bottom row
+            d = &dst[IX(0, RH - 1)];
+
+            // bottom-left corner
+            a[0] = src[IX(0, RH - 2)];
+            a[1] = src[IX(1, RH - 2)];
+            a[2] = src[IX(0, RH - 1)];
+            a[3] = src[IX(1, RH - 1)];
+            *d++ = (T) median4(a);
+
+            // bottom row middle pixels
+            for (int x = 1; x <= RW - 2; x++)
+            {
+                a[0] = src[IX(x - 1, RH - 2)];
+                a[1] = src[IX(x    , RH - 2)];
+                a[2] = src[IX(x + 1, RH - 2)];
+                a[3] = src[IX(x - 1, RH - 1)];
+                a[4] = src[IX(x    , RH - 1)];
+                a[5] = src[IX(x + 1, RH - 1)];
+                *d++ = (T) median6(a);
+            }
+
+            // bottom-right corner
+            a[0] = src[IX(RW - 2, RH - 2)];
+            a[1] = src[IX(RW - 1, RH - 2)];
+            a[2] = src[IX(RW - 2, RH - 1)];
+            a[3] = src[IX(RW - 1, RH - 1)];
+            *d = (T) median4(a);
         }
+        else
+        {
+            d = &dst[IX(0, y)];
+
+            // leftmost pixel
+            a[0] = src[IX(0, y - 1)];
+            a[1] = src[IX(1, y - 1)];
+            a[2] = src[IX(0, y    )];
+            a[3] = src[IX(1, y    )];
+            a[4] = src[IX(0, y + 1)];
+            a[5] = src[IX(1, y + 1)];
+            *d++ = (T) median6(a);
+
+            for (int x = 1; x <= RW - 2; x++)
+            {
+                a[0] = src[IX(x - 1, y - 1)];
+                a[1] = src[IX(x    , y - 1)];
+                a[2] = src[IX(x + 1, y - 1)];
+                a[3] = src[IX(x - 1, y    )];
+                a[4] = src[IX(x    , y    )];
+                a[5] = src[IX(x + 1, y    )];
+                a[6] = src[IX(x - 1, y + 1)];
+                a[7] = src[IX(x    , y + 1)];
+                a[8] = src[IX(x + 1, y + 1)];
+                *d++ = (T) median9(a);
+            }
 
-        // rightmost pixel
-        a[0] = src[IX(RW - 2, y - 1)];
-        a[1] = src[IX(RW - 1, y - 1)];
-        a[2] = src[IX(RW - 2, y    )];
-        a[3] = src[IX(RW - 1, y    )];
-        a[4] = src[IX(RW - 2, y + 1)];
-        a[5] = src[IX(RW - 1, y + 1)];
-        *d++ = median6(a);
+            // rightmost pixel
+            a[0] = src[IX(RW - 2, y - 1)];
+            a[1] = src[IX(RW - 1, y - 1)];
+            a[2] = src[IX(RW - 2, y    )];
+            a[3] = src[IX(RW - 1, y    )];
+            a[4] = src[IX(RW - 2, y + 1)];
+            a[5] = src[IX(RW - 1, y + 1)];
+            *d++ = (T) median6(a);
+        }
     }
 
-    // bottom row
-    d = &dst[IX(0, RH - 1)];
+#undef IX
 
-    // bottom-left corner
-    a[0] = src[IX(0, RH - 2)];
-    a[1] = src[IX(1, RH - 2)];
-    a[2] = src[IX(0, RH - 1)];
-    a[3] = src[IX(1, RH - 1)];
-    *d++ = median4(a);
+    return false;
+}
 
-    // bottom row middle pixels
-    for (int x = 1; x <= RW - 2; x++)
-    {
-        a[0] = src[IX(x - 1, RH - 2)];
-        a[1] = src[IX(x    , RH - 2)];
-        a[2] = src[IX(x + 1, RH - 2)];
-        a[3] = src[IX(x - 1, RH - 1)];
-        a[4] = src[IX(x    , RH - 1)];
-        a[5] = src[IX(x + 1, RH - 1)];
-        *d++ = median6(a);
-    }
+bool Median3Rows(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect, int y0, int y1)
+{
+    return Median3RowsT(dst, src, size, rect, y0, y1);
+}
 
-    // bottom-right corner
-    a[0] = src[IX(RW - 2, RH - 2)];
-    a[1] = src[IX(RW - 1, RH - 2)];
-    a[2] = src[IX(RW - 2, RH - 1)];
-    a[3] = src[IX(RW - 1, RH - 1)];
-    *d = median4(a);
+bool Median3Rows(unsigned char *dst, const unsigned char *src, const wxSize& size, const wxRect& rect, int y0, int y1)
+{
+    return Median3RowsT(dst, src, size, rect, y0, y1);
+}
 
-#undef IX
+bool Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect)
+{
+    return Median3RowsT(dst, src, size, rect, 0, rect.GetHeight());
+}
 
-    return false;
+bool Median3(unsigned char *dst, const unsigned char *src, const wxSize& size, const wxRect& rect)
+{
+    return Median3RowsT(dst, src, size, rect, 0, rect.GetHeight());
 }
 
 static unsigned short MedianBorderingPixels(const usImage& img, int x, int y)
 {
     unsigned short array[8];
-    int const xsize = img.Size.GetWidth();
-    int const ysize = img.Size.GetHeight();
 
-    if (x > 0 && y > 0 && x < xsize - 1 && y < ysize - 1)
+    // the edges are those of the stored pixels, which for a subframe-only
+    // image are the edges of the subframe
+    const wxRect r(img.DataRect());
+    int const x0 = r.GetLeft();
+    int const y0 = r.GetTop();
+    int const x1 = r.GetRight();
+    int const y1 = r.GetBottom();
+
+    if (x > x0 && y > y0 && x < x1 && y < y1)
     {
-        array[0] = img.ImageData[(x-1) + (y-1) * xsize];
-        array[1] = img.ImageData[(x)   + (y-1) * xsize];
-        array[2] = img.ImageData[(x+1) + (y-1) * xsize];
-        array[3] = img.ImageData[(x-1) + (y)   * xsize];
-        array[4] = img.ImageData[(x+1) + (y)   * xsize];
-        array[5] = img.ImageData[(x-1) + (y+1) * xsize];
-        array[6] = img.ImageData[(x)   + (y+1) * xsize];
-        array[7] = img.ImageData[(x+1) + (y+1) * xsize];
+        array[0] = img.PixelValue(x-1, y-1);
+        array[1] = img.PixelValue(x, y-1);
+        array[2] = img.PixelValue(x+1, y-1);
+        array[3] = img.PixelValue(x-1, y);
+        array[4] = img.PixelValue(x+1, y);
+        array[5] = img.PixelValue(x-1, y+1);
+        array[6] = img.PixelValue(x, y+1);
+        array[7] = img.PixelValue(x+1, y+1);
         return median8(array);
     }
 
-    if (x == 0 && y > 0 && y < ysize - 1)
+    if (x == x0 && y > y0 && y < y1)
     {
         // On left edge
-        array[0] = img.ImageData[(x)     + (y - 1) * xsize];
-        array[1] = img.ImageData[(x)     + (y + 1) * xsize];
-        array[2] = img.ImageData[(x + 1) + (y - 1) * xsize];
-        array[3] = img.ImageData[(x + 1) + (y)     * xsize];
-        array[4] = img.ImageData[(x + 1) + (y + 1) * xsize];
+        array[0] = img.PixelValue(x, y - 1);
+        array[1] = img.PixelValue(x, y + 1);
+        array[2] = img.PixelValue(x + 1, y - 1);
+        array[3] = img.PixelValue(x + 1, y);
+        array[4] = img.PixelValue(x + 1, y + 1);
         return median5(array);
     }
 
-    if (x == xsize - 1 && y > 0 && y < ysize - 1)
+    if (x == x1 && y > y0 && y < y1)
     {
         // On right edge
-        array[0] = img.ImageData[(x)     + (y - 1) * xsize];
-        array[1] = img.ImageData[(x)     + (y + 1) * xsize];
-        array[2] = img.ImageData[(x - 1) + (y - 1) * xsize];
-        array[3] = img.ImageData[(x - 1) + (y)     * xsize];
-        array[4] = img.ImageData[(x - 1) + (y + 1) * xsize];
+        array[0] = img.PixelValue(x, y - 1);
+        array[1] = img.PixelValue(x, y + 1);
+        array[2] = img.PixelValue(x - 1, y - 1);
+        array[3] = img.PixelValue(x - 1, y);
+        array[4] = img.PixelValue(x - 1, y + 1);
         return median5(array);
     }
 
-    if (y == 0 && x > 0 && x < xsize - 1)
+    if (y == y0 && x > x0 && x < x1)
     {
         // On bottom edge
-        array[0] = img.ImageData[(x - 1) + (y)     * xsize];
-        array[1] = img.ImageData[(x - 1) + (y + 1) * xsize];
-        array[2] = img.ImageData[(x)     + (y + 1) * xsize];
-        array[3] = img.ImageData[(x + 1) + (y)     * xsize];
-        array[4] = img.ImageData[(x + 1) + (y + 1) * xsize];
+        array[0] = img.PixelValue(x - 1, y);
+        array[1] = img.PixelValue(x - 1, y + 1);
+        array[2] = img.PixelValue(x, y + 1);
+        array[3] = img.PixelValue(x + 1, y);
+        array[4] = img.PixelValue(x + 1, y + 1);
         return median5(array);
     }
 
-    if (y == ysize - 1 && x > 0 && x < xsize - 1)
+    if (y == y1 && x > x0 && x < x1)
     {
         // On top edge
-        array[0] = img.ImageData[(x - 1) + (y)     * xsize];
-        array[1] = img.ImageData[(x - 1) + (y - 1) * xsize];
-        array[2] = img.ImageData[(x)     + (y - 1) * xsize];
-        array[3] = img.ImageData[(x + 1) + (y)     * xsize];
-        array[4] = img.ImageData[(x + 1) + (y - 1) * xsize];
+        array[0] = img.PixelValue(x - 1, y);
+        array[1] = img.PixelValue(x - 1, y - 1);
+        array[2] = img.PixelValue(x, y - 1);
+        array[3] = img.PixelValue(x + 1, y);
+        array[4] = img.PixelValue(x + 1, y - 1);
         return median5(array);
     }
 
-    if (x == 0 && y == 0)
+    if (x == x0 && y == y0)
     {
         // At lower left corner
-        array[0] = img.ImageData[(x + 1) + (y)     * xsize];
-        array[1] = img.ImageData[(x)     + (y + 1) * xsize];
-        array[2] = img.ImageData[(x + 1) + (y + 1) * xsize];
+        array[0] = img.PixelValue(x + 1, y);
+        array[1] = img.PixelValue(x, y + 1);
+        array[2] = img.PixelValue(x + 1, y + 1);
     }
-    else if (x == 0 && y == ysize - 1)
+    else if (x == x0 && y == y1)
     {
         // At upper left corner
-        array[0] = img.ImageData[(x + 1) + (y)     * xsize];
-        array[1] = img.ImageData[(x)     + (y - 1) * xsize];
-        array[2] = img.ImageData[(x + 1) + (y - 1) * xsize];
+        array[0] = img.PixelValue(x + 1, y);
+        array[1] = img.PixelValue(x, y - 1);
+        array[2] = img.PixelValue(x + 1, y - 1);
     }
-    else if (x == xsize - 1 && y == ysize - 1)
+    else if (x == x1 && y == y1)
     {
         // At upper right corner
-        array[0] = img.ImageData[(x - 1) + (y)     * xsize];
-        array[1] = img.ImageData[(x)     + (y - 1) * xsize];
-        array[2] = img.ImageData[(x - 1) + (y - 1) * xsize];
+        array[0] = img.PixelValue(x - 1, y);
+        array[1] = img.PixelValue(x, y - 1);
+        array[2] = img.PixelValue(x - 1, y - 1);
     }
-    else if (x == xsize - 1 && y == 0)
+    else if (x == x1 && y == y0)
     {
         // At lower right corner
-        array[0] = img.ImageData[(x - 1) + (y)     * xsize];
-        array[1] = img.ImageData[(x)     + (y + 1) * xsize];
-        array[2] = img.ImageData[(x - 1) + (y + 1) * xsize];
+        array[0] = img.PixelValue(x - 1, y);
+        array[1] = img.PixelValue(x, y + 1);
+        array[2] = img.PixelValue(x - 1, y + 1);
     }
     else
     {
@@ -529,54 +782,249 @@ static unsigned short MedianBorderingPixels(const usImage& img, int x, int y)
     return median3(array);
 }
 
+// Bilinear resampling of a full-frame image into a new one of the same pixel
+// type. Output pixel (x, y) samples the source at
+//   (ox + x * xx + y * xy, oy + x * yx + y * yy)
+// so one kernel serves rotation, mirroring and scaling. When the map has no
+// cross terms it is separable: the column indexes and weights are computed
+// once and every row is a blend of two source rows. Bands of output rows are
+// resampled in parallel on the WorkPool.
+struct ResampleJob
+{
+    const usImage *src;
+    usImage *dst;
+    double ox, xx, xy;
+    double oy, yx, yy;
+    bool clip;                  // pixels mapping outside the source are black instead of the nearest edge value
+    bool separable;
+    std::vector<int> col0;      // separable maps: source columns and weight of col1 for each output column
+    std::vector<int> col1;
+    std::vector<float> colWeight;
+    int bandHeight;
+};
+
+// the two source indexes around position p and the weight of the second one,
+// clamped to the n valid indexes
+inline static void LerpIndex(double p, int n, int *i0, int *i1, float *w)
+{
+    int const i = (int) floor(p);
+    if (i < 0)
+    {
+        *i0 = *i1 = 0;
+        *w = 0.f;
+    }
+    else if (i >= n - 1)
+    {
+        *i0 = *i1 = n - 1;
+        *w = 0.f;
+    }
+    else
+    {
+        *i0 = i;
+        *i1 = i + 1;
+        *w = (float) (p - i);
+    }
+}
+
+template<typename T>
+static void ResampleRows(const ResampleJob& job, int y0, int y1)
+{
+    const usImage& src = *job.src;
+    int const sw = src.Size.GetWidth();
+    int const sh = src.Size.GetHeight();
+    int const dw = job.dst->Size.GetWidth();
+    const T *s = PixelData<T>(src);
+
+    for (int y = y0; y < y1; y++)
+    {
+        T *d = PixelPtr<T>(*job.dst, 0, y);
+
+        if (job.separable)
+        {
+            int r0, r1;
+            float wy;
+            LerpIndex(job.oy + y * job.yy, sh, &r0, &r1, &wy);
+            const T *s0 = s + r0 * sw;
+            const T *s1 = s + r1 * sw;
+            const int *c0 = &job.col0[0];
+            const int *c1 = &job.col1[0];
+            const float *wx = &job.colWeight[0];
+
+            for (int x = 0; x < dw; x++)
+            {
+                float const top = s0[c0[x]] + (s0[c1[x]] - (float) s0[c0[x]]) * wx[x];
+                float const bot = s1[c0[x]] + (s1[c1[x]] - (float) s1[c0[x]]) * wx[x];
+                d[x] = (T) (top + (bot - top) * wy + 0.5f);
+            }
+            continue;
+        }
+
+        double px = job.ox + y * job.xy;
+        double py = job.oy + y * job.yy;
+
+        for (int x = 0; x < dw; x++, px += job.xx, py += job.yx)
+        {
+            if (job.clip && (px <= -0.25 || px >= sw - 0.75 || py <= -0.25 || py >= sh - 0.75))
+            {
+                d[x] = 0;
+                continue;
+            }
+
+            int c0, c1, r0, r1;
+            float wx, wy;
+            LerpIndex(px, sw, &c0, &c1, &wx);
+            LerpIndex(py, sh, &r0, &r1, &wy);
+            const T *s0 = s + r0 * sw;
+            const T *s1 = s + r1 * sw;
+            float const top = s0[c0] + (s0[c1] - (float) s0[c0]) * wx;
+            float const bot = s1[c0] + (s1[c1] - (float) s1[c0]) * wx;
+            d[x] = (T) (top + (bot - top) * wy + 0.5f);
+        }
+    }
+}
+
+static void ResampleBand(void *ctx, unsigned int band)
+{
+    const ResampleJob& job = *static_cast<const ResampleJob *>(ctx);
+    int const height = job.dst->Size.GetHeight();
+    int const y0 = wxMin((int) band * job.bandHeight, height);
+    int const y1 = wxMin(y0 + job.bandHeight, height);
+
+    if (job.src->Is8Bit())
+        ResampleRows<unsigned char>(job, y0, y1);
+    else
+        ResampleRows<unsigned short>(job, y0, y1);
+}
+
+// Resamples img to size through the map in job, keeping its pixel type.
+// The result is a full frame without a subframe; the old pixel buffer goes
+// back to the buffer pool. Returns true on error.
+static bool Resample(usImage& img, const wxSize& size, ResampleJob& job)
+{
+    if (size.GetWidth() < 1 || size.GetHeight() < 1 || img.MakeFullFrame())
+        return true;
+
+    usImage tmp;
+    if (tmp.Init(size, img.Is8Bit()))
+        return true;
+
+    job.src = &img;
+    job.dst = &tmp;
+    job.separable = !job.clip && job.xy == 0. && job.yx == 0.;
+    if (job.separable)
+    {
+        int const w = size.GetWidth();
+        job.col0.resize(w);
+        job.col1.resize(w);
+        job.colWeight.resize(w);
+        for (int x = 0; x < w; x++)
+            LerpIndex(job.ox + x * job.xx, img.Size.GetWidth(), &job.col0[x], &job.col1[x], &job.colWeight[x]);
+    }
+
+    enum { MIN_BAND_HEIGHT = 16 };
+    int const h = size.GetHeight();
+    unsigned int nbands = WorkPool::Concurrency() * 4;
+    job.bandHeight = wxMax((h + (int) nbands - 1) / (int) nbands, (int) MIN_BAND_HEIGHT);
+    nbands = (h + job.bandHeight - 1) / job.bandHeight;
+
+    WorkPool::Run(&ResampleBand, &job, nbands);
+
+    img.Size = tmp.Size;
+    img.Subframe = tmp.Subframe;
+    img.SwapImageData(tmp);
+
+    return false;
+}
+
 bool SquarePixels(usImage& img, float xsize, float ysize)
 {
     // Stretches one dimension to square up pixels
-    if (!img.ImageData)
+    if (!img.HasPixels())
         return true;
 
     if (xsize <= ysize)
         return false;
 
-    // Move the existing data to a temp image
-    usImage tempimg;
-    if (tempimg.Init(img.Size))
-    {
-        pFrame->Alert(_("Memory allocation error"));
-        return true;
-    }
-    tempimg.SwapImageData(img);
+    TraceSpan span("SquarePixels");
 
     // if X > Y, when viewing stock, Y is unnaturally stretched, so stretch X to match
     double ratio = ysize / xsize;
-    int newsize = ROUND((double) tempimg.Size.GetWidth() / ratio);  // make new image correct size
-    img.Init(newsize,tempimg.Size.GetHeight());
-    unsigned short *optr = img.ImageData;
-    int linesize = tempimg.Size.GetWidth();  // size of an original line
-    for (int y = 0; y < img.Size.GetHeight(); y++)
+    int newsize = ROUND((double) img.Size.GetWidth() / ratio);  // make new image correct size
+
+    ResampleJob job;
+    job.ox = 0.;
+    job.xx = ratio;
+    job.xy = 0.;
+    job.oy = 0.;
+    job.yx = 0.;
+    job.yy = 1.;
+    job.clip = false;
+
+    if (Resample(img, wxSize(newsize, img.Size.GetHeight()), job))
     {
-        for (int x = 0; x < newsize; x++, optr++)
-        {
-            double oldposition = x * ratio;
-            int ind1 = (unsigned int) floor(oldposition);
-            int ind2 = (unsigned int) ceil(oldposition);
-            if (ind2 > (tempimg.Size.GetWidth() - 1))
-                ind2 = tempimg.Size.GetWidth() - 1;
-            double weight = ceil(oldposition) - oldposition;
-            *optr = (unsigned short) (((float) *(tempimg.ImageData + y*linesize + ind1) * weight) + ((float) *(tempimg.ImageData + y*linesize + ind1) * (1.0 - weight)));
-        }
+        pFrame->Alert(_("Memory allocation error"));
+        return true;
     }
 
     return false;
 }
 
-bool Subtract(usImage& light, const usImage& dark)
+// Rotates img by theta radians about its top-left corner, after mirroring it
+// top to bottom if mirror is set. The result is just big enough to hold the
+// rotated frame, with black outside of it, the same geometry wxImage::Rotate()
+// gives.
+bool RotateImage(usImage& img, double theta, bool mirror)
 {
-    if (!light.ImageData || !dark.ImageData)
+    if (!img.HasPixels())
         return true;
-    if (light.Size != dark.Size)
+
+    TraceSpan span("RotateImage");
+
+    double const c = cos(theta);
+    double const s = sin(theta);
+    int const w = img.Size.GetWidth();
+    int const h = img.Size.GetHeight();
+
+    // bounding box of the rotated corners
+    double const cx[4] = { 0., -h * s, w * c, w * c - h * s };
+    double const cy[4] = { 0., h * c, w * s, w * s + h * c };
+    int const x1 = (int) floor(*std::min_element(cx, cx + 4));
+    int const y1 = (int) floor(*std::min_element(cy, cy + 4));
+    int const x2 = (int) ceil(*std::max_element(cx, cx + 4));
+    int const y2 = (int) ceil(*std::max_element(cy, cy + 4));
+
+    // output pixel (x, y) is at (x + x1, y + y1) in rotated coordinates; the
+    // source position is that point rotated back by -theta
+    ResampleJob job;
+    job.ox = x1 * c + y1 * s;
+    job.xx = c;
+    job.xy = s;
+    job.oy = y1 * c - x1 * s;
+    job.yx = -s;
+    job.yy = c;
+    job.clip = true;
+
+    if (mirror)
+    {
+        job.oy = (h - 1) - job.oy;
+        job.yx = -job.yx;
+        job.yy = -job.yy;
+    }
+
+    if (Resample(img, wxSize(x2 - x1 + 1, y2 - y1 + 1), job))
+    {
+        pFrame->Alert(_("Memory allocation error"));
         return true;
+    }
+
+    return false;
+}
 
+// the dark library is always 16-bit; an 8-bit light is subtracted in place
+// and clipped to the range of its pixel type
+template<typename T>
+static void SubtractT(usImage& light, const usImage& dark)
+{
     unsigned int left, top, width, height;
     if (!light.Subframe.IsEmpty())
     {
@@ -594,13 +1042,13 @@ bool Subtract(usImage& light, const usImage& dark)
 
     int mindiff = 65535;
 
-    unsigned short *pl0 = &light.Pixel(left, top);
+    T *pl0 = PixelPtr<T>(light, left, top);
     const unsigned short *pd0 = &dark.Pixel(left, top);
     for (unsigned int r = 0; r < height;
-         r++, pl0 += light.Size.GetWidth(), pd0 += light.Size.GetWidth())
+         r++, pl0 += light.Stride, pd0 += dark.Stride)
     {
-        unsigned short *const endl = pl0 + width;
-        unsigned short *pl;
+        T *const endl = pl0 + width;
+        T *pl;
         const unsigned short *pd;
         for (pl = pl0, pd = pd0; pl < endl; pl++, pd++)
         {
@@ -617,22 +1065,39 @@ bool Subtract(usImage& light, const usImage& dark)
         light.Pedestal = (unsigned short) offset;
     }
 
-    pl0 = &light.Pixel(left, top);
+    int const maxval = std::numeric_limits<T>::max();
+
+    pl0 = PixelPtr<T>(light, left, top);
     pd0 = &dark.Pixel(left, top);
     for (unsigned int r = 0; r < height;
-         r++, pl0 += light.Size.GetWidth(), pd0 += light.Size.GetWidth())
+         r++, pl0 += light.Stride, pd0 += dark.Stride)
     {
-        unsigned short *const endl = pl0 + width;
-        unsigned short *pl;
+        T *const endl = pl0 + width;
+        T *pl;
         const unsigned short *pd;
         for (pl = pl0, pd = pd0; pl < endl; pl++, pd++)
         {
             int newval = (int) *pl - (int) *pd + offset;
             if (newval < 0) newval = 0; // shouldn't hit this...
-            else if (newval > 65535) newval = 65535;
-            *pl = (unsigned short) newval;
+            else if (newval > maxval) newval = maxval;
+            *pl = (T) newval;
         }
     }
+}
+
+bool Subtract(usImage& light, const usImage& dark)
+{
+    if (!light.HasPixels() || !dark.ImageData)
+        return true;
+    if (light.Size != dark.Size)
+        return true;
+    if (!dark.DataRect().Contains(light.DataRect()))
+        return true;
+
+    if (light.Is8Bit())
+        SubtractT<unsigned char>(light, dark);
+    else
+        SubtractT<unsigned short>(light, dark);
 
     return false;
 }
@@ -1038,7 +1503,7 @@ const wxArrayString& DefectMapBuilder::GetMapInfo() const
 bool RemoveDefects(usImage& light, const DefectMap& defectMap)
 {
     // Check to make sure the light frame is valid
-    if (!light.ImageData)
+    if (!light.HasPixels())
         return true;
 
     if (!light.Subframe.IsEmpty())
@@ -1051,7 +1516,7 @@ bool RemoveDefects(usImage& light, const DefectMap& defectMap)
             // Check to see if we are within the subframe before correcting the defect
             if (light.Subframe.Contains(pt))
             {
-                light.Pixel(pt.x, pt.y) = MedianBorderingPixels(light, pt.x, pt.y);
+                light.SetPixelValue(pt.x, pt.y, MedianBorderingPixels(light, pt.x, pt.y));
             }
         }
     }
@@ -1066,7 +1531,7 @@ bool RemoveDefects(usImage& light, const DefectMap& defectMap)
 
             if (x >= 0 && x < light.Size.GetWidth() && y >= 0 && y < light.Size.GetHeight())
             {
-                light.Pixel(x, y) = MedianBorderingPixels(light, x, y);
+                light.SetPixelValue(x, y, MedianBorderingPixels(light, x, y));
             }
         }
     }
@@ -1121,7 +1586,7 @@ bool DefectMap::DefectMapExists(int profileId, bool showAlert)
     if (wxFileExists(DefectMapFileName(profileId)))
     {
         wxString fName = DefectMapMasterPath(profileId);
-        const wxSize& sensorSize = pCamera->DarkFrameSize();
+        const wxSize& sensorSize = pCamera->DarkLibraryFrameSize();
         if (sensorSize == UNDEFINED_FRAME_SIZE)
         {
             bOk = true;
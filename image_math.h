@@ -53,10 +53,17 @@ public:
 
 };
 
-extern bool QuickLRecon(usImage& img);
+extern bool QuickLRecon(usImage& img);
+extern bool BayerLuminance(usImage& img);
 extern bool Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect);
+extern bool Median3(unsigned char *dst, const unsigned char *src, const wxSize& size, const wxRect& rect);
+extern bool Median3Rows(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect, int y0, int y1);
+extern bool Median3Rows(unsigned char *dst, const unsigned char *src, const wxSize& size, const wxRect& rect, int y0, int y1);
 extern bool Median3(usImage& img);
-extern bool SquarePixels(usImage& img, float xsize, float ysize);
+extern bool BinPyramid(const usImage& img, usImage *bin2, usImage *bin4, unsigned short *maxVal);
+extern bool SoftwareBin(usImage& img, int factor, bool sum);
+extern bool SquarePixels(usImage& img, float xsize, float ysize);
+extern bool RotateImage(usImage& img, double theta, bool mirror);
 extern int dbl_sort_func(double *first, double *second);
 extern bool Subtract(usImage& light, const usImage& dark);
 extern double CalcSlope(const ArrayOfDbl& y);
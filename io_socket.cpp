@@ -0,0 +1,238 @@
+/*
+*  io_socket.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+#ifdef __WINDOWS__
+# include <winsock.h>
+typedef int socklen_t;
+#else
+# include <sys/types.h>
+# include <sys/select.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+# define SEND_FLAGS MSG_NOSIGNAL
+#else
+# define SEND_FLAGS 0
+#endif
+
+static void init_sockets()
+{
+    // wx starts up the platform socket library along with its own sockets
+    if (!wxSocketBase::IsInitialized())
+        wxSocketBase::Initialize();
+}
+
+static bool would_block()
+{
+#ifdef __WINDOWS__
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// returns true on error
+static bool set_nonblocking(wxSOCKET_T fd)
+{
+#ifdef __WINDOWS__
+    u_long arg = 1;
+    return ioctlsocket(fd, FIONBIO, &arg) != 0;
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1;
+#endif
+}
+
+static sockaddr_in make_addr(unsigned long host, unsigned short port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(host);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+wxSOCKET_T IoSocket::Listen(unsigned short port)
+{
+    init_sockets();
+
+    wxSOCKET_T fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_IO_SOCKET)
+        return fd;
+
+#ifndef __WINDOWS__
+    // allow a restart while connections from the last run are in TIME_WAIT;
+    // a second instance on the port still fails to bind
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *) &on, sizeof(on));
+#endif
+
+    sockaddr_in addr = make_addr(INADDR_ANY, port);
+
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0 || set_nonblocking(fd))
+    {
+        Close(fd);
+        return INVALID_IO_SOCKET;
+    }
+
+    return fd;
+}
+
+wxSOCKET_T IoSocket::Accept(wxSOCKET_T listener)
+{
+    while (true)
+    {
+        wxSOCKET_T fd = accept(listener, 0, 0);
+        if (fd == INVALID_IO_SOCKET)
+            return fd;
+
+#ifndef __WINDOWS__
+        if (fd >= FD_SETSIZE)
+        {
+            // cannot be waited on with select()
+            Debug.Write(wxString::Format("IoSocket: refusing connection, descriptor %d out of range\n", (int) fd));
+            Close(fd);
+            continue;
+        }
+#endif
+
+        if (set_nonblocking(fd))
+        {
+            Close(fd);
+            continue;
+        }
+
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (const char *) &on, sizeof(on));
+#endif
+
+        return fd;
+    }
+}
+
+int IoSocket::Read(wxSOCKET_T fd, void *buf, size_t len)
+{
+    int n = recv(fd, (char *) buf, (int) len, 0);
+    if (n > 0)
+        return n;
+    if (n < 0 && would_block())
+        return 0;
+    return -1;  // closed by the peer, or failed
+}
+
+int IoSocket::Write(wxSOCKET_T fd, const void *buf, size_t len)
+{
+    int n = send(fd, (const char *) buf, (int) len, SEND_FLAGS);
+    if (n >= 0)
+        return n;
+    return would_block() ? 0 : -1;
+}
+
+void IoSocket::Close(wxSOCKET_T fd)
+{
+#ifdef __WINDOWS__
+    closesocket(fd);
+#else
+    close(fd);
+#endif
+}
+
+int IoSocket::LastError()
+{
+#ifdef __WINDOWS__
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// a datagram socket on the loopback interface that sends to itself
+
+IoWaker::IoWaker()
+    : m_fd(INVALID_IO_SOCKET),
+    m_port(0)
+{
+    init_sockets();
+
+    wxSOCKET_T fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == INVALID_IO_SOCKET)
+        return;
+
+    sockaddr_in addr = make_addr(INADDR_LOOPBACK, 0);
+    socklen_t len = sizeof(addr);
+
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || getsockname(fd, (sockaddr *) &addr, &len) != 0 ||
+        set_nonblocking(fd))
+    {
+        Debug.Write(wxString::Format("IoWaker: could not create wakeup socket, error %d\n", IoSocket::LastError()));
+        IoSocket::Close(fd);
+        return;
+    }
+
+    m_fd = fd;
+    m_port = ntohs(addr.sin_port);
+}
+
+IoWaker::~IoWaker()
+{
+    if (m_fd != INVALID_IO_SOCKET)
+        IoSocket::Close(m_fd);
+}
+
+void IoWaker::Wake()
+{
+    if (m_fd == INVALID_IO_SOCKET)
+        return;
+
+    // if the socket buffer is full a wakeup is already pending
+    sockaddr_in addr = make_addr(INADDR_LOOPBACK, m_port);
+    char c = 0;
+    sendto(m_fd, &c, 1, 0, (sockaddr *) &addr, sizeof(addr));
+}
+
+void IoWaker::Drain()
+{
+    char buf[64];
+    while (recv(m_fd, buf, sizeof(buf), 0) > 0)
+        ;
+}
@@ -0,0 +1,86 @@
+/*
+*  io_socket.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef IO_SOCKET_INCLUDED
+#define IO_SOCKET_INCLUDED
+
+// Plain non-blocking TCP sockets for the servers that read and write their
+// clients on a worker thread. A wxSocketBase belongs to the main thread's
+// event loop, so these servers do not use one per client: the I/O thread
+// owns the descriptors outright and is the only thread that reads, writes or
+// closes them.
+
+#define INVALID_IO_SOCKET ((wxSOCKET_T) -1)
+
+class IoSocket
+{
+public:
+    // socket listening on the given port, INVALID_IO_SOCKET on failure
+    static wxSOCKET_T Listen(unsigned short port);
+
+    // next pending connection, INVALID_IO_SOCKET if there is none
+    static wxSOCKET_T Accept(wxSOCKET_T listener);
+
+    // bytes read, 0 if nothing is available yet, -1 if the connection closed or failed
+    static int Read(wxSOCKET_T fd, void *buf, size_t len);
+
+    // bytes written, 0 if the socket cannot take more yet, -1 on error
+    static int Write(wxSOCKET_T fd, const void *buf, size_t len);
+
+    static void Close(wxSOCKET_T fd);
+
+    // error code of the last failed call, for logging
+    static int LastError();
+};
+
+// Wakes a thread waiting in select() on its sockets. The thread adds Fd() to
+// its read set and calls Drain() when it is readable; Wake() may be called
+// from any thread.
+class IoWaker
+{
+    wxSOCKET_T m_fd;
+    unsigned short m_port;
+
+public:
+    IoWaker();
+    ~IoWaker();
+
+    bool Ok() const { return m_fd != INVALID_IO_SOCKET; }
+    wxSOCKET_T Fd() const { return m_fd; }
+
+    void Wake();
+    void Drain();
+};
+
+#endif
@@ -54,11 +54,11 @@
  *  THE SOFTWARE.
  */
 
-#include "phd.h"
 #include "json_parser.h"
 
 #include <algorithm>
 #include <memory.h>
+#include <stdlib.h>
 
 class block_allocator
 {
@@ -70,6 +70,8 @@ private:
         block *next;
     };
 
+    enum { MAX_BLOCK_SIZE = 4 * 1024 * 1024 };
+
     block *m_head;
     size_t m_blocksize;
 
@@ -86,7 +88,7 @@ public:
     // allocate memory
     void *malloc(size_t size);
 
-    // reset to empty state, keeping one allocated block
+    // reset to empty state, keeping the largest allocated block
     void reset();
 
     // free all allocated blocks
@@ -133,8 +135,14 @@ void *block_allocator::malloc(size_t size)
 {
     if (!m_head || m_head->used + size > m_head->size)
     {
-        // calc needed size for allocation
-        size_t alloc_size = std::max(sizeof(block) + size, m_blocksize);
+        // calc needed size for allocation. Each new block is twice the size
+        // of the previous one so a large document takes a logarithmic number
+        // of allocations, and the block kept by reset() is big enough for
+        // the next document of a similar size.
+        size_t alloc_size = m_blocksize;
+        if (m_head)
+            alloc_size = std::max(alloc_size, std::min(m_head->size * 2, (size_t) MAX_BLOCK_SIZE));
+        alloc_size = std::max(alloc_size, sizeof(block) + size);
 
         // create new block
         block *b = (block *)::malloc(alloc_size);
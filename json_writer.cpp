@@ -0,0 +1,264 @@
+/*
+*  json_writer.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "json_writer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+# define snprintf _snprintf
+#endif
+
+static const char HEX[] = "0123456789abcdef";
+
+void JsonWriter::Escape(const char *s, size_t len)
+{
+    const char *end = s + len;
+    const char *run = s;
+
+    for (; s < end; ++s)
+    {
+        unsigned char c = (unsigned char) *s;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        m_buf.append(run, s - run);
+        run = s + 1;
+
+        switch (c)
+        {
+        case '"':  m_buf += "\\\""; break;
+        case '\\': m_buf += "\\\\"; break;
+        case '\n': m_buf += "\\n"; break;
+        case '\r': m_buf += "\\r"; break;
+        case '\t': m_buf += "\\t"; break;
+        default:
+        {
+            char u[6] = { '\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf] };
+            m_buf.append(u, sizeof(u));
+            break;
+        }
+        }
+    }
+
+    m_buf.append(run, end - run);
+}
+
+// encode a wide string (UTF-16 or UTF-32 depending on the platform) as UTF-8
+void JsonWriter::Escape(const wchar_t *s)
+{
+    for (; *s; ++s)
+    {
+        unsigned long c = (unsigned long) *s;
+
+        if (c < 0x80)
+        {
+            if (c >= 0x20 && c != '"' && c != '\\')
+                m_buf += (char) c;
+            else
+            {
+                char ch = (char) c;
+                Escape(&ch, 1);
+            }
+            continue;
+        }
+
+        if (sizeof(wchar_t) == 2 && c >= 0xd800 && c < 0xdc00 && s[1] >= 0xdc00 && s[1] < 0xe000)
+        {
+            c = 0x10000 + ((c - 0xd800) << 10) + ((unsigned long) s[1] - 0xdc00);
+            ++s;
+        }
+
+        if (c < 0x800)
+        {
+            m_buf += (char) (0xc0 | (c >> 6));
+        }
+        else if (c < 0x10000)
+        {
+            m_buf += (char) (0xe0 | (c >> 12));
+            m_buf += (char) (0x80 | ((c >> 6) & 0x3f));
+        }
+        else
+        {
+            m_buf += (char) (0xf0 | (c >> 18));
+            m_buf += (char) (0x80 | ((c >> 12) & 0x3f));
+            m_buf += (char) (0x80 | ((c >> 6) & 0x3f));
+        }
+        m_buf += (char) (0x80 | (c & 0x3f));
+    }
+}
+
+JsonWriter& JsonWriter::Key(const char *name)
+{
+    Separator();
+    m_buf += '"';
+    m_buf += name;
+    m_buf += "\":";
+    m_afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(const char *s)
+{
+    return String(s, strlen(s));
+}
+
+JsonWriter& JsonWriter::String(const char *s, size_t len)
+{
+    Separator();
+    m_buf += '"';
+    Escape(s, len);
+    m_buf += '"';
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(const wchar_t *s)
+{
+    Separator();
+    m_buf += '"';
+    Escape(s);
+    m_buf += '"';
+    return *this;
+}
+
+// digits of an unsigned value, most significant first; returns the number of digits
+static int utoa(unsigned long long v, char *out)
+{
+    char tmp[20];
+    int n = 0;
+    do
+    {
+        tmp[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (int i = 0; i < n; i++)
+        out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+JsonWriter& JsonWriter::Int(int val)
+{
+    Separator();
+    char buf[12];
+    int n = 0;
+    long long v = val;
+    if (v < 0)
+    {
+        buf[n++] = '-';
+        v = -v;
+    }
+    n += utoa((unsigned long long) v, buf + n);
+    m_buf.append(buf, n);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Double(double val)
+{
+    Separator();
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%g", val);
+    m_buf.append(buf, n);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Double(double val, int prec)
+{
+    static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+    Separator();
+
+    char buf[512];      // room for %.100f of the largest double
+    double a = fabs(val);
+    double x = prec >= 0 && prec <= 9 ? a * POW10[prec] : 0.0;
+    double ip0 = floor(x);
+    double tie = x - ip0 - 0.5;
+
+    // Values that do not fit the fast path (including NaN and infinity) go
+    // through printf, as do values within rounding error of a tie between
+    // two outputs: the product is rounded, and printf rounds the exact value
+    // of val, so 1.0005 (really 1.000499999...) is "1.000" at precision 3.
+    if (!(a < 1e15) || prec < 0 || prec > 9 || x >= 9e15 || fabs(tie) <= x * 2.3e-16)
+    {
+        int n = snprintf(buf, sizeof(buf), "%.*f", prec < 100 ? prec : 100, val);
+        if (n > 0 && (size_t) n < sizeof(buf))
+            m_buf.append(buf, n);
+        return *this;
+    }
+
+    unsigned long long scaled = (unsigned long long) ip0 + (tie > 0.0 ? 1 : 0);
+    unsigned long long scale = (unsigned long long) POW10[prec];
+    unsigned long long ip = scaled / scale;
+    unsigned long long fp = scaled % scale;
+
+    int n = 0;
+    if (val < 0.0)
+        buf[n++] = '-';
+    n += utoa(ip, buf + n);
+    if (prec > 0)
+    {
+        buf[n++] = '.';
+        for (int i = prec - 1; i >= 0; i--)
+        {
+            buf[n + i] = (char) ('0' + fp % 10);
+            fp /= 10;
+        }
+        n += prec;
+    }
+
+    m_buf.append(buf, n);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool val)
+{
+    Separator();
+    m_buf += val ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null()
+{
+    Separator();
+    m_buf += "null";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(const char *json, size_t len)
+{
+    Separator();
+    m_buf.append(json, len);
+    return *this;
+}
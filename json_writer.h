@@ -0,0 +1,109 @@
+/*
+*  json_writer.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef JSON_WRITER_INCLUDED
+#define JSON_WRITER_INCLUDED
+
+#include <string>
+#include <vector>
+
+// Streaming JSON writer that serializes straight into a reusable UTF-8
+// byte buffer. Reset() keeps the buffer's capacity, so once the buffer has
+// grown to the size of the largest message nothing is allocated.
+//
+//   JsonWriter w;
+//   w.BeginObject().Key("Event").String("GuideStep").Key("dx").Double(0.25, 3).EndObject();
+//   send(w.Data(), w.Size());
+//
+class JsonWriter
+{
+    std::string m_buf;
+    unsigned int m_depth;
+    std::vector<bool> m_needComma;  // entry n set if the next item at depth n needs a separator
+    bool m_afterKey;
+
+    void Separator()
+    {
+        if (m_afterKey)
+            m_afterKey = false;
+        else if (m_needComma[m_depth])
+            m_buf += ',';
+        m_needComma[m_depth] = true;
+    }
+
+    void Open(char c)
+    {
+        Separator();
+        m_buf += c;
+        if (++m_depth == m_needComma.size())
+            m_needComma.push_back(false);
+        else
+            m_needComma[m_depth] = false;
+    }
+
+    void Escape(const char *s, size_t len);
+    void Escape(const wchar_t *s);
+
+public:
+    JsonWriter() : m_depth(0), m_needComma(1, false), m_afterKey(false) { m_buf.reserve(1024); }
+
+    void Reset() { m_buf.clear(); m_depth = 0; m_needComma[0] = false; m_afterKey = false; }
+
+    JsonWriter& BeginObject() { Open('{'); return *this; }
+    JsonWriter& EndObject() { --m_depth; m_buf += '}'; return *this; }
+    JsonWriter& BeginArray() { Open('['); return *this; }
+    JsonWriter& EndArray() { --m_depth; m_buf += ']'; return *this; }
+
+    // names are written as is, they must not need escaping
+    JsonWriter& Key(const char *name);
+
+    JsonWriter& String(const char *s);      // UTF-8
+    JsonWriter& String(const char *s, size_t len);
+    JsonWriter& String(const wchar_t *s);
+    JsonWriter& Int(int val);
+    JsonWriter& Double(double val);         // like printf %g
+    JsonWriter& Double(double val, int prec);   // like printf %.<prec>f
+    JsonWriter& Bool(bool val);
+    JsonWriter& Null();
+    // an already serialized JSON value
+    JsonWriter& Raw(const char *json, size_t len);
+
+    // append a line terminator after the top-level value
+    JsonWriter& EndLine() { m_buf += "\r\n"; return *this; }
+
+    const char *Data() const { return m_buf.data(); }
+    size_t Size() const { return m_buf.size(); }
+};
+
+#endif
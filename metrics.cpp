@@ -0,0 +1,361 @@
+/*
+*  metrics.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+PipelineMetrics Metrics;
+MetricsServer MetricsHttp;
+
+// histogram bucket upper bounds in milliseconds
+static const double s_boundsMs[LatencyHistogram::NUM_BOUNDS] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000
+};
+
+static const char *s_stageNames[PipelineMetrics::NUM_STAGES] = {
+    "capture", "image_prep", "guide_update", "move"
+};
+
+enum
+{
+    MAX_REQUEST = 4096
+};
+
+struct MetricsClient
+{
+    std::string request;
+    std::string response;
+    size_t sent;
+
+    MetricsClient() : sent(0) { }
+};
+
+BEGIN_EVENT_TABLE(MetricsServer, wxEvtHandler)
+    EVT_SOCKET(METRICS_SERVER_ID, MetricsServer::OnServerEvent)
+    EVT_SOCKET(METRICS_CLIENT_ID, MetricsServer::OnClientEvent)
+END_EVENT_TABLE()
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (unsigned int i = 0; i <= NUM_BOUNDS; i++)
+        m_buckets[i].store(0);
+    m_sumUs.store(0);
+}
+
+void LatencyHistogram::Observe(double ms)
+{
+    unsigned int i = 0;
+    while (i < NUM_BOUNDS && ms > s_boundsMs[i])
+        ++i;
+
+    m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    m_sumUs.fetch_add((unsigned long long) (ms * 1000.0 + 0.5), std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Write(wxString *out, const char *name, const wxString& labels) const
+{
+    unsigned int cumulative = 0;
+
+    for (unsigned int i = 0; i < NUM_BOUNDS; i++)
+    {
+        cumulative += m_buckets[i].load(std::memory_order_relaxed);
+        *out << wxString::Format("%s_bucket{%s,le=\"%g\"} %u\n", name, labels, s_boundsMs[i] / 1000.0, cumulative);
+    }
+    cumulative += m_buckets[NUM_BOUNDS].load(std::memory_order_relaxed);
+    *out << wxString::Format("%s_bucket{%s,le=\"+Inf\"} %u\n", name, labels, cumulative);
+
+    *out << wxString::Format("%s_sum{%s} %.6f\n", name, labels, (double) m_sumUs.load(std::memory_order_relaxed) / 1e6)
+         << wxString::Format("%s_count{%s} %u\n", name, labels, cumulative);
+}
+
+PipelineMetrics::PipelineMetrics()
+{
+    framesCaptured.store(0);
+    framesDropped.store(0);
+    captureErrors.store(0);
+    workerQueueDepth[QUEUE_HIGH].store(0);
+    workerQueueDepth[QUEUE_LOW].store(0);
+}
+
+static void write_header(wxString *out, const char *name, const char *type, const char *help)
+{
+    *out << wxString::Format("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static unsigned long long dark_library_bytes()
+{
+    unsigned long long bytes = 0;
+
+    if (pCamera)
+    {
+        for (ExposureImgMap::const_iterator it = pCamera->Darks.begin(); it != pCamera->Darks.end(); ++it)
+            bytes += (unsigned long long) it->second->NPixels * sizeof(unsigned short);
+        if (pCamera->CurrentDefectMap)
+            bytes += pCamera->CurrentDefectMap->size() * sizeof(wxPoint);
+    }
+
+    return bytes;
+}
+
+// called on the main thread, so gauges owned by the UI can be read directly
+static wxString build_metrics()
+{
+    wxString out;
+
+    write_header(&out, "phd2_frames_captured_total", "counter", "Frames successfully captured");
+    out << wxString::Format("phd2_frames_captured_total %u\n", Metrics.framesCaptured.load(std::memory_order_relaxed));
+
+    write_header(&out, "phd2_frames_dropped_total", "counter", "Frames dropped because the guide star was lost");
+    out << wxString::Format("phd2_frames_dropped_total %u\n", Metrics.framesDropped.load(std::memory_order_relaxed));
+
+    write_header(&out, "phd2_capture_errors_total", "counter", "Failed camera captures");
+    out << wxString::Format("phd2_capture_errors_total %u\n", Metrics.captureErrors.load(std::memory_order_relaxed));
+
+    write_header(&out, "phd2_stage_duration_seconds", "histogram", "Time spent in each stage of the guiding pipeline");
+    for (int i = 0; i < PipelineMetrics::NUM_STAGES; i++)
+    {
+        Metrics.stageMs[i].Write(&out, "phd2_stage_duration_seconds", wxString::Format("stage=\"%s\"", s_stageNames[i]));
+    }
+
+    write_header(&out, "phd2_guide_pulse_seconds", "histogram", "Guide pulse durations issued to the mount");
+    Metrics.pulseMs[0].Write(&out, "phd2_guide_pulse_seconds", "axis=\"ra\"");
+    Metrics.pulseMs[1].Write(&out, "phd2_guide_pulse_seconds", "axis=\"dec\"");
+
+    write_header(&out, "phd2_worker_queue_depth", "gauge", "Requests waiting for the worker thread");
+    out << wxString::Format("phd2_worker_queue_depth{priority=\"high\"} %d\n",
+                            Metrics.workerQueueDepth[PipelineMetrics::QUEUE_HIGH].load(std::memory_order_relaxed))
+        << wxString::Format("phd2_worker_queue_depth{priority=\"low\"} %d\n",
+                            Metrics.workerQueueDepth[PipelineMetrics::QUEUE_LOW].load(std::memory_order_relaxed));
+
+    write_header(&out, "phd2_dark_library_bytes", "gauge", "Memory held by the loaded dark library and defect map");
+    out << wxString::Format("phd2_dark_library_bytes %llu\n", dark_library_bytes());
+
+    unsigned int poolHits, poolMisses;
+    usImage::GetBufferPoolStats(&poolHits, &poolMisses);
+    write_header(&out, "phd2_image_buffers_total", "counter", "Image pixel buffers handed out, by whether the pool had one");
+    out << wxString::Format("phd2_image_buffers_total{source=\"pool\"} %u\n", poolHits)
+        << wxString::Format("phd2_image_buffers_total{source=\"heap\"} %u\n", poolMisses);
+
+    unsigned int clients;
+    unsigned long long queued, sent, dropped;
+    EvtServer.GetTrafficStats(&clients, &queued, &sent, &dropped);
+
+    write_header(&out, "phd2_event_server_clients", "gauge", "Connected event server clients");
+    out << wxString::Format("phd2_event_server_clients %u\n", clients);
+
+    write_header(&out, "phd2_event_server_bytes_total", "counter", "Event server bytes by disposition");
+    out << wxString::Format("phd2_event_server_bytes_total{state=\"queued\"} %llu\n", queued)
+        << wxString::Format("phd2_event_server_bytes_total{state=\"sent\"} %llu\n", sent)
+        << wxString::Format("phd2_event_server_bytes_total{state=\"dropped\"} %llu\n", dropped);
+
+    if (pFrame && pFrame->pGraphLog)
+    {
+        const SummaryStats& stats = pFrame->pGraphLog->Stats();
+        write_header(&out, "phd2_guide_rms_pixels", "gauge", "RMS guide error over the graph history");
+        out << wxString::Format("phd2_guide_rms_pixels{axis=\"ra\"} %.4f\n", stats.rms_ra)
+            << wxString::Format("phd2_guide_rms_pixels{axis=\"dec\"} %.4f\n", stats.rms_dec)
+            << wxString::Format("phd2_guide_rms_pixels{axis=\"total\"} %.4f\n", stats.rms_tot);
+    }
+
+    return out;
+}
+
+MetricsServer::MetricsServer()
+    : m_serverSocket(0)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+}
+
+bool MetricsServer::Start(unsigned int instanceId)
+{
+    if (m_serverSocket)
+        return false;
+
+    unsigned int port = 4600 + instanceId - 1;
+    wxIPV4address addr;
+    addr.LocalHost();
+    addr.Service(port);
+    m_serverSocket = new wxSocketServer(addr, wxSOCKET_REUSEADDR);
+
+    if (!m_serverSocket->Ok())
+    {
+        Debug.Write(wxString::Format("Metrics server failed to start - Could not listen at port %u\n", port));
+        delete m_serverSocket;
+        m_serverSocket = 0;
+        return true;
+    }
+
+    m_serverSocket->SetEventHandler(*this, METRICS_SERVER_ID);
+    m_serverSocket->SetNotify(wxSOCKET_CONNECTION_FLAG);
+    m_serverSocket->Notify(true);
+
+    Debug.Write(wxString::Format("metrics server started, listening on port %u\n", port));
+
+    return false;
+}
+
+void MetricsServer::Stop()
+{
+    if (!m_serverSocket)
+        return;
+
+    for (std::set<wxSocketClient *>::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+    {
+        delete static_cast<MetricsClient *>((*it)->GetClientData());
+        (*it)->Destroy();
+    }
+    m_clients.clear();
+
+    delete m_serverSocket;
+    m_serverSocket = 0;
+
+    Debug.AddLine("metrics server stopped");
+}
+
+void MetricsServer::DestroyClient(wxSocketClient *cli)
+{
+    m_clients.erase(cli);
+    delete static_cast<MetricsClient *>(cli->GetClientData());
+    cli->Destroy();
+}
+
+void MetricsServer::OnServerEvent(wxSocketEvent& event)
+{
+    if (event.GetSocketEvent() != wxSOCKET_CONNECTION)
+        return;
+
+    wxSocketClient *cli = static_cast<wxSocketClient *>(m_serverSocket->Accept(false));
+    if (!cli)
+        return;
+
+    cli->SetEventHandler(*this, METRICS_CLIENT_ID);
+    cli->SetNotify(wxSOCKET_LOST_FLAG | wxSOCKET_INPUT_FLAG);
+    cli->SetFlags(wxSOCKET_NOWAIT);
+    cli->SetClientData(new MetricsClient());
+    cli->Notify(true);
+
+    m_clients.insert(cli);
+}
+
+void MetricsServer::OnClientEvent(wxSocketEvent& event)
+{
+    wxSocketClient *cli = static_cast<wxSocketClient *>(event.GetSocket());
+
+    if (m_clients.find(cli) == m_clients.end())
+        return;
+
+    switch (event.GetSocketEvent())
+    {
+    case wxSOCKET_LOST:
+        DestroyClient(cli);
+        break;
+    case wxSOCKET_INPUT:
+        HandleRequest(cli);
+        break;
+    case wxSOCKET_OUTPUT:
+        SendPending(cli);
+        break;
+    default:
+        break;
+    }
+}
+
+void MetricsServer::HandleRequest(wxSocketClient *cli)
+{
+    MetricsClient *mc = static_cast<MetricsClient *>(cli->GetClientData());
+
+    if (!mc->response.empty())
+    {
+        // already answering; discard anything else the client sends
+        char buf[256];
+        cli->Read(buf, sizeof(buf));
+        return;
+    }
+
+    char buf[1024];
+    cli->Read(buf, sizeof(buf));
+    mc->request.append(buf, cli->LastCount());
+
+    size_t end = mc->request.find("\r\n\r\n");
+    if (end == std::string::npos)
+        end = mc->request.find("\n\n");
+    if (end == std::string::npos)
+    {
+        if (mc->request.size() > MAX_REQUEST)
+            DestroyClient(cli);
+        return;
+    }
+
+    std::string line = mc->request.substr(0, mc->request.find_first_of("\r\n"));
+
+    std::string status;
+    std::string body;
+    if (line.compare(0, 13, "GET /metrics ") == 0 || line.compare(0, 6, "GET / ") == 0)
+    {
+        status = "200 OK";
+        body = std::string(build_metrics().utf8_str());
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "not found\n";
+    }
+
+    mc->response = wxString::Format("HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                    "Content-Length: %lu\r\nConnection: close\r\n\r\n",
+                                    status.c_str(), (unsigned long) body.size()).ToStdString();
+    mc->response += body;
+
+    cli->SetNotify(wxSOCKET_LOST_FLAG | wxSOCKET_INPUT_FLAG | wxSOCKET_OUTPUT_FLAG);
+
+    SendPending(cli);
+}
+
+void MetricsServer::SendPending(wxSocketClient *cli)
+{
+    MetricsClient *mc = static_cast<MetricsClient *>(cli->GetClientData());
+
+    if (mc->response.empty())
+        return;
+
+    cli->Write(mc->response.data() + mc->sent, mc->response.size() - mc->sent);
+    mc->sent += cli->LastCount();
+
+    if (mc->sent >= mc->response.size())
+        DestroyClient(cli);
+    else if (cli->Error() && cli->LastError() != wxSOCKET_WOULDBLOCK)
+        DestroyClient(cli);
+}
@@ -0,0 +1,126 @@
+/*
+*  metrics.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef METRICS_INCLUDED
+#define METRICS_INCLUDED
+
+#include <atomic>
+#include <set>
+
+// Histogram with fixed millisecond buckets, updated with relaxed atomics so
+// it can be fed from any thread without locking.
+class LatencyHistogram
+{
+public:
+    enum { NUM_BOUNDS = 14 };
+
+private:
+    std::atomic<unsigned int> m_buckets[NUM_BOUNDS + 1];    // the last one is +Inf
+    std::atomic<unsigned long long> m_sumUs;
+
+public:
+    LatencyHistogram();
+
+    void Observe(double ms);
+
+    // append the histogram in Prometheus text format, in seconds
+    void Write(wxString *out, const char *name, const wxString& labels) const;
+};
+
+// Counters updated on the guiding hot paths and read by the metrics endpoint
+struct PipelineMetrics
+{
+    enum Stage
+    {
+        STAGE_CAPTURE,          // camera capture, worker thread
+        STAGE_IMAGE_PREP,       // noise reduction and image statistics, worker thread
+        STAGE_GUIDE_UPDATE,     // star finding and the guide calculation, main thread
+        STAGE_MOVE,             // mount or AO move, worker thread
+        NUM_STAGES
+    };
+
+    enum { QUEUE_HIGH, QUEUE_LOW };
+
+    std::atomic<unsigned int> framesCaptured;
+    std::atomic<unsigned int> framesDropped;
+    std::atomic<unsigned int> captureErrors;
+    std::atomic<int> workerQueueDepth[2];
+    LatencyHistogram stageMs[NUM_STAGES];
+    LatencyHistogram pulseMs[2];        // RA, Dec guide pulse durations
+
+    PipelineMetrics();
+
+    static void Inc(std::atomic<unsigned int>& counter) { counter.fetch_add(1, std::memory_order_relaxed); }
+    static void Add(std::atomic<int>& gauge, int delta) { gauge.fetch_add(delta, std::memory_order_relaxed); }
+};
+
+extern PipelineMetrics Metrics;
+
+// records the time from construction to destruction in a histogram
+class MetricsTimer
+{
+    LatencyHistogram& m_hist;
+    wxStopWatch m_swatch;
+
+public:
+    MetricsTimer(LatencyHistogram& hist) : m_hist(hist) { }
+    ~MetricsTimer() { m_hist.Observe(m_swatch.TimeInMicro().ToDouble() / 1000.0); }
+};
+
+// Serves the metrics in Prometheus text format over HTTP on localhost, port
+// 4600 + instance - 1, when /Server/Metrics is enabled.
+class MetricsServer : public wxEvtHandler
+{
+    wxSocketServer *m_serverSocket;
+    std::set<wxSocketClient *> m_clients;
+
+    void OnServerEvent(wxSocketEvent& evt);
+    void OnClientEvent(wxSocketEvent& evt);
+    void HandleRequest(wxSocketClient *cli);
+    void SendPending(wxSocketClient *cli);
+    void DestroyClient(wxSocketClient *cli);
+
+public:
+    MetricsServer();
+    ~MetricsServer();
+
+    bool Start(unsigned int instanceId);
+    void Stop();
+
+    wxDECLARE_EVENT_TABLE();
+};
+
+extern MetricsServer MetricsHttp;
+
+#endif
@@ -758,6 +758,27 @@ void Mount::LogGuideStepInfo()
     pFrame->UpdateGuiderInfo(m_lastStep);
     GuideLog.GuideStep(m_lastStep);
     EvtServer.NotifyGuideStep(m_lastStep);
+    GuideHistory.Add(m_lastStep);
+
+    if (m_lastStep.durationRA > 0)
+        Metrics.pulseMs[0].Observe(m_lastStep.durationRA);
+    if (m_lastStep.durationDec > 0)
+        Metrics.pulseMs[1].Observe(m_lastStep.durationDec);
+
+    // tell the guider how far the pulses should have moved the star, so it
+    // knows where to look if the star is lost
+    if (IsCalibrated() && (m_lastStep.durationRA > 0 || m_lastStep.durationDec > 0))
+    {
+        double x = m_lastStep.durationRA * m_xRate;
+        // leave out any backlash compensation, which does not move the star
+        double y = wxMin(m_lastStep.durationDec * m_cal.yRate, fabs(m_lastStep.guideDistanceDec));
+        // the star moves opposite to the guide vector
+        PHD_Point mountMotion(m_lastStep.directionRA == LEFT ? -x : x,
+                              m_lastStep.directionDec == DOWN ? -y : y);
+        PHD_Point starMotion;
+        if (!TransformMountCoordinatesToCameraCoordinates(mountMotion, starMotion))
+            pFrame->pGuider->NotifyCommandedMotion(starMotion);
+    }
 
     if (m_lastStep.moveType != MOVETYPE_DIRECT)
     {
@@ -771,6 +792,8 @@ void Mount::LogGuideStepInfo()
 
 Mount::MOVE_RESULT Mount::Move(const PHD_Point& cameraVectorEndpoint, MountMoveType moveType)
 {
+    TraceSpan span("Mount::Move");
+
     MOVE_RESULT result = MOVE_OK;
 
     try
@@ -808,6 +831,7 @@ Mount::MOVE_RESULT Mount::Move(const PHD_Point& cameraVectorEndpoint, MountMoveT
                 // Feed the raw distances to the guide algorithms
                 if (m_pXGuideAlgorithm)
                 {
+                    TraceSpan span("GuideAlgorithm::result");
                     xDistance = m_pXGuideAlgorithm->result(xDistance);
                 }
 
@@ -817,6 +841,7 @@ Mount::MOVE_RESULT Mount::Move(const PHD_Point& cameraVectorEndpoint, MountMoveT
 
                 if (m_pYGuideAlgorithm)
                 {
+                    TraceSpan span("GuideAlgorithm::result");
                     yDistance = m_pYGuideAlgorithm->result(yDistance);
                 }
             }
@@ -868,6 +893,8 @@ Mount::MOVE_RESULT Mount::Move(const PHD_Point& cameraVectorEndpoint, MountMoveT
         info.aoPos = GetAoPos();
         info.starMass = pFrame->pGuider->StarMass();
         info.starSNR = pFrame->pGuider->SNR();
+        info.starFWHM = pFrame->pGuider->FWHM();
+        info.starEllipticity = pFrame->pGuider->Ellipticity();
         info.avgDist = pFrame->pGuider->CurrentError();
         info.starError = pFrame->pGuider->StarError();
     }
@@ -1045,7 +1072,7 @@ void Mount::AdjustCalibrationForScopePointing(void)
     double newDeclination = pPointingSource->GetDeclination();
     PierSide newPierSide = pPointingSource->SideOfPier();
     double newRotatorAngle = Rotator::RotatorPosition();
-    unsigned short binning = pCamera->Binning;
+    unsigned short binning = pCamera->ImageBinning();
 
     Debug.AddLine(wxString::Format("AdjustCalibrationForScopePointing (%s): current dec=%s pierSide=%d, cal dec=%s pierSide=%d rotAngle=%s bin=%hu",
         GetMountClassName(), DeclinationStr(newDeclination), newPierSide, DeclinationStr(m_cal.declination), m_cal.pierSide,
@@ -112,6 +112,7 @@ BEGIN_EVENT_TABLE(MyFrame, wxFrame)
 #endif
 
     EVT_MENU(MENU_LOGIMAGES,MyFrame::OnLog)
+    EVT_MENU(MENU_TRACE,MyFrame::OnLog)
     EVT_MENU(MENU_TOOLBAR,MyFrame::OnToolBar)
     EVT_MENU(MENU_GRAPH, MyFrame::OnGraph)
     EVT_MENU(MENU_STATS, MyFrame::OnStats)
@@ -172,6 +173,7 @@ MyFrame::MyFrame(int instanceNumber, wxLocale *locale)
     StartWorkerThread(m_pPrimaryWorkerThread);
     m_pSecondaryWorkerThread = NULL;
     StartWorkerThread(m_pSecondaryWorkerThread);
+    ImageLog.Start();
 
     m_statusbarTimer.SetOwner(this, STATUSBAR_TIMER_EVENT);
 
@@ -456,6 +458,7 @@ void MyFrame::SetupMenuBar(void)
     tools_menu->Append(MENU_DRIFTTOOL, _("&Drift Align"), _("Run the Drift Alignment tool"));
     tools_menu->AppendSeparator();
     tools_menu->AppendCheckItem(MENU_LOGIMAGES,_("Enable Star Image Logging"),_("Enable logging of star images"));
+    tools_menu->AppendCheckItem(MENU_TRACE,_("Enable Pipeline Tracing"),_("Record where each frame spends its time; the trace is saved to the log folder when disabled"));
     tools_menu->AppendCheckItem(MENU_SERVER,_("Enable Server"),_("Enable PHD2 server capability"));
     tools_menu->AppendCheckItem(EEGG_STICKY_LOCK,_("Sticky Lock Position"),_("Keep the same lock position when guiding starts"));
 
@@ -695,6 +698,31 @@ bool MyFrame::IsImageLoggingEnabled(void)
     return m_image_logging_enabled;
 }
 
+// start or stop the pipeline span recorder; when stopping, the trace is
+// written to the log directory and its name returned in traceFile
+bool MyFrame::EnablePipelineTracing(bool enable, wxString *traceFile)
+{
+    bool err = false;
+
+    if (enable)
+    {
+        Tracer.Start();
+        StatusMsg(_("Pipeline tracing started"));
+    }
+    else if (Tracer.Enabled())
+    {
+        err = Tracer.Stop(traceFile);
+        if (err)
+            StatusMsg(_("Could not save pipeline trace"));
+        else
+            StatusMsg(wxString::Format(_("Pipeline trace saved to %s"), wxFileName(*traceFile).GetFullName()));
+    }
+
+    tools_menu->Check(MENU_TRACE, enable);
+
+    return err;
+}
+
 void MyFrame::SetLoggedImageFormat(LOGGED_IMAGE_FORMAT format)
 {
     pConfig->Global.SetInt("/LoggedImageFormat", (int) format);
@@ -1786,6 +1814,7 @@ void MyFrame::OnClose(wxCloseEvent& event)
     StartServer(false);
 
     GuideLog.Close();
+    ImageLog.Stop();
 
     pConfig->Global.SetString("/perspective", m_mgr.SavePerspective());
     wxString geometry = wxString::Format("%c;%d;%d;%d;%d",
@@ -2131,7 +2160,7 @@ bool MyFrame::DarkLibExists(int profileId, bool showAlert)
 
     if (wxFileExists(fileName))
     {
-        const wxSize& sensorSize = pCamera->DarkFrameSize();
+        const wxSize& sensorSize = pCamera->DarkLibraryFrameSize();
         if (sensorSize == UNDEFINED_FRAME_SIZE)
         {
             bOk = true;
@@ -2208,7 +2237,7 @@ void MyFrame::CheckDarkFrameGeometry()
         m_useDarksMenuItem->Enable(true);
     }
 
-    m_prevDarkFrameSize = pCamera->DarkFrameSize();
+    m_prevDarkFrameSize = pCamera->DarkLibraryFrameSize();
     m_statusbar->UpdateStates();
 }
 
@@ -2371,7 +2400,7 @@ double MyFrame::GetCameraPixelScale(void) const
     if (!pCamera || pCamera->GetCameraPixelSize() == 0.0 || m_focalLength == 0)
         return 1.0;
 
-    return GetPixelScale(pCamera->GetCameraPixelSize(), m_focalLength, pCamera->Binning);
+    return GetPixelScale(pCamera->GetCameraPixelSize(), m_focalLength, pCamera->ImageBinning());
 }
 
 wxString MyFrame::PixelScaleSummary(void) const
@@ -2389,7 +2418,7 @@ wxString MyFrame::PixelScaleSummary(void) const
         focalLengthStr = wxString::Format("%d", m_focalLength) + " mm";
 
     return wxString::Format("Pixel scale = %s, Binning = %hu, Focal length = %s",
-        scaleStr, pCamera->Binning, focalLengthStr);
+        scaleStr, pCamera->ImageBinning(), focalLengthStr);
 }
 
 wxString MyFrame::GetSettingsSummary()
@@ -2508,7 +2537,7 @@ MyFrameConfigDialogCtrlSet::MyFrameConfigDialogCtrlSet(MyFrame *pFrame, Advanced
 
     wxString img_formats[] =
     {
-        _("Low Q JPEG"), _("High Q JPEG"), _("Raw FITS")
+        _("Low Q JPEG"), _("High Q JPEG"), _("Raw FITS"), _("Compressed FITS")
     };
 
     width = StringArrayWidth(img_formats, WXSIZEOF(img_formats));
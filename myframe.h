@@ -68,7 +68,8 @@ enum LOGGED_IMAGE_FORMAT
 {
     LIF_LOW_Q_JPEG,
     LIF_HI_Q_JPEG,
-    LIF_RAW_FITS
+    LIF_RAW_FITS,
+    LIF_COMPRESSED_FITS
 };
 
 struct AutoExposureCfg
@@ -315,6 +316,7 @@ public:
     double GetDitherAmount(int ditherType);
     void EnableImageLogging(bool enable);
     bool IsImageLoggingEnabled(void);
+    bool EnablePipelineTracing(bool enable, wxString *traceFile);
     void SetLoggedImageFormat(LOGGED_IMAGE_FORMAT val);
     LOGGED_IMAGE_FORMAT GetLoggedImageFormat(void);
     Star::FindMode GetStarFindMode(void) const;
@@ -545,6 +547,7 @@ enum {
     MENU_SLIT_OVERLAY_COORDS,
     MENU_TAKEDARKS,
     MENU_LOGIMAGES,
+    MENU_TRACE,
     MENU_SERVER,
     MENU_TOOLBAR,
     MENU_GRAPH,
@@ -599,6 +602,7 @@ enum {
     EEGG_STICKY_LOCK,
     EEGG_FLIPRACAL,
     STAR_MASS_ENABLE,
+    MULTI_STAR_ENABLE,
     MENU_BOOKMARKS_SHOW,
     MENU_BOOKMARKS_SET_AT_LOCK,
     MENU_BOOKMARKS_SET_AT_STAR,
@@ -610,6 +614,8 @@ enum {
     SOCK_SERVER_CLIENT_ID,
     EVENT_SERVER_ID,
     EVENT_SERVER_CLIENT_ID,
+    METRICS_SERVER_ID,
+    METRICS_CLIENT_ID,
 };
 
 wxDECLARE_EVENT(APPSTATE_NOTIFY_EVENT, wxCommandEvent);
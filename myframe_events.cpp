@@ -239,7 +239,7 @@ void MyFrame::OnOverlaySlitCoords(wxCommandEvent& evt)
 
 void MyFrame::OnSave(wxCommandEvent& WXUNUSED(event))
 {
-    if (!pGuider->CurrentImage()->ImageData)
+    if (!pGuider->CurrentImage()->HasPixels())
         return;
 
     wxString fname = wxFileSelector( _("Save FITS Image"), (const wxChar *)NULL,
@@ -353,6 +353,8 @@ void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
             delete pNewFrame;
 
             bool stopping = !m_continueCapturing;
+            if (!stopping)
+                PipelineMetrics::Inc(Metrics.captureErrors);
             StopCapturing();
             if (pGuider->IsCalibratingOrGuiding())
             {
@@ -373,6 +375,7 @@ void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
             throw ERROR_INFO("Error reported capturing image");
         }
         ++m_frameCounter;
+        PipelineMetrics::Inc(Metrics.framesCaptured);
 
         if (m_rawImageMode && !m_rawImageModeWarningDone)
         {
@@ -381,12 +384,17 @@ void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
         }
 
         // check for dark frame compatibility in case the frame size changed (binning changed)
-        if (pCamera->DarkFrameSize() != m_prevDarkFrameSize)
+        if (pCamera->DarkLibraryFrameSize() != m_prevDarkFrameSize)
         {
             CheckDarkFrameGeometry();
         }
 
-        pGuider->UpdateGuideState(pNewFrame, !m_continueCapturing);
+        FrameStream.PushFrame(*pNewFrame, m_frameCounter);
+
+        {
+            MetricsTimer timer(Metrics.stageMs[PipelineMetrics::STAGE_GUIDE_UPDATE]);
+            pGuider->UpdateGuideState(pNewFrame, !m_continueCapturing);
+        }
         pNewFrame = NULL; // the guider owns it now
 
         PhdController::UpdateControllerState();
@@ -735,6 +743,11 @@ void MyFrame::OnLog(wxCommandEvent& evt)
     {
         pFrame->EnableImageLogging(evt.IsChecked());
     }
+    else if (evt.GetId() == MENU_TRACE)
+    {
+        wxString traceFile;
+        EnablePipelineTracing(evt.IsChecked(), &traceFile);
+    }
 }
 
 bool MyFrame::FlipRACal()
@@ -130,6 +130,7 @@ bool PhdApp::OnInit()
     pConfig = new PhdConfig(_T("PHDGuidingV2"), m_instanceNumber);
 
     Debug.Init("debug", true);
+    Debug.SetVerbose(pConfig->Global.GetBoolean("/VerboseDebugLog", true));
 
     Debug.AddLine(wxString::Format("PHD2 version %s begins execution with:", FULLVER));
     Debug.AddLine(wxString::Format("   %s", wxVERSION_STRING));
@@ -146,6 +147,10 @@ bool PhdApp::OnInit()
 
     DisableOSXAppNap();
 
+#if wxUSE_ON_FATAL_EXCEPTION
+    wxHandleFatalExceptions();
+#endif
+
     if (m_resetConfig)
     {
         pConfig->DeleteAll();
@@ -199,12 +204,17 @@ int PhdApp::OnExit(void)
 
     PhdController::OnAppExit();
 
+    WorkPool::Shutdown();
+
     delete pConfig;
     pConfig = NULL;
 
     delete m_instanceChecker; // OnExit() won't be called if we return false
     m_instanceChecker = 0;
 
+    // anything logged from here on is written synchronously
+    Debug.Shutdown();
+
     return wxApp::OnExit();
 }
 
@@ -225,6 +235,15 @@ bool PhdApp::OnCmdLineParsed(wxCmdLineParser& parser)
     return bReturn;
 }
 
+#if wxUSE_ON_FATAL_EXCEPTION
+void PhdApp::OnFatalException()
+{
+    // we are crashing; get the buffered log output onto disk
+    GuideLog.EmergencyFlush();
+    Debug.EmergencyFlush();
+}
+#endif
+
 bool PhdApp::Yield(bool onlyIfNeeded)
 {
     bool bReturn = !onlyIfNeeded;
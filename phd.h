@@ -61,6 +61,7 @@
 #include <wx/textfile.h>
 #include <wx/tglbtn.h>
 #include <wx/thread.h>
+#include <wx/tls.h>
 #include <wx/utils.h>
 
 #include <map>
@@ -150,6 +151,7 @@ WX_DEFINE_ARRAY_DOUBLE(double, ArrayOfDbl);
 #include "star.h"
 #include "circbuf.h"
 #include "guidinglog.h"
+#include "guide_history.h"
 #include "graph.h"
 #include "statswindow.h"
 #include "star_profile.h"
@@ -174,7 +176,14 @@ WX_DEFINE_ARRAY_DOUBLE(double, ArrayOfDbl);
 #include "myframe.h"
 #include "debuglog.h"
 #include "worker_thread.h"
+#include "image_logger.h"
+#include "json_writer.h"
 #include "event_server.h"
+#include "frame_stream.h"
+#include "metrics.h"
+#include "trace.h"
+#include "work_pool.h"
+#include "io_socket.h"
 #include "confirm_dialog.h"
 #include "phdcontrol.h"
 #include "runinbg.h"
@@ -220,6 +229,9 @@ public:
     void OnInitCmdLine(wxCmdLineParser& parser);
     bool OnCmdLineParsed(wxCmdLineParser & parser);
     virtual bool Yield(bool onlyIfNeeded=false);
+#if wxUSE_ON_FATAL_EXCEPTION
+    virtual void OnFatalException();
+#endif
     wxString GetLocaleDir() const { return m_localeDir; }
 };
 
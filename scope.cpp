@@ -935,7 +935,7 @@ bool Scope::DecCompensationActive(void) const
 
 static double CalibrationDistance(void)
 {
-    return wxMin(pCamera->FullSize.GetHeight() * 0.05, MAX_CALIBRATION_DISTANCE);
+    return wxMin(pCamera->ImageSize().GetHeight() * 0.05, MAX_CALIBRATION_DISTANCE);
 }
 
 int Scope::CalibrationTotDistance(void)
@@ -1413,11 +1413,11 @@ bool Scope::UpdateCalibrationState(const PHD_Point& currentLocation)
                 cal.declination = pPointingSource->GetDeclination();
                 cal.pierSide = pPointingSource->SideOfPier();
                 cal.rotatorAngle = Rotator::RotatorPosition();
-                cal.binning = pCamera->Binning;
+                cal.binning = pCamera->ImageBinning();
                 SetCalibration(cal);
                 m_calibrationDetails.raStepCount = m_raSteps;
                 m_calibrationDetails.decStepCount = m_decSteps;
-                SetCalibrationDetails(m_calibrationDetails, m_calibration.xAngle, m_calibration.yAngle, pCamera->Binning);
+                SetCalibrationDetails(m_calibrationDetails, m_calibration.xAngle, m_calibration.yAngle, pCamera->ImageBinning());
                 if (SANITY_CHECKING_ACTIVE)
                     SanityCheckCalibration(m_prevCalibration, m_prevCalibrationDetails);  // method gets "new" info itself
                 pFrame->StatusMsg(_("Calibration complete"));
@@ -1736,16 +1736,18 @@ void ScopeConfigDialogCtrlSet::OnCalcCalibrationStep(wxCommandEvent& evt)
     int focalLength = 0;
     double pixelSize = 0;
     int binning = 1;
+    int softwareBinning = 1;
     AdvancedDialog *pAdvancedDlg = pFrame->pAdvancedDialog;
 
     if (pAdvancedDlg)
     {
         pixelSize = pAdvancedDlg->GetPixelSize();
         binning = pAdvancedDlg->GetBinning();
+        softwareBinning = pAdvancedDlg->GetSoftwareBinning();
         focalLength = pAdvancedDlg->GetFocalLength();
     }
 
-    CalstepDialog calc(m_pParent, focalLength, pixelSize, binning);
+    CalstepDialog calc(m_pParent, focalLength, pixelSize, binning, softwareBinning);
     if (calc.ShowModal() == wxID_OK)
     {
         int calibrationStep;
@@ -118,6 +118,12 @@ bool MyFrame::StartServer(bool state)
             return true;
         }
 
+        // the frame stream is optional, PHD2 works without it
+        if (pConfig->Global.GetBoolean("/Server/FrameStream", false))
+            FrameStream.Start(m_instanceNumber);
+        if (pConfig->Global.GetBoolean("/Server/Metrics", false))
+            MetricsHttp.Start(m_instanceNumber);
+
         Debug.AddLine(wxString::Format("Server started, listening on port %u", port));
         StatusMsg(_("Server started"));
     }
@@ -132,6 +138,8 @@ bool MyFrame::StartServer(bool state)
         std::for_each(s_clients.begin(), s_clients.end(), std::mem_fun(&wxSocketBase::Destroy));
         s_clients.empty();
         EvtServer.EventServerStop();
+        FrameStream.Stop();
+        MetricsHttp.Stop();
         delete SocketServer;
         SocketServer = NULL;
         StatusMsg(_("Server stopped"));
@@ -72,6 +72,9 @@ void Star::Invalidate(void)
     Mass = 0.0;
     SNR = 0.0;
     HFD = 0.0;
+    FWHM = 0.0;
+    Ellipticity = 0.0;
+    m_psfShape[0] = m_psfShape[1] = m_psfShape[2] = 0.0;
     m_lastFindResult = STAR_ERROR;
     PHD_Point::Invalidate();
 }
@@ -135,12 +138,409 @@ static double hfr(std::vector<R2M>& vec, double cx, double cy, double mass)
     return hfr;
 }
 
+// Star::Find measures the star within an aperture of radius 7 and the
+// background in the annulus between radius 7 and 12. Both are walked as row
+// spans: entry |dy| is the largest |dx| with dx^2 + dy^2 <= r^2, or -1 if the
+// row misses the circle.
+enum { FIND_APERTURE_RADIUS = 7, FIND_ANNULUS_RADIUS = 12 };
+
+static const int s_apertureHalfWidth[FIND_ANNULUS_RADIUS + 1] = {
+    7, 6, 6, 6, 5, 4, 3, 0, -1, -1, -1, -1, -1,
+};
+
+static const int s_annulusHalfWidth[FIND_ANNULUS_RADIUS + 1] = {
+    12, 11, 11, 11, 11, 10, 10, 9, 8, 7, 6, 4, 0,
+};
+
+// The pixel loops of Star::Find are templated on the pixel type so 8-bit
+// images are read without widening them first.
+
+// find the peak pixel in the search region, or with smoothed set the peak of
+// the 3x3 weighted sum together with the three largest raw pixel values
+template<typename T>
+static void FindPeak(const usImage *pImg, bool smoothed, int start_x, int end_x, int start_y, int end_y,
+                     int *peak_x, int *peak_y, unsigned int *peak_val, unsigned short max3[3])
+{
+    if (!smoothed)
+    {
+        for (int y = start_y; y <= end_y; y++)
+        {
+            const T *row = PixelPtr<T>(*pImg, start_x, y);
+            for (int x = start_x; x <= end_x; x++)
+            {
+                unsigned short val = row[x - start_x];
+
+                if (val > *peak_val)
+                {
+                    *peak_val = val;
+                    *peak_x = x;
+                    *peak_y = y;
+                }
+            }
+        }
+        return;
+    }
+
+    for (int y = start_y + 1; y <= end_y - 1; y++)
+    {
+        const T *r0 = PixelPtr<T>(*pImg, start_x, y - 1);
+        const T *r1 = PixelPtr<T>(*pImg, start_x, y);
+        const T *r2 = PixelPtr<T>(*pImg, start_x, y + 1);
+        for (int x = start_x + 1; x <= end_x - 1; x++)
+        {
+            int const i = x - start_x;
+            unsigned short p = r1[i];
+            unsigned int val =
+                4 * (unsigned int) p +
+                r0[i - 1] +
+                r0[i + 1] +
+                r2[i - 1] +
+                r2[i + 1] +
+                2 * r0[i] +
+                2 * r1[i - 1] +
+                2 * r1[i + 1] +
+                2 * r2[i];
+
+            if (val > *peak_val)
+            {
+                *peak_val = val;
+                *peak_x = x;
+                *peak_y = y;
+            }
+
+            if (p > max3[0])
+                std::swap(p, max3[0]);
+            if (p > max3[1])
+                std::swap(p, max3[1]);
+            if (p > max3[2])
+                std::swap(p, max3[2]);
+        }
+    }
+}
+
+// the loop has no branches so the compiler can vectorize it
+template<typename T>
+inline static void SumRow(const T *row, int n, wxUint64 *sum, wxUint64 *sumsq)
+{
+    unsigned int s = 0;
+    wxUint64 ss = 0;
+    for (int i = 0; i < n; i++)
+    {
+        unsigned int const val = row[i];
+        s += val;
+        ss += val * val;
+    }
+    *sum += s;
+    *sumsq += ss;
+}
+
+// add the pixels in [x0, x1] of row y to the sum and sum of squares and
+// return the pixel count
+inline static unsigned int SumSpan(const usImage *pImg, int y, int x0, int x1, wxUint64 *sum, wxUint64 *sumsq)
+{
+    if (x1 < x0)
+        return 0;
+    int const n = x1 - x0 + 1;
+    if (pImg->ImageData8)
+        SumRow(PixelPtr<unsigned char>(*pImg, x0, y), n, sum, sumsq);
+    else
+        SumRow(PixelPtr<unsigned short>(*pImg, x0, y), n, sum, sumsq);
+    return n;
+}
+
+// the n pixels of row y starting at x0 as 16-bit values; the pixels of an
+// 8-bit image are widened into buf, which must hold n values
+inline static const unsigned short *ApertureRow(const usImage *pImg, int x0, int y, int n, unsigned short *buf)
+{
+    if (!pImg->ImageData8)
+        return &pImg->Pixel(x0, y);
+    const unsigned char *src = &pImg->Pixel8(x0, y);
+    for (int i = 0; i < n; i++)
+        buf[i] = src[i];
+    return buf;
+}
+
+// Sub-pixel centroid by fitting an elliptical Gaussian
+//
+//    f(x, y) = B + A exp(-(a u^2 + 2 b u v + c v^2)),  u = x - x0, v = y - y0
+//
+// to the pixels in the aperture by Levenberg-Marquardt. The fit is bounded
+// by an iteration count and a time budget so a star that does not converge
+// cannot hold up the frame.
+
+enum { PSF_B, PSF_A, PSF_X0, PSF_Y0, PSF_XX, PSF_XY, PSF_YY, PSF_NPARAMS };
+
+enum
+{
+    PSF_FIT_MAX_ITERATIONS = 20,
+    PSF_FIT_TIME_BUDGET_US = 2000,
+    PSF_FIT_MIN_PIXELS = 2 * PSF_NPARAMS,
+};
+
+static const double FWHM_PER_SIGMA = 2.35482;   // 2 sqrt(2 ln 2)
+
+struct PSFPixels
+{
+    enum { MAX_PIXELS = (2 * FIND_APERTURE_RADIUS + 1) * (2 * FIND_APERTURE_RADIUS + 1) };
+    int n;
+    double x[MAX_PIXELS];   // relative to the peak pixel
+    double y[MAX_PIXELS];
+    double z[MAX_PIXELS];
+};
+
+static bool PSFParamsValid(const double p[PSF_NPARAMS])
+{
+    return p[PSF_A] > 0.0 && p[PSF_XX] > 0.0 && p[PSF_YY] > 0.0 &&
+        p[PSF_XX] * p[PSF_YY] > p[PSF_XY] * p[PSF_XY] &&
+        fabs(p[PSF_X0]) <= FIND_APERTURE_RADIUS && fabs(p[PSF_Y0]) <= FIND_APERTURE_RADIUS;
+}
+
+// sum of squared residuals; if jtj is not null also accumulate the normal
+// equations with the analytic Jacobian
+static double PSFResiduals(const PSFPixels& px, const double p[PSF_NPARAMS],
+                           double jtj[PSF_NPARAMS][PSF_NPARAMS], double jtr[PSF_NPARAMS])
+{
+    if (jtj)
+    {
+        for (int j = 0; j < PSF_NPARAMS; j++)
+        {
+            jtr[j] = 0.0;
+            for (int k = 0; k < PSF_NPARAMS; k++)
+                jtj[j][k] = 0.0;
+        }
+    }
+
+    double chi2 = 0.0;
+
+    for (int i = 0; i < px.n; i++)
+    {
+        double const u = px.x[i] - p[PSF_X0];
+        double const v = px.y[i] - p[PSF_Y0];
+        double const e = exp(-(p[PSF_XX] * u * u + 2.0 * p[PSF_XY] * u * v + p[PSF_YY] * v * v));
+        double const ae = p[PSF_A] * e;
+        double const r = px.z[i] - (p[PSF_B] + ae);
+        chi2 += r * r;
+
+        if (!jtj)
+            continue;
+
+        double J[PSF_NPARAMS];
+        J[PSF_B] = 1.0;
+        J[PSF_A] = e;
+        J[PSF_X0] = 2.0 * ae * (p[PSF_XX] * u + p[PSF_XY] * v);
+        J[PSF_Y0] = 2.0 * ae * (p[PSF_XY] * u + p[PSF_YY] * v);
+        J[PSF_XX] = -ae * u * u;
+        J[PSF_XY] = -2.0 * ae * u * v;
+        J[PSF_YY] = -ae * v * v;
+
+        for (int j = 0; j < PSF_NPARAMS; j++)
+        {
+            jtr[j] += J[j] * r;
+            for (int k = 0; k <= j; k++)
+                jtj[j][k] += J[j] * J[k];
+        }
+    }
+
+    if (jtj)
+    {
+        for (int j = 0; j < PSF_NPARAMS; j++)
+            for (int k = j + 1; k < PSF_NPARAMS; k++)
+                jtj[j][k] = jtj[k][j];
+    }
+
+    return chi2;
+}
+
+// solve m x = b for symmetric positive definite m by Cholesky decomposition;
+// m is overwritten. Returns true on error.
+static bool SolveCholesky(double m[PSF_NPARAMS][PSF_NPARAMS], const double b[PSF_NPARAMS], double x[PSF_NPARAMS])
+{
+    for (int j = 0; j < PSF_NPARAMS; j++)
+    {
+        double d = m[j][j];
+        for (int k = 0; k < j; k++)
+            d -= m[j][k] * m[j][k];
+        if (d <= 0.0)
+            return true;
+        m[j][j] = sqrt(d);
+        for (int i = j + 1; i < PSF_NPARAMS; i++)
+        {
+            double s = m[i][j];
+            for (int k = 0; k < j; k++)
+                s -= m[i][k] * m[j][k];
+            m[i][j] = s / m[j][j];
+        }
+    }
+
+    for (int i = 0; i < PSF_NPARAMS; i++)
+    {
+        double s = b[i];
+        for (int k = 0; k < i; k++)
+            s -= m[i][k] * x[k];
+        x[i] = s / m[i][i];
+    }
+    for (int i = PSF_NPARAMS - 1; i >= 0; i--)
+    {
+        double s = x[i];
+        for (int k = i + 1; k < PSF_NPARAMS; k++)
+            s -= m[k][i] * x[k];
+        x[i] = s / m[i][i];
+    }
+
+    return false;
+}
+
+// Fit the PSF around the peak pixel, ignoring pixels at or above satLevel.
+// Starts from the shape of the previous fit if there was one, or from the
+// HFD. On success sets *x, *y, FWHM and Ellipticity. Returns true on error.
+bool Star::FitPSF(const usImage *pImg, const wxRect& bounds, int peak_x, int peak_y, unsigned int satLevel,
+                  double mean_bg, double *x, double *y)
+{
+    wxStopWatch swatch;
+
+    PSFPixels px;
+    px.n = 0;
+    double zmax = 0.0;
+
+    for (int dy = -FIND_APERTURE_RADIUS; dy <= FIND_APERTURE_RADIUS; dy++)
+    {
+        int const yy = peak_y + dy;
+        if (yy < bounds.GetTop() || yy > bounds.GetBottom())
+            continue;
+        int const hw = s_apertureHalfWidth[abs(dy)];
+        int const x0 = wxMax(peak_x - hw, bounds.GetLeft());
+        int const x1 = wxMin(peak_x + hw, bounds.GetRight());
+        unsigned short buf[2 * FIND_APERTURE_RADIUS + 1];
+        const unsigned short *row = ApertureRow(pImg, x0, yy, x1 - x0 + 1, buf);
+        for (int xx = x0; xx <= x1; xx++)
+        {
+            if (row[xx - x0] >= satLevel)
+                continue;
+            px.x[px.n] = xx - peak_x;
+            px.y[px.n] = dy;
+            px.z[px.n] = row[xx - x0];
+            zmax = wxMax(zmax, px.z[px.n]);
+            ++px.n;
+        }
+    }
+
+    if (px.n < PSF_FIT_MIN_PIXELS)
+        return true;
+
+    double p[PSF_NPARAMS];
+    p[PSF_B] = mean_bg;
+    p[PSF_A] = zmax - mean_bg;
+    p[PSF_X0] = *x - peak_x;
+    p[PSF_Y0] = *y - peak_y;
+    if (m_psfShape[0] > 0.0)
+    {
+        p[PSF_XX] = m_psfShape[0];
+        p[PSF_XY] = m_psfShape[1];
+        p[PSF_YY] = m_psfShape[2];
+    }
+    else
+    {
+        // for a Gaussian the HFD is the FWHM
+        double sigma = wxMax(HFD, 1.0) / FWHM_PER_SIGMA;
+        p[PSF_XX] = p[PSF_YY] = 1.0 / (2.0 * sigma * sigma);
+        p[PSF_XY] = 0.0;
+    }
+
+    if (!PSFParamsValid(p))
+        return true;
+
+    double jtj[PSF_NPARAMS][PSF_NPARAMS];
+    double jtr[PSF_NPARAMS];
+    double chi2 = PSFResiduals(px, p, jtj, jtr);
+    double lambda = 1e-3;
+    bool converged = false;
+    int iter;
+
+    for (iter = 0; iter < PSF_FIT_MAX_ITERATIONS && !converged; iter++)
+    {
+        if (swatch.TimeInMicro().GetValue() > PSF_FIT_TIME_BUDGET_US)
+            break;
+
+        double m[PSF_NPARAMS][PSF_NPARAMS];
+        for (int j = 0; j < PSF_NPARAMS; j++)
+        {
+            for (int k = 0; k < PSF_NPARAMS; k++)
+                m[j][k] = jtj[j][k];
+            m[j][j] *= 1.0 + lambda;
+        }
+
+        double delta[PSF_NPARAMS];
+        double trial[PSF_NPARAMS];
+        bool ok = !SolveCholesky(m, jtr, delta);
+        if (ok)
+        {
+            for (int j = 0; j < PSF_NPARAMS; j++)
+                trial[j] = p[j] + delta[j];
+            ok = PSFParamsValid(trial);
+        }
+
+        double trialChi2 = ok ? PSFResiduals(px, trial, 0, 0) : 0.0;
+        if (!ok || trialChi2 >= chi2)
+        {
+            lambda *= 10.0;
+            if (lambda > 1e10)
+                break;
+            continue;
+        }
+
+        converged = chi2 - trialChi2 <= 1e-6 * chi2 ||
+            (fabs(delta[PSF_X0]) < 1e-3 && fabs(delta[PSF_Y0]) < 1e-3);
+
+        memcpy(p, trial, sizeof(p));
+        chi2 = PSFResiduals(px, p, jtj, jtr);
+        lambda = wxMax(lambda / 10.0, 1e-7);
+    }
+
+    if (!converged)
+    {
+        Debug.Write(wxString::Format("Star::FitPSF no convergence after %d iterations, %ld us\n", iter,
+            (long) swatch.TimeInMicro().GetValue()));
+        m_psfShape[0] = m_psfShape[1] = m_psfShape[2] = 0.0;
+        return true;
+    }
+
+    // principal axes of the fitted ellipse
+    double const tr = p[PSF_XX] + p[PSF_YY];
+    double const det = p[PSF_XX] * p[PSF_YY] - p[PSF_XY] * p[PSF_XY];
+    double const disc = sqrt(wxMax(tr * tr / 4.0 - det, 0.0));
+    double const lmin = tr / 2.0 - disc;
+    double const lmax = tr / 2.0 + disc;
+    if (lmin <= 0.0)
+        return true;
+
+    double const fwhmMajor = FWHM_PER_SIGMA / sqrt(2.0 * lmin);
+    double const fwhmMinor = FWHM_PER_SIGMA / sqrt(2.0 * lmax);
+
+    *x = peak_x + p[PSF_X0];
+    *y = peak_y + p[PSF_Y0];
+    FWHM = sqrt(fwhmMajor * fwhmMinor);
+    Ellipticity = 1.0 - fwhmMinor / fwhmMajor;
+    m_psfShape[0] = p[PSF_XX];
+    m_psfShape[1] = p[PSF_XY];
+    m_psfShape[2] = p[PSF_YY];
+
+    Debug.Write(wxString::Format("Star::FitPSF (%.2f, %.2f) FWHM %.2f ellipticity %.3f after %d iterations\n",
+        *x, *y, FWHM, Ellipticity, iter));
+
+    return false;
+}
+
 bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, FindMode mode)
 {
+    TraceSpan span("Star::Find");
+
     FindResult Result = STAR_OK;
     double newX = base_x;
     double newY = base_y;
 
+    FWHM = 0.0;
+    Ellipticity = 0.0;
+
     try
     {
         Debug.Write(wxString::Format("Star::Find(%d, %d, %d, %d, (%d,%d,%d,%d))\n", searchRegion, base_x, base_y, mode,
@@ -173,118 +573,66 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         int start_y = wxMax(base_y - searchRegion, miny);
         int end_y   = wxMin(base_y + searchRegion, maxy);
 
-        const unsigned short *imgdata = pImg->ImageData;
-        int rowsize = pImg->Size.GetWidth();
+        // rows are addressed relative to the stored pixels so that
+        // subframe-only images, which store just the subframe, work the same
+        // as full frames
 
         int peak_x = 0, peak_y = 0;
         unsigned int peak_val = 0;
         unsigned short max3[3] = { 0, 0, 0 };
 
+        // in FIND_PEAK mode the raw peak value, otherwise the peak value
+        // within the search region using a smoothing function; the latter also
+        // collects the max values to check for saturation
+        if (pImg->ImageData8)
+            FindPeak<unsigned char>(pImg, mode != FIND_PEAK, start_x, end_x, start_y, end_y, &peak_x, &peak_y, &peak_val, max3);
+        else
+            FindPeak<unsigned short>(pImg, mode != FIND_PEAK, start_x, end_x, start_y, end_y, &peak_x, &peak_y, &peak_val, max3);
+
         if (mode == FIND_PEAK)
         {
-            for (int y = start_y; y <= end_y; y++)
-            {
-                for (int x = start_x; x <= end_x; x++)
-                {
-                    unsigned short val = imgdata[y * rowsize + x];
-
-                    if (val > peak_val)
-                    {
-                        peak_val = val;
-                        peak_x = x;
-                        peak_y = y;
-                    }
-                }
-            }
-
             PeakVal = peak_val;
         }
         else
         {
-            // find the peak value within the search region using a smoothing function
-            // also check for saturation
-
-            for (int y = start_y + 1; y <= end_y - 1; y++)
-            {
-                for (int x = start_x + 1; x <= end_x - 1; x++)
-                {
-                    unsigned short p = imgdata[y * rowsize + x];
-                    unsigned int val =
-                        4 * (unsigned int) p +
-                        imgdata[(y - 1) * rowsize + (x - 1)] +
-                        imgdata[(y - 1) * rowsize + (x + 1)] +
-                        imgdata[(y + 1) * rowsize + (x - 1)] +
-                        imgdata[(y + 1) * rowsize + (x + 1)] +
-                        2 * imgdata[(y - 1) * rowsize + (x + 0)] +
-                        2 * imgdata[(y + 0) * rowsize + (x - 1)] +
-                        2 * imgdata[(y + 0) * rowsize + (x + 1)] +
-                        2 * imgdata[(y + 1) * rowsize + (x + 0)];
-
-                    if (val > peak_val)
-                    {
-                        peak_val = val;
-                        peak_x = x;
-                        peak_y = y;
-                    }
-
-                    if (p > max3[0])
-                        std::swap(p, max3[0]);
-                    if (p > max3[1])
-                        std::swap(p, max3[1]);
-                    if (p > max3[2])
-                        std::swap(p, max3[2]);
-                }
-            }
-
             PeakVal = max3[0];   // raw peak val
             peak_val /= 16; // smoothed peak value
         }
 
         // meaure noise in the annulus with inner radius A and outer radius B
-        int const A = 7;   // inner radius
-        int const B = 12;  // outer radius
-        int const A2 = A * A;
-        int const B2 = B * B;
-
-        // center window around peak value
-        start_x = wxMax(peak_x - B, minx);
-        end_x = wxMin(peak_x + B, maxx);
-        start_y = wxMax(peak_y - B, miny);
-        end_y = wxMin(peak_y + B, maxy);
-
-        // find the mean and stdev of the background
-
-        double sum = 0.0;
-        double a = 0.0;
-        double q = 0.0;
+        int const A = FIND_APERTURE_RADIUS;
+        int const B = FIND_ANNULUS_RADIUS;
+
+        // find the mean and stdev of the background, accumulating exact
+        // integer sums over the annulus row spans
+
+        wxUint64 bgsum = 0;
+        wxUint64 bgsumsq = 0;
         unsigned int nbg = 0;
 
-        const unsigned short *row = imgdata + rowsize * start_y;
-        for (int y = start_y; y <= end_y; y++, row += rowsize)
+        for (int dy = -B; dy <= B; dy++)
         {
-            int dy = y - peak_y;
-            int dy2 = dy * dy;
-            for (int x = start_x; x <= end_x; x++)
-            {
-                int dx = x - peak_x;
-                int r2 = dx * dx + dy2;
+            int y = peak_y + dy;
+            if (y < miny || y > maxy)
+                continue;
 
-                // exclude points not in annulus
-                if (r2 <= A2 || r2 > B2)
-                    continue;
+            int const outer = s_annulusHalfWidth[abs(dy)];
+            int const inner = s_apertureHalfWidth[abs(dy)];
 
-                double const val = (double) row[x];
-                sum += val;
-                ++nbg;
-                double const k = (double) nbg;
-                double const a0 = a;
-                a += (val - a) / k;
-                q += (val - a0) * (val - a);
+            if (inner < 0)
+            {
+                // the row misses the aperture
+                nbg += SumSpan(pImg, y, wxMax(peak_x - outer, minx), wxMin(peak_x + outer, maxx), &bgsum, &bgsumsq);
+            }
+            else
+            {
+                nbg += SumSpan(pImg, y, wxMax(peak_x - outer, minx), wxMin(peak_x - inner - 1, maxx), &bgsum, &bgsumsq);
+                nbg += SumSpan(pImg, y, wxMax(peak_x + inner + 1, minx), wxMin(peak_x + outer, maxx), &bgsum, &bgsumsq);
             }
         }
 
-        double const mean_bg = sum / (double) nbg;
-        double const sigma2_bg = q / (double) (nbg - 1);
+        double const mean_bg = (double) bgsum / (double) nbg;
+        double const sigma2_bg = nbg > 1 ? (double) (nbg * bgsumsq - bgsum * bgsum) / ((double) nbg * (double) (nbg - 1)) : 0.0;
         double const sigma_bg = sqrt(sigma2_bg);
         unsigned short thresh;
 
@@ -306,45 +654,58 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
             thresh = (unsigned short)(mean_bg + 3.0 * sigma_bg + 0.5);
 
             // find pixels over threshold within aperture; compute mass and centroid
+            // from integer sums of the pixel values and their moments
 
-            start_x = wxMax(peak_x - A, minx);
-            end_x = wxMin(peak_x + A, maxx);
-            start_y = wxMax(peak_y - A, miny);
-            end_y = wxMin(peak_y + A, maxy);
-
+            wxUint64 sum = 0;
+            wxInt64 sumx = 0;
+            wxInt64 sumy = 0;
+            int sumdx = 0;
+            int sumdy = 0;
             n = 0;
 
-            row = imgdata + rowsize * start_y;
-            for (int y = start_y; y <= end_y; y++, row += rowsize)
+            hfrvec.reserve((2 * A + 1) * (2 * A + 1));
+
+            for (int dy = -A; dy <= A; dy++)
             {
-                int dy = y - peak_y;
-                int dy2 = dy * dy;
-                if (dy2 > A2)
+                int y = peak_y + dy;
+                if (y < miny || y > maxy)
                     continue;
 
-                for (int x = start_x; x <= end_x; x++)
-                {
-                    int dx = x - peak_x;
-
-                    // exclude points outside aperture
-                    if (dx * dx + dy2 > A2)
-                        continue;
+                int const hw = s_apertureHalfWidth[abs(dy)];
+                int const x0 = wxMax(peak_x - hw, minx);
+                int const x1 = wxMin(peak_x + hw, maxx);
+                unsigned short buf[2 * FIND_APERTURE_RADIUS + 1];
+                const unsigned short *row = ApertureRow(pImg, x0, y, x1 - x0 + 1, buf);
 
+                unsigned int rowsum = 0;
+                int rowsumx = 0;
+                unsigned int rown = 0;
+                for (int x = x0; x <= x1; x++)
+                {
                     // exclude points below threshold
-                    unsigned short val = row[x];
+                    unsigned int const val = row[x - x0];
                     if (val < thresh)
                         continue;
 
-                    double const d = (double) val - mean_bg;
+                    int const dx = x - peak_x;
+                    rowsum += val;
+                    rowsumx += dx * (int) val;
+                    sumdx += dx;
+                    ++rown;
 
-                    cx += dx * d;
-                    cy += dy * d;
-                    mass += d;
-                    ++n;
-
-                    hfrvec.push_back(R2M(x, y, d));
+                    hfrvec.push_back(R2M(x, y, (double) val - mean_bg));
                 }
+
+                sum += rowsum;
+                sumx += rowsumx;
+                sumy += (wxInt64) dy * rowsum;
+                sumdy += dy * (int) rown;
+                n += rown;
             }
+
+            cx = (double) sumx - mean_bg * sumdx;
+            cy = (double) sumy - mean_bg * sumdy;
+            mass = (double) sum - mean_bg * n;
         }
 
         Mass = mass;
@@ -397,6 +758,22 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
                 if (d * 65535U < 32U * mx)
                     Result = STAR_SATURATED;
             }
+
+            if (mode == FIND_PSF_FIT)
+            {
+                // leave the clipped pixels of a saturated star out of the fit
+                unsigned int satLevel = Result == STAR_SATURATED ? max3[2] : 65536U;
+                double fitX = newX, fitY = newY;
+                if (FitPSF(pImg, wxRect(wxPoint(minx, miny), wxPoint(maxx, maxy)), peak_x, peak_y, satLevel, mean_bg, &fitX, &fitY))
+                {
+                    Debug.AddLine("Star::Find PSF fit failed, using centroid");
+                }
+                else
+                {
+                    newX = fitX;
+                    newY = fitY;
+                }
+            }
         }
     }
     catch (const wxString& Msg)
@@ -420,6 +797,8 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         Mass = 0.0;
         SNR = 0.0;
         HFD = 0.0;
+        FWHM = 0.0;
+        Ellipticity = 0.0;
     }
 
     Debug.Write(wxString::Format("Star::Find returns %d (%d), X=%.2f, Y=%.2f, Mass=%.f, SNR=%.1f, Peak=%hu HFD=%.1f\n",
@@ -510,17 +889,13 @@ static void SaveImage(const FloatImg& img, const char *name)
 #endif // SAVE_AUTOFIND_IMG
 }
 
-static void psf_conv(FloatImg& dst, const FloatImg& src)
+// Convolve rows [y0, y1) of the median-filtered image with the star PSF.
+// Rows and columns within 4 pixels of the edge are set to zero.
+static void psf_conv_rows(FloatImg& dst, const unsigned short *src, int y0, int y1)
 {
-    dst.Init(src.Size);
-
     //                       A      B1     B2    C1     C2    C3     D1     D2     D3
     const double PSF[] = { 0.906, 0.584, 0.365, .117, .049, -0.05, -.064, -.074, -.094 };
-
-    int const width = src.Size.GetWidth();
-    int const height = src.Size.GetHeight();
-
-    memset(dst.px, 0, src.NPixels * sizeof(float));
+    const int PSF_N[] = { 1, 4, 4, 4, 8, 4, 4, 8, 44 };
 
     /* PSF Grid is:
     D3 D3 D3 D3 D3 D3 D3 D3 D3
@@ -537,80 +912,93 @@ static void psf_conv(FloatImg& dst, const FloatImg& src)
     4@B1, B2, C1, C3, D1
     8@C2, D2
     44 * D3
-    */
 
-    int psf_size = 4;
+    The fit is sum(PSF[k] * (S[k] - N[k] * mean)) where S[k] is the sum of the
+    N[k] pixels of ring k and mean is the mean of all 81 pixels. D3 is
+    everything outside the inner 37 pixels, so the fit is also
 
-    for (int y = psf_size; y < height - psf_size; y++)
-    {
-        for (int x = psf_size; x < width - psf_size; x++)
-        {
-            float A, B1, B2, C1, C2, C3, D1, D2, D3;
+       sum(k < D3, (PSF[k] - PSF[D3]) * S[k]) + (PSF[D3] - sum(PSF[k] * N[k]) / 81) * total
 
-#define PX(dx, dy) *(src.px + width * (y + (dy)) + x + (dx))
-            A =  PX(+0, +0);
-            B1 = PX(+0, -1) + PX(+0, +1) + PX(+1, +0) + PX(-1, +0);
-            B2 = PX(-1, -1) + PX(+1, -1) + PX(-1, +1) + PX(+1, +1);
-            C1 = PX(+0, -2) + PX(-2, +0) + PX(+2, +0) + PX(+0, +2);
-            C2 = PX(-1, -2) + PX(+1, -2) + PX(-2, -1) + PX(+2, -1) + PX(-2, +1) + PX(+2, +1) + PX(-1, +2) + PX(+1, +2);
-            C3 = PX(-2, -2) + PX(+2, -2) + PX(-2, +2) + PX(+2, +2);
-            D1 = PX(+0, -3) + PX(-3, +0) + PX(+3, +0) + PX(+0, +3);
-            D2 = PX(-1, -3) + PX(+1, -3) + PX(-3, -1) + PX(+3, -1) + PX(-3, +1) + PX(+3, +1) + PX(-1, +3) + PX(+1, +3);
-            D3 = PX(-4, -2) + PX(-3, -2) + PX(+3, -2) + PX(+4, -2) + PX(-4, -1) + PX(+4, -1) + PX(-4, +0) + PX(+4, +0) + PX(-4, +1) + PX(+4, +1) + PX(-4, +2) + PX(-3, +2) + PX(+3, +2) + PX(+4, +2);
-#undef PX
-            int i;
-            const float *uptr;
-
-            uptr = src.px + width * (y - 4) + (x - 4);
-            for (i = 0; i < 9; i++)
-                D3 += *uptr++;
-
-            uptr = src.px + width * (y - 3) + (x - 4);
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
-            uptr += 3;
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
+    where total is the 9x9 box sum, which is separable. The pixel values are
+    integers and the sums stay below 2^24, so the float sums are exact.
+    */
 
-            uptr = src.px + width * (y + 3) + (x - 4);
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
-            uptr += 3;
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
+    float w[8];
+    double c = 0.0;
+    for (int k = 0; k < 9; k++)
+        c += PSF[k] * PSF_N[k];
+    for (int k = 0; k < 8; k++)
+        w[k] = (float) (PSF[k] - PSF[8]);
+    const float wt = (float) (PSF[8] - c / 81.0);
 
-            uptr = src.px + width * (y + 4) + (x - 4);
-            for (i = 0; i < 9; i++)
-                D3 += *uptr++;
+    enum { R = 4 };
 
-            double mean = (A + B1 + B2 + C1 + C2 + C3 + D1 + D2 + D3) / 81.0;
-            double PSF_fit = PSF[0] * (A - mean) + PSF[1] * (B1 - 4.0 * mean) + PSF[2] * (B2 - 4.0 * mean) +
-                PSF[3] * (C1 - 4.0 * mean) + PSF[4] * (C2 - 8.0 * mean) + PSF[5] * (C3 - 4.0 * mean) +
-                PSF[6] * (D1 - 4.0 * mean) + PSF[7] * (D2 - 8.0 * mean) + PSF[8] * (D3 - 44.0 * mean);
+    int const width = dst.Size.GetWidth();
+    int const height = dst.Size.GetHeight();
 
-            dst.px[width * y + x] = (float) PSF_fit;
+    for (int y = y0; y < y1; y++)
+    {
+        float *d = dst.px + width * y;
+        if (y < R || y >= height - R)
+        {
+            memset(d, 0, width * sizeof(float));
+        }
+        else
+        {
+            for (int x = 0; x < R && x < width; x++)
+                d[x] = 0.f;
+            for (int x = wxMax(width - R, 0); x < width; x++)
+                d[x] = 0.f;
         }
     }
-}
 
-static void Downsample(FloatImg& dst, const FloatImg& src, int downsample)
-{
-    int width = src.Size.GetWidth();
-    int dw = src.Size.GetWidth() / downsample;
-    int dh = src.Size.GetHeight() / downsample;
+    int const ys = wxMax(y0, (int) R);
+    int const ye = wxMin(y1, height - R);
+    if (ys >= ye || width <= 2 * R)
+        return;
 
-    dst.Init(wxSize(dw, dh));
+    // vertical 9 pixel sums, slid down one row at a time
+    std::vector<float> colsum(width, 0.f);
+    for (int j = -R; j <= R; j++)
+    {
+        const unsigned short *row = src + width * (ys + j);
+        for (int x = 0; x < width; x++)
+            colsum[x] += (float) row[x];
+    }
 
-    for (int yy = 0; yy < dh; yy++)
+    for (int y = ys; y < ye; y++)
     {
-        for (int xx = 0; xx < dw; xx++)
+        if (y > ys)
         {
-            float sum = 0.0;
-            for (int j = 0; j < downsample; j++)
-                for (int i = 0; i < downsample; i++)
-                    sum += src.px[(yy * downsample + j) * width + xx * downsample + i];
-            float val = sum / (downsample * downsample);
-            dst.px[yy * dw + xx] = val;
+            const unsigned short *add = src + width * (y + R);
+            const unsigned short *sub = src + width * (y - R - 1);
+            for (int x = 0; x < width; x++)
+                colsum[x] += (float) add[x] - (float) sub[x];
+        }
+
+        const unsigned short *m3 = src + width * (y - 3);
+        const unsigned short *m2 = src + width * (y - 2);
+        const unsigned short *m1 = src + width * (y - 1);
+        const unsigned short *z0 = src + width * y;
+        const unsigned short *p1 = src + width * (y + 1);
+        const unsigned short *p2 = src + width * (y + 2);
+        const unsigned short *p3 = src + width * (y + 3);
+        const float *cs = &colsum[0];
+        float *d = dst.px + width * y;
+
+        for (int x = R; x < width - R; x++)
+        {
+            float A = z0[x];
+            float B1 = (float) m1[x] + p1[x] + z0[x - 1] + z0[x + 1];
+            float B2 = (float) m1[x - 1] + m1[x + 1] + p1[x - 1] + p1[x + 1];
+            float C1 = (float) m2[x] + p2[x] + z0[x - 2] + z0[x + 2];
+            float C2 = (float) m2[x - 1] + m2[x + 1] + m1[x - 2] + m1[x + 2] + p1[x - 2] + p1[x + 2] + p2[x - 1] + p2[x + 1];
+            float C3 = (float) m2[x - 2] + m2[x + 2] + p2[x - 2] + p2[x + 2];
+            float D1 = (float) m3[x] + p3[x] + z0[x - 3] + z0[x + 3];
+            float D2 = (float) m3[x - 1] + m3[x + 1] + m1[x - 3] + m1[x + 3] + p1[x - 3] + p1[x + 3] + p3[x - 1] + p3[x + 1];
+            float total = cs[x - 4] + cs[x - 3] + cs[x - 2] + cs[x - 1] + cs[x] + cs[x + 1] + cs[x + 2] + cs[x + 3] + cs[x + 4];
+
+            d[x] = w[0] * A + w[1] * B1 + w[2] * B2 + w[3] * C1 + w[4] * C2 + w[5] * C3 + w[6] * D1 + w[7] * D2 + wt * total;
         }
     }
 }
@@ -626,6 +1014,217 @@ struct Peak
     bool operator<(const Peak& rhs) const { return val < rhs.val; }
 };
 
+enum { AUTOFIND_TOP_N = 100 };  // keep track of the brightest stars
+
+// AutoFind searches a 2x binned image above this size, 4x binned above the next
+enum { AUTOFIND_BIN2_MIN_PIXELS = 6000000, AUTOFIND_BIN4_MIN_PIXELS = 24000000 };
+
+// AutoFind works on horizontal bands of the image in parallel: the median
+// filter, the PSF convolution and the peak search each run as a separate
+// WorkPool batch over the bands
+struct AutoFindBand
+{
+    std::set<Peak> peaks;       // brightest local maxima in the band
+    double sum;                 // convolution sum and sum of squares over convRect
+    double sumsq;
+    unsigned int n;
+    unsigned short maxVal;      // brightest original pixel
+};
+
+struct AutoFindJob
+{
+    const usImage *image;
+    usImage smoothed;
+    FloatImg conv;
+    wxRect convRect;
+    double threshold;
+    double globalStdev;
+    int bandHeight;
+    std::vector<AutoFindBand> bands;
+};
+
+static void AutoFindBandRows(const AutoFindJob *job, unsigned int band, int *y0, int *y1)
+{
+    int height = job->image->Size.GetHeight();
+    *y0 = wxMin((int) band * job->bandHeight, height);
+    *y1 = wxMin(*y0 + job->bandHeight, height);
+}
+
+static void AutoFindSmoothBand(void *ctx, unsigned int band)
+{
+    AutoFindJob *job = static_cast<AutoFindJob *>(ctx);
+    const usImage& image = *job->image;
+    int y0, y1;
+    AutoFindBandRows(job, band, &y0, &y1);
+
+    // run a 3x3 median first to eliminate hot pixels
+    Median3Rows(job->smoothed.ImageData, image.ImageData, image.Size, wxRect(image.Size), y0, y1);
+
+    unsigned short maxVal = 0;
+    const unsigned short *p = image.ImageData + image.Size.GetWidth() * y0;
+    const unsigned short *end = image.ImageData + image.Size.GetWidth() * y1;
+    for (; p < end; p++)
+        if (*p > maxVal)
+            maxVal = *p;
+    job->bands[band].maxVal = maxVal;
+}
+
+static void AutoFindConvBand(void *ctx, unsigned int band)
+{
+    AutoFindJob *job = static_cast<AutoFindJob *>(ctx);
+    int y0, y1;
+    AutoFindBandRows(job, band, &y0, &y1);
+
+    psf_conv_rows(job->conv, job->smoothed.ImageData, y0, y1);
+
+    // partial sums for the global mean and standard deviation
+    AutoFindBand& b = job->bands[band];
+    b.sum = b.sumsq = 0.0;
+    b.n = 0;
+
+    const wxRect& r = job->convRect;
+    if (r.IsEmpty())
+        return;
+
+    int const width = job->conv.Size.GetWidth();
+    int const ys = wxMax(y0, r.GetTop());
+    int const ye = wxMin(y1, r.GetBottom() + 1);
+    for (int y = ys; y < ye; y++)
+    {
+        const float *p = job->conv.px + width * y + r.GetLeft();
+        double sum = 0.0, sumsq = 0.0;
+        for (int x = 0; x < r.GetWidth(); x++)
+        {
+            double const v = p[x];
+            sum += v;
+            sumsq += v * v;
+        }
+        b.sum += sum;
+        b.sumsq += sumsq;
+        b.n += r.GetWidth();
+    }
+}
+
+static void AutoFindPeakBand(void *ctx, unsigned int band)
+{
+    AutoFindJob *job = static_cast<AutoFindJob *>(ctx);
+    const FloatImg& conv = job->conv;
+    const wxRect& convRect = job->convRect;
+    int y0, y1;
+    AutoFindBandRows(job, band, &y0, &y1);
+
+    // local maxima are pixels that are not exceeded by any pixel within srch
+    // pixels; find them with a separable max filter
+    enum { srch = 4 };
+    int const dw = conv.Size.GetWidth();
+    int const xs = convRect.GetLeft() + srch;
+    int const xe = convRect.GetRight() - srch + 1;
+    int const ys = wxMax(y0, convRect.GetTop() + srch);
+    int const ye = wxMin(y1, convRect.GetBottom() - srch + 1);
+    if (ys >= ye || xs >= xe)
+        return;
+
+    // horizontal max over rows ys - srch .. ye + srch - 1
+    int const hrows = ye - ys + 2 * srch;
+    std::vector<float> hmax(hrows * dw);
+    for (int j = 0; j < hrows; j++)
+    {
+        const float *src = conv.px + dw * (ys - srch + j);
+        float *dst = &hmax[j * dw];
+        for (int x = xs; x < xe; x++)
+        {
+            float m = src[x - srch];
+            for (int i = -srch + 1; i <= srch; i++)
+                m = wxMax(m, src[x + i]);
+            dst[x] = m;
+        }
+    }
+
+    std::vector<float> vmax(dw);
+    std::set<Peak>& stars = job->bands[band].peaks;
+
+    for (int y = ys; y < ye; y++)
+    {
+        int const j0 = y - ys;
+        for (int x = xs; x < xe; x++)
+        {
+            float m = hmax[j0 * dw + x];
+            for (int j = 1; j <= 2 * srch; j++)
+                m = wxMax(m, hmax[(j0 + j) * dw + x]);
+            vmax[x] = m;
+        }
+
+        const float *row = conv.px + dw * y;
+        for (int x = xs; x < xe; x++)
+        {
+            float val = row[x];
+            if (val <= 0.0 || val < vmax[x])
+                continue;
+
+            // compare local maximum to mean value of surrounding pixels
+            const int local = 7;
+            double local_mean, local_stdev;
+            wxRect localRect(x - local, y - local, 2 * local + 1, 2 * local + 1);
+            localRect.Intersect(convRect);
+            GetStats(&local_mean, &local_stdev, conv, localRect);
+
+            // this is our measure of star intensity
+            double h = (val - local_mean) / job->globalStdev;
+
+            if (h < job->threshold)
+                continue;
+
+            stars.insert(Peak(x, y, h));
+            if (stars.size() > AUTOFIND_TOP_N)
+                stars.erase(stars.begin());
+        }
+    }
+}
+
+// move peaks found on a binned pyramid level to the brightest pixel (3x3 sum,
+// so a hot pixel does not win) within the bin and its neighbors at full
+// resolution
+static void RefineBinnedPeaks(const usImage& image, int level, std::set<Peak> *stars)
+{
+    int const scale = 1 << level;
+    int const w = image.Size.GetWidth();
+    int const h = image.Size.GetHeight();
+
+    std::set<Peak> refined;
+    for (std::set<Peak>::const_iterator it = stars->begin(); it != stars->end(); ++it)
+    {
+        int const x0 = wxMax((it->x - 1) * scale, 1);
+        int const x1 = wxMin((it->x + 2) * scale - 1, w - 2);
+        int const y0 = wxMax((it->y - 1) * scale, 1);
+        int const y1 = wxMin((it->y + 2) * scale - 1, h - 2);
+
+        int bx = wxMin(it->x * scale, w - 1), by = wxMin(it->y * scale, h - 1);
+        unsigned int best = 0;
+        for (int y = y0; y <= y1; y++)
+        {
+            const unsigned short *r0 = image.ImageData + w * (y - 1);
+            const unsigned short *r1 = r0 + w;
+            const unsigned short *r2 = r1 + w;
+            for (int x = x0; x <= x1; x++)
+            {
+                unsigned int const s = (unsigned int) r0[x - 1] + r0[x] + r0[x + 1] +
+                    r1[x - 1] + r1[x] + r1[x + 1] +
+                    r2[x - 1] + r2[x] + r2[x + 1];
+                if (s > best)
+                {
+                    best = s;
+                    bx = x;
+                    by = y;
+                }
+            }
+        }
+
+        refined.insert(Peak(bx, by, it->val));
+    }
+
+    stars->swap(refined);
+}
+
 static void RemoveItems(std::set<Peak>& stars, const std::set<int>& to_erase)
 {
     int n = 0;
@@ -645,114 +1244,115 @@ static void RemoveItems(std::set<Peak>& stars, const std::set<int>& to_erase)
 
 bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegion)
 {
+    std::vector<Star> stars;
+    if (!AutoFindStars(image, extraEdgeAllowance, searchRegion, 1, &stars))
+        return false;
+
+    SetXY(stars[0].X, stars[0].Y);
+    return true;
+}
+
+bool Star::AutoFindStars(const usImage& image, int extraEdgeAllowance, int searchRegion, unsigned int maxStars,
+                         std::vector<Star> *foundStars)
+{
+    foundStars->clear();
+
     if (!image.Subframe.IsEmpty())
     {
         Debug.AddLine("Autofind called on subframe, returning error");
         return false; // not found
     }
 
+    if (image.Is8Bit())
+    {
+        // the detection filters work on 16-bit pixels
+        usImage wide;
+        if (wide.CopyFrom(image) || wide.Widen())
+            return false;
+        wide.BitsPerPixel = image.BitsPerPixel;
+        wide.Pedestal = image.Pedestal;
+        return AutoFindStars(wide, extraEdgeAllowance, searchRegion, maxStars, foundStars);
+    }
+
     wxBusyCursor busy;
 
     Debug.Write(wxString::Format("Star::AutoFind called with edgeAllowance = %d searchRegion = %d\n", extraEdgeAllowance, searchRegion));
 
-    // run a 3x3 median first to eliminate hot pixels
-    usImage smoothed;
-    smoothed.CopyFrom(image);
-    Median3(smoothed);
+    // on large sensors, look for the stars on a binned level of the image
+    // pyramid and refine their positions at full resolution
+    usImage bin2, bin4;
+    unsigned short pyramidMax = 0;
+    int level = 0;
+    if (image.NPixels > AUTOFIND_BIN2_MIN_PIXELS && !BinPyramid(image, &bin2, &bin4, &pyramidMax))
+        level = image.NPixels > AUTOFIND_BIN4_MIN_PIXELS ? 2 : 1;
+    const usImage& detect = level == 2 ? bin4 : level == 1 ? bin2 : image;
 
-    // convert to floating point
-    FloatImg conv(smoothed);
+    if (level > 0)
+        Debug.Write(wxString::Format("AutoFind: searching %dx%d image binned %dx%d\n", image.Size.GetWidth(), image.Size.GetHeight(), 1 << level, 1 << level));
 
-    // downsample the source image
-    const int downsample = 1;
-    if (downsample > 1)
-    {
-        FloatImg tmp;
-        Downsample(tmp, conv, downsample);
-        conv.Swap(tmp);
-    }
-
-    // run the PSF convolution
-    {
-        FloatImg tmp;
-        psf_conv(tmp, conv);
-        conv.Swap(tmp);
-    }
+    AutoFindJob job;
+    job.image = &detect;
+    job.smoothed.Init(detect.Size);
+    job.conv.Init(detect.Size);
 
     enum { CONV_RADIUS = 4 };
-    int dw = conv.Size.GetWidth();      // width of the downsampled image
-    int dh = conv.Size.GetHeight();     // height of the downsampled image
-    wxRect convRect(CONV_RADIUS, CONV_RADIUS, dw - 2 * CONV_RADIUS, dh - 2 * CONV_RADIUS);  // region containing valid data
+    int dw = detect.Size.GetWidth();
+    int dh = detect.Size.GetHeight();
+    job.convRect = wxRect(CONV_RADIUS, CONV_RADIUS, dw - 2 * CONV_RADIUS, dh - 2 * CONV_RADIUS);  // region containing valid data
 
-    SaveImage(conv, "PHD2_AutoFind.fit");
+    // a few bands per thread evens out the load, but keep them tall enough
+    // that the filter margins stay small
+    enum { MIN_BAND_HEIGHT = 32 };
+    unsigned int nbands = WorkPool::Concurrency() * 4;
+    job.bandHeight = wxMax((dh + (int) nbands - 1) / (int) nbands, (int) MIN_BAND_HEIGHT);
+    nbands = (dh + job.bandHeight - 1) / job.bandHeight;
+    job.bands.resize(nbands);
 
-    enum { TOP_N = 100 };  // keep track of the brightest stars
-    std::set<Peak> stars;  // sorted by ascending intensity
-
-    double global_mean, global_stdev;
-    GetStats(&global_mean, &global_stdev, conv, convRect);
+    WorkPool::Run(&AutoFindSmoothBand, &job, nbands);
+    WorkPool::Run(&AutoFindConvBand, &job, nbands);
 
-    Debug.Write(wxString::Format("AutoFind: global mean = %.1f, stdev %.1f\n", global_mean, global_stdev));
+    SaveImage(job.conv, "PHD2_AutoFind.fit");
 
-    const double threshold = 0.1;
-    Debug.Write(wxString::Format("AutoFind: using threshold = %.1f\n", threshold));
-
-    // find each local maximum
-    int srch = 4;
-    for (int y = convRect.GetTop() + srch; y <= convRect.GetBottom() - srch; y++)
+    double sum = 0.0, sumsq = 0.0, n = 0.0;
+    unsigned short maxVal = 0;
+    for (unsigned int i = 0; i < nbands; i++)
     {
-        for (int x = convRect.GetLeft() + srch; x <= convRect.GetRight() - srch; x++)
-        {
-            float val = conv.px[dw * y + x];
-            bool ismax = false;
-            if (val > 0.0)
-            {
-                ismax = true;
-                for (int j = -srch; j <= srch; j++)
-                {
-                    for (int i = -srch; i <= srch; i++)
-                    {
-                        if (i == 0 && j == 0)
-                            continue;
-                        if (conv.px[dw * (y + j) + (x + i)] > val)
-                        {
-                            ismax = false;
-                            break;
-                        }
-                    }
-                }
-            }
-            if (!ismax)
-                continue;
-
-            // compare local maximum to mean value of surrounding pixels
-            const int local = 7;
-            double local_mean, local_stdev;
-            wxRect localRect(x - local, y - local, 2 * local + 1, 2 * local + 1);
-            localRect.Intersect(convRect);
-            GetStats(&local_mean, &local_stdev, conv, localRect);
+        sum += job.bands[i].sum;
+        sumsq += job.bands[i].sumsq;
+        n += job.bands[i].n;
+        maxVal = wxMax(maxVal, job.bands[i].maxVal);
+    }
+    if (level > 0)
+        maxVal = pyramidMax;
+    double global_mean = n > 0.0 ? sum / n : 0.0;
+    double global_stdev = n > 0.0 ? sqrt(wxMax(sumsq / n - global_mean * global_mean, 0.0)) : 0.0;
 
-            // this is our measure of star intensity
-            double h = (val - local_mean) / global_stdev;
+    Debug.Write(wxString::Format("AutoFind: global mean = %.1f, stdev %.1f\n", global_mean, global_stdev));
 
-            if (h < threshold)
-            {
-                //  Debug.Write(wxString::Format("AG: local max REJECT [%d, %d] PSF %.1f SNR %.1f\n", imgx, imgy, val, SNR));
-                continue;
-            }
+    job.threshold = 0.1;
+    job.globalStdev = global_stdev;
+    Debug.Write(wxString::Format("AutoFind: using threshold = %.1f\n", job.threshold));
 
-            // coordinates on the original image
-            int imgx = x * downsample + downsample / 2;
-            int imgy = y * downsample + downsample / 2;
+    // find each local maximum, keeping the brightest ones in each band
+    WorkPool::Run(&AutoFindPeakBand, &job, nbands);
 
-            stars.insert(Peak(imgx, imgy, h));
-            if (stars.size() > TOP_N)
+    std::set<Peak> stars;  // sorted by ascending intensity
+    for (unsigned int i = 0; i < nbands; i++)
+    {
+        const std::set<Peak>& peaks = job.bands[i].peaks;
+        for (std::set<Peak>::const_iterator it = peaks.begin(); it != peaks.end(); ++it)
+        {
+            stars.insert(*it);
+            if (stars.size() > AUTOFIND_TOP_N)
                 stars.erase(stars.begin());
         }
     }
 
+    if (level > 0)
+        RefineBinnedPeaks(image, level, &stars);
+
     for (std::set<Peak>::const_reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
-        Debug.Write(wxString::Format("AutoFind: local max [%d, %d] %.1f\n", it->x, it->y, it->val));
+        DEBUG_VERBOSE(wxString::Format("AutoFind: local max [%d, %d] %.1f\n", it->x, it->y, it->val));
 
     // merge stars that are very close into a single star
     {
@@ -770,7 +1370,7 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
                 if (d2 < minlimitsq)
                 {
                     // very close, treat as single star
-                    Debug.Write(wxString::Format("AutoFind: merge [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
+                    DEBUG_VERBOSE(wxString::Format("AutoFind: merge [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
                     // erase the dimmer one
                     stars.erase(a);
                     goto repeat;
@@ -799,11 +1399,11 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
                     // but do not let a very dim star eliminate a very bright star
                     if (b->val / a->val >= 5.0)
                     {
-                        Debug.Write(wxString::Format("AutoFind: close dim-bright [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
+                        DEBUG_VERBOSE(wxString::Format("AutoFind: close dim-bright [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
                     }
                     else
                     {
-                        Debug.Write(wxString::Format("AutoFind: too close [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
+                        DEBUG_VERBOSE(wxString::Format("AutoFind: too close [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
                         to_erase.insert(std::distance(stars.begin(), a));
                         to_erase.insert(std::distance(stars.begin(), b));
                     }
@@ -826,7 +1426,7 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
             if (it->x <= edgeDist || it->x >= image.Size.GetWidth() - edgeDist ||
                 it->y <= edgeDist || it->y >= image.Size.GetHeight() - edgeDist)
             {
-                Debug.Write(wxString::Format("AutoFind: too close to edge [%d, %d] %.1f\n", it->x, it->y, it->val));
+                DEBUG_VERBOSE(wxString::Format("AutoFind: too close to edge [%d, %d] %.1f\n", it->x, it->y, it->val));
                 stars.erase(it);
             }
             it = next;
@@ -839,11 +1439,7 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
 
     // try to identify the saturation point
 
-    //  first, find the peak pixel overall
-    unsigned short maxVal = 0;
-    for (unsigned int i = 0; i < image.NPixels; i++)
-        if (image.ImageData[i] > maxVal)
-            maxVal = image.ImageData[i];
+    //  first, find the peak pixel overall (maxVal, found while smoothing)
 
     // next see if any of the stars has a flat-top
     bool foundSaturated = false;
@@ -897,13 +1493,24 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
     //       this pass will reject saturated and nearly-saturated stars
     //   pass 2: find brightest non-saturated star
     //   pass 3: find brightest star, even if saturated
+    // When more than one star is wanted, each pass adds stars in order of
+    // brightness until maxStars are found. Saturated stars are only used if
+    // nothing else was found.
+
+    std::set<const Peak *> accepted;
 
     for (int pass = 1; pass <= 3; pass++)
     {
+        if (pass == 3 && !foundStars->empty())
+            break;
+
         Debug.Write(wxString::Format("AutoSelect: finding best star pass %d\n", pass));
 
         for (std::set<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
         {
+            if (accepted.find(&*it) != accepted.end())
+                continue;
+
             Star tmp;
             tmp.Find(&image, searchRegion, it->x, it->y, FIND_CENTROID);
             if (tmp.WasFound())
@@ -928,18 +1535,89 @@ bool Star::AutoFind(const usImage& image, int extraEdgeAllowance, int searchRegi
                 }
 
                 // star accepted
-                SetXY(it->x, it->y);
                 Debug.Write(wxString::Format("Autofind returns star at [%d, %d] %.1f Mass %.f SNR %.1f\n", it->x, it->y, it->val, tmp.Mass, tmp.SNR));
-                return true;
+                tmp.SetXY(it->x, it->y);
+                foundStars->push_back(tmp);
+                accepted.insert(&*it);
+                if (foundStars->size() >= maxStars)
+                    return true;
             }
         }
 
+        if (!foundStars->empty())
+            continue;
+
         if (pass == 1)
             Debug.Write("AutoFind: could not find a star on Pass 1\n");
         else if (pass == 2)
             Debug.Write("AutoFind: could not find a non-saturated star!\n");
     }
 
+    if (!foundStars->empty())
+        return true;
+
     Debug.Write("Autofind: no star found\n");
     return false;
 }
+
+void Star::FindCandidates(const usImage& image, const wxRect& rect, unsigned int maxPeaks,
+                          std::vector<PHD_Point> *peaks)
+{
+    peaks->clear();
+
+    usImage crop;
+    if (rect.IsEmpty() || crop.Init(rect.GetSize()))
+        return;
+    for (int y = 0; y < rect.GetHeight(); y++)
+    {
+        unsigned short *dst = crop.ImageData + y * rect.GetWidth();
+        if (image.Is8Bit())
+        {
+            const unsigned char *src = &image.Pixel8(rect.GetLeft(), rect.GetTop() + y);
+            for (int x = 0; x < rect.GetWidth(); x++)
+                dst[x] = src[x];
+        }
+        else
+            memcpy(dst, &image.Pixel(rect.GetLeft(), rect.GetTop() + y), rect.GetWidth() * sizeof(unsigned short));
+    }
+
+    usImage bin2, bin4;
+    if (BinPyramid(crop, &bin2, &bin4, 0) || bin2.NPixels == 0)
+        return;
+
+    int const w = bin2.Size.GetWidth();
+    int const h = bin2.Size.GetHeight();
+
+    double sum = 0.0, sumsq = 0.0;
+    for (int i = 0; i < bin2.NPixels; i++)
+    {
+        double const v = bin2.ImageData[i];
+        sum += v;
+        sumsq += v * v;
+    }
+    double const mean = sum / bin2.NPixels;
+    double const stdev = sqrt(wxMax(sumsq / bin2.NPixels - mean * mean, 0.0));
+    double const thresh = mean + 3.0 * stdev;
+
+    // local maxima over the threshold
+    std::set<Peak> best;
+    for (int y = 1; y < h - 1; y++)
+    {
+        for (int x = 1; x < w - 1; x++)
+        {
+            unsigned short const v = bin2.Pixel(x, y);
+            if (v <= thresh)
+                continue;
+            if (v < bin2.Pixel(x - 1, y - 1) || v < bin2.Pixel(x, y - 1) || v < bin2.Pixel(x + 1, y - 1) ||
+                v < bin2.Pixel(x - 1, y) || v < bin2.Pixel(x + 1, y) ||
+                v < bin2.Pixel(x - 1, y + 1) || v < bin2.Pixel(x, y + 1) || v < bin2.Pixel(x + 1, y + 1))
+                continue;
+            best.insert(Peak(x, y, v));
+            if (best.size() > maxPeaks)
+                best.erase(best.begin());
+        }
+    }
+
+    for (std::set<Peak>::const_reverse_iterator it = best.rbegin(); it != best.rend(); ++it)
+        peaks->push_back(PHD_Point(rect.GetLeft() + 2 * it->x + 1, rect.GetTop() + 2 * it->y + 1));
+}
@@ -40,6 +40,8 @@
 
 #include "point.h"
 
+#include <vector>
+
 class Star : public PHD_Point
 {
 public:
@@ -47,6 +49,7 @@ public:
     {
         FIND_CENTROID,
         FIND_PEAK,
+        FIND_PSF_FIT,   // fit a Gaussian PSF, falling back to the centroid
     };
 
     enum FindResult
@@ -63,6 +66,8 @@ public:
     double Mass;
     double SNR;
     double HFD;
+    double FWHM;            // from the PSF fit, 0 if not fitted
+    double Ellipticity;     // 1 - minor / major axis, from the PSF fit
     unsigned short PeakVal;
 
     Star(void);
@@ -76,6 +81,13 @@ public:
     bool Find(const usImage *pImg, int searchRegion, FindMode mode);
     bool Find(const usImage *pImg, int searchRegion, int X, int Y, FindMode mode);
     bool AutoFind(const usImage& image, int edgeAllowance, int searchRegion);
+    // find up to maxStars guide star candidates, best first
+    static bool AutoFindStars(const usImage& image, int edgeAllowance, int searchRegion, unsigned int maxStars,
+                              std::vector<Star> *foundStars);
+    // find up to maxPeaks likely star positions within rect on a 2x binned
+    // copy of the image, brightest first, for Find to refine
+    static void FindCandidates(const usImage& image, const wxRect& rect, unsigned int maxPeaks,
+                               std::vector<PHD_Point> *peaks);
 
     bool WasFound(FindResult result);
     bool WasFound(void);
@@ -84,7 +96,11 @@ public:
     FindResult GetError(void) const;
 
 private:
+    bool FitPSF(const usImage *pImg, const wxRect& bounds, int peak_x, int peak_y, unsigned int satLevel,
+                double mean_bg, double *x, double *y);
+
     FindResult m_lastFindResult;
+    double m_psfShape[3];   // quadratic form of the last fitted PSF, to warm-start the next fit
 };
 
 inline Star::FindResult Star::GetError(void) const
@@ -79,23 +79,26 @@ void ProfileWindow::SetState(bool is_active)
 void ProfileWindow::UpdateData(usImage *pImg, float xpos, float ypos)
 {
     if (this->data == NULL) return;
+    // keep the box within the stored pixels, which for a subframe-only
+    // image are just the subframe
+    const wxRect r(pImg->DataRect());
     int xstart = ROUNDF(xpos) - HALFW;
     int ystart = ROUNDF(ypos) - HALFW;
-    if (xstart < 0) xstart = 0;
-    else if (xstart > (pImg->Size.GetWidth() - (FULLW + 1)))
-        xstart = pImg->Size.GetWidth() - (FULLW + 1);
-    if (ystart < 0) ystart = 0;
-    else if (ystart > (pImg->Size.GetHeight() - (FULLW + 1)))
-        ystart = pImg->Size.GetHeight() - (FULLW + 1);
+    if (xstart > r.GetRight() - FULLW)
+        xstart = r.GetRight() - FULLW;
+    if (xstart < r.GetLeft()) xstart = r.GetLeft();
+    if (ystart > r.GetBottom() - FULLW)
+        ystart = r.GetBottom() - FULLW;
+    if (ystart < r.GetTop()) ystart = r.GetTop();
 
     int x,y;
     unsigned short *uptr = this->data;
-    const int xrowsize = pImg->Size.GetWidth();
     for (x = 0; x < FULLW; x++)
         horiz_profile[x] = vert_profile[x] = midrow_profile[x] = 0;
     for (y = 0; y < FULLW; y++) {
         for (x = 0; x < FULLW; x++, uptr++) {
-            *uptr = *(pImg->ImageData + xstart + x + (ystart + y) * xrowsize);
+            // pixels beyond a subframe smaller than the box read as black
+            *uptr = r.Contains(xstart + x, ystart + y) ? pImg->PixelValue(xstart + x, ystart + y) : 0;
             horiz_profile[x] += (int) *uptr;
             vert_profile[y] += (int) *uptr;
         }
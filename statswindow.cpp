@@ -317,7 +317,7 @@ void StatsWindow::UpdateScopePointing()
         m_grid2->SetCellValue(row++, col, Mount::DeclinationStr(declination, "% .1f" DEGREES_SYMBOL));
         m_grid2->SetCellValue(row++, col, Mount::PierSideStr(pierSide));
         m_grid2->SetCellValue(row++, col, RotatorPosStr());
-        m_grid2->SetCellValue(row++, col, wxString::Format("%hu", pCamera->Binning));
+        m_grid2->SetCellValue(row++, col, wxString::Format("%hu", pCamera->ImageBinning()));
         m_grid2->EndBatch();
     }
 }
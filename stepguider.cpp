@@ -698,9 +698,9 @@ bool StepGuider::UpdateCalibrationState(const PHD_Point& currentLocation)
                 m_calibration.pierSide = PIER_SIDE_UNKNOWN;
                 m_calibration.raGuideParity = m_calibration.decGuideParity = GUIDE_PARITY_UNKNOWN;
                 m_calibration.rotatorAngle = Rotator::RotatorPosition();
-                m_calibration.binning = pCamera->Binning;
+                m_calibration.binning = pCamera->ImageBinning();
                 SetCalibration(m_calibration);
-                SetCalibrationDetails(m_calibrationDetails, m_calibration.xAngle, m_calibration.yAngle, pCamera->Binning);
+                SetCalibrationDetails(m_calibrationDetails, m_calibration.xAngle, m_calibration.yAngle, pCamera->ImageBinning());
                 status0 = _T("Calibration complete");
                 GuideLog.CalibrationComplete(this);
                 Debug.AddLine("Calibration Complete");
@@ -1151,7 +1151,7 @@ void StepGuider::AdjustCalibrationForScopePointing(void)
 {
     // compensate for binning change
 
-    unsigned short binning = pCamera->Binning;
+    unsigned short binning = pCamera->ImageBinning();
 
     if (binning == m_calibration.binning)
     {
@@ -0,0 +1,112 @@
+/*
+*  json_parser_bench.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+// Measures JsonParser throughput on JSON-RPC input like the event server
+// receives: a stream of small single requests, and large batch requests.
+// Parse() works in place, so each iteration parses a fresh copy of the
+// input; the copy is included in the timing.
+
+#include "json_parser.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static std::string request(int id)
+{
+    static const char *const methods[] = {
+        "{\"method\":\"get_app_state\",\"id\":%d}",
+        "{\"method\":\"set_exposure\",\"params\":[2000],\"id\":%d}",
+        "{\"method\":\"guide\",\"params\":{\"settle\":{\"pixels\":1.5,\"time\":10,\"timeout\":60},\"recalibrate\":false},\"id\":%d}",
+        "{\"method\":\"set_lock_position\",\"params\":[412.75,307.125,true],\"id\":%d}",
+    };
+    char buf[256];
+    sprintf(buf, methods[id % 4], id);
+    return buf;
+}
+
+static std::string batch(int count)
+{
+    std::string s("[");
+    for (int i = 0; i < count; i++)
+    {
+        if (i)
+            s += ',';
+        s += request(i);
+    }
+    s += ']';
+    return s;
+}
+
+static void run(const char *name, const std::string& input, int iterations)
+{
+    JsonParser parser;
+    std::vector<char> buf(input.size() + 1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        memcpy(&buf[0], input.c_str(), input.size() + 1);
+        if (!parser.Parse(&buf[0]))
+        {
+            fprintf(stderr, "%s: parse error: %s\n", name, parser.ErrorDesc());
+            exit(1);
+        }
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+    printf("%-16s %8d x %8lu bytes in %.3f s: %10.0f docs/s, %7.1f MB/s\n",
+        name, iterations, (unsigned long) input.size(), secs.count(), iterations / secs.count(),
+        (double) iterations * input.size() / secs.count() / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale <= 0)
+    {
+        fprintf(stderr, "usage: json_parser_bench [SCALE]\n");
+        return 2;
+    }
+
+    run("single request", request(2), 2000000 * scale);
+    run("batch of 100", batch(100), 20000 * scale);
+    run("batch of 10000", batch(10000), 200 * scale);
+    run("batch of 100000", batch(100000), 20 * scale);
+
+    return 0;
+}
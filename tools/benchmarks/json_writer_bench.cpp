@@ -0,0 +1,95 @@
+/*
+*  json_writer_bench.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+// Measures how many GuideStep events per second one core can serialize with
+// JsonWriter. The event has the same fields as the one the event server
+// sends for every guide frame.
+
+#include "json_writer.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t guide_step(JsonWriter& w, int frame)
+{
+    w.Reset();
+    w.BeginObject()
+        .Key("Event").String("GuideStep")
+        .Key("Timestamp").Double(1466111230.123 + frame, 3)
+        .Key("Host").String("observatory-pc")
+        .Key("Inst").Int(1)
+        .Key("Frame").Int(frame)
+        .Key("Time").Double(frame * 2.013, 3)
+        .Key("Mount").String(L"EQMOD ASCOM HEQ5/6")
+        .Key("dx").Double(-0.234 + frame * 1e-4, 3)
+        .Key("dy").Double(0.417, 3)
+        .Key("RADistanceRaw").Double(0.381, 3)
+        .Key("DECDistanceRaw").Double(-0.129, 3)
+        .Key("RADistanceGuide").Double(0.3, 3)
+        .Key("DECDistanceGuide").Double(0.0, 3)
+        .Key("RADuration").Int(212)
+        .Key("RADirection").String("West")
+        .Key("StarMass").Double(34567.8, 0)
+        .Key("SNR").Double(41.27, 2)
+        .Key("AvgDist").Double(0.44, 2)
+        .EndObject()
+        .EndLine();
+    return w.Size();
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 2000000;
+    if (count <= 0)
+    {
+        fprintf(stderr, "usage: json_writer_bench [EVENTS]\n");
+        return 2;
+    }
+
+    JsonWriter w;
+    guide_step(w, 0);
+    fwrite(w.Data(), 1, w.Size(), stdout);
+
+    size_t bytes = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        bytes += guide_step(w, i);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+    printf("%d GuideStep events in %.3f s: %.0f events/s, %.1f MB/s\n",
+        count, secs.count(), count / secs.count(), bytes / secs.count() / 1e6);
+
+    return 0;
+}
@@ -0,0 +1,1081 @@
+/*
+*  guide_session.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "guide_session.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+namespace GuideSession
+{
+
+static const char FILE_MAGIC[8] = { 'P', 'H', 'D', '2', 'S', 'E', 'S', 'S' };
+static const char TRAILER_MAGIC[8] = { 'P', 'H', 'D', '2', 'S', 'I', 'D', 'X' };
+
+enum
+{
+    CHUNK_MAGIC = 0x4b4e4843,   // "CHNK"
+    INDEX_MAGIC = 0x58444e49,   // "INDX"
+    FILE_HEADER_SIZE = 16,
+    CHUNK_HEADER_SIZE = 16,
+    INDEX_ENTRY_SIZE = 24,
+    TRAILER_SIZE = 16
+};
+
+// the file is little-endian; values are byte-swapped on big-endian hosts
+static bool HostIsLittleEndian()
+{
+    const unsigned int one = 1;
+    return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+static const bool s_littleEndian = HostIsLittleEndian();
+
+// reverse the bytes of each of n values of the given size
+static void SwapBytes(void *data, size_t size, size_t n)
+{
+    unsigned char *p = static_cast<unsigned char *>(data);
+    for (size_t i = 0; i < n; i++, p += size)
+    {
+        for (size_t a = 0, b = size - 1; a < b; a++, b--)
+        {
+            unsigned char t = p[a];
+            p[a] = p[b];
+            p[b] = t;
+        }
+    }
+}
+
+static void AppendFormat(std::string& out, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return;
+
+    if ((size_t) n < sizeof(buf))
+    {
+        out.append(buf, n);
+        return;
+    }
+
+    std::vector<char> big(n + 1);
+    va_start(ap, fmt);
+    vsnprintf(&big[0], big.size(), fmt, ap);
+    va_end(ap);
+    out.append(&big[0], n);
+}
+
+void FormatStep(std::string& out, const Step& step)
+{
+    AppendFormat(out, "%d,%.3f,\"%s\",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,",
+        step.frameNumber, step.time,
+        step.isAO ? "AO" : "Mount",
+        step.cameraOffsetX, step.cameraOffsetY,
+        step.mountOffsetX, step.mountOffsetY,
+        step.guideDistanceRA, step.guideDistanceDec);
+
+    if (step.isAO)
+    {
+        AppendFormat(out, ",,,,%d,%d,", step.durationRA, step.durationDec);
+    }
+    else
+    {
+        char ra[2] = { step.directionRA, 0 };
+        char dec[2] = { step.directionDec, 0 };
+        AppendFormat(out, "%d,%s,%d,%s,,,", step.durationRA, ra, step.durationDec, dec);
+    }
+
+    AppendFormat(out, "%.f,%.2f,%d\n", step.starMass, step.starSNR, step.starError);
+}
+
+void FormatFrameDropped(std::string& out, const FrameDropped& drop, const char *status)
+{
+    AppendFormat(out, "%d,%.3f,\"DROP\",,,,,,,,,,,,,%.f,%.2f,%d,\"%s\"\n",
+        drop.frameNumber, drop.time, drop.starMass, drop.starSNR, drop.starError, status);
+}
+
+void FormatCalibrationStep(std::string& out, const char *direction, const CalibrationStep& cal)
+{
+    // Direction,Step,dx,dy,x,y,Dist
+    AppendFormat(out, "%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", direction, cal.steps, cal.dx, cal.dy, cal.x, cal.y, cal.dist);
+}
+
+void FormatParam(std::string& out, const char *name, const char *value)
+{
+    AppendFormat(out, "INFO: Guiding parameter change, %s = %s\n", name, value);
+}
+
+//
+// columns
+//
+
+static unsigned int ToMillis(double t)
+{
+    if (!(t > 0.0))
+        return 0;
+    if (t >= 4294967.0)
+        return 0xffffffff;
+    return (unsigned int)(t * 1000.0 + 0.5);
+}
+
+void StringColumn::push_back(const char *s, size_t len)
+{
+    bytes.append(s, len);
+    offsets.push_back((unsigned int) bytes.size());
+}
+
+void TextColumns::clear()
+{
+    seq.clear();
+    text.clear();
+}
+
+void StepColumns::push_back(unsigned int s, const Step& step)
+{
+    seq.push_back(s);
+    frameNumber.push_back(step.frameNumber);
+    time.push_back(ToMillis(step.time));
+    isAO.push_back(step.isAO ? 1 : 0);
+    cameraOffsetX.push_back((float) step.cameraOffsetX);
+    cameraOffsetY.push_back((float) step.cameraOffsetY);
+    mountOffsetX.push_back((float) step.mountOffsetX);
+    mountOffsetY.push_back((float) step.mountOffsetY);
+    guideDistanceRA.push_back((float) step.guideDistanceRA);
+    guideDistanceDec.push_back((float) step.guideDistanceDec);
+    durationRA.push_back(step.durationRA);
+    durationDec.push_back(step.durationDec);
+    directionRA.push_back(step.directionRA);
+    directionDec.push_back(step.directionDec);
+    starMass.push_back((float) step.starMass);
+    starSNR.push_back((float) step.starSNR);
+    starError.push_back((unsigned char) step.starError);
+}
+
+Step StepColumns::operator[](size_t i) const
+{
+    Step step;
+    step.frameNumber = frameNumber[i];
+    step.time = time[i] / 1000.0;
+    step.isAO = isAO[i] != 0;
+    step.cameraOffsetX = cameraOffsetX[i];
+    step.cameraOffsetY = cameraOffsetY[i];
+    step.mountOffsetX = mountOffsetX[i];
+    step.mountOffsetY = mountOffsetY[i];
+    step.guideDistanceRA = guideDistanceRA[i];
+    step.guideDistanceDec = guideDistanceDec[i];
+    step.durationRA = durationRA[i];
+    step.durationDec = durationDec[i];
+    step.directionRA = directionRA[i];
+    step.directionDec = directionDec[i];
+    step.starMass = starMass[i];
+    step.starSNR = starSNR[i];
+    step.starError = starError[i];
+    return step;
+}
+
+void StepColumns::clear()
+{
+    seq.clear();
+    frameNumber.clear();
+    time.clear();
+    isAO.clear();
+    cameraOffsetX.clear();
+    cameraOffsetY.clear();
+    mountOffsetX.clear();
+    mountOffsetY.clear();
+    guideDistanceRA.clear();
+    guideDistanceDec.clear();
+    durationRA.clear();
+    durationDec.clear();
+    directionRA.clear();
+    directionDec.clear();
+    starMass.clear();
+    starSNR.clear();
+    starError.clear();
+}
+
+void FrameDroppedColumns::push_back(unsigned int s, const FrameDropped& drop, const char *st)
+{
+    seq.push_back(s);
+    frameNumber.push_back(drop.frameNumber);
+    time.push_back(ToMillis(drop.time));
+    starMass.push_back((float) drop.starMass);
+    starSNR.push_back((float) drop.starSNR);
+    starError.push_back((unsigned char) drop.starError);
+    status.push_back(st, strlen(st));
+}
+
+FrameDropped FrameDroppedColumns::operator[](size_t i) const
+{
+    FrameDropped drop;
+    drop.frameNumber = frameNumber[i];
+    drop.time = time[i] / 1000.0;
+    drop.starMass = starMass[i];
+    drop.starSNR = starSNR[i];
+    drop.starError = starError[i];
+    return drop;
+}
+
+void FrameDroppedColumns::clear()
+{
+    seq.clear();
+    frameNumber.clear();
+    time.clear();
+    starMass.clear();
+    starSNR.clear();
+    starError.clear();
+    status.clear();
+}
+
+void CalibrationStepColumns::push_back(unsigned int s, const char *dir, const CalibrationStep& cal)
+{
+    seq.push_back(s);
+    direction.push_back(dir, strlen(dir));
+    steps.push_back(cal.steps);
+    dx.push_back((float) cal.dx);
+    dy.push_back((float) cal.dy);
+    x.push_back((float) cal.x);
+    y.push_back((float) cal.y);
+    dist.push_back((float) cal.dist);
+}
+
+CalibrationStep CalibrationStepColumns::operator[](size_t i) const
+{
+    CalibrationStep cal;
+    cal.steps = steps[i];
+    cal.dx = dx[i];
+    cal.dy = dy[i];
+    cal.x = x[i];
+    cal.y = y[i];
+    cal.dist = dist[i];
+    return cal;
+}
+
+void CalibrationStepColumns::clear()
+{
+    seq.clear();
+    direction.clear();
+    steps.clear();
+    dx.clear();
+    dy.clear();
+    x.clear();
+    y.clear();
+    dist.clear();
+}
+
+void ParamColumns::clear()
+{
+    seq.clear();
+    name.clear();
+    value.clear();
+}
+
+//
+// Writer
+//
+
+template <typename T>
+static void PutColumn(std::string& out, const std::vector<T>& v)
+{
+    if (v.empty())
+        return;
+    size_t pos = out.size();
+    out.append(reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(T));
+    if (!s_littleEndian && sizeof(T) > 1)
+        SwapBytes(&out[pos], sizeof(T), v.size());
+}
+
+static void PutStrings(std::string& out, const StringColumn& col)
+{
+    PutColumn(out, col.offsets);
+    out.append(col.bytes);
+}
+
+template <typename T>
+static void PutValue(std::string& out, T val)
+{
+    if (!s_littleEndian)
+        SwapBytes(&val, sizeof(T), 1);
+    out.append(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+Writer::Writer()
+    : m_fp(0),
+    m_seq(0),
+    m_offset(0),
+    m_pos(0),
+    m_tailWritten(false),
+    m_error(false)
+{
+}
+
+Writer::~Writer()
+{
+    End();
+}
+
+bool Writer::Begin(FILE *fp)
+{
+    End();
+
+    m_fp = fp;
+    m_seq = 0;
+    m_offset = FILE_HEADER_SIZE;
+    m_pos = FILE_HEADER_SIZE;
+    m_tailWritten = false;
+    m_error = false;
+    m_index.clear();
+
+    std::string hdr(FILE_MAGIC, sizeof(FILE_MAGIC));
+    PutValue<unsigned int>(hdr, FORMAT_VERSION);
+    PutValue<unsigned int>(hdr, 0);
+
+    m_error = fwrite(hdr.data(), 1, hdr.size(), m_fp) != hdr.size();
+
+    return m_error;
+}
+
+// offsets are tracked rather than asked from the stream so large files work everywhere
+bool Writer::Seek(unsigned long long offset)
+{
+    if (offset == m_pos)
+        return false;
+
+#ifdef _MSC_VER
+    bool err = _fseeki64(m_fp, (__int64) offset, SEEK_SET) != 0;
+#else
+    bool err = fseeko(m_fp, (off_t) offset, SEEK_SET) != 0;
+#endif
+
+    if (err)
+        m_error = true;
+    else
+        m_pos = offset;
+
+    return err;
+}
+
+// write m_chunk at the current position; returns the bytes written
+size_t Writer::WriteChunk(ChunkType type, unsigned int count)
+{
+    std::string hdr;
+    PutValue<unsigned int>(hdr, CHUNK_MAGIC);
+    PutValue<unsigned short>(hdr, (unsigned short) type);
+    PutValue<unsigned short>(hdr, 0);
+    PutValue<unsigned int>(hdr, count);
+    PutValue<unsigned int>(hdr, (unsigned int) m_chunk.size());
+
+    if (fwrite(hdr.data(), 1, hdr.size(), m_fp) != hdr.size() ||
+        fwrite(m_chunk.data(), 1, m_chunk.size(), m_fp) != m_chunk.size())
+    {
+        m_error = true;
+    }
+
+    size_t size = hdr.size() + m_chunk.size();
+    m_pos += size;
+    m_chunk.clear();
+
+    return size;
+}
+
+// write m_chunk as a full chunk, over any partial chunks
+void Writer::Commit(ChunkType type, unsigned int count, const std::vector<unsigned int>& seq)
+{
+    Seek(m_offset);
+
+    IndexEntry entry;
+    entry.offset = m_offset;
+    entry.type = type;
+    entry.count = count;
+    entry.firstSeq = seq.front();
+    entry.lastSeq = seq.back();
+    m_index.push_back(entry);
+
+    m_offset += WriteChunk(type, count);
+}
+
+void Writer::PutText()
+{
+    PutColumn(m_chunk, m_text.seq);
+    PutStrings(m_chunk, m_text.text);
+}
+
+void Writer::PutSteps()
+{
+    PutColumn(m_chunk, m_steps.seq);
+    PutColumn(m_chunk, m_steps.frameNumber);
+    PutColumn(m_chunk, m_steps.time);
+    PutColumn(m_chunk, m_steps.isAO);
+    PutColumn(m_chunk, m_steps.cameraOffsetX);
+    PutColumn(m_chunk, m_steps.cameraOffsetY);
+    PutColumn(m_chunk, m_steps.mountOffsetX);
+    PutColumn(m_chunk, m_steps.mountOffsetY);
+    PutColumn(m_chunk, m_steps.guideDistanceRA);
+    PutColumn(m_chunk, m_steps.guideDistanceDec);
+    PutColumn(m_chunk, m_steps.durationRA);
+    PutColumn(m_chunk, m_steps.durationDec);
+    PutColumn(m_chunk, m_steps.directionRA);
+    PutColumn(m_chunk, m_steps.directionDec);
+    PutColumn(m_chunk, m_steps.starMass);
+    PutColumn(m_chunk, m_steps.starSNR);
+    PutColumn(m_chunk, m_steps.starError);
+}
+
+void Writer::PutDrops()
+{
+    PutColumn(m_chunk, m_drops.seq);
+    PutColumn(m_chunk, m_drops.frameNumber);
+    PutColumn(m_chunk, m_drops.time);
+    PutColumn(m_chunk, m_drops.starMass);
+    PutColumn(m_chunk, m_drops.starSNR);
+    PutColumn(m_chunk, m_drops.starError);
+    PutStrings(m_chunk, m_drops.status);
+}
+
+void Writer::PutCal()
+{
+    PutColumn(m_chunk, m_cal.seq);
+    PutStrings(m_chunk, m_cal.direction);
+    PutColumn(m_chunk, m_cal.steps);
+    PutColumn(m_chunk, m_cal.dx);
+    PutColumn(m_chunk, m_cal.dy);
+    PutColumn(m_chunk, m_cal.x);
+    PutColumn(m_chunk, m_cal.y);
+    PutColumn(m_chunk, m_cal.dist);
+}
+
+void Writer::PutParams()
+{
+    PutColumn(m_chunk, m_params.seq);
+    PutStrings(m_chunk, m_params.name);
+    PutStrings(m_chunk, m_params.value);
+}
+
+void Writer::CommitText()
+{
+    if (m_text.seq.empty())
+        return;
+
+    PutText();
+    Commit(CHUNK_TEXT, (unsigned int) m_text.seq.size(), m_text.seq);
+    m_text.clear();
+}
+
+void Writer::CommitSteps()
+{
+    if (m_steps.seq.empty())
+        return;
+
+    PutSteps();
+    Commit(CHUNK_GUIDE_STEP, (unsigned int) m_steps.size(), m_steps.seq);
+    m_steps.clear();
+}
+
+void Writer::CommitDrops()
+{
+    if (m_drops.seq.empty())
+        return;
+
+    PutDrops();
+    Commit(CHUNK_FRAME_DROPPED, (unsigned int) m_drops.size(), m_drops.seq);
+    m_drops.clear();
+}
+
+void Writer::CommitCal()
+{
+    if (m_cal.seq.empty())
+        return;
+
+    PutCal();
+    Commit(CHUNK_CALIBRATION_STEP, (unsigned int) m_cal.size(), m_cal.seq);
+    m_cal.clear();
+}
+
+void Writer::CommitParams()
+{
+    if (m_params.seq.empty())
+        return;
+
+    PutParams();
+    Commit(CHUNK_PARAM, (unsigned int) m_params.size(), m_params.seq);
+    m_params.clear();
+}
+
+// Write the partially filled chunks after the full ones, where the reader
+// finds them when scanning a file without an index. Records are only ever
+// added, so the new tail is never shorter than the one it overwrites.
+void Writer::WriteTail()
+{
+    Seek(m_offset);
+
+    if (!m_text.seq.empty())
+    {
+        PutText();
+        WriteChunk(CHUNK_TEXT, (unsigned int) m_text.seq.size());
+    }
+    if (!m_steps.seq.empty())
+    {
+        PutSteps();
+        WriteChunk(CHUNK_GUIDE_STEP, (unsigned int) m_steps.size());
+    }
+    if (!m_drops.seq.empty())
+    {
+        PutDrops();
+        WriteChunk(CHUNK_FRAME_DROPPED, (unsigned int) m_drops.size());
+    }
+    if (!m_cal.seq.empty())
+    {
+        PutCal();
+        WriteChunk(CHUNK_CALIBRATION_STEP, (unsigned int) m_cal.size());
+    }
+    if (!m_params.seq.empty())
+    {
+        PutParams();
+        WriteChunk(CHUNK_PARAM, (unsigned int) m_params.size());
+    }
+
+    m_tailWritten = true;
+}
+
+void Writer::AddText(const char *text, size_t len)
+{
+    if (!m_fp)
+        return;
+    m_text.seq.push_back(m_seq++);
+    m_text.text.push_back(text, len);
+    if (m_text.seq.size() >= CHUNK_RECORDS)
+    {
+        CommitText();
+        if (m_tailWritten)
+            WriteTail();
+    }
+}
+
+void Writer::AddStep(const Step& step)
+{
+    if (!m_fp)
+        return;
+    m_steps.push_back(m_seq++, step);
+    if (m_steps.size() >= CHUNK_RECORDS)
+    {
+        CommitSteps();
+        if (m_tailWritten)
+            WriteTail();
+    }
+}
+
+void Writer::AddFrameDropped(const FrameDropped& drop, const char *status)
+{
+    if (!m_fp)
+        return;
+    m_drops.push_back(m_seq++, drop, status);
+    if (m_drops.size() >= CHUNK_RECORDS)
+    {
+        CommitDrops();
+        if (m_tailWritten)
+            WriteTail();
+    }
+}
+
+void Writer::AddCalibrationStep(const char *direction, const CalibrationStep& cal)
+{
+    if (!m_fp)
+        return;
+    m_cal.push_back(m_seq++, direction, cal);
+    if (m_cal.size() >= CHUNK_RECORDS)
+    {
+        CommitCal();
+        if (m_tailWritten)
+            WriteTail();
+    }
+}
+
+void Writer::AddParam(const char *name, const char *value)
+{
+    if (!m_fp)
+        return;
+    m_params.seq.push_back(m_seq++);
+    m_params.name.push_back(name, strlen(name));
+    m_params.value.push_back(value, strlen(value));
+    if (m_params.size() >= CHUNK_RECORDS)
+    {
+        CommitParams();
+        if (m_tailWritten)
+            WriteTail();
+    }
+}
+
+bool Writer::Flush()
+{
+    if (!m_fp)
+        return false;
+
+    WriteTail();
+
+    if (fflush(m_fp) != 0)
+        m_error = true;
+
+    return m_error;
+}
+
+bool Writer::End()
+{
+    if (!m_fp)
+        return false;
+
+    // the pending records become full chunks, in the place of the tail
+    CommitText();
+    CommitSteps();
+    CommitDrops();
+    CommitCal();
+    CommitParams();
+
+    Seek(m_offset);
+
+    std::string idx;
+    PutValue<unsigned int>(idx, INDEX_MAGIC);
+    PutValue<unsigned int>(idx, (unsigned int) m_index.size());
+    for (size_t i = 0; i < m_index.size(); i++)
+    {
+        PutValue<unsigned long long>(idx, m_index[i].offset);
+        PutValue<unsigned int>(idx, m_index[i].type);
+        PutValue<unsigned int>(idx, m_index[i].count);
+        PutValue<unsigned int>(idx, m_index[i].firstSeq);
+        PutValue<unsigned int>(idx, m_index[i].lastSeq);
+    }
+    PutValue<unsigned long long>(idx, m_offset);
+    idx.append(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+
+    if (fwrite(idx.data(), 1, idx.size(), m_fp) != idx.size() || fflush(m_fp) != 0)
+        m_error = true;
+
+    m_fp = 0;
+
+    return m_error;
+}
+
+//
+// Reader
+//
+
+namespace
+{
+
+struct Cursor
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    bool fail;
+
+    Cursor(const unsigned char *begin, size_t size) : p(begin), end(begin + size), fail(false) { }
+
+    template <typename T>
+    bool Get(T *val)
+    {
+        if (fail || (size_t)(end - p) < sizeof(T))
+            return !(fail = true);
+        memcpy(val, p, sizeof(T));
+        if (!s_littleEndian)
+            SwapBytes(val, sizeof(T), 1);
+        p += sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    void Read(std::vector<T>& v, size_t n)
+    {
+        if (fail || (size_t)(end - p) / sizeof(T) < n)
+        {
+            fail = true;
+            return;
+        }
+        size_t old = v.size();
+        v.resize(old + n);
+        if (n)
+        {
+            memcpy(&v[old], p, n * sizeof(T));
+            if (!s_littleEndian && sizeof(T) > 1)
+                SwapBytes(&v[old], sizeof(T), n);
+        }
+        p += n * sizeof(T);
+    }
+
+    void ReadStrings(StringColumn& col, size_t n)
+    {
+        std::vector<unsigned int> offs;
+        Read(offs, n + 1);
+        if (fail)
+            return;
+        unsigned int total = offs[n];
+        if (offs[0] != 0 || (size_t)(end - p) < total)
+        {
+            fail = true;
+            return;
+        }
+        unsigned int base = (unsigned int) col.bytes.size();
+        for (size_t i = 1; i <= n; i++)
+        {
+            if (offs[i] < offs[i - 1] || offs[i] > total)
+            {
+                fail = true;
+                return;
+            }
+            col.offsets.push_back(base + offs[i]);
+        }
+        col.bytes.append(reinterpret_cast<const char *>(p), total);
+        p += total;
+    }
+};
+
+template <typename T>
+void Append(std::vector<T>& dst, const std::vector<T>& src)
+{
+    dst.insert(dst.end(), src.begin(), src.end());
+}
+
+void Append(StringColumn& dst, const StringColumn& src)
+{
+    unsigned int base = (unsigned int) dst.bytes.size();
+    for (size_t i = 1; i < src.offsets.size(); i++)
+        dst.offsets.push_back(base + src.offsets[i]);
+    dst.bytes.append(src.bytes);
+}
+
+} // namespace
+
+// A chunk is parsed into a fresh set of columns, which is appended to the
+// loaded ones only if the whole chunk is good, so a truncated or damaged
+// chunk cannot leave the columns with different lengths.
+bool Reader::LoadChunk(const unsigned char *p, size_t avail, size_t *chunkSize)
+{
+    Cursor hdr(p, avail);
+    unsigned int magic, count, size;
+    unsigned short type, reserved;
+
+    if (!hdr.Get(&magic) || magic != CHUNK_MAGIC || !hdr.Get(&type) || !hdr.Get(&reserved) ||
+        !hdr.Get(&count) || !hdr.Get(&size) || (size_t)(hdr.end - hdr.p) < size)
+    {
+        return true;
+    }
+
+    *chunkSize = CHUNK_HEADER_SIZE + size;
+
+    Cursor c(hdr.p, size);
+
+    switch (type)
+    {
+    case CHUNK_TEXT:
+    {
+        TextColumns t;
+        c.Read(t.seq, count);
+        c.ReadStrings(t.text, count);
+        if (c.fail)
+            break;
+        Append(text.seq, t.seq);
+        Append(text.text, t.text);
+        break;
+    }
+
+    case CHUNK_GUIDE_STEP:
+    {
+        StepColumns t;
+        c.Read(t.seq, count);
+        c.Read(t.frameNumber, count);
+        c.Read(t.time, count);
+        c.Read(t.isAO, count);
+        c.Read(t.cameraOffsetX, count);
+        c.Read(t.cameraOffsetY, count);
+        c.Read(t.mountOffsetX, count);
+        c.Read(t.mountOffsetY, count);
+        c.Read(t.guideDistanceRA, count);
+        c.Read(t.guideDistanceDec, count);
+        c.Read(t.durationRA, count);
+        c.Read(t.durationDec, count);
+        c.Read(t.directionRA, count);
+        c.Read(t.directionDec, count);
+        c.Read(t.starMass, count);
+        c.Read(t.starSNR, count);
+        c.Read(t.starError, count);
+        if (c.fail)
+            break;
+        Append(steps.seq, t.seq);
+        Append(steps.frameNumber, t.frameNumber);
+        Append(steps.time, t.time);
+        Append(steps.isAO, t.isAO);
+        Append(steps.cameraOffsetX, t.cameraOffsetX);
+        Append(steps.cameraOffsetY, t.cameraOffsetY);
+        Append(steps.mountOffsetX, t.mountOffsetX);
+        Append(steps.mountOffsetY, t.mountOffsetY);
+        Append(steps.guideDistanceRA, t.guideDistanceRA);
+        Append(steps.guideDistanceDec, t.guideDistanceDec);
+        Append(steps.durationRA, t.durationRA);
+        Append(steps.durationDec, t.durationDec);
+        Append(steps.directionRA, t.directionRA);
+        Append(steps.directionDec, t.directionDec);
+        Append(steps.starMass, t.starMass);
+        Append(steps.starSNR, t.starSNR);
+        Append(steps.starError, t.starError);
+        break;
+    }
+
+    case CHUNK_FRAME_DROPPED:
+    {
+        FrameDroppedColumns t;
+        c.Read(t.seq, count);
+        c.Read(t.frameNumber, count);
+        c.Read(t.time, count);
+        c.Read(t.starMass, count);
+        c.Read(t.starSNR, count);
+        c.Read(t.starError, count);
+        c.ReadStrings(t.status, count);
+        if (c.fail)
+            break;
+        Append(drops.seq, t.seq);
+        Append(drops.frameNumber, t.frameNumber);
+        Append(drops.time, t.time);
+        Append(drops.starMass, t.starMass);
+        Append(drops.starSNR, t.starSNR);
+        Append(drops.starError, t.starError);
+        Append(drops.status, t.status);
+        break;
+    }
+
+    case CHUNK_CALIBRATION_STEP:
+    {
+        CalibrationStepColumns t;
+        c.Read(t.seq, count);
+        c.ReadStrings(t.direction, count);
+        c.Read(t.steps, count);
+        c.Read(t.dx, count);
+        c.Read(t.dy, count);
+        c.Read(t.x, count);
+        c.Read(t.y, count);
+        c.Read(t.dist, count);
+        if (c.fail)
+            break;
+        Append(cal.seq, t.seq);
+        Append(cal.direction, t.direction);
+        Append(cal.steps, t.steps);
+        Append(cal.dx, t.dx);
+        Append(cal.dy, t.dy);
+        Append(cal.x, t.x);
+        Append(cal.y, t.y);
+        Append(cal.dist, t.dist);
+        break;
+    }
+
+    case CHUNK_PARAM:
+    {
+        ParamColumns t;
+        c.Read(t.seq, count);
+        c.ReadStrings(t.name, count);
+        c.ReadStrings(t.value, count);
+        if (c.fail)
+            break;
+        Append(params.seq, t.seq);
+        Append(params.name, t.name);
+        Append(params.value, t.value);
+        break;
+    }
+
+    default:
+        // unknown chunk types from newer versions are skipped
+        break;
+    }
+
+    return c.fail;
+}
+
+bool Reader::Load(const void *data, size_t size)
+{
+    const unsigned char *base = static_cast<const unsigned char *>(data);
+
+    text.clear();
+    steps.clear();
+    drops.clear();
+    cal.clear();
+    params.clear();
+
+    if (size < FILE_HEADER_SIZE || memcmp(base, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+        return true;
+
+    unsigned int version;
+    Cursor hdr(base + sizeof(FILE_MAGIC), sizeof(version));
+    if (!hdr.Get(&version) || version != FORMAT_VERSION)
+        return true;
+
+    // use the index if the session was closed properly
+    if (size >= FILE_HEADER_SIZE + TRAILER_SIZE &&
+        memcmp(base + size - sizeof(TRAILER_MAGIC), TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) == 0)
+    {
+        unsigned long long indexOffset;
+        Cursor trailer(base + size - TRAILER_SIZE, sizeof(indexOffset));
+        trailer.Get(&indexOffset);
+
+        if (indexOffset < size - TRAILER_SIZE)
+        {
+            Cursor idx(base + indexOffset, (size_t)(size - TRAILER_SIZE - indexOffset));
+            unsigned int magic, nchunks;
+
+            if (idx.Get(&magic) && magic == INDEX_MAGIC && idx.Get(&nchunks))
+            {
+                bool ok = true;
+                unsigned long long next = FILE_HEADER_SIZE;
+
+                // the chunks must come in file order without overlapping,
+                // so none can be loaded twice
+                for (unsigned int i = 0; i < nchunks && ok; i++)
+                {
+                    unsigned long long offset;
+                    unsigned int type, count, firstSeq, lastSeq;
+                    size_t chunkSize;
+
+                    ok = idx.Get(&offset) && idx.Get(&type) && idx.Get(&count) && idx.Get(&firstSeq) && idx.Get(&lastSeq) &&
+                        offset >= next && offset < indexOffset &&
+                        !LoadChunk(base + offset, (size_t)(indexOffset - offset), &chunkSize);
+                    if (ok)
+                        next = offset + chunkSize;
+                }
+
+                if (ok)
+                    return false;
+            }
+        }
+
+        // damaged index, fall back to scanning
+        text.clear();
+        steps.clear();
+        drops.clear();
+        cal.clear();
+        params.clear();
+    }
+
+    size_t pos = FILE_HEADER_SIZE;
+
+    while (pos + CHUNK_HEADER_SIZE <= size)
+    {
+        size_t chunkSize;
+        if (LoadChunk(base + pos, size - pos, &chunkSize))
+            break; // reached the index or a truncated chunk
+        pos += chunkSize;
+    }
+
+    return false;
+}
+
+bool Reader::Load(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return true;
+
+    std::vector<unsigned char> data;
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+
+    bool err = ferror(fp) != 0;
+    fclose(fp);
+
+    if (err || data.empty())
+        return true;
+
+    return Load(&data[0], data.size());
+}
+
+static bool SeqBefore(unsigned int a, unsigned int b)
+{
+    return (int)(a - b) < 0;
+}
+
+bool Reader::WriteGuideLog(FILE *fp) const
+{
+    enum { SRC_TEXT, SRC_STEP, SRC_DROP, SRC_CAL, SRC_PARAM, NUM_SRC };
+
+    const std::vector<unsigned int> *seqs[NUM_SRC] = { &text.seq, &steps.seq, &drops.seq, &cal.seq, &params.seq };
+    size_t pos[NUM_SRC] = { 0, 0, 0, 0, 0 };
+    std::string out;
+
+    while (true)
+    {
+        int src = -1;
+        for (int i = 0; i < NUM_SRC; i++)
+        {
+            if (pos[i] < seqs[i]->size() && (src < 0 || SeqBefore((*seqs[i])[pos[i]], (*seqs[src])[pos[src]])))
+                src = i;
+        }
+
+        if (src < 0)
+            break;
+
+        size_t i = pos[src]++;
+
+        switch (src)
+        {
+        case SRC_TEXT:
+            out.append(text.text.bytes, text.text.offsets[i], text.text.offsets[i + 1] - text.text.offsets[i]);
+            break;
+        case SRC_STEP:
+            FormatStep(out, steps[i]);
+            break;
+        case SRC_DROP:
+            FormatFrameDropped(out, drops[i], drops.status[i].c_str());
+            break;
+        case SRC_CAL:
+            FormatCalibrationStep(out, cal.direction[i].c_str(), cal[i]);
+            break;
+        case SRC_PARAM:
+            FormatParam(out, params.name[i].c_str(), params.value[i].c_str());
+            break;
+        }
+
+        if (out.size() >= 65536)
+        {
+            if (fwrite(out.data(), 1, out.size(), fp) != out.size())
+                return true;
+            out.clear();
+        }
+    }
+
+    return fwrite(out.data(), 1, out.size(), fp) != out.size();
+}
+
+} // namespace GuideSession
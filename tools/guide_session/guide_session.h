@@ -0,0 +1,296 @@
+/*
+*  guide_session.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef GUIDE_SESSION_INCLUDED
+#define GUIDE_SESSION_INCLUDED
+
+// Binary guide session recording
+//
+// A session file holds the same information as the text guide log, stored
+// as typed, column-oriented chunks so that a whole night can be loaded
+// without parsing text. The file layout is
+//
+//   file header     "PHD2SESS", u32 version, u32 reserved
+//   chunk*          u32 CHUNK_MAGIC, u16 chunk type, u16 reserved,
+//                   u32 record count, u32 payload bytes, payload
+//   index           u32 INDEX_MAGIC, u32 chunk count,
+//                   { u64 offset, u32 type, u32 count, u32 first seq, u32 last seq }*
+//   trailer         u64 index offset, "PHD2SIDX"
+//
+// A chunk payload is one array per column, in the order the columns are
+// declared in the *Columns structs below. String columns are stored as
+// u32 offsets[count + 1] followed by the concatenated bytes. Every record
+// carries a sequence number so records of different types can be merged
+// back into their original order. All values are little-endian; a
+// big-endian host swaps them as it writes and reads.
+//
+// To keep the file small, times are stored as u32 milliseconds, real values
+// as float and star errors as u8, so a reproduced guide log can differ from
+// the original in the last digit of a value.
+//
+// Records that do not yet fill a chunk are written after the last full chunk
+// each time the writer is flushed, and rewritten in place as they grow, so a
+// crash loses at most the records since the last flush. A file without a
+// trailer (e.g. PHD2 crashed) can still be read; the reader then scans the
+// chunks from the start.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace GuideSession
+{
+
+enum
+{
+    FORMAT_VERSION = 2,
+    CHUNK_RECORDS = 1024    // records per chunk
+};
+
+enum ChunkType
+{
+    CHUNK_TEXT = 1,
+    CHUNK_GUIDE_STEP = 2,
+    CHUNK_FRAME_DROPPED = 3,
+    CHUNK_CALIBRATION_STEP = 4,
+    CHUNK_PARAM = 5
+};
+
+struct Step
+{
+    int frameNumber;
+    double time;
+    bool isAO;
+    double cameraOffsetX, cameraOffsetY;
+    double mountOffsetX, mountOffsetY;
+    double guideDistanceRA, guideDistanceDec;
+    int durationRA, durationDec;        // AO: signed step counts
+    char directionRA, directionDec;     // 0 if no pulse
+    double starMass;
+    double starSNR;
+    int starError;
+};
+
+struct FrameDropped
+{
+    int frameNumber;
+    double time;
+    double starMass;
+    double starSNR;
+    int starError;
+};
+
+struct CalibrationStep
+{
+    int steps;
+    double dx, dy;
+    double x, y;
+    double dist;
+};
+
+struct StringColumn
+{
+    std::vector<unsigned int> offsets;  // size() == count + 1
+    std::string bytes;
+
+    StringColumn() : offsets(1, 0) { }
+    size_t size() const { return offsets.size() - 1; }
+    void push_back(const char *s, size_t len);
+    std::string operator[](size_t i) const { return bytes.substr(offsets[i], offsets[i + 1] - offsets[i]); }
+    void clear() { offsets.assign(1, 0); bytes.clear(); }
+};
+
+struct TextColumns
+{
+    std::vector<unsigned int> seq;
+    StringColumn text;
+    void clear();
+};
+
+struct StepColumns
+{
+    std::vector<unsigned int> seq;
+    std::vector<int> frameNumber;
+    std::vector<unsigned int> time;     // milliseconds
+    std::vector<unsigned char> isAO;
+    std::vector<float> cameraOffsetX, cameraOffsetY;
+    std::vector<float> mountOffsetX, mountOffsetY;
+    std::vector<float> guideDistanceRA, guideDistanceDec;
+    std::vector<int> durationRA, durationDec;
+    std::vector<char> directionRA, directionDec;
+    std::vector<float> starMass;
+    std::vector<float> starSNR;
+    std::vector<unsigned char> starError;
+
+    size_t size() const { return seq.size(); }
+    void push_back(unsigned int s, const Step& step);
+    Step operator[](size_t i) const;
+    void clear();
+};
+
+struct FrameDroppedColumns
+{
+    std::vector<unsigned int> seq;
+    std::vector<int> frameNumber;
+    std::vector<unsigned int> time;     // milliseconds
+    std::vector<float> starMass;
+    std::vector<float> starSNR;
+    std::vector<unsigned char> starError;
+    StringColumn status;
+
+    size_t size() const { return seq.size(); }
+    void push_back(unsigned int s, const FrameDropped& drop, const char *status);
+    FrameDropped operator[](size_t i) const;
+    void clear();
+};
+
+struct CalibrationStepColumns
+{
+    std::vector<unsigned int> seq;
+    StringColumn direction;
+    std::vector<int> steps;
+    std::vector<float> dx, dy;
+    std::vector<float> x, y;
+    std::vector<float> dist;
+
+    size_t size() const { return seq.size(); }
+    void push_back(unsigned int s, const char *direction, const CalibrationStep& cal);
+    CalibrationStep operator[](size_t i) const;
+    void clear();
+};
+
+struct ParamColumns
+{
+    std::vector<unsigned int> seq;
+    StringColumn name;
+    StringColumn value;
+
+    size_t size() const { return seq.size(); }
+    void clear();
+};
+
+// the guide log text for each record type; these produce exactly the lines PHD2 writes
+void FormatStep(std::string& out, const Step& step);
+void FormatFrameDropped(std::string& out, const FrameDropped& drop, const char *status);
+void FormatCalibrationStep(std::string& out, const char *direction, const CalibrationStep& cal);
+void FormatParam(std::string& out, const char *name, const char *value);
+
+// Appends records to a session file. Records are collected in memory and a
+// chunk is written when it fills up. Flush() writes the partially filled
+// chunks after the full ones; they are rewritten there until they fill up or
+// the session ends.
+class Writer
+{
+    struct IndexEntry
+    {
+        unsigned long long offset;
+        unsigned int type;
+        unsigned int count;
+        unsigned int firstSeq;
+        unsigned int lastSeq;
+    };
+
+    FILE *m_fp;
+    unsigned int m_seq;
+    unsigned long long m_offset;        // end of the full chunks
+    unsigned long long m_pos;           // stream position
+    bool m_tailWritten;                 // partial chunks follow m_offset
+    TextColumns m_text;
+    StepColumns m_steps;
+    FrameDroppedColumns m_drops;
+    CalibrationStepColumns m_cal;
+    ParamColumns m_params;
+    std::vector<IndexEntry> m_index;
+    std::string m_chunk;
+    bool m_error;
+
+    bool Seek(unsigned long long offset);
+    size_t WriteChunk(ChunkType type, unsigned int count);
+    void Commit(ChunkType type, unsigned int count, const std::vector<unsigned int>& seq);
+    void PutText();
+    void PutSteps();
+    void PutDrops();
+    void PutCal();
+    void PutParams();
+    void CommitText();
+    void CommitSteps();
+    void CommitDrops();
+    void CommitCal();
+    void CommitParams();
+    void WriteTail();
+
+public:
+    Writer();
+    ~Writer();
+
+    // start a session in an open file; the file is not closed by the writer
+    bool Begin(FILE *fp);
+    // write any pending records plus the index; returns true on error
+    bool End();
+    bool IsActive() const { return m_fp != 0; }
+
+    void AddText(const char *text, size_t len);
+    void AddStep(const Step& step);
+    void AddFrameDropped(const FrameDropped& drop, const char *status);
+    void AddCalibrationStep(const char *direction, const CalibrationStep& cal);
+    void AddParam(const char *name, const char *value);
+
+    // write the partially filled chunks after the full ones; returns true on error
+    bool Flush();
+};
+
+// Loads a whole session file into columns.
+class Reader
+{
+public:
+    TextColumns text;
+    StepColumns steps;
+    FrameDroppedColumns drops;
+    CalibrationStepColumns cal;
+    ParamColumns params;
+
+    // returns true on error
+    bool Load(const char *filename);
+    bool Load(const void *data, size_t size);
+
+    // reproduce the text guide log; returns true on error
+    bool WriteGuideLog(FILE *fp) const;
+
+private:
+    bool LoadChunk(const unsigned char *p, size_t avail, size_t *chunkSize);
+};
+
+} // namespace GuideSession
+
+#endif
@@ -0,0 +1,80 @@
+/*
+*  session2csv.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+// Converts a binary guide session (.phds) recorded by PHD2 into the text
+// guide log that PHD2 would have written for the same session.
+
+#include "guide_session.h"
+
+#include <stdio.h>
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: phd2_session2csv SESSION_FILE [OUTPUT_FILE]\n");
+        return 2;
+    }
+
+    GuideSession::Reader reader;
+    if (reader.Load(argv[1]))
+    {
+        fprintf(stderr, "could not read session file %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (argc == 3)
+    {
+        out = fopen(argv[2], "w");
+        if (!out)
+        {
+            fprintf(stderr, "could not create %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    bool err = reader.WriteGuideLog(out);
+
+    if (out != stdout)
+        err = fclose(out) != 0 || err;
+
+    if (err)
+    {
+        fprintf(stderr, "error writing guide log\n");
+        return 1;
+    }
+
+    return 0;
+}
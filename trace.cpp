@@ -0,0 +1,298 @@
+/*
+*  trace.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+#ifdef __WINDOWS__
+# include <wx/msw/wrapwin.h>
+#else
+# include <pthread.h>
+#endif
+
+TraceRecorder Tracer;
+
+// Each thread's slot lives in thread-local storage with a destructor so the
+// slot goes back to the table when the thread exits; wxTLS has no exit hook.
+#ifdef __WINDOWS__
+
+static DWORD s_tlsKey = FLS_OUT_OF_INDEXES;
+
+static void WINAPI release_thread_buf(void *buf)
+{
+    if (buf)
+        Tracer.ReleaseThreadBuf(buf);
+}
+
+static bool tls_init()
+{
+    s_tlsKey = FlsAlloc(release_thread_buf);
+    return s_tlsKey != FLS_OUT_OF_INDEXES;
+}
+
+static void tls_free()
+{
+    FlsFree(s_tlsKey);
+}
+
+static void *get_thread_buf()
+{
+    return FlsGetValue(s_tlsKey);
+}
+
+static void set_thread_buf(void *buf)
+{
+    FlsSetValue(s_tlsKey, buf);
+}
+
+#else
+
+static pthread_key_t s_tlsKey;
+
+static void release_thread_buf(void *buf)
+{
+    Tracer.ReleaseThreadBuf(buf);
+}
+
+static bool tls_init()
+{
+    return pthread_key_create(&s_tlsKey, release_thread_buf) == 0;
+}
+
+static void tls_free()
+{
+    pthread_key_delete(s_tlsKey);
+}
+
+static void *get_thread_buf()
+{
+    return pthread_getspecific(s_tlsKey);
+}
+
+static void set_thread_buf(void *buf)
+{
+    pthread_setspecific(s_tlsKey, buf);
+}
+
+#endif
+
+static bool s_tlsOk;
+
+TraceRecorder::TraceRecorder()
+    : m_threadSeq(0), m_sessionStart(0)
+{
+    m_enabled.store(false);
+    m_dropped.store(0);
+    for (unsigned int i = 0; i < MAX_THREADS; i++)
+    {
+        m_threads[i].count.store(0);
+        m_threads[i].events = 0;
+        m_threads[i].base = 0;
+        m_threads[i].state = SLOT_FREE;
+        m_threads[i].name[0] = 0;
+    }
+    s_tlsOk = tls_init();
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    if (s_tlsOk)
+    {
+        s_tlsOk = false;
+        tls_free();
+    }
+    for (unsigned int i = 0; i < MAX_THREADS; i++)
+        delete[] m_threads[i].events;
+}
+
+// first span on this thread, give it a free slot from the table
+TraceRecorder::ThreadBuf *TraceRecorder::ClaimThreadBuf()
+{
+    if (!s_tlsOk)
+        return 0;
+
+    wxCriticalSectionLocker lck(m_claimLock);
+
+    unsigned int i;
+    for (i = 0; i < MAX_THREADS; i++)
+        if (m_threads[i].state == SLOT_FREE)
+            break;
+    if (i == MAX_THREADS)
+        return 0;
+
+    // the previous owner, if any, has exited, so nothing else writes the slot
+    ThreadBuf *buf = &m_threads[i];
+    if (!buf->events)
+        buf->events = new Event[CAPACITY];
+    buf->count.store(0, std::memory_order_relaxed);
+    buf->base = 0;
+    buf->state = SLOT_ACTIVE;
+    if (wxThread::IsMain())
+        strcpy(buf->name, "main");
+    else
+        sprintf(buf->name, "thread %u", m_threadSeq);
+    ++m_threadSeq;
+
+    set_thread_buf(buf);
+
+    return buf;
+}
+
+void TraceRecorder::ReleaseThreadBuf(void *p)
+{
+    ThreadBuf *buf = static_cast<ThreadBuf *>(p);
+
+    wxCriticalSectionLocker lck(m_claimLock);
+    if (buf->state == SLOT_ACTIVE)
+        buf->state = SLOT_EXITED;
+}
+
+void TraceRecorder::Record(const char *name, long long startUs, long long endUs)
+{
+    ThreadBuf *buf = s_tlsOk ? static_cast<ThreadBuf *>(get_thread_buf()) : 0;
+    if (!buf && (buf = ClaimThreadBuf()) == 0)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    unsigned int count = buf->count.load(std::memory_order_relaxed);
+    Event& ev = buf->events[count % CAPACITY];
+    ev.name = name;
+    ev.startUs = startUs;
+    ev.durUs = endUs - startUs;
+    buf->count.store(count + 1, std::memory_order_release);
+}
+
+void TraceRecorder::Start()
+{
+    if (Enabled())
+        return;
+
+    {
+        // the owning threads may be recording while we do this, so rather
+        // than clearing their counts note where the new session begins
+        wxCriticalSectionLocker lck(m_claimLock);
+
+        for (unsigned int i = 0; i < MAX_THREADS; i++)
+        {
+            ThreadBuf& buf = m_threads[i];
+            if (buf.state == SLOT_EXITED)
+                buf.state = SLOT_FREE;
+            buf.base = buf.count.load(std::memory_order_acquire);
+        }
+
+        m_dropped.store(0);
+        m_sessionStart = Now();
+    }
+
+    m_enabled.store(true);
+
+    Debug.AddLine("pipeline tracing started");
+}
+
+bool TraceRecorder::Stop(wxString *filename)
+{
+    if (!Enabled())
+        return true;
+
+    m_enabled.store(false);
+
+    // a span that was open when tracing stopped may still land in its
+    // buffer while we copy it out; at worst that span is dropped or torn
+    JsonWriter w;
+    w.BeginObject().Key("traceEvents").BeginArray();
+
+    unsigned int total = 0;
+    unsigned int dropped;
+    {
+        wxCriticalSectionLocker lck(m_claimLock);
+
+        for (unsigned int i = 0; i < MAX_THREADS; i++)
+        {
+            const ThreadBuf& buf = m_threads[i];
+            if (buf.state == SLOT_FREE)
+                continue;
+
+            w.BeginObject()
+                .Key("name").String("thread_name")
+                .Key("ph").String("M")
+                .Key("pid").Int(1)
+                .Key("tid").Int(i)
+                .Key("args").BeginObject().Key("name").String(buf.name).EndObject()
+                .EndObject();
+
+            unsigned int count = buf.count.load(std::memory_order_acquire);
+            unsigned int first = count - buf.base > CAPACITY ? count - CAPACITY : buf.base;
+            for (unsigned int j = first; j < count; j++)
+            {
+                const Event& ev = buf.events[j % CAPACITY];
+                // skip spans that were opened during an earlier session
+                if (ev.startUs < m_sessionStart)
+                    continue;
+                w.BeginObject()
+                    .Key("name").String(ev.name)
+                    .Key("ph").String("X")
+                    .Key("pid").Int(1)
+                    .Key("tid").Int(i)
+                    .Key("ts").Double((double) ev.startUs, 0)
+                    .Key("dur").Double((double) ev.durUs, 0)
+                    .EndObject();
+                ++total;
+            }
+        }
+
+        dropped = m_dropped.load();
+    }
+
+    w.EndArray()
+        .Key("displayTimeUnit").String("ms")
+        .Key("otherData").BeginObject().Key("droppedSpans").Int((int) dropped).EndObject()
+        .EndObject();
+
+    wxDateTime now = wxDateTime::Now();
+    *filename = Debug.GetLogDir() + PATHSEPSTR + "PHD2_Trace" + now.Format(_T("_%Y-%m-%d")) +
+        now.Format(_T("_%H%M%S")) + ".json";
+
+    wxFFile file(*filename, "wb");
+    if (!file.IsOpened() || file.Write(w.Data(), w.Size()) != w.Size())
+    {
+        Debug.Write(wxString::Format("pipeline tracing stopped, could not write %s\n", *filename));
+        return true;
+    }
+
+    Debug.Write(wxString::Format("pipeline tracing stopped, %u spans written to %s, %u dropped (no free thread slot)\n",
+        total, *filename, dropped));
+
+    return false;
+}
@@ -0,0 +1,121 @@
+/*
+*  trace.h
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+
+#include <atomic>
+
+// Records timed spans into per-thread ring buffers and writes them out in
+// the Chrome trace-event format, which chrome://tracing and Perfetto load.
+// When tracing is off a span costs one relaxed atomic load.
+class TraceRecorder
+{
+public:
+    enum
+    {
+        MAX_THREADS = 32,
+        CAPACITY = 16384        // spans kept per thread
+    };
+
+private:
+    struct Event
+    {
+        const char *name;
+        long long startUs;
+        long long durUs;
+    };
+
+    enum SlotState
+    {
+        SLOT_FREE,
+        SLOT_ACTIVE,            // owned by a running thread
+        SLOT_EXITED,            // owner exited, spans kept until the next Start()
+    };
+
+    // events and count are written only by the owning thread; count is the
+    // total number of spans recorded, so the ring holds the last
+    // min(count, CAPACITY) of them. The other fields are guarded by m_claimLock.
+    struct ThreadBuf
+    {
+        std::atomic<unsigned int> count;
+        Event *events;
+        unsigned int base;      // count when the current session started
+        SlotState state;
+        char name[32];
+    };
+
+    std::atomic<bool> m_enabled;
+    std::atomic<unsigned int> m_dropped;    // spans lost because every slot was taken
+    ThreadBuf m_threads[MAX_THREADS];
+    unsigned int m_threadSeq;
+    long long m_sessionStart;
+    wxCriticalSection m_claimLock;
+    wxStopWatch m_clock;
+
+    ThreadBuf *ClaimThreadBuf();
+
+public:
+    TraceRecorder();
+    ~TraceRecorder();
+
+    bool Enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    long long Now() const { return m_clock.TimeInMicro().GetValue(); }
+
+    void Record(const char *name, long long startUs, long long endUs);
+
+    // called on thread exit to hand the thread's slot back
+    void ReleaseThreadBuf(void *buf);
+
+    // discard previously recorded spans and start recording
+    void Start();
+    // stop recording and write the spans to a file in the log directory;
+    // returns true on error
+    bool Stop(wxString *filename);
+};
+
+extern TraceRecorder Tracer;
+
+// records the lifetime of the object as a span; name must be a string literal
+class TraceSpan
+{
+    const char *m_name;
+    long long m_start;
+
+public:
+    TraceSpan(const char *name) : m_name(name), m_start(Tracer.Enabled() ? Tracer.Now() : -1) { }
+    ~TraceSpan() { if (m_start >= 0) Tracer.Record(m_name, m_start, Tracer.Now()); }
+};
+
+#endif
@@ -35,48 +35,278 @@
 #include "phd.h"
 #include "image_math.h"
 
-bool usImage::Init(const wxSize& size)
+#include <algorithm>
+#include <vector>
+
+// Pixel buffers of released images are kept for reuse. A new image is
+// created for every exposure and the previous one is freed when the new one
+// is displayed, so with the pool the camera driver is handed a recycled
+// buffer of the right size instead of a fresh multi-megabyte allocation.
+// Buffers are sized in 16-bit words; the buffer of an 8-bit image holds two
+// pixels per word.
+class PixelBufferPool
 {
-    // Allocates space for image and sets params up
-    // returns true on error
-
-    int prev = NPixels;
-    NPixels = size.GetWidth() * size.GetHeight();
-    Size = size;
-    Subframe = wxRect(0, 0, 0, 0);
-    Min = Max = 0;
+    enum { MAX_BUFFERS = 4 };
 
-    if (NPixels != prev)
+    struct Entry
     {
-        delete[] ImageData;
+        unsigned short *data;
+        int npixels;
+    };
+
+    wxCriticalSection m_lock;
+    Entry m_free[MAX_BUFFERS];
+    unsigned int m_count;
+    unsigned int m_hits;
+    unsigned int m_misses;
+
+public:
+    PixelBufferPool() : m_count(0), m_hits(0), m_misses(0) { }
+    unsigned short *Get(int npixels);
+    void Put(unsigned short *data, int npixels);
+    void GetStats(unsigned int *hits, unsigned int *misses);
+};
+
+// The pool is never destroyed: images owned by globals in other files, like
+// the ones ImageLog holds, are freed at exit in no particular order relative
+// to this file's statics.
+static PixelBufferPool& PixelPool()
+{
+    static PixelBufferPool *s_pool = new PixelBufferPool();
+    return *s_pool;
+}
+
+// create the pool during static initialization, before any threads start
+static PixelBufferPool& s_initPool = PixelPool();
 
-        if (NPixels)
+unsigned short *PixelBufferPool::Get(int npixels)
+{
+    {
+        wxCriticalSectionLocker lck(m_lock);
+        for (unsigned int i = 0; i < m_count; i++)
         {
-            ImageData = new unsigned short[NPixels];
-            if (!ImageData)
+            if (m_free[i].npixels == npixels)
             {
-                NPixels = 0;
-                return true;
+                unsigned short *data = m_free[i].data;
+                m_free[i] = m_free[--m_count];
+                ++m_hits;
+                return data;
             }
         }
+        ++m_misses;
+    }
+
+    return new unsigned short[npixels];
+}
+
+void PixelBufferPool::Put(unsigned short *data, int npixels)
+{
+    if (!data)
+        return;
+
+    unsigned short *evict = data;
+    {
+        wxCriticalSectionLocker lck(m_lock);
+        if (m_count < MAX_BUFFERS)
+        {
+            m_free[m_count].data = data;
+            m_free[m_count].npixels = npixels;
+            ++m_count;
+            evict = NULL;
+        }
         else
+        {
+            // replace the oldest buffer, the sizes in use may have changed
+            evict = m_free[0].data;
+            for (unsigned int i = 1; i < m_count; i++)
+                m_free[i - 1] = m_free[i];
+            m_free[m_count - 1].data = data;
+            m_free[m_count - 1].npixels = npixels;
+        }
+    }
+
+    delete[] evict;
+}
+
+void PixelBufferPool::GetStats(unsigned int *hits, unsigned int *misses)
+{
+    wxCriticalSectionLocker lck(m_lock);
+    *hits = m_hits;
+    *misses = m_misses;
+}
+
+void usImage::GetBufferPoolStats(unsigned int *hits, unsigned int *misses)
+{
+    PixelPool().GetStats(hits, misses);
+}
+
+inline static int BufferWords(int npixels, bool eightBit)
+{
+    return eightBit ? (npixels + 1) / 2 : npixels;
+}
+
+inline static unsigned short *BufferOf(const usImage& img)
+{
+    return img.ImageData8 ? reinterpret_cast<unsigned short *>(img.ImageData8) : img.ImageData;
+}
+
+usImage::~usImage()
+{
+    PixelPool().Put(BufferOf(*this), BufferWords(NPixels, Is8Bit()));
+}
+
+bool usImage::AllocPixels(int npixels, bool eightBit)
+{
+    // (re)allocates the pixel buffer if the buffer size needed changed
+    // returns true on error
+
+    int prev = BufferWords(NPixels, Is8Bit());
+    int words = BufferWords(npixels, eightBit);
+    unsigned short *buf = BufferOf(*this);
+
+    NPixels = npixels;
+
+    if (words != prev)
+    {
+        PixelPool().Put(buf, prev);
+
+        buf = words ? PixelPool().Get(words) : NULL;
+        if (words && !buf)
+        {
+            NPixels = 0;
             ImageData = NULL;
+            ImageData8 = NULL;
+            return true;
+        }
+    }
+
+    if (eightBit && buf)
+    {
+        ImageData = NULL;
+        ImageData8 = reinterpret_cast<unsigned char *>(buf);
+    }
+    else
+    {
+        ImageData = buf;
+        ImageData8 = NULL;
+    }
+
+    return false;
+}
+
+bool usImage::Init(const wxSize& size, bool eightBit)
+{
+    // Allocates space for image and sets params up
+    // returns true on error
+
+    Size = size;
+    Subframe = wxRect(0, 0, 0, 0);
+    Origin = wxPoint(0, 0);
+    Stride = size.GetWidth();
+    Min = Max = 0;
+
+    return AllocPixels(size.GetWidth() * size.GetHeight(), eightBit);
+}
+
+bool usImage::InitSubframe(const wxSize& fullSize, const wxRect& subframe, bool eightBit)
+{
+    // Allocates space for the subframe pixels only. Size is still the full
+    // frame size; pixels outside the subframe are not stored and are treated
+    // as black when the image is displayed or saved.
+    // returns true on error
+
+    Size = fullSize;
+    Subframe = subframe;
+    Origin = subframe.GetTopLeft();
+    Stride = subframe.GetWidth();
+    Min = Max = 0;
+
+    return AllocPixels(subframe.GetWidth() * subframe.GetHeight(), eightBit);
+}
+
+bool usImage::MakeFullFrame()
+{
+    // Expands a subframe-only image to a full-size buffer for code that needs
+    // one, filling the pixels outside the subframe with black. The subframe
+    // rectangle is retained.
+    // returns true on error
+
+    if (!IsRoiOnly())
+        return false;
+
+    bool const eightBit = Is8Bit();
+    size_t const bpp = eightBit ? 1 : sizeof(unsigned short);
+    int const width = Size.GetWidth();
+    int const npixels = width * Size.GetHeight();
+    unsigned short *full = PixelPool().Get(BufferWords(npixels, eightBit));
+    if (!full)
+        return true;
+
+    unsigned char *dst = reinterpret_cast<unsigned char *>(full);
+    memset(dst, 0, npixels * bpp);
+
+    const wxRect r(DataRect());
+    for (int y = r.GetTop(); y <= r.GetBottom(); y++)
+    {
+        const void *src = eightBit ? (const void *) &Pixel8(r.GetLeft(), y) : (const void *) &Pixel(r.GetLeft(), y);
+        memcpy(dst + (y * width + r.GetLeft()) * bpp, src, r.GetWidth() * bpp);
     }
 
+    PixelPool().Put(BufferOf(*this), BufferWords(NPixels, eightBit));
+    if (eightBit)
+        ImageData8 = dst;
+    else
+        ImageData = full;
+    NPixels = npixels;
+    Origin = wxPoint(0, 0);
+    Stride = width;
+
     return false;
 }
 
 void usImage::SwapImageData(usImage& other)
 {
-    unsigned short *t = ImageData;
-    ImageData = other.ImageData;
-    other.ImageData = t;
+    // the buffer layout goes along with the data
+    std::swap(ImageData, other.ImageData);
+    std::swap(ImageData8, other.ImageData8);
+    std::swap(NPixels, other.NPixels);
+    std::swap(Origin, other.Origin);
+    std::swap(Stride, other.Stride);
 }
 
-void usImage::CalcStats()
+bool usImage::Widen()
 {
-    if (!ImageData || !NPixels)
-        return;
+    // Converts an 8-bit image to 16-bit pixels for code that only handles
+    // 16-bit images, keeping the pixel values and the buffer layout.
+    // returns true on error
+
+    if (!ImageData8)
+        return false;
+
+    unsigned short *wide = PixelPool().Get(NPixels);
+    if (!wide)
+        return true;
+
+    const unsigned char *src = ImageData8;
+    unsigned short *dst = wide;
+    for (int i = 0; i < NPixels; i++)
+        *dst++ = *src++;
+
+    PixelPool().Put(BufferOf(*this), BufferWords(NPixels, true));
+    ImageData8 = NULL;
+    ImageData = wide;
+
+    return false;
+}
+
+template<typename T>
+static void CalcStatsT(usImage& img)
+{
+    const wxRect& Subframe = img.Subframe;
+    int& Min = img.Min;
+    int& Max = img.Max;
+    int& FiltMin = img.FiltMin;
+    int& FiltMax = img.FiltMax;
 
     Min = 65535; Max = 0;
     FiltMin = 65535; FiltMax = 0;
@@ -85,9 +315,10 @@ void usImage::CalcStats()
     {
         // full frame, no subframe
 
-        const unsigned short *src;
+        int const NPixels = img.NPixels;
+        const T *src;
 
-        src = ImageData;
+        src = PixelData<T>(img);
         for (int i = 0; i < NPixels; i++)
         {
             int d = (int) *src++;
@@ -95,9 +326,9 @@ void usImage::CalcStats()
             if (d > Max) Max = d;
         }
 
-        unsigned short *tmpdata = new unsigned short[NPixels];
+        T *tmpdata = new T[NPixels];
 
-        Median3(tmpdata, ImageData, Size, wxRect(Size));
+        Median3(tmpdata, PixelData<T>(img), img.Size, wxRect(img.Size));
 
         src = tmpdata;
         for (int i = 0; i < NPixels; i++)
@@ -114,14 +345,14 @@ void usImage::CalcStats()
         // Subframe
 
         unsigned int pixcnt = Subframe.width * Subframe.height;
-        unsigned short *tmpdata = new unsigned short[pixcnt];
+        T *tmpdata = new T[pixcnt];
 
-        unsigned short *dst;
+        T *dst;
 
         dst = tmpdata;
         for (int y = 0; y < Subframe.height; y++)
         {
-            const unsigned short *src = ImageData + Subframe.x + (Subframe.y + y) * Size.GetWidth();
+            const T *src = PixelPtr<T>(img, Subframe.x, Subframe.y + y);
             for (int x = 0; x < Subframe.width; x++)
             {
                int d = (int) *src;
@@ -131,11 +362,11 @@ void usImage::CalcStats()
             }
         }
 
-        dst = new unsigned short[pixcnt];
+        dst = new T[pixcnt];
 
         Median3(dst, tmpdata, Subframe.GetSize(), wxRect(Subframe.GetSize()));
 
-        const unsigned short *src = dst;
+        const T *src = dst;
         for (unsigned int i = 0; i < pixcnt; i++)
         {
             int d = (int) *src++;
@@ -148,65 +379,113 @@ void usImage::CalcStats()
     }
 }
 
-bool usImage::CopyToImage(wxImage **rawimg, int blevel, int wlevel, double power)
+void usImage::CalcStats()
 {
-    wxImage *img = *rawimg;
+    TraceSpan span("usImage::CalcStats");
 
-    if (!img || !img->Ok() || (img->GetWidth() != Size.GetWidth()) || (img->GetHeight() != Size.GetHeight()) ) // can't reuse bitmap
-    {
-        delete img;
-        img = new wxImage(Size.GetWidth(), Size.GetHeight(), false);
-    }
+    if (!HasPixels() || !NPixels)
+        return;
 
-    unsigned char *ImgPtr = img->GetData();
-    unsigned short *RawPtr = ImageData;
+    if (ImageData8)
+        CalcStatsT<unsigned char>(*this);
+    else
+        CalcStatsT<unsigned short>(*this);
+}
+
+// display stretch of the stored pixels within r into the RGB buffer of a
+// full-size wxImage
+template<typename T>
+static void StretchToImage(const usImage& src, unsigned char *rgb, const wxRect& r, int blevel, int wlevel, double power)
+{
+    int const width = src.Size.GetWidth();
 
     if (power == 1.0 || blevel >= wlevel)
     {
         float range = (float) wxMax(1, wlevel);  // Go 0-max
-        for (int i = 0; i < NPixels; i++, RawPtr++)
+        for (int y = r.GetTop(); y <= r.GetBottom(); y++)
         {
-            float d;
-            if (*RawPtr >= range)
-                d = 255.0;
-            else
-                d = ((float) (*RawPtr) / range) * 255.0;
-
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
+            const T *RawPtr = PixelPtr<T>(src, r.GetLeft(), y);
+            unsigned char *ImgPtr = rgb + 3 * (y * width + r.GetLeft());
+            for (int x = 0; x < r.GetWidth(); x++, RawPtr++)
+            {
+                float d;
+                if (*RawPtr >= range)
+                    d = 255.0;
+                else
+                    d = ((float) (*RawPtr) / range) * 255.0;
+
+                *ImgPtr++ = (unsigned char) d;
+                *ImgPtr++ = (unsigned char) d;
+                *ImgPtr++ = (unsigned char) d;
+            }
         }
     }
     else
     {
         float range = (float) (wlevel - blevel);
-        for (int i = 0; i < NPixels; i++, RawPtr++ )
+        for (int y = r.GetTop(); y <= r.GetBottom(); y++)
         {
-            float d;
-            if (*RawPtr <= blevel)
-                d = 0.0;
-            else if (*RawPtr >= wlevel)
-                d = 255.0;
-            else
+            const T *RawPtr = PixelPtr<T>(src, r.GetLeft(), y);
+            unsigned char *ImgPtr = rgb + 3 * (y * width + r.GetLeft());
+            for (int x = 0; x < r.GetWidth(); x++, RawPtr++)
             {
-                d = ((float) (*RawPtr) - (float) blevel) / range;
-                d = pow(d, (float) power) * 255.0;
+                float d;
+                if (*RawPtr <= blevel)
+                    d = 0.0;
+                else if (*RawPtr >= wlevel)
+                    d = 255.0;
+                else
+                {
+                    d = ((float) (*RawPtr) - (float) blevel) / range;
+                    d = pow(d, (float) power) * 255.0;
+                }
+                *ImgPtr++ = (unsigned char) d;
+                *ImgPtr++ = (unsigned char) d;
+                *ImgPtr++ = (unsigned char) d;
             }
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
-            *ImgPtr++ = (unsigned char) d;
         }
     }
+}
+
+bool usImage::CopyToImage(wxImage **rawimg, int blevel, int wlevel, double power)
+{
+    wxImage *img = *rawimg;
+
+    if (!img || !img->Ok() || (img->GetWidth() != Size.GetWidth()) || (img->GetHeight() != Size.GetHeight()) ) // can't reuse bitmap
+    {
+        delete img;
+        img = new wxImage(Size.GetWidth(), Size.GetHeight(), false);
+    }
+
+    // only the stored pixels are converted; the rest of a subframe-only image is black
+    const wxRect r(DataRect());
+    if (IsRoiOnly())
+        memset(img->GetData(), 0, Size.GetWidth() * Size.GetHeight() * 3);
+
+    if (ImageData8)
+        StretchToImage<unsigned char>(*this, img->GetData(), r, blevel, wlevel, power);
+    else
+        StretchToImage<unsigned short>(*this, img->GetData(), r, blevel, wlevel, power);
 
     *rawimg = img;
     return false;
 }
 
+inline static unsigned int Sum2x2(const usImage& img, int x, int y)
+{
+    if (img.ImageData8)
+    {
+        const unsigned char *p = &img.Pixel8(x, y);
+        return p[0] + p[1] + p[img.Stride] + p[img.Stride + 1];
+    }
+    const unsigned short *p = &img.Pixel(x, y);
+    return p[0] + p[1] + p[img.Stride] + p[img.Stride + 1];
+}
+
 bool usImage::BinnedCopyToImage(wxImage **rawimg, int blevel, int wlevel, double power)
 {
     wxImage *img;
     unsigned char *ImgPtr;
-    unsigned short *RawPtr;
     int x,y;
     float d;
     //, s_factor;
@@ -229,18 +508,30 @@ bool usImage::BinnedCopyToImage(wxImage **rawimg, int blevel, int wlevel, double
         }
         img = new wxImage(full_xsize/2, full_ysize/2, false);
     }
-    ImgPtr = img->GetData();
-    RawPtr = ImageData;
+
+    // only the 2x2 bins lying within the stored pixels are converted; the
+    // rest of a subframe-only image is black
+    const wxRect r(DataRect());
+    int x0 = 0, y0 = 0;
+    int x1 = use_xsize, y1 = use_ysize;
+    if (IsRoiOnly())
+    {
+        memset(img->GetData(), 0, (full_xsize/2) * (full_ysize/2) * 3);
+        x0 = (r.GetLeft() + 1) & ~1;
+        y0 = (r.GetTop() + 1) & ~1;
+        x1 = wxMin(x1, r.GetRight() + 1);
+        y1 = wxMin(y1, r.GetBottom() + 1);
+    }
 //  s_factor = (((float) Max - (float) Min) / 255.0);
     float range = (float) (wlevel - blevel);
 
     if ((power == 1.0) || (range == 0.0)) {
         range = wlevel;  // Go 0-max
         if (range == 0.0) range = 0.001;
-        for (y=0; y<use_ysize; y+=2) {
-            for (x=0; x<use_xsize; x+=2) {
-                RawPtr = ImageData + x + y*full_xsize;
-                d = (float) (*RawPtr + *(RawPtr+1) + *(RawPtr+full_xsize) + *(RawPtr+1+full_xsize)) / 4.0;
+        for (y=y0; y+1<y1; y+=2) {
+            ImgPtr = img->GetData() + 3 * ((y/2)*(full_xsize/2) + x0/2);
+            for (x=x0; x+1<x1; x+=2) {
+                d = (float) Sum2x2(*this, x, y) / 4.0;
                 d = (d / range) * 255.0;
                 if (d < 0.0) d = 0.0;
                 else if (d > 255.0) d = 255.0;
@@ -254,10 +545,10 @@ bool usImage::BinnedCopyToImage(wxImage **rawimg, int blevel, int wlevel, double
         }
     }
     else {
-        for (y=0; y<use_ysize; y+=2) {
-            for (x=0; x<use_xsize; x+=2) {
-                RawPtr = ImageData + x + y*full_xsize;
-                d = (float) (*RawPtr + *(RawPtr+1) + *(RawPtr+full_xsize) + *(RawPtr+1+full_xsize)) / 4.0;
+        for (y=y0; y+1<y1; y+=2) {
+            ImgPtr = img->GetData() + 3 * ((y/2)*(full_xsize/2) + x0/2);
+            for (x=x0; x+1<x1; x+=2) {
+                d = (float) Sum2x2(*this, x, y) / 4.0;
                 d = (d - (float) blevel) / range ;
                 if (d < 0.0) d= 0.0;
                 else if (d > 1.0) d = 1.0;
@@ -347,7 +638,7 @@ bool usImage::Save(const wxString& fname, const wxString& hdrNote) const
         if (pCamera)
         {
             hdr.write("INSTRUME", pCamera->Name.c_str(), "Instrument name");
-            unsigned int b = pCamera->Binning;
+            unsigned int b = pCamera->ImageBinning();
             hdr.write("XBINNING", b, "Camera X Bin");
             hdr.write("YBINNING", b, "Camera Y Bin");
             hdr.write("CCDXBIN", b, "Camera X Bin");
@@ -397,7 +688,27 @@ bool usImage::Save(const wxString& fname, const wxString& hdrNote) const
         hdr.write("PIXSCALE", sc, "Image scale (arcsec / pixel)");
         hdr.write("PEDESTAL", (unsigned int) Pedestal, "dark subtraction bias value");
 
-        fits_write_pix(fptr, TUSHORT, fpixel, NPixels, ImageData, &status);
+        if (IsRoiOnly())
+        {
+            // write the full frame a row at a time, black outside the subframe
+            const wxRect r(DataRect());
+            std::vector<unsigned short> row(Size.GetWidth());
+            for (int y = 0; y < Size.GetHeight() && !status; y++)
+            {
+                std::fill(row.begin(), row.end(), 0);
+                if (y >= r.GetTop() && y <= r.GetBottom())
+                {
+                    for (int x = r.GetLeft(); x <= r.GetRight(); x++)
+                        row[x] = PixelValue(x, y);
+                }
+                fpixel[1] = y + 1;
+                fits_write_pix(fptr, TUSHORT, fpixel, Size.GetWidth(), &row[0], &status);
+            }
+        }
+        else if (ImageData8)
+            fits_write_pix(fptr, TBYTE, fpixel, NPixels, ImageData8, &status);
+        else
+            fits_write_pix(fptr, TUSHORT, fpixel, NPixels, ImageData, &status);
 
         PHD_fits_close_file(fptr);
 
@@ -490,48 +801,18 @@ bool usImage::Load(const wxString& fname)
 
 bool usImage::CopyFrom(const usImage& src)
 {
-    if (Init(src.Size))
+    bool eightBit = src.Is8Bit();
+    if (src.IsRoiOnly() ? InitSubframe(src.Size, src.Subframe, eightBit) : Init(src.Size, eightBit))
         return true;
-    memcpy(ImageData, src.ImageData, NPixels * sizeof(unsigned short));
+    if (eightBit)
+        memcpy(ImageData8, src.ImageData8, NPixels);
+    else
+        memcpy(ImageData, src.ImageData, NPixels * sizeof(unsigned short));
     return false;
 }
 
 bool usImage::Rotate(double theta, bool mirror)
 {
-    wxImage *pImg = 0;
-
-    CalcStats();
-
-    CopyToImage(&pImg, Min, Max, 1.0);
-
-    wxImage mirrored = *pImg;
-
-    if (mirror)
-    {
-        mirrored = pImg->Mirror(false);
-    }
-
-    wxImage rotated = mirrored.Rotate(theta, wxPoint(0,0));
-
-    CopyFromImage(rotated);
-
-    delete pImg;
-
-    return false;
-}
-
-bool usImage::CopyFromImage(const wxImage& img)
-{
-    Init(img.GetSize());
-
-    const unsigned char *pSrc = img.GetData();
-    unsigned short *pDest = ImageData;
-
-    for (int i = 0; i < NPixels; i++)
-    {
-        *pDest++ = ((unsigned short) *pSrc) << 8;
-        pSrc += 3;
-    }
-
-    return false;
+    // resampled natively, keeping the pixel type and full dynamic range
+    return RotateImage(*this, theta, mirror);
 }
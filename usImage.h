@@ -38,10 +38,13 @@
 class usImage
 {
 public:
-    unsigned short      *ImageData;     // Pointer to raw data
+    unsigned short      *ImageData;     // Pointer to raw data (NULL for 8-bit images)
+    unsigned char       *ImageData8;    // Pointer to raw data of 8-bit images, else NULL
     wxSize              Size;               // Dimensions of image
     wxRect              Subframe;       // were the valid data is
-    int                 NPixels;
+    wxPoint             Origin;         // image coordinates of ImageData[0]
+    int                 Stride;         // pixels per row of ImageData
+    int                 NPixels;        // number of pixels stored in ImageData
     int                 Min;
     int                 Max;
     int                 FiltMin, FiltMax;
@@ -54,17 +57,26 @@ public:
     usImage() {
         Min = Max = FiltMin = FiltMax = 0;
         NPixels = 0;
+        Stride = 0;
         ImageData = NULL;
+        ImageData8 = NULL;
         ImgStartTime = 0;
         ImgExpDur = 0;
         ImgStackCnt = 1;
         BitsPerPixel = 0;
         Pedestal = 0;
     }
-    ~usImage() { delete[] ImageData; }
+    ~usImage();
 
-    bool                Init(const wxSize& size);
+    bool                Init(const wxSize& size, bool eightBit = false);
     bool                Init(int width, int height) { return Init(wxSize(width, height)); }
+    bool                InitSubframe(const wxSize& fullSize, const wxRect& subframe, bool eightBit = false);
+    bool                HasPixels() const { return ImageData || ImageData8; }
+    bool                Is8Bit() const { return ImageData8 != NULL; }
+    bool                Widen();
+    bool                IsRoiOnly() const { return NPixels != Size.GetWidth() * Size.GetHeight(); }
+    wxRect              DataRect() const { return wxRect(Origin, wxSize(Stride, Stride ? NPixels / Stride : 0)); }
+    bool                MakeFullFrame();
     void                SwapImageData(usImage& other);
     void                CalcStats();
     void                InitImgStartTime();
@@ -72,18 +84,55 @@ public:
     bool                CopyFrom(const usImage& src);
     bool                CopyToImage(wxImage **img, int blevel, int wlevel, double power);
     bool                BinnedCopyToImage(wxImage **img, int blevel, int wlevel, double power); // Does 2x2 bin during copy
-    bool                CopyFromImage(const wxImage& img);
     bool                Load(const wxString& fname);
     bool                Save(const wxString& fname, const wxString& hdrComment = wxEmptyString) const;
     bool                Rotate(double theta, bool mirror=false);
-    unsigned short&     Pixel(int x, int y) { return ImageData[y * Size.x + x]; }
-    const unsigned short& Pixel(int x, int y) const { return ImageData[y * Size.x + x]; }
+    unsigned short&     Pixel(int x, int y) { return ImageData[(y - Origin.y) * Stride + (x - Origin.x)]; }
+    const unsigned short& Pixel(int x, int y) const { return ImageData[(y - Origin.y) * Stride + (x - Origin.x)]; }
+    unsigned char&      Pixel8(int x, int y) { return ImageData8[(y - Origin.y) * Stride + (x - Origin.x)]; }
+    const unsigned char& Pixel8(int x, int y) const { return ImageData8[(y - Origin.y) * Stride + (x - Origin.x)]; }
+    unsigned short      PixelValue(int x, int y) const { return ImageData8 ? Pixel8(x, y) : Pixel(x, y); }
+    void                SetPixelValue(int x, int y, unsigned short val);
     void                Clear(void);
+
+    static void         GetBufferPoolStats(unsigned int *hits, unsigned int *misses);
+
+private:
+    bool                AllocPixels(int npixels, bool eightBit);
 };
 
+inline void usImage::SetPixelValue(int x, int y, unsigned short val)
+{
+    if (ImageData8)
+        Pixel8(x, y) = (unsigned char) wxMin(val, 255);
+    else
+        Pixel(x, y) = val;
+}
+
 inline void usImage::Clear(void)
 {
-    memset(ImageData, 0, NPixels * sizeof(unsigned short));
+    if (ImageData8)
+        memset(ImageData8, 0, NPixels);
+    else
+        memset(ImageData, 0, NPixels * sizeof(unsigned short));
+}
+
+// Typed access to the pixel buffer for the image kernels, which are templated
+// on the pixel type and instantiated for 8-bit and 16-bit images
+template<typename T> T *PixelData(usImage& img);
+template<> inline unsigned short *PixelData<unsigned short>(usImage& img) { return img.ImageData; }
+template<> inline unsigned char *PixelData<unsigned char>(usImage& img) { return img.ImageData8; }
+
+template<typename T> const T *PixelData(const usImage& img) { return PixelData<T>(const_cast<usImage&>(img)); }
+
+template<typename T> T *PixelPtr(usImage& img, int x, int y)
+{
+    return PixelData<T>(img) + (y - img.Origin.y) * img.Stride + (x - img.Origin.x);
+}
+
+template<typename T> const T *PixelPtr(const usImage& img, int x, int y)
+{
+    return PixelData<T>(img) + (y - img.Origin.y) * img.Stride + (x - img.Origin.x);
 }
 
 #endif
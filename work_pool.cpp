@@ -0,0 +1,210 @@
+/*
+*  work_pool.cpp
+*  PHD Guiding
+*
+*  Copyright (c) 2016 openphdguiding.org
+*  All rights reserved.
+*
+*  This source code is distributed under the following "BSD" license
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*    Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*    Redistributions in binary form must reproduce the above copyright notice,
+*     this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*    Neither the name of Craig Stark, Stark Labs,
+*     Bret McKee, Dad Dog Development, Ltd, nor the names of its
+*     contributors may be used to endorse or promote products derived from
+*     this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+#include "phd.h"
+
+#include <atomic>
+
+enum
+{
+    MAX_WORKERS = 7
+};
+
+struct WorkBatch
+{
+    WorkPool::WorkFn fn;
+    void *ctx;
+    unsigned int count;
+    std::atomic<unsigned int> next;
+    unsigned int done;          // guarded by the pool lock
+    unsigned int active;        // workers still draining the batch, guarded by the pool lock
+
+    // claim and run items until there are none left, returns the number run
+    unsigned int Drain()
+    {
+        unsigned int n = 0;
+        unsigned int item;
+        while ((item = next.fetch_add(1)) < count)
+        {
+            (*fn)(ctx, item);
+            ++n;
+        }
+        return n;
+    }
+};
+
+struct WorkPoolState
+{
+    wxMutex lock;
+    wxCondition workCond;       // a batch was posted or the pool is stopping
+    wxCondition doneCond;       // a worker finished with the current batch
+    wxMutex runLock;            // one batch at a time
+    WorkBatch *batch;
+    unsigned int generation;    // incremented for each batch posted
+    bool stopping;
+    std::vector<wxThread *> threads;
+
+    WorkPoolState() : workCond(lock), doneCond(lock), batch(0), generation(0), stopping(false) { }
+};
+
+static WorkPoolState *s_pool;
+static wxCriticalSection s_poolInit;
+
+class WorkPoolThread : public wxThread
+{
+public:
+    WorkPoolThread() : wxThread(wxTHREAD_JOINABLE) { }
+    ExitCode Entry();
+};
+
+wxThread::ExitCode WorkPoolThread::Entry()
+{
+    WorkPoolState *pool = s_pool;
+    wxMutexLocker lck(pool->lock);
+    unsigned int seen = pool->generation;
+
+    while (true)
+    {
+        while ((!pool->batch || pool->generation == seen) && !pool->stopping)
+            pool->workCond.Wait();
+
+        if (pool->stopping)
+            break;
+
+        seen = pool->generation;
+        WorkBatch *batch = pool->batch;
+        ++batch->active;
+
+        pool->lock.Unlock();
+        unsigned int n = batch->Drain();
+        pool->lock.Lock();
+
+        batch->done += n;
+        --batch->active;
+        pool->doneCond.Broadcast();
+    }
+
+    return 0;
+}
+
+static WorkPoolState *GetPool()
+{
+    wxCriticalSectionLocker lck(s_poolInit);
+
+    if (!s_pool)
+    {
+        s_pool = new WorkPoolState();
+
+        unsigned int nthreads = wxThread::GetCPUCount() > 1 ? wxMin(wxThread::GetCPUCount() - 1, (int) MAX_WORKERS) : 0;
+        for (unsigned int i = 0; i < nthreads; i++)
+        {
+            WorkPoolThread *thread = new WorkPoolThread();
+            if (thread->Create() != wxTHREAD_NO_ERROR || thread->Run() != wxTHREAD_NO_ERROR)
+            {
+                delete thread;
+                break;
+            }
+            s_pool->threads.push_back(thread);
+        }
+
+        Debug.Write(wxString::Format("WorkPool: started %u threads\n", (unsigned int) s_pool->threads.size()));
+    }
+
+    return s_pool;
+}
+
+void WorkPool::Run(WorkFn fn, void *ctx, unsigned int count)
+{
+    WorkPoolState *pool = GetPool();
+
+    if (count <= 1 || pool->threads.empty())
+    {
+        for (unsigned int i = 0; i < count; i++)
+            (*fn)(ctx, i);
+        return;
+    }
+
+    wxMutexLocker runLck(pool->runLock);
+
+    WorkBatch batch;
+    batch.fn = fn;
+    batch.ctx = ctx;
+    batch.count = count;
+    batch.next.store(0);
+    batch.done = 0;
+    batch.active = 0;
+
+    {
+        wxMutexLocker lck(pool->lock);
+        pool->batch = &batch;
+        ++pool->generation;
+        pool->workCond.Broadcast();
+    }
+
+    unsigned int n = batch.Drain();
+
+    wxMutexLocker lck(pool->lock);
+    batch.done += n;
+    while (batch.done < count || batch.active > 0)
+        pool->doneCond.Wait();
+    pool->batch = 0;
+}
+
+unsigned int WorkPool::Concurrency()
+{
+    return GetPool()->threads.size() + 1;
+}
+
+void WorkPool::Shutdown()
+{
+    wxCriticalSectionLocker lck(s_poolInit);
+
+    if (!s_pool)
+        return;
+
+    {
+        wxMutexLocker poolLck(s_pool->lock);
+        s_pool->stopping = true;
+        s_pool->workCond.Broadcast();
+    }
+
+    for (std::vector<wxThread *>::iterator it = s_pool->threads.begin(); it != s_pool->threads.end(); ++it)
+    {
+        (*it)->Wait();
+        delete *it;
+    }
+
+    delete s_pool;
+    s_pool = 0;
+}
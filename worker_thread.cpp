@@ -56,10 +56,12 @@ void WorkerThread::EnqueueMessage(const WORKER_THREAD_REQUEST& message)
 
     if (message.request == REQUEST_EXPOSE)
     {
+        PipelineMetrics::Add(Metrics.workerQueueDepth[PipelineMetrics::QUEUE_LOW], 1);
         queueError = m_lowPriorityQueue.Post(message);
     }
     else
     {
+        PipelineMetrics::Add(Metrics.workerQueueDepth[PipelineMetrics::QUEUE_HIGH], 1);
         queueError = m_highPriorityQueue.Post(message);
     }
 
@@ -138,6 +140,8 @@ void WorkerThread::SetSkipExposeComplete()
 
 bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
 {
+    TraceSpan span("WorkerThread::HandleExpose");
+
     bool bError = false;
 
     try
@@ -152,6 +156,8 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
             Debug.Write(wxString::Format("Handling exposure in thread, d=%d o=%x r=(%d,%d,%d,%d)\n", req->exposureDuration,
                                          req->options, req->subframe.x, req->subframe.y, req->subframe.width, req->subframe.height));
 
+            MetricsTimer timer(Metrics.stageMs[PipelineMetrics::STAGE_CAPTURE]);
+
             if (GuideCamera::Capture(pCamera, req->exposureDuration, *req->pImage, req->options, req->subframe))
             {
                 throw ERROR_INFO("Capture failed");
@@ -162,6 +168,8 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
             Debug.Write(wxString::Format("Handling exposure in myFrame, d=%d o=%x r=(%d,%d,%d,%d)\n", req->exposureDuration,
                                          req->options, req->subframe.x, req->subframe.y, req->subframe.width, req->subframe.height));
 
+            MetricsTimer timer(Metrics.stageMs[PipelineMetrics::STAGE_CAPTURE]);
+
             wxSemaphore semaphore;
             req->pSemaphore = &semaphore;
 
@@ -180,6 +188,8 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
 
         if (!bError)
         {
+            MetricsTimer timer(Metrics.stageMs[PipelineMetrics::STAGE_IMAGE_PREP]);
+
             switch (m_pFrame->GetNoiseReductionMethod())
             {
                 case NR_NONE:
@@ -256,6 +266,7 @@ void WorkerThread::EnqueueWorkerThreadMoveRequest(Mount *mount, const GUIDE_DIRE
 Mount::MOVE_RESULT WorkerThread::HandleMove(MOVE_REQUEST *pArgs)
 {
     Mount::MOVE_RESULT result = Mount::MOVE_OK;
+    MetricsTimer timer(Metrics.stageMs[PipelineMetrics::STAGE_MOVE]);
 
     try
     {
@@ -367,6 +378,9 @@ wxThread::ExitCode WorkerThread::Entry()
 
         assert(queueError == wxMSGQUEUE_NO_ERROR);
 
+        PipelineMetrics::Add(Metrics.workerQueueDepth[message.request == REQUEST_EXPOSE ?
+            PipelineMetrics::QUEUE_LOW : PipelineMetrics::QUEUE_HIGH], -1);
+
         switch(message.request)
         {
             bool bError;